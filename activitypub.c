@@ -466,18 +466,22 @@ int timeline_request(snac *snac, const char **id, xs_str **wrk, int level)
 
 
 int send_to_inbox_raw(const char *keyid, const char *seckey,
-                  const xs_str *inbox, const xs_dict *msg,
+                  const xs_str *inbox, const char *body, const char *digest,
                   xs_val **payload, int *p_size, int timeout)
-/* sends a message to an Inbox */
+/* sends an already serialized message to an Inbox
+   (digest is calculated if NULL); returns -1 if it cannot be signed */
 {
     int status;
-    xs_dict *response;
-    xs *j_msg = xs_json_dumps((xs_dict *)msg, 4);
+    int b_size = strlen(body);
+    xs *hdrs   = http_signed_headers(keyid, seckey, "POST", inbox, NULL, body, b_size, digest);
+    xs *response;
 
-    response = http_signed_request_raw(keyid, seckey, "POST", inbox,
-        NULL, j_msg, strlen(j_msg), &status, payload, p_size, timeout);
+    if (hdrs == NULL)
+        return -1;
 
-    xs_free(response);
+    response = xs_http_request("POST", inbox, hdrs, body, b_size, &status, payload, p_size, timeout);
+
+    srv_archive("SEND", inbox, hdrs, body, b_size, status, response, *payload, *p_size);
 
     return status;
 }
@@ -487,9 +491,9 @@ int send_to_inbox(snac *snac, const xs_str *inbox, const xs_dict *msg,
                   xs_val **payload, int *p_size, int timeout)
 /* sends a message to an Inbox */
 {
-    const char *seckey = xs_dict_get(snac->key, "secret");
+    xs *j_msg = xs_json_dumps((xs_dict *)msg, 4);
 
-    return send_to_inbox_raw(snac->actor, seckey, inbox, msg, payload, p_size, timeout);
+    return send_to_inbox_raw(snac->actor, NULL, inbox, j_msg, NULL, payload, p_size, timeout);
 }
 
 
@@ -636,6 +640,57 @@ int is_msg_from_private_user(const xs_dict *msg)
 }
 
 
+static void _local_uid_add(xs_set *set, const char *url)
+/* adds the uid of a local actor or post url */
+{
+    int n = strlen(srv_baseurl);
+
+    if (xs_is_string(url) && strncmp(url, srv_baseurl, n) == 0 && url[n] == '/') {
+        xs *l = xs_split_n(url + n + 1, "/", 1);
+        const char *uid = xs_list_get(l, 0);
+
+        if (xs_is_string(uid) && *uid)
+            xs_set_add(set, uid);
+    }
+}
+
+
+static void _rfollow_add_to_set(xs_set *set, const char *key)
+/* adds the local users related to an actor or hashtag */
+{
+    if (xs_is_string(key)) {
+        xs *l = rfollow_list(key);
+        const char *uid;
+
+        xs_list_foreach(l, uid)
+            xs_set_add(set, uid);
+    }
+}
+
+
+static void _hashtags_add_to_set(xs_set *set, const xs_dict *msg)
+/* adds the local users following the hashtags of a message */
+{
+    const xs_list *tags = xs_dict_get(msg, "tag");
+    const xs_dict *te;
+
+    if (!xs_is_dict(msg) || !xs_is_list(tags))
+        return;
+
+    xs_list_foreach(tags, te) {
+        if (xs_is_dict(te)) {
+            const char *type = xs_dict_get(te, "type");
+            const char *name = xs_dict_get(te, "name");
+
+            if (xs_is_string(type) && xs_is_string(name) && strcmp(type, "Hashtag") == 0) {
+                xs *lc_name = xs_utf8_to_lower(name);
+                _rfollow_add_to_set(set, lc_name);
+            }
+        }
+    }
+}
+
+
 void followed_hashtag_distribute(const xs_dict *msg)
 /* distribute this post to all users following the included hashtags */
 {
@@ -647,7 +702,12 @@ void followed_hashtag_distribute(const xs_dict *msg)
 
     srv_debug(1, xs_fmt("followed_hashtag_distribute check for %s", id));
 
-    xs *users = user_list();
+    /* only the users following any of its hashtags */
+    xs_set set;
+    xs_set_init(&set);
+    _hashtags_add_to_set(&set, msg);
+
+    xs *users = xs_set_result(&set);
     const char *uid;
 
     xs_list_foreach(users, uid) {
@@ -666,6 +726,79 @@ void followed_hashtag_distribute(const xs_dict *msg)
 }
 
 
+xs_list *shared_inbox_users(const xs_dict *c_msg)
+/* returns the local users that may accept a message from the shared inbox;
+   it's a superset of those for which is_msg_for_me() returns true */
+{
+    const char *type  = xs_dict_get(c_msg, "type");
+    const char *actor = xs_dict_get(c_msg, "actor");
+    xs_set set;
+
+    /* these are accepted by everybody */
+    if (!xs_is_string(type) ||
+        !xs_match(type, "Like|Announce|EmojiReact|Undo|Accept|Follow|Ping|Create|Update"))
+        return user_list();
+
+    xs_set_init(&set);
+
+    /* anyone following the actor or followed by it */
+    _rfollow_add_to_set(&set, actor);
+
+    if (xs_match(type, "Like|Announce|EmojiReact")) {
+        const char *object = xs_dict_get(c_msg, "object");
+        xs *obj = NULL;
+
+        if (xs_is_dict(object)) {
+            obj = xs_dup(object);
+            object = xs_dict_get(object, "id");
+        }
+
+        if (xs_is_string(object)) {
+            _local_uid_add(&set, object);
+
+            if (!xs_is_dict(obj))
+                object_get(object, &obj);
+
+            _hashtags_add_to_set(&set, obj);
+        }
+    }
+    else
+    if (xs_match(type, "Follow"))
+        _local_uid_add(&set, xs_dict_get(c_msg, "object"));
+    else
+    if (xs_match(type, "Ping"))
+        _local_uid_add(&set, xs_dict_get(c_msg, "to"));
+    else
+    if (xs_match(type, "Create|Update")) {
+        const xs_dict *msg = xs_dict_get(c_msg, "object");
+
+        if (xs_is_dict(msg)) {
+            xs *rcpts = recipient_list(NULL, msg, 0);
+            const char *v;
+
+            xs_list_foreach(rcpts, v) {
+                if (strcmp(v, public_address) != 0) {
+                    _local_uid_add(&set, v);
+                    _rfollow_add_to_set(&set, v);
+                }
+            }
+
+            _rfollow_add_to_set(&set, get_atto(msg));
+
+            const char *irt = get_in_reply_to(msg);
+            xs *r_msg = NULL;
+
+            if (xs_is_string(irt) && valid_status(object_get(irt, &r_msg)))
+                _rfollow_add_to_set(&set, get_atto(r_msg));
+
+            _hashtags_add_to_set(&set, msg);
+        }
+    }
+
+    return xs_set_result(&set);
+}
+
+
 int is_msg_for_me(snac *snac, const xs_dict *c_msg)
 /* checks if this message is for me */
 {
@@ -2609,10 +2742,13 @@ void process_user_queue_item(snac *user, xs_dict *q_item)
 
         xs_set_init(&inboxes);
 
+        /* serialize and store the message only once for all inboxes */
+        xs *pid = payload_put(msg);
+
         /* add this shared inbox first */
         xs *this_shared_inbox = xs_fmt("%s/shared-inbox", srv_baseurl);
         xs_set_add(&inboxes, this_shared_inbox);
-        enqueue_output(user, msg, this_shared_inbox, 0, 0);
+        enqueue_output_payload(user->actor, pid, this_shared_inbox, 0, 0);
 
         /* iterate the recipients */
         xs_list_foreach(rcpts, actor) {
@@ -2623,7 +2759,7 @@ void process_user_queue_item(snac *user, xs_dict *q_item)
                 if (inbox != NULL) {
                     /* add to the set and, if it's not there, send message */
                     if (xs_set_add(&inboxes, inbox) == 1)
-                        enqueue_output(user, msg, inbox, 0, 0);
+                        enqueue_output_payload(user->actor, pid, inbox, 0, 0);
                 }
                 else
                     snac_log(user, xs_fmt("cannot find inbox for %s", actor));
@@ -2638,7 +2774,7 @@ void process_user_queue_item(snac *user, xs_dict *q_item)
 
                 xs_list_foreach(shibx, inbox) {
                     if (xs_set_add(&inboxes, inbox) == 1)
-                        enqueue_output(user, msg, inbox, 0, 0);
+                        enqueue_output_payload(user->actor, pid, inbox, 0, 0);
                 }
             }
         }
@@ -2771,6 +2907,74 @@ xs_str *str_status(int status)
 }
 
 
+void output_result(const xs_dict *q_item, int status,
+                   const char *payload, int p_size, double secs)
+/* logs the result of the delivery of an output message, requeueing it if needed */
+{
+    const xs_str *inbox  = xs_dict_get(q_item, "inbox");
+    const xs_str *keyid  = xs_dict_get(q_item, "keyid");
+    const xs_dict *msg   = xs_dict_get(q_item, "message");
+    int retries    = xs_number_get(xs_dict_get(q_item, "retries"));
+    int p_status   = xs_number_get(xs_dict_get(q_item, "p_status"));
+    int queue_retry_max = xs_number_get(xs_dict_get(srv_config, "queue_retry_max"));
+    xs *s_payload  = NULL;
+
+    if (payload) {
+        /* trim the message */
+        if (p_size > 64)
+            s_payload = xs_fmt("%.64s...", payload);
+        else
+            s_payload = xs_str_new(payload);
+
+        /* strip ugly control characters */
+        s_payload = xs_replace_i(s_payload, "\n", "");
+        s_payload = xs_replace_i(s_payload, "\r", "");
+
+        if (*s_payload)
+            s_payload = xs_str_wrap_i(" [", s_payload, "]");
+    }
+    else
+        s_payload = xs_str_new(NULL);
+
+    xs *s_status = str_status(status);
+
+    srv_log(xs_fmt("output message: sent to inbox %s (%s)%s %.3fs", inbox, s_status, s_payload, secs));
+
+    if (!valid_status(status)) {
+        retries++;
+
+        /* if it's not the first time it fails with a timeout,
+           penalize the server by skipping one retry */
+        if (p_status == status && status == HTTP_STATUS_CLIENT_CLOSED_REQUEST)
+            retries++;
+
+        /* error sending; requeue? */
+        if (status == HTTP_STATUS_BAD_REQUEST
+            || status == HTTP_STATUS_NOT_FOUND
+            || status == HTTP_STATUS_METHOD_NOT_ALLOWED
+            || status == HTTP_STATUS_GONE
+            || status == HTTP_STATUS_UNPROCESSABLE_CONTENT
+            || status < 0)
+            /* explicit error: discard */
+            srv_log(xs_fmt("output message: error %s (%s)", inbox, s_status));
+        else
+        if (retries > queue_retry_max)
+            srv_log(xs_fmt("output message: giving up %s (%s)", inbox, s_status));
+        else {
+            /* requeue */
+            const char *pid = xs_dict_get(q_item, "payload");
+
+            if (xs_is_string(pid))
+                enqueue_output_payload(keyid, pid, inbox, retries, status);
+            else
+                enqueue_output_raw(keyid, xs_dict_get(q_item, "seckey"),
+                    msg, inbox, retries, status);
+            srv_log(xs_fmt("output message: requeue %s #%d", inbox, retries));
+        }
+    }
+}
+
+
 void process_queue_item(xs_dict *q_item)
 /* processes an item from the global queue */
 {
@@ -2778,18 +2982,17 @@ void process_queue_item(xs_dict *q_item)
     int queue_retry_max = xs_number_get(xs_dict_get(srv_config, "queue_retry_max"));
 
     if (strcmp(type, "output") == 0) {
-        int status;
         const xs_str *inbox  = xs_dict_get(q_item, "inbox");
         const xs_str *keyid  = xs_dict_get(q_item, "keyid");
-        const xs_str *seckey = xs_dict_get(q_item, "seckey");
+        const xs_str *seckey = xs_dict_get(q_item, "seckey"); /* only if the user is gone */
         const xs_dict *msg   = xs_dict_get(q_item, "message");
-        int retries    = xs_number_get(xs_dict_get(q_item, "retries"));
+        const char *pid      = xs_dict_get(q_item, "payload");
         int p_status   = xs_number_get(xs_dict_get(q_item, "p_status"));
         xs *payload    = NULL;
         int p_size     = 0;
         int timeout    = 0;
 
-        if (xs_is_null(inbox) || xs_is_null(msg) || xs_is_null(keyid) || xs_is_null(seckey)) {
+        if (xs_is_null(inbox) || (xs_is_null(msg) && xs_is_null(pid)) || xs_is_null(keyid)) {
             srv_log(xs_fmt("output message error: missing fields"));
             return;
         }
@@ -2808,55 +3011,34 @@ void process_queue_item(xs_dict *q_item)
         if (timeout == 0)
             timeout = 6;
 
-        status = send_to_inbox_raw(keyid, seckey, inbox, msg, &payload, &p_size, timeout);
-
-        if (payload) {
-            if (p_size > 64) {
-                /* trim the message */
-                payload[64] = '\0';
-                payload = xs_str_cat(payload, "...");
-            }
+        /* the delivery engine sends it, if it's running */
+        if (delivery_add(q_item, timeout))
+            return;
 
-            /* strip ugly control characters */
-            payload = xs_replace_i(payload, "\n", "");
-            payload = xs_replace_i(payload, "\r", "");
+        /* is the host down? */
+        int wait = 0;
 
-            if (*payload)
-                payload = xs_str_wrap_i(" [", payload, "]");
+        if (host_health_admit(inbox, timeout, &wait) >= HOST_HOLD) {
+            delivery_park(q_item, wait);
+            return;
         }
-        else
-            payload = xs_str_new(NULL);
 
-        xs *s_status = str_status(status);
+        xs *body   = NULL;
+        xs *digest = NULL;
 
-        srv_log(xs_fmt("output message: sent to inbox %s (%s)%s", inbox, s_status, payload));
+        if (!output_body(q_item, &body, &digest)) {
+            srv_log(xs_fmt("output message: payload not found for %s", inbox));
+            return;
+        }
 
-        if (!valid_status(status)) {
-            retries++;
+        double t = ftime();
+        int status = send_to_inbox_raw(keyid, seckey, inbox, body, digest, &payload, &p_size, timeout);
 
-            /* if it's not the first time it fails with a timeout,
-               penalize the server by skipping one retry */
-            if (p_status == status && status == HTTP_STATUS_CLIENT_CLOSED_REQUEST)
-                retries++;
-
-            /* error sending; requeue? */
-            if (status == HTTP_STATUS_BAD_REQUEST
-                || status == HTTP_STATUS_NOT_FOUND
-                || status == HTTP_STATUS_METHOD_NOT_ALLOWED
-                || status == HTTP_STATUS_GONE
-                || status == HTTP_STATUS_UNPROCESSABLE_CONTENT
-                || status < 0)
-                /* explicit error: discard */
-                srv_log(xs_fmt("output message: error %s (%s)", inbox, s_status));
-            else
-            if (retries > queue_retry_max)
-                srv_log(xs_fmt("output message: giving up %s (%s)", inbox, s_status));
-            else {
-                /* requeue */
-                enqueue_output_raw(keyid, seckey, msg, inbox, retries, status);
-                srv_log(xs_fmt("output message: requeue %s #%d", inbox, retries));
-            }
-        }
+        /* not signed, so not sent: the host is not to blame */
+        if (status != -1)
+            host_health_update(inbox, status, ftime() - t);
+
+        output_result(q_item, status, payload, p_size, ftime() - t);
     }
     else
     if (strcmp(type, "email") == 0) {
@@ -2963,11 +3145,12 @@ void process_queue_item(xs_dict *q_item)
             FILE *f;
 
             if ((f = fopen(tmpfn, "w")) != NULL) {
-                xs_json_dump(q_item, 4, f);
+                data_dump(q_item, f);
                 fclose(f);
             }
 
-            xs *users = user_list();
+            /* only the users that may be interested are checked */
+            xs *users = shared_inbox_users(msg);
             xs_list *p = users;
             const char *v;
             int cnt = 0;
@@ -2985,6 +3168,8 @@ void process_queue_item(xs_dict *q_item)
 
                         if (link(tmpfn, fn) < 0)
                             srv_log(xs_fmt("link(%s, %s) error", tmpfn, fn));
+                        else
+                            queue_sched_add(fn);
 
                         cnt++;
                     }
@@ -3018,7 +3203,10 @@ int process_queue(void)
         xs *q_item = dequeue(fn);
 
         if (q_item != NULL) {
-            job_post(q_item, 0);
+            /* no room? try again a bit later */
+            if (!job_post(q_item))
+                enqueue_delayed(q_item, 1);
+
             cnt++;
         }
     }
@@ -3027,6 +3215,59 @@ int process_queue(void)
 }
 
 
+int process_queues(time_t *next)
+/* processes the due items of all queues, as told by the scheduler */
+{
+    int cnt = 0;
+    xs *list = queue_sched_due(next);
+    xs *u_prefix = xs_fmt("%s/user/", srv_basedir);
+    const char *fn;
+
+    xs_list_foreach(list, fn) {
+        if (xs_endswith(fn, "/sched.idx") && xs_startswith(fn, u_prefix)) {
+            /* a scheduled post of this user is due */
+            xs *l = xs_split_n(fn + strlen(u_prefix), "/", 1);
+            const char *uid = xs_list_get(l, 0);
+            snac user;
+
+            if (xs_is_string(uid) && user_open(&user, uid)) {
+                scheduled_process(&user);
+                user_free(&user);
+            }
+
+            continue;
+        }
+
+        xs *q_item = dequeue(fn);
+
+        /* already processed by someone else? */
+        if (q_item == NULL)
+            continue;
+
+        if (xs_startswith(fn, u_prefix)) {
+            /* an item from a user queue */
+            xs *l = xs_split_n(fn + strlen(u_prefix), "/", 1);
+            const char *uid = xs_list_get(l, 0);
+            snac user;
+
+            if (xs_is_string(uid) && user_open(&user, uid)) {
+                process_user_queue_item(&user, q_item);
+                user_free(&user);
+            }
+        }
+        else
+        if (!job_post(q_item)) {
+            /* no room? try again a bit later */
+            enqueue_delayed(q_item, 1);
+        }
+
+        cnt++;
+    }
+
+    return cnt;
+}
+
+
 /** account migration **/
 
 int migrate_account(snac *user)
@@ -3081,56 +3322,39 @@ int migrate_account(snac *user)
 
 /** HTTP handlers */
 
-int activitypub_get_handler(const xs_dict *req, const char *q_path,
+int activitypub_get_handler(const xs_dict *req, const char *q_path, snac *user,
                             char **body, int *b_size, char **ctype)
+/* serves an ActivityPub object of the user (the router has already
+   checked the accept header) */
 {
     int status = HTTP_STATUS_OK;
-    const char *accept = xs_dict_get(req, "accept");
-    snac snac;
     xs *msg = NULL;
 
-    if (accept == NULL)
-        return 0;
-
-    if (xs_str_in(accept, "application/activity+json") == -1 &&
-        xs_str_in(accept, "application/ld+json") == -1)
-        return 0;
-
     xs *l = xs_split_n(q_path, "/", 2);
-    const char *uid;
-    const char *p_path;
-
-    uid = xs_list_get(l, 1);
-    if (!user_open(&snac, uid)) {
-        /* invalid user */
-        srv_debug(1, xs_fmt("activitypub_get_handler bad user %s", uid));
-        return HTTP_STATUS_NOT_FOUND;
-    }
-
-    p_path = xs_list_get(l, 2);
+    const char *p_path = xs_list_get(l, 2);
 
     *ctype  = "application/activity+json";
 
-    int show_contact_metrics = xs_is_true(xs_dict_get(snac.config, "show_contact_metrics"));
+    int show_contact_metrics = xs_is_true(xs_dict_get(user->config, "show_contact_metrics"));
 
     if (p_path == NULL) {
         /* if there was no component after the user, it's an actor request */
-        msg = msg_actor(&snac);
+        msg = msg_actor(user);
         *ctype = "application/ld+json; profile=\"https://www.w3.org/ns/activitystreams\"";
 
         const char *ua = xs_dict_get(req, "user-agent");
 
-        snac_debug(&snac, 0, xs_fmt("serving actor [%s]", ua ? ua : "No UA"));
+        snac_debug(user, 0, xs_fmt("serving actor [%s]", ua ? ua : "No UA"));
     }
     else
     if (strcmp(p_path, "outbox") == 0 || strcmp(p_path, "featured") == 0) {
-        xs *id = xs_fmt("%s/%s", snac.actor, p_path);
+        xs *id = xs_fmt("%s/%s", user->actor, p_path);
         xs *list = xs_list_new();
         const char *v;
         int cnt = xs_number_get(xs_dict_get_def(srv_config, "max_public_entries", "20"));
 
         /* get the public outbox or the pinned list */
-        xs *elems = *p_path == 'o' ? timeline_simple_list(&snac, "public", 0, cnt, NULL) : pinned_list(&snac);
+        xs *elems = *p_path == 'o' ? timeline_simple_list(user, "public", 0, cnt, NULL) : pinned_list(user);
 
         xs_list_foreach(elems, v) {
             xs *i = NULL;
@@ -3139,15 +3363,15 @@ int activitypub_get_handler(const xs_dict *req, const char *q_path,
                 const char *type = xs_dict_get(i, "type");
                 const char *id   = xs_dict_get(i, "id");
 
-                if (type && id && strcmp(type, "Note") == 0 && xs_startswith(id, snac.actor)) {
-                    xs *c_msg = msg_create(&snac, i);
+                if (type && id && strcmp(type, "Note") == 0 && xs_startswith(id, user->actor)) {
+                    xs *c_msg = msg_create(user, i);
                     list = xs_list_append(list, c_msg);
                 }
             }
         }
 
         /* replace the 'orderedItems' with the latest posts */
-        msg = msg_collection(&snac, id, xs_list_len(list));
+        msg = msg_collection(user, id, xs_list_len(list));
         msg = xs_dict_set(msg, "orderedItems", list);
     }
     else
@@ -3155,28 +3379,28 @@ int activitypub_get_handler(const xs_dict *req, const char *q_path,
         int total = 0;
 
         if (show_contact_metrics) {
-            xs *l = follower_list(&snac);
+            xs *l = follower_list(user);
             total = xs_list_len(l);
         }
 
-        xs *id = xs_fmt("%s/%s", snac.actor, p_path);
-        msg = msg_collection(&snac, id, total);
+        xs *id = xs_fmt("%s/%s", user->actor, p_path);
+        msg = msg_collection(user, id, total);
     }
     else
     if (strcmp(p_path, "following") == 0) {
         int total = 0;
 
         if (show_contact_metrics) {
-            xs *l = following_list(&snac);
+            xs *l = following_list(user);
             total = xs_list_len(l);
         }
 
-        xs *id = xs_fmt("%s/%s", snac.actor, p_path);
-        msg = msg_collection(&snac, id, total);
+        xs *id = xs_fmt("%s/%s", user->actor, p_path);
+        msg = msg_collection(user, id, total);
     }
     else
     if (xs_startswith(p_path, "p/")) {
-        xs *id = xs_fmt("%s/%s", snac.actor, p_path);
+        xs *id = xs_fmt("%s/%s", user->actor, p_path);
 
         status = object_get(id, &msg);
 
@@ -3188,28 +3412,26 @@ int activitypub_get_handler(const xs_dict *req, const char *q_path,
         status = HTTP_STATUS_NOT_FOUND;
 
     if (status == HTTP_STATUS_OK && msg != NULL) {
-        *body   = xs_json_dumps(msg, 4);
+        *body   = xs_json_dumps(msg, 0);
         *b_size = strlen(*body);
     }
 
-    snac_debug(&snac, 1, xs_fmt("activitypub_get_handler serving %s %d", q_path, status));
-
-    user_free(&snac);
+    snac_debug(user, 1, xs_fmt("activitypub_get_handler serving %s %d", q_path, status));
 
     return status;
 }
 
 
-int activitypub_post_handler(const xs_dict *req, const char *q_path,
+int activitypub_post_handler(const xs_dict *req, const char *q_path, snac *user,
                              char *payload, int p_size,
                              char **body, int *b_size, char **ctype)
-/* processes an input message */
+/* processes an input message to the user's inbox (or to the
+   shared inbox, if there is no user) */
 {
     (void)b_size;
 
     int status = HTTP_STATUS_ACCEPTED;
     const char *i_ctype = xs_dict_get(req, "content-type");
-    snac snac;
     const char *v;
 
     if (i_ctype == NULL) {
@@ -3224,10 +3446,6 @@ int activitypub_post_handler(const xs_dict *req, const char *q_path,
         return HTTP_STATUS_BAD_REQUEST;
     }
 
-    if (xs_str_in(i_ctype, "application/activity+json") == -1 &&
-        xs_str_in(i_ctype, "application/ld+json") == -1)
-        return 0;
-
     /* decode the message */
     xs *msg = xs_json_loads(payload);
     const char *id = xs_dict_get(msg, "id");
@@ -3250,27 +3468,12 @@ int activitypub_post_handler(const xs_dict *req, const char *q_path,
         return HTTP_STATUS_FORBIDDEN;
     }
 
-    /* get the user and path */
-    xs *l = xs_split_n(q_path, "/", 2);
-
-    if (xs_list_len(l) == 2 && strcmp(xs_list_get(l, 1), "shared-inbox") == 0) {
+    if (user == NULL) {
+        /* the shared inbox */
         enqueue_shared_input(msg, req, 0);
         return HTTP_STATUS_ACCEPTED;
     }
 
-    if (xs_list_len(l) != 3 || strcmp(xs_list_get(l, 2), "inbox") != 0) {
-        /* strange q_path */
-        srv_debug(1, xs_fmt("activitypub_post_handler unsupported path %s", q_path));
-        return HTTP_STATUS_NOT_FOUND;
-    }
-
-    const char *uid = xs_list_get(l, 1);
-    if (!user_open(&snac, uid)) {
-        /* invalid user */
-        srv_debug(1, xs_fmt("activitypub_post_handler bad user %s", uid));
-        return HTTP_STATUS_NOT_FOUND;
-    }
-
     /* if it has a digest, check it now, because
        later the payload won't be exactly the same */
     if ((v = xs_dict_get(req, "digest")) != NULL) {
@@ -3288,8 +3491,8 @@ int activitypub_post_handler(const xs_dict *req, const char *q_path,
 
     /* if the message is from a muted actor, reject it right now */
     if (!xs_is_null(v = xs_dict_get(msg, "actor")) && *v) {
-        if (is_muted(&snac, v)) {
-            snac_log(&snac, xs_fmt("rejected message from MUTEd actor %s", v));
+        if (is_muted(user, v)) {
+            snac_log(user, xs_fmt("rejected message from MUTEd actor %s", v));
 
             *body  = xs_str_new("rejected");
             *ctype = "text/plain";
@@ -3298,11 +3501,9 @@ int activitypub_post_handler(const xs_dict *req, const char *q_path,
     }
 
     if (valid_status(status)) {
-        enqueue_input(&snac, msg, req, 0);
+        enqueue_input(user, msg, req, 0);
         *ctype = "application/activity+json";
     }
 
-    user_free(&snac);
-
     return status;
 }
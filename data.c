@@ -3,6 +3,7 @@
 
 #include "xs.h"
 #include "xs_hex.h"
+#include "xs_bin.h"
 #include "xs_io.h"
 #include "xs_json.h"
 #include "xs_openssl.h"
@@ -23,12 +24,42 @@
 #include <sys/time.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
-double disk_layout = 2.7;
+#if defined(__linux__) && !defined(WITHOUT_INOTIFY)
+#define USE_INOTIFY
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+double disk_layout = 2.9;
 
 /* storage serializer */
 pthread_mutex_t data_mutex = {0};
 
+/* index position maps serializer */
+static pthread_mutex_t pos_map_mutex;
+
+/* segmented object store serializer */
+static pthread_mutex_t store_mutex;
+
+/* parsed object cache serializer */
+static pthread_mutex_t obj_cache_mutex;
+
+/* resident user table serializer */
+static pthread_mutex_t user_table_mutex;
+
+/* queue scheduler serializer */
+static pthread_mutex_t qsched_mutex;
+
+/* delivery payload cache serializer */
+static pthread_mutex_t payload_mutex;
+
 int snac_upgrade(xs_str **error);
 
 
@@ -41,6 +72,12 @@ int srv_open(const char *basedir, int auto_upgrade)
     xs_str *error = NULL;
 
     pthread_mutex_init(&data_mutex, NULL);
+    pthread_mutex_init(&pos_map_mutex, NULL);
+    pthread_mutex_init(&store_mutex, NULL);
+    pthread_mutex_init(&obj_cache_mutex, NULL);
+    pthread_mutex_init(&user_table_mutex, NULL);
+    pthread_mutex_init(&qsched_mutex, NULL);
+    pthread_mutex_init(&payload_mutex, NULL);
 
     srv_basedir = xs_str_new(basedir);
 
@@ -88,6 +125,9 @@ int srv_open(const char *basedir, int auto_upgrade)
                 else {
                     if (xs_number_get(xs_dict_get(srv_config, "layout")) < disk_layout)
                         error = xs_fmt("ERROR: disk layout changed - execute 'snac upgrade' first");
+                    else
+                    if (object_store_is_seg() && !object_store_ready())
+                        error = xs_fmt("ERROR: object store changed - execute 'snac upgrade' first");
                     else
                         ret = 1;
                 }
@@ -109,6 +149,9 @@ int srv_open(const char *basedir, int auto_upgrade)
     xs *ibdir = xs_fmt("%s/inbox", srv_basedir);
     mkdirx(ibdir);
 
+    xs *pldir = xs_fmt("%s/payload", srv_basedir);
+    mkdirx(pldir);
+
     xs *tmpdir = xs_fmt("%s/tmp", srv_basedir);
     mkdirx(tmpdir);
 
@@ -203,8 +246,8 @@ void user_free(snac *snac)
 }
 
 
-int user_open(snac *user, const char *uid)
-/* opens a user */
+static int _user_open(snac *user, const char *uid)
+/* opens a user from disk */
 {
     int ret = 0;
 
@@ -214,30 +257,7 @@ int user_open(snac *user, const char *uid)
         xs *cfg_file = NULL;
         FILE *f;
 
-        xs *t = xs_fmt("%s/user/%s", srv_basedir, uid);
-
-        if (mtime(t) == 0.0) {
-            /* user folder does not exist; try with a different case */
-            xs *lcuid = xs_tolower_i(xs_dup(uid));
-            xs *ulist = user_list();
-            xs_list *p = ulist;
-            const xs_str *v;
-
-            while (xs_list_iter(&p, &v)) {
-                xs *v2 = xs_tolower_i(xs_dup(v));
-
-                if (strcmp(lcuid, v2) == 0) {
-                    user->uid = xs_dup(v);
-                    break;
-                }
-            }
-        }
-        else
-            user->uid = xs_str_new(uid);
-
-        if (user->uid == NULL)
-            return ret;
-
+        user->uid     = xs_str_new(uid);
         user->basedir = xs_fmt("%s/user/%s", srv_basedir, user->uid);
 
         cfg_file = xs_fmt("%s/user.json", user->basedir);
@@ -258,6 +278,9 @@ int user_open(snac *user, const char *uid)
                         user->actor = xs_fmt("%s/%s", srv_baseurl, user->uid);
                         user->md5   = xs_md5_hex(user->actor, strlen(user->actor));
 
+                        /* keep the parsed private key at hand for signing */
+                        signing_key_add(user->actor, xs_dict_get(user->key, "secret"));
+
                         /* everything is ok right now */
                         ret = 1;
 
@@ -306,6 +329,269 @@ int user_open(snac *user, const char *uid)
 }
 
 
+/** resident user table **/
+
+/* opened users are kept in memory and handed out as copies; the files
+   they come from are checked for changes at most once per second */
+
+#define USER_FILES 4
+
+static const char *user_files[USER_FILES] = { "user.json", "key.json",
+                                              "user_o.json", "links.json" };
+
+typedef struct {
+    snac user;                      /* master copy */
+    int64_t stamp[USER_FILES][2];   /* mtime (ns) and size of each file */
+    time_t checked;                 /* last check against the disk */
+    int size;                       /* memory used */
+} t_user_ent;
+
+static t_user_ent *user_table = NULL;
+static int user_table_n       = 0;
+
+/* maps from uids (also lowercased) and actor md5s to uids,
+   rebuilt whenever the user directory changes */
+static xs_dict *user_uid_map  = NULL;
+static xs_dict *user_md5_map  = NULL;
+static int64_t user_map_stamp = 0;
+
+
+static void _user_stamp(const char *uid, int64_t stamp[USER_FILES][2])
+/* gets the mtime and size of the files of a user */
+{
+    int n;
+
+    for (n = 0; n < USER_FILES; n++) {
+        xs *fn = xs_fmt("%s/user/%s/%s", srv_basedir, uid, user_files[n]);
+        struct stat st;
+
+        if (stat(fn, &st) != -1) {
+            stamp[n][0] = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            stamp[n][1] = st.st_size;
+        }
+        else
+            stamp[n][0] = stamp[n][1] = 0;
+    }
+}
+
+
+static void _user_dup(snac *dst, const snac *src)
+/* copies an opened user */
+{
+    dst->uid      = xs_dup(src->uid);
+    dst->basedir  = xs_dup(src->basedir);
+    dst->config   = xs_dup(src->config);
+    dst->config_o = xs_dup(src->config_o);
+    dst->key      = xs_dup(src->key);
+    dst->links    = src->links ? xs_dup(src->links) : NULL;
+    dst->actor    = xs_dup(src->actor);
+    dst->md5      = xs_dup(src->md5);
+    dst->lang     = NULL;
+    dst->tz       = xs_dict_get_def(dst->config, "tz", "UTC");
+}
+
+
+static t_user_ent *_user_table_find(const char *uid)
+/* finds a user in the table (user_table_mutex must be locked) */
+{
+    int n;
+
+    for (n = 0; n < user_table_n; n++) {
+        if (strcmp(user_table[n].user.uid, uid) == 0)
+            return &user_table[n];
+    }
+
+    return NULL;
+}
+
+
+static void _user_table_stats(void)
+/* updates the shared statistics (user_table_mutex must be locked) */
+{
+    if (p_state != NULL) {
+        long bytes = 0;
+        int n;
+
+        for (n = 0; n < user_table_n; n++)
+            bytes += user_table[n].size;
+
+        p_state->user_table_entries = user_table_n;
+        p_state->user_table_bytes   = bytes;
+    }
+}
+
+
+static xs_str *_user_map_get(int by_md5, const char *key)
+/* resolves a uid (in any case) or an actor md5 to a uid */
+{
+    xs *dir = xs_fmt("%s/user", srv_basedir);
+    const char *v = NULL;
+    xs_str *uid = NULL;
+    int64_t stamp = 0;
+    struct stat st;
+
+    if (stat(dir, &st) != -1)
+        stamp = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    pthread_mutex_lock(&user_table_mutex);
+
+    if (user_uid_map == NULL || stamp != user_map_stamp) {
+        xs *ulist = user_list();
+        const char *u;
+
+        xs_free(user_uid_map);
+        xs_free(user_md5_map);
+        user_uid_map = xs_dict_new();
+        user_md5_map = xs_dict_new();
+
+        xs_list_foreach(ulist, u) {
+            xs *lc    = xs_tolower_i(xs_dup(u));
+            xs *actor = xs_fmt("%s/%s", srv_baseurl, u);
+            xs *md5   = xs_md5_hex(actor, strlen(actor));
+
+            /* exact matches take precedence over lowercased ones */
+            if (xs_dict_get(user_uid_map, lc) == NULL)
+                user_uid_map = xs_dict_set(user_uid_map, lc, u);
+
+            user_uid_map = xs_dict_set(user_uid_map, u, u);
+            user_md5_map = xs_dict_set(user_md5_map, md5, u);
+        }
+
+        user_map_stamp = stamp;
+    }
+
+    if (by_md5)
+        v = xs_dict_get(user_md5_map, key);
+    else
+    if ((v = xs_dict_get(user_uid_map, key)) == NULL) {
+        xs *lc = xs_tolower_i(xs_dup(key));
+        v = xs_dict_get(user_uid_map, lc);
+    }
+
+    if (v != NULL)
+        uid = xs_dup(v);
+
+    pthread_mutex_unlock(&user_table_mutex);
+
+    return uid;
+}
+
+
+void user_map_reset(void)
+/* forces the uid and md5 maps to be rebuilt on next use */
+{
+    pthread_mutex_lock(&user_table_mutex);
+
+    user_uid_map = xs_free(user_uid_map);
+    user_md5_map = xs_free(user_md5_map);
+
+    pthread_mutex_unlock(&user_table_mutex);
+}
+
+
+void user_table_del(const char *uid)
+/* drops a user from the table (because its files have been rewritten) */
+{
+    t_user_ent *e;
+
+    pthread_mutex_lock(&user_table_mutex);
+
+    if ((e = _user_table_find(uid)) != NULL) {
+        user_free(&e->user);
+        *e = user_table[--user_table_n];
+        _user_table_stats();
+    }
+
+    pthread_mutex_unlock(&user_table_mutex);
+}
+
+
+int user_open(snac *user, const char *uid)
+/* opens a user */
+{
+    int64_t stamp[USER_FILES][2];
+    time_t t = time(NULL);
+    t_user_ent *e;
+    int ret = 0;
+
+    *user = (snac){0};
+
+    if (!validate_uid(uid)) {
+        srv_debug(1, xs_fmt("invalid user '%s'", uid));
+        return 0;
+    }
+
+    pthread_mutex_lock(&user_table_mutex);
+
+    if ((e = _user_table_find(uid)) != NULL && e->checked != t) {
+        /* time to see if anything changed */
+        _user_stamp(uid, stamp);
+
+        if (memcmp(stamp, e->stamp, sizeof(stamp)) == 0)
+            e->checked = t;
+        else {
+            /* stale: drop it */
+            user_free(&e->user);
+            *e = user_table[--user_table_n];
+            _user_table_stats();
+            e = NULL;
+        }
+    }
+
+    if (e != NULL) {
+        _user_dup(user, &e->user);
+        ret = 1;
+    }
+
+    pthread_mutex_unlock(&user_table_mutex);
+
+    if (ret)
+        return ret;
+
+    /* not resident: find the real uid, as it may be in a different case */
+    xs *ruid = _user_map_get(0, uid);
+
+    if (ruid == NULL) {
+        srv_debug(2, xs_fmt("user_open: no such user '%s'", uid));
+        return 0;
+    }
+
+    if (strcmp(ruid, uid) != 0)
+        return user_open(user, ruid);
+
+    /* get the stamps before reading, so that changes are never missed */
+    _user_stamp(uid, stamp);
+
+    if ((ret = _user_open(user, uid))) {
+        int size = sizeof(t_user_ent) + xs_size(user->uid) + xs_size(user->basedir) +
+            xs_size(user->config) + xs_size(user->config_o) + xs_size(user->key) +
+            xs_size(user->links) + xs_size(user->actor) + xs_size(user->md5);
+
+        pthread_mutex_lock(&user_table_mutex);
+
+        if ((e = _user_table_find(uid)) != NULL)
+            user_free(&e->user);
+        else {
+            user_table = xs_realloc(user_table, (user_table_n + 1) * sizeof(t_user_ent));
+            e = &user_table[user_table_n++];
+        }
+
+        _user_dup(&e->user, user);
+        memcpy(e->stamp, stamp, sizeof(stamp));
+        e->checked = t;
+        e->size    = size;
+
+        _user_table_stats();
+
+        pthread_mutex_unlock(&user_table_mutex);
+
+        srv_debug(1, xs_fmt("user_open: %s loaded (%d bytes)", uid, size));
+    }
+
+    return ret;
+}
+
+
 xs_list *user_list(void)
 /* returns the list of user ids */
 {
@@ -315,15 +601,13 @@ xs_list *user_list(void)
 
 
 int user_open_by_md5(snac *snac, const char *md5)
-/* iterates all users searching by md5 */
+/* opens a user by the md5 of its actor */
 {
-    xs *ulist  = user_list();
-    xs_list *p = ulist;
-    const xs_str *v;
+    xs *uid = _user_map_get(1, md5);
 
-    while (xs_list_iter(&p, &v)) {
-        user_open(snac, v);
+    memset(snac, '\0', sizeof(*snac));
 
+    if (uid != NULL && user_open(snac, uid)) {
         if (strcmp(snac->md5, md5) == 0)
             return 1;
 
@@ -383,6 +667,8 @@ int user_persist(snac *snac, int publish)
     else
         rename(bfn, fn);
 
+    user_table_del(snac->uid);
+
     history_del(snac, "timeline.html_");
     timeline_touch(snac);
 
@@ -436,2789 +722,6134 @@ double f_ctime(const char *fn)
 }
 
 
-int is_md5_hex(const char *md5)
+int data_binary(void)
+/* returns true if objects are to be written in binary format */
 {
-    return xs_is_hex(md5) && strlen(md5) == MD5_HEX_SIZE - 1;
+    const char *v = xs_dict_get(srv_config, "object_format");
+    return xs_type(v) == XSTYPE_STRING && strcmp(v, "binary") == 0;
 }
 
 
-/** database 2.1+ **/
-
-/** indexes **/
-
-
-int index_add_md5(const char *fn, const char *md5)
-/* adds an md5 to an index */
+int data_json_indent(void)
+/* returns the indentation of the JSON written to storage (compact by default) */
 {
-    int status = HTTP_STATUS_CREATED;
-    FILE *f;
-
-    if (!is_md5_hex(md5)) {
-        srv_log(xs_fmt("index_add_md5: bad md5 %s %s", fn, md5));
-        return HTTP_STATUS_BAD_REQUEST;
-    }
+    return xs_number_get(xs_dict_get_def(srv_config, "json_indent", "0"));
+}
 
-    pthread_mutex_lock(&data_mutex);
 
-    if ((f = fopen(fn, "a")) != NULL) {
-        flock(fileno(f), LOCK_EX);
+xs_val *data_loads(const char *data, int size)
+/* loads a value from memory, in binary or JSON format */
+{
+    if (xs_bin_is(data, size))
+        return xs_bin_loads(data, size);
 
-        /* ensure the position is at the end after getting the lock */
-        fseek(f, 0, SEEK_END);
+    return xs_json_loads(data);
+}
 
-        fprintf(f, "%s\n", md5);
-        fclose(f);
-    }
-    else
-        status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
 
-    pthread_mutex_unlock(&data_mutex);
+xs_val *data_load(FILE *f)
+/* loads a value from a file, in binary or JSON format */
+{
+    char magic[4];
+    size_t n = fread(magic, 1, sizeof(magic), f);
 
-    return status;
-}
+    rewind(f);
 
+    if (xs_bin_is(magic, n))
+        return xs_bin_load(f);
 
-int index_add(const char *fn, const char *id)
-/* adds an id to an index */
-{
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return index_add_md5(fn, md5);
+    return xs_json_load(f);
 }
 
 
-int index_del_md5(const char *fn, const char *md5)
-/* deletes an md5 from an index */
+xs_data *data_dumps(const xs_val *v, int *size)
+/* dumps a value to memory, in the configured format */
 {
-    int status = HTTP_STATUS_NOT_FOUND;
-    FILE *f;
-
-    pthread_mutex_lock(&data_mutex);
+    xs_data *d;
 
-    if ((f = fopen(fn, "r+")) != NULL) {
-        char line[256];
+    if (data_binary() && (d = xs_bin_dumps(v, size)) != NULL)
+        return d;
 
-        while (fgets(line, sizeof(line), f) != NULL) {
-            line[MD5_HEX_SIZE - 1] = '\0';
+    xs_str *j = xs_json_dumps(v, data_json_indent());
 
-            if (strcmp(line, md5) == 0) {
-                /* found! just rewind, overwrite it with garbage
-                   and an eventual call to index_gc() will clean it
-                   [yes: this breaks index_len()] */
-                fseek(f, -MD5_HEX_SIZE, SEEK_CUR);
-                fwrite("-", 1, 1, f);
-                status = HTTP_STATUS_OK;
+    if (j != NULL)
+        *size = strlen(j);
 
-                break;
-            }
-        }
+    return j;
+}
 
-        fclose(f);
-    }
-    else
-        status = HTTP_STATUS_GONE;
 
-    pthread_mutex_unlock(&data_mutex);
+int data_dump(const xs_val *v, FILE *f)
+/* dumps a value to a file, in the configured format */
+{
+    if (data_binary() && xs_bin_dump(v, f))
+        return 1;
 
-    return status;
+    return xs_json_dump(v, data_json_indent(), f);
 }
 
 
-int index_del(const char *fn, const char *id)
-/* deletes an id from an index */
+static int _data_converted(const char *data, int size)
+/* returns true if data is already in the configured format */
 {
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return index_del_md5(fn, md5);
+    return !xs_bin_is(data, size) == !data_binary();
 }
 
 
-int index_gc(const char *fn)
-/* garbage-collects an index, deleting objects that are not here */
+static int _data_convert_file(const char *fn, xs_dict **links)
+/* rewrites a file in the configured format; returns 1 if converted,
+   0 if it was already in it, or -1 on error. The objects are hard-linked
+   from the users' caches, so the converted files of linked inodes are
+   kept in links, for the other names of them to be linked again */
 {
-    FILE *i, *o;
-    int gc = -1;
-
-    pthread_mutex_lock(&data_mutex);
+    FILE *f;
+    char hdr[XS_BIN_HDR_SIZE];
+    size_t n;
+    xs *v = NULL;
+    struct stat st;
 
-    if ((i = fopen(fn, "r")) != NULL) {
-        xs *nfn = xs_fmt("%s.new", fn);
-        char line[256];
+    if (stat(fn, &st) == -1 || (f = fopen(fn, "r")) == NULL)
+        return -1;
 
-        if ((o = fopen(nfn, "w")) != NULL) {
-            gc = 0;
+    n = fread(hdr, 1, sizeof(hdr), f);
+    rewind(f);
 
-            while (fgets(line, sizeof(line), i) != NULL) {
-                line[MD5_HEX_SIZE - 1] = '\0';
+    if (n == 0 || _data_converted(hdr, n)) {
+        fclose(f);
+        return 0;
+    }
 
-                if (line[0] != '-' && object_here_by_md5(line))
-                    fprintf(o, "%s\n", line);
-                else
-                    gc++;
-            }
+    xs *tfn   = xs_fmt("%s.tmp", fn);
+    xs *s_ino = xs_fmt("%lu.%lu", (unsigned long)st.st_dev, (unsigned long)st.st_ino);
+    const char *o_fn = xs_dict_get(*links, s_ino);
 
-            fclose(o);
+    if (xs_is_string(o_fn)) {
+        /* another name of an already converted file: link it again */
+        fclose(f);
 
-            xs *ofn = xs_fmt("%s.bak", fn);
+        unlink(tfn);
 
-            unlink(ofn);
-            link(fn, ofn);
-            rename(nfn, fn);
+        if (link(o_fn, tfn) == -1 || rename(tfn, fn) == -1) {
+            unlink(tfn);
+            return -1;
         }
 
-        fclose(i);
+        return 1;
     }
 
-    pthread_mutex_unlock(&data_mutex);
-
-    return gc;
-}
+    v = data_load(f);
+    fclose(f);
 
+    if (!xs_is_dict(v) && !xs_is_list(v))
+        return -1;
 
-int index_in_md5(const char *fn, const char *md5)
-/* checks if the md5 is already in the index */
-{
-    FILE *f;
-    int ret = 0;
+    int size;
+    xs *data = data_dumps(v, &size);
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        flock(fileno(f), LOCK_SH);
+    /* written to a temporary file and renamed, so that
+       an error never leaves a damaged file behind */
+    if (data == NULL || (f = fopen(tfn, "w")) == NULL)
+        return -1;
 
-        char line[256];
+    n = fwrite(data, size, 1, f);
 
-        while (!ret && fgets(line, sizeof(line), f) != NULL) {
-            line[MD5_HEX_SIZE - 1] = '\0';
+    if (fclose(f) == EOF || n != 1) {
+        unlink(tfn);
+        return -1;
+    }
 
-            if (strcmp(line, md5) == 0)
-                ret = 1;
-        }
+    /* keep the time, as the purge depends on it */
+    struct timespec ts[2] = { st.st_atim, st.st_mtim };
+    utimensat(AT_FDCWD, tfn, ts, 0);
 
-        fclose(f);
+    if (rename(tfn, fn) == -1) {
+        unlink(tfn);
+        return -1;
     }
 
-    return ret;
+    if (st.st_nlink > 1)
+        *links = xs_dict_set(*links, s_ino, fn);
+
+    return 1;
 }
 
 
-int index_in(const char *fn, const char *id)
-/* checks if the object id is already in the index */
+int is_md5_hex(const char *md5)
 {
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return index_in_md5(fn, md5);
+    return xs_is_hex(md5) && strlen(md5) == MD5_HEX_SIZE - 1;
 }
 
 
-int index_first(const char *fn, char md5[MD5_HEX_SIZE])
-/* reads the first entry of an index */
-{
-    FILE *f;
-    int ret = 0;
+/** database 2.1+ **/
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        if (fread(md5, MD5_HEX_SIZE, 1, f)) {
-            md5[MD5_HEX_SIZE - 1] = '\0';
-            ret = 1;
-        }
+/** indexes **/
 
-        fclose(f);
-    }
+/* Since disk layout 2.8, indexes are binary files made of a header
+   (see index_header()) followed by 16 byte raw md5 records. Deleted
+   records are overwritten with 0xff bytes until an index_gc().
+   Old text indexes (32 hex chars + newline per record) are still
+   readable and appendable, as notify.idx always is */
 
-    return ret;
+static const char index_deleted_rec[INDEX_REC_SIZE + 1] =
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff";
+
+
+static uint32_t _index_get32(const char *p)
+/* reads a little-endian 32 bit number */
+{
+    const unsigned char *u = (const unsigned char *)p;
+
+    return (uint32_t)u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16 | (uint32_t)u[3] << 24;
 }
 
 
-int index_len(const char *fn)
-/* returns the number of elements in an index */
+static void _index_put32(char *p, uint32_t v)
+/* writes a little-endian 32 bit number */
 {
-    struct stat st;
-    int len = 0;
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
 
-    if (stat(fn, &st) != -1)
-        len = st.st_size / MD5_HEX_SIZE;
 
-    return len;
+void index_header(char hdr[INDEX_HDR_SIZE])
+/* fills a binary index header: magic, version and record size
+   (the numbers are little-endian, so indexes can be moved around) */
+{
+    memset(hdr, '\0', INDEX_HDR_SIZE);
+    memcpy(hdr, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    _index_put32(hdr + sizeof(INDEX_MAGIC), INDEX_VERSION);
+    _index_put32(hdr + sizeof(INDEX_MAGIC) + 4, INDEX_REC_SIZE);
 }
 
 
-xs_list *index_list(const char *fn, int max)
-/* returns an index as a list */
+int index_open(t_index *idx, const char *fn)
+/* opens an index for reading (the caller must call index_close()) */
 {
-    xs_list *list = xs_list_new();
-    FILE *f;
-    int n = 0;
+    struct stat st;
+    int fd;
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        flock(fileno(f), LOCK_SH);
+    memset(idx, '\0', sizeof(*idx));
+    idx->fn       = fn;
+    idx->rec_size = MD5_HEX_SIZE;
+    idx->pos      = -1;
 
-        char line[256];
+    if ((fd = open(fn, O_RDONLY)) == -1)
+        return 0;
 
-        while (n < max && fgets(line, sizeof(line), f) != NULL) {
-            if (line[0] != '-') {
-                line[MD5_HEX_SIZE - 1] = '\0';
-                list = xs_list_append(list, line);
-                n++;
-            }
-        }
+    /* wait for any writer to finish its record */
+    flock(fd, LOCK_SH);
 
-        fclose(f);
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return 0;
     }
 
-    return list;
-}
+    idx->ino = st.st_ino;
 
+    if (st.st_size > 0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-int index_desc_next(FILE *f, char md5[MD5_HEX_SIZE])
-/* reads the next entry of a desc index */
-{
-    for (;;) {
-        /* move backwards 2 entries */
-        if (fseek(f, MD5_HEX_SIZE * -2, SEEK_CUR) == -1)
+        if (p == MAP_FAILED) {
+            srv_log(xs_fmt("index_open: cannot map %s", fn));
+            close(fd);
             return 0;
+        }
+
+        idx->data = p;
+        idx->size = st.st_size;
+    }
+
+    close(fd);
+
+    if (idx->size >= INDEX_HDR_SIZE &&
+        memcmp(idx->data, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0) {
+        uint32_t v[2];
+
+        v[0] = _index_get32(idx->data + sizeof(INDEX_MAGIC));
+        v[1] = _index_get32(idx->data + sizeof(INDEX_MAGIC) + 4);
 
-        /* read and md5 */
-        if (!fread(md5, MD5_HEX_SIZE, 1, f))
+        if (v[0] != INDEX_VERSION || v[1] != INDEX_REC_SIZE) {
+            srv_log(xs_fmt("index_open: unsupported index %s (v%u, %u)", fn, v[0], v[1]));
+            index_close(idx);
             return 0;
+        }
 
-        if (md5[0] != '-')
-            break;
+        idx->binary   = 1;
+        idx->hdr_size = INDEX_HDR_SIZE;
+        idx->rec_size = INDEX_REC_SIZE;
     }
 
-    md5[MD5_HEX_SIZE - 1] = '\0';
+    idx->n_recs = (idx->size - idx->hdr_size) / idx->rec_size;
 
     return 1;
 }
 
 
-int index_desc_first(FILE *f, char md5[MD5_HEX_SIZE], int skip)
-/* reads the first entry of a desc index */
+void index_close(t_index *idx)
+/* closes an index */
 {
-    /* try to position at the end and then back to the first element */
-    if (fseek(f, 0, SEEK_END) || fseek(f, (skip + 1) * -MD5_HEX_SIZE, SEEK_CUR))
-        return 0;
+    if (idx->data != NULL)
+        munmap((void *)idx->data, idx->size);
 
-    /* try to read an md5 */
-    if (!fread(md5, MD5_HEX_SIZE, 1, f))
-        return 0;
-
-    /* null-terminate */
-    md5[MD5_HEX_SIZE - 1] = '\0';
+    idx->data   = NULL;
+    idx->size   = 0;
+    idx->n_recs = 0;
+}
 
-    /* deleted? retry next */
-    if (md5[0] == '-')
-        return index_desc_next(f, md5);
 
-    return 1;
+static const char *_index_rec_ptr(const t_index *idx, long n)
+/* returns a pointer to the record number n */
+{
+    return idx->data + idx->hdr_size + n * idx->rec_size;
 }
 
-int index_asc_first(FILE *f,char md5[MD5_HEX_SIZE], const char *seek_md5)
-/* reads the first entry of an ascending index, starting from a given md5 */
+
+static int _index_rec(const t_index *idx, long n, char md5[MD5_HEX_SIZE])
+/* gets the record number n as a string; returns 0 if it's deleted */
 {
-    fseek(f, SEEK_SET, 0);
-    while (fread(md5, MD5_HEX_SIZE, 1, f)) {
-        md5[MD5_HEX_SIZE - 1] = '\0';
-        if (strcmp(md5,seek_md5) == 0) {
-            return index_asc_next(f, md5);
+    const char *r = _index_rec_ptr(idx, n);
+
+    if (idx->binary) {
+        if (memcmp(r, index_deleted_rec, INDEX_REC_SIZE) == 0) {
+            strcpy(md5, "-");
+            return 0;
         }
+
+        *_xs_hex_enc(md5, r, INDEX_REC_SIZE) = '\0';
     }
-    return 0;
+    else {
+        memcpy(md5, r, MD5_HEX_SIZE - 1);
+        md5[MD5_HEX_SIZE - 1] = '\0';
+    }
+
+    return md5[0] != '-';
 }
 
-int index_asc_next(FILE *f, char md5[MD5_HEX_SIZE])
-/* reads the next entry of an ascending index */
+
+static long _index_scan(const char *recs, long n_recs, const char key[INDEX_REC_SIZE])
+/* finds a raw md5 in an array of binary records; returns -1 if not found */
 {
-    for (;;) {
-        /* read an md5 */
-        if (!fread(md5, MD5_HEX_SIZE, 1, f))
-            return 0;
+    long n;
 
-        /* deleted, skip */
-        if (md5[0] != '-')
-            break;
+#ifdef __SSE2__
+    const __m128i k = _mm_loadu_si128((const __m128i *)key);
+
+    for (n = 0; n < n_recs; n++) {
+        __m128i r = _mm_loadu_si128((const __m128i *)(recs + n * INDEX_REC_SIZE));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(r, k)) == 0xffff)
+            return n;
     }
+#else
+    uint64_t k[2];
 
-    md5[MD5_HEX_SIZE - 1] = '\0';
+    memcpy(k, key, sizeof(k));
 
-    return 1;
+    for (n = 0; n < n_recs; n++) {
+        uint64_t r[2];
+
+        memcpy(r, recs + n * INDEX_REC_SIZE, sizeof(r));
+
+        if (((r[0] ^ k[0]) | (r[1] ^ k[1])) == 0)
+            return n;
+    }
+#endif
+
+    return -1;
 }
 
 
-xs_list *index_list_desc(const char *fn, int skip, int show)
-/* returns an index as a list, in reverse order */
+static long _index_find(const t_index *idx, const char *md5)
+/* finds the record number of an md5; returns -1 if not found */
 {
-    xs_list *list = xs_list_new();
-    FILE *f;
+    long n;
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        char md5[MD5_HEX_SIZE];
+    if (idx->n_recs == 0 || strlen(md5) != MD5_HEX_SIZE - 1)
+        return -1;
 
-        if (index_desc_first(f, md5, skip)) {
-            int n = 1;
+    if (idx->binary) {
+        char key[INDEX_REC_SIZE];
 
-            do {
-                list = xs_list_append(list, md5);
-            } while (n++ < show && index_desc_next(f, md5));
-        }
+        if (_xs_hex_dec(key, md5, MD5_HEX_SIZE - 1) == NULL)
+            return -1;
 
-        fclose(f);
+        return _index_scan(_index_rec_ptr(idx, 0), idx->n_recs, key);
     }
 
-    return list;
+    for (n = 0; n < idx->n_recs; n++) {
+        if (memcmp(_index_rec_ptr(idx, n), md5, MD5_HEX_SIZE - 1) == 0)
+            return n;
+    }
+
+    return -1;
 }
 
 
-/** objects **/
+/** index position maps **/
 
-static xs_str *_object_fn_by_md5(const char *md5, const char *func)
-{
-    xs *bfn = xs_fmt("%s/object/%c%c", srv_basedir, md5[0], md5[1]);
-    xs_str *ret;
-    int ok = 1;
+/* maps from md5 to record number for binary indexes used as timelines,
+   so that pagination cursors are resolved without scanning. They live
+   in memory, are validated against the index inode and length, and
+   are extended as records are appended. As many are kept as fit in
+   POS_MAP_BYTES, so the number of them follows the number of indexes
+   in use; when it's exceeded, the least recently used ones are freed */
 
-    /* an object deleted from an index; fail but don't bark */
-    if (md5[0] == '-')
-        ok = 0;
-    else
-    if (!is_md5_hex(md5)) {
-        srv_log(xs_fmt("_object_fn_by_md5() [from %s()]: bad md5 '%s'", func, md5));
-        ok = 0;
-    }
+typedef struct {
+    char key[INDEX_REC_SIZE];   /* raw md5 */
+    long pos;                   /* record number (-1, empty) */
+} t_pos_slot;
 
-    if (ok) {
-        mkdirx(bfn);
-        ret = xs_fmt("%s/%s.json", bfn, md5);
-    }
-    else
-        ret = xs_fmt("%s/object/invalid/invalid.json", srv_basedir);
+typedef struct {
+    xs_str *fn;             /* index file name */
+    ino_t ino;              /* inode of the index file */
+    long n_recs;            /* number of records covered */
+    long n_slots;           /* hash table size (power of 2) */
+    long n_used;            /* used slots */
+    t_pos_slot *slots;      /* the hash table */
+    unsigned long used;     /* last use (for eviction) */
+    unsigned int hash;      /* hash of fn */
+} t_pos_map;
 
-    return ret;
-}
+#define POS_MAP_BYTES (32 * 1024 * 1024)
 
+static t_pos_map *pos_maps = NULL;
+static int pos_map_n = 0;
+static long pos_map_bytes = 0;
+static unsigned long pos_map_tick = 0;
 
-static xs_str *_object_fn(const char *id)
+
+static t_pos_slot *_pos_map_slot(t_pos_slot *slots, long n_slots, const char *key)
+/* returns the slot for a key (either holding it or empty) */
 {
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return _object_fn_by_md5(md5, "_object_fn");
-}
+    uint64_t h;
 
+    memcpy(&h, key, sizeof(h));
 
-int object_here_by_md5(const char *id)
-/* checks if an object is already downloaded */
-{
-    xs *fn = _object_fn_by_md5(id, "object_here_by_md5");
-    return mtime(fn) > 0.0;
+    for (h &= n_slots - 1;; h = (h + 1) & (n_slots - 1)) {
+        t_pos_slot *s = &slots[h];
+
+        if (s->pos == -1 || memcmp(s->key, key, INDEX_REC_SIZE) == 0)
+            return s;
+    }
 }
 
 
-int object_here(const char *id)
-/* checks if an object is already downloaded */
+static void _pos_map_put(t_pos_map *m, const char *key, long pos)
+/* sets the position of a key (the newest record wins) */
 {
-    xs *fn = _object_fn(id);
-    return mtime(fn) > 0.0;
-}
+    if ((m->n_used + 1) * 2 > m->n_slots) {
+        /* grow */
+        long n_slots = m->n_slots ? m->n_slots * 2 : 1024;
+        t_pos_slot *slots = xs_realloc(NULL, n_slots * sizeof(t_pos_slot));
+        long n;
 
+        for (n = 0; n < n_slots; n++)
+            slots[n].pos = -1;
 
-int object_get_by_md5(const char *md5, xs_dict **obj)
-/* returns a stored object, optionally of the requested type */
-{
-    int status = HTTP_STATUS_NOT_FOUND;
-    xs *fn     = _object_fn_by_md5(md5, "object_get_by_md5");
-    FILE *f;
+        for (n = 0; n < m->n_slots; n++) {
+            if (m->slots[n].pos != -1)
+                *_pos_map_slot(slots, n_slots, m->slots[n].key) = m->slots[n];
+        }
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        *obj = xs_json_load(f);
-        fclose(f);
+        xs_free(m->slots);
+        m->slots   = slots;
+        m->n_slots = n_slots;
+    }
 
-        if (*obj)
-            status = HTTP_STATUS_OK;
+    t_pos_slot *s = _pos_map_slot(m->slots, m->n_slots, key);
+
+    if (s->pos == -1) {
+        memcpy(s->key, key, INDEX_REC_SIZE);
+        m->n_used++;
     }
-    else
-        *obj = NULL;
 
-    return status;
+    s->pos = pos;
 }
 
 
-int object_get(const char *id, xs_dict **obj)
-/* returns a stored object, optionally of the requested type */
+static void _pos_map_free(t_pos_map *m)
+/* frees a map */
 {
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return object_get_by_md5(md5, obj);
+    xs_free(m->fn);
+    xs_free(m->slots);
+    memset(m, '\0', sizeof(*m));
 }
 
 
-int _object_add(const char *id, const xs_dict *obj, int ow)
-/* stores an object */
+static t_pos_map *_pos_map_find(const char *fn)
+/* finds the map of an index (pos_map_mutex must be locked) */
 {
-    int status = HTTP_STATUS_CREATED; /* Created */
-    xs *fn     = _object_fn(id);
-    FILE *f;
+    unsigned int h = xs_hash_func(fn, strlen(fn));
+    int n;
 
-    if (mtime(fn) > 0.0) {
-        if (!ow) {
-            /* object already here */
-            srv_debug(1, xs_fmt("object_add object already here %s", id));
-            return HTTP_STATUS_NO_CONTENT;
-        }
-        else
-            status = HTTP_STATUS_OK;
+    for (n = 0; n < pos_map_n; n++) {
+        if (pos_maps[n].fn != NULL && pos_maps[n].hash == h && strcmp(pos_maps[n].fn, fn) == 0)
+            return &pos_maps[n];
     }
 
-    if ((f = fopen(fn, "w")) != NULL) {
-        flock(fileno(f), LOCK_EX);
-
-        xs_json_dump(obj, 4, f);
-        fclose(f);
-
-        /* does this object has a parent? */
-        const char *in_reply_to = get_in_reply_to(obj);
+    return NULL;
+}
 
-        if (!xs_is_null(in_reply_to) && *in_reply_to) {
-            /* update the children index of the parent */
-            xs *c_idx = _object_fn(in_reply_to);
 
-            c_idx = xs_replace_i(c_idx, ".json", "_c.idx");
+static void _pos_map_drop(t_pos_map *m)
+/* frees a map from the cache (pos_map_mutex must be locked) */
+{
+    pos_map_bytes -= m->n_slots * sizeof(t_pos_slot);
+    _pos_map_free(m);
+}
 
-            if (!index_in(c_idx, id)) {
-                index_add(c_idx, id);
-                srv_debug(1, xs_fmt("object_add added child %s to %s", id, c_idx));
-            }
-            else
-                srv_debug(1, xs_fmt("object_add %s child already in %s", id, c_idx));
 
-            /* create a one-element index with the parent */
-            xs *p_idx = xs_replace(fn, ".json", "_p.idx");
+static t_pos_map *_pos_map_new(const char *fn)
+/* creates a map for an index (pos_map_mutex must be locked) */
+{
+    t_pos_map *m = NULL;
+    int n;
 
-            if (mtime(p_idx) == 0.0) {
-                index_add(p_idx, in_reply_to);
-                srv_debug(1, xs_fmt("object_add added parent %s to %s", in_reply_to, p_idx));
-            }
-        }
+    for (n = 0; n < pos_map_n && m == NULL; n++) {
+        if (pos_maps[n].fn == NULL)
+            m = &pos_maps[n];
     }
-    else {
-        srv_log(xs_fmt("object_add error writing %s (errno: %d)", fn, errno));
-        status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+
+    if (m == NULL) {
+        pos_maps = xs_realloc(pos_maps, (pos_map_n + 1) * sizeof(t_pos_map));
+        m = &pos_maps[pos_map_n++];
+        memset(m, '\0', sizeof(*m));
     }
 
-    srv_debug(1, xs_fmt("object_add %s %s %d", id, fn, status));
+    m->fn   = xs_str_new(fn);
+    m->hash = xs_hash_func(fn, strlen(fn));
 
-    return status;
+    return m;
 }
 
 
-int object_add(const char *id, const xs_dict *obj)
-/* stores an object */
+static void _pos_map_trim(const t_pos_map *keep)
+/* frees the least recently used maps until they fit in their
+   memory budget (pos_map_mutex must be locked) */
 {
-    return _object_add(id, obj, 0);
-}
+    while (pos_map_bytes > POS_MAP_BYTES) {
+        t_pos_map *m = NULL;
+        int n;
 
+        for (n = 0; n < pos_map_n; n++) {
+            t_pos_map *o = &pos_maps[n];
 
-int object_add_ow(const char *id, const xs_dict *obj)
-/* stores an object (overwriting allowed) */
-{
-    return _object_add(id, obj, 1);
+            if (o->fn != NULL && o != keep && (m == NULL || o->used < m->used))
+                m = o;
+        }
+
+        if (m == NULL)
+            break;
+
+        _pos_map_drop(m);
+    }
 }
 
 
-int object_del_by_md5(const char *md5)
-/* deletes an object by its md5 */
+static void _pos_map_sync(t_pos_map *m, const t_index *idx)
+/* brings a map up to date with an opened index (pos_map_mutex must be locked) */
 {
-    int status = HTTP_STATUS_NOT_FOUND;
-    xs *fn     = _object_fn_by_md5(md5, "object_del_by_md5");
+    long n, n_slots = m->n_slots;
 
-    if (unlink(fn) != -1) {
-        status = HTTP_STATUS_OK;
+    if (m->ino != idx->ino || m->n_recs > idx->n_recs) {
+        /* replaced or truncated: start again */
+        m->slots   = xs_free(m->slots);
+        m->n_slots = m->n_used = m->n_recs = 0;
+        m->ino     = idx->ino;
+    }
 
-        /* also delete associated indexes */
-        xs *spec  = xs_dup(fn);
-        spec      = xs_replace_i(spec, ".json", "*.idx");
-        xs *files = xs_glob(spec, 0, 0);
-        char *p;
-        const char *v;
+    for (n = m->n_recs; n < idx->n_recs; n++) {
+        const char *r = _index_rec_ptr(idx, n);
 
-        p = files;
-        while (xs_list_iter(&p, &v)) {
-            srv_debug(1, xs_fmt("object_del index %s", v));
-            unlink(v);
-        }
+        if (memcmp(r, index_deleted_rec, INDEX_REC_SIZE) != 0)
+            _pos_map_put(m, r, n);
     }
 
-    srv_debug(1, xs_fmt("object_del %s %d", fn, status));
+    m->n_recs = idx->n_recs;
 
-    return status;
+    pos_map_bytes += (m->n_slots - n_slots) * sizeof(t_pos_slot);
 }
 
 
-int object_del(const char *id)
-/* deletes an object */
+static void _pos_map_append(const char *fn, ino_t ino, long pos, const char *key)
+/* updates a map, if there is one, with a just appended record */
 {
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return object_del_by_md5(md5);
-}
+    t_pos_map *m;
 
+    pthread_mutex_lock(&pos_map_mutex);
 
-int object_del_if_unref(const char *id)
-/* deletes an object if its n_links < 2 */
-{
-    xs *fn = _object_fn(id);
-    int n_links;
-    int ret = 0;
+    if ((m = _pos_map_find(fn)) != NULL && m->ino == ino && m->n_recs == pos) {
+        long n_slots = m->n_slots;
 
-    if (mtime_nl(fn, &n_links) > 0.0 && n_links < 2)
-        ret = object_del(id);
+        _pos_map_put(m, key, pos);
+        m->n_recs++;
 
-    return ret;
+        pos_map_bytes += (m->n_slots - n_slots) * sizeof(t_pos_slot);
+        _pos_map_trim(m);
+    }
+
+    pthread_mutex_unlock(&pos_map_mutex);
 }
 
 
-double object_ctime_by_md5(const char *md5)
+static void _pos_map_forget(const char *fn)
+/* forgets a map, if there is one, after an index has been rewritten
+   (it will be built again if the index is used) */
 {
-    xs *fn = _object_fn_by_md5(md5, "object_ctime_by_md5");
-    return f_ctime(fn);
-}
+    t_pos_map *m;
 
+    pthread_mutex_lock(&pos_map_mutex);
 
-double object_ctime(const char *id)
-{
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return object_ctime_by_md5(md5);
+    if ((m = _pos_map_find(fn)) != NULL)
+        _pos_map_drop(m);
+
+    pthread_mutex_unlock(&pos_map_mutex);
 }
 
 
-double object_mtime_by_md5(const char *md5)
+static long _index_pos(const t_index *idx, const char *md5)
+/* finds the record number of an md5 using the position map */
 {
-    xs *fn = _object_fn_by_md5(md5, "object_mtime_by_md5");
-    return mtime(fn);
-}
+    char key[INDEX_REC_SIZE];
+    long pos = -1;
 
+    if (!idx->binary || idx->fn == NULL || strlen(md5) != MD5_HEX_SIZE - 1 ||
+        _xs_hex_dec(key, md5, MD5_HEX_SIZE - 1) == NULL)
+        return _index_find(idx, md5);
 
-double object_mtime(const char *id)
-{
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return object_mtime_by_md5(md5);
-}
+    pthread_mutex_lock(&pos_map_mutex);
 
+    t_pos_map *m = _pos_map_find(idx->fn);
 
-void object_touch(const char *id)
-{
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    xs *fn = _object_fn_by_md5(md5, "object_touch");
+    if (m == NULL)
+        m = _pos_map_new(idx->fn);
 
-    if (mtime(fn))
-        utimes(fn, NULL);
-}
+    m->used = ++pos_map_tick;
 
+    _pos_map_sync(m, idx);
+    _pos_map_trim(m);
 
-xs_str *_object_index_fn(const char *id, const char *idxsfx)
-/* returns the filename of an object's index */
-{
-    xs_str *fn = _object_fn(id);
-    return xs_replace_i(fn, ".json", idxsfx);
-}
+    if (m->n_slots)
+        pos = _pos_map_slot(m->slots, m->n_slots, key)->pos;
 
+    pthread_mutex_unlock(&pos_map_mutex);
 
-int object_likes_len(const char *id)
-/* returns the number of likes (without reading the index) */
-{
-    xs *fn = _object_index_fn(id, "_l.idx");
-    return index_len(fn);
+    /* the record may have been deleted in place */
+    if (pos != -1 && memcmp(_index_rec_ptr(idx, pos), key, INDEX_REC_SIZE) != 0)
+        pos = _index_find(idx, md5);
+
+    return pos;
 }
 
 
-int object_announces_len(const char *id)
-/* returns the number of announces (without reading the index) */
+int index_seek(t_index *idx, const char *md5)
+/* positions the iterator on the record holding an md5 */
 {
-    xs *fn = _object_index_fn(id, "_a.idx");
-    return index_len(fn);
-}
+    long pos = _index_pos(idx, md5);
 
+    if (pos == -1)
+        return 0;
 
-xs_list *object_children(const char *id)
-/* returns the list of an object's children */
-{
-    xs *fn = _object_index_fn(id, "_c.idx");
-    return index_list(fn, XS_ALL);
+    idx->pos = pos;
+
+    return 1;
 }
 
 
-xs_list *object_likes(const char *id)
-{
-    xs *fn = _object_index_fn(id, "_l.idx");
-    return index_list(fn, XS_ALL);
-}
+/** index filters **/
 
+/* Binary indexes with at least INDEX_FILTER_MIN records get a bloom
+   filter sidecar file (the index file name plus .bloom), so that most
+   negative membership checks don't need to read the index. The filter
+   header stores the number of index records it covers; if it doesn't
+   match the index length, the filter is ignored until the next writer
+   rebuilds it. Deleted records are left in the filter */
 
-xs_list *object_announces(const char *id)
+#define INDEX_FILTER_MAGIC "SNACBLM"
+#define INDEX_FILTER_MIN 128    /* minimum index records to have a filter */
+#define INDEX_FILTER_BPR 10     /* bits per record */
+#define INDEX_FILTER_K 7        /* number of hashes */
+
+typedef struct {
+    char magic[8];
+    uint32_t n_bits;            /* filter size in bits (power of 2) */
+    uint32_t k;                 /* number of hashes */
+    uint64_t n_recs;            /* number of index records covered */
+} t_filter_hdr;
+
+
+static xs_str *_index_filter_fn(const char *fn)
 {
-    xs *fn = _object_index_fn(id, "_a.idx");
-    return index_list(fn, XS_ALL);
+    return xs_fmt("%s.bloom", fn);
 }
 
 
-int object_parent(const char *md5, char parent[MD5_HEX_SIZE])
-/* returns the object parent, if any */
+static void _index_filter_bits(const char key[INDEX_REC_SIZE], uint32_t n_bits,
+                               uint32_t bits[INDEX_FILTER_K])
+/* computes the bit numbers of a raw md5 (by double hashing) */
 {
-    xs *fn = _object_fn_by_md5(md5, "object_parent");
+    uint64_t h[2];
+    int n;
 
-    fn = xs_replace_i(fn, ".json", "_p.idx");
-    return index_first(fn, parent);
+    memcpy(h, key, sizeof(h));
+    h[1] |= 1;
+
+    for (n = 0; n < INDEX_FILTER_K; n++)
+        bits[n] = (h[0] + n * h[1]) & (n_bits - 1);
 }
 
 
-int object_admire(const char *id, const char *actor, int like)
-/* actor likes or announces this object */
+static int _index_filter_build(const char *fn)
+/* (re)builds the filter of an index */
 {
-    int status = HTTP_STATUS_OK;
-    xs *fn     = _object_fn(id);
-
-    fn = xs_replace_i(fn, ".json", like ? "_l.idx" : "_a.idx");
-
-    if (!index_in(fn, actor)) {
-        status = index_add(fn, actor);
+    xs *ffn = _index_filter_fn(fn);
+    t_index idx;
+    int ret = 0;
 
-        srv_debug(1, xs_fmt("object_admire (%s) %s %s", like ? "Like" : "Announce", actor, fn));
+    if (!index_open(&idx, fn)) {
+        unlink(ffn);
+        return 0;
     }
 
-    return status;
-}
+    if (idx.binary && idx.n_recs >= INDEX_FILTER_MIN) {
+        t_filter_hdr hdr;
+        uint32_t n_bits = 1024;
+        long n;
 
+        /* leave room for the index to double its size */
+        while (n_bits < (uint64_t)idx.n_recs * INDEX_FILTER_BPR * 2)
+            n_bits *= 2;
 
-int object_unadmire(const char *id, const char *actor, int like)
-/* actor no longer likes or announces this object */
-{
-    int status;
-    xs *fn = _object_fn(id);
+        unsigned char *map = xs_realloc(NULL, n_bits / 8);
+        memset(map, '\0', n_bits / 8);
 
-    fn = xs_replace_i(fn, ".json", like ? "_l.idx" : "_a.idx");
+        for (n = 0; n < idx.n_recs; n++) {
+            const char *r = _index_rec_ptr(&idx, n);
+            uint32_t bits[INDEX_FILTER_K];
+            int i;
 
-    status = index_del(fn, actor);
+            if (memcmp(r, index_deleted_rec, INDEX_REC_SIZE) == 0)
+                continue;
 
-    if (valid_status(status))
-        index_gc(fn);
+            _index_filter_bits(r, n_bits, bits);
 
-    srv_debug(0,
-        xs_fmt("object_unadmire (%s) %s %s %d", like ? "Like" : "Announce", actor, fn, status));
+            for (i = 0; i < INDEX_FILTER_K; i++)
+                map[bits[i] / 8] |= 1 << (bits[i] % 8);
+        }
 
-    return status;
-}
+        memset(&hdr, '\0', sizeof(hdr));
+        memcpy(hdr.magic, INDEX_FILTER_MAGIC, sizeof(INDEX_FILTER_MAGIC));
+        hdr.n_bits = n_bits;
+        hdr.k      = INDEX_FILTER_K;
+        hdr.n_recs = idx.n_recs;
 
+        xs *nfn = xs_fmt("%s.new", ffn);
+        FILE *f;
 
-xs_str *object_user_cache_fn_by_md5(snac *user, const char *md5, const char *cachedir)
-{
-    return xs_fmt("%s/%s/%s.json", user->basedir, cachedir, md5);
-}
+        if ((f = fopen(nfn, "w")) != NULL) {
+            int ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+                     fwrite(map, n_bits / 8, 1, f) == 1;
 
+            if (fclose(f) == EOF)
+                ok = 0;
 
-xs_str *object_user_cache_fn(snac *user, const char *id, const char *cachedir)
-{
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return object_user_cache_fn_by_md5(user, md5, cachedir);
-}
+            if (ok && rename(nfn, ffn) != -1)
+                ret = 1;
+            else {
+                /* never leave an old (or partial) filter behind */
+                unlink(nfn);
+                unlink(ffn);
+            }
+        }
 
+        xs_free(map);
+    }
+    else
+        unlink(ffn);
 
-xs_str *object_user_cache_index_fn(snac *user, const char *cachedir)
-{
-    return xs_fmt("%s/%s.idx", user->basedir, cachedir);
+    index_close(&idx);
+
+    return ret;
 }
 
 
-int _object_user_cache(snac *user, const char *id, const char *cachedir, int del)
-/* adds or deletes from a user cache */
+static void _index_filter_add(const char *fn, const char key[INDEX_REC_SIZE], long pos)
+/* adds a just appended record (number pos) to the filter of an index */
 {
-    xs *ofn = _object_fn(id);
-    xs *cfn = object_user_cache_fn(user, id, cachedir);
-    xs *idx = object_user_cache_index_fn(user, cachedir);
-    int ret;
+    xs *ffn = _index_filter_fn(fn);
+    t_filter_hdr hdr;
+    int fd;
 
-    if (del) {
-        ret = unlink(cfn);
-        index_del(idx, id);
-    }
-    else {
-        /* create the subfolder, if it does not exist */
-        xs *dir = xs_fmt("%s/%s/", user->basedir, cachedir);
-        mkdirx(dir);
+    if ((fd = open(ffn, O_RDWR)) == -1) {
+        /* no filter yet: create it if the index is big enough */
+        if (pos + 1 >= INDEX_FILTER_MIN)
+            _index_filter_build(fn);
 
-        if ((ret = link(ofn, cfn)) != -1)
-            index_add(idx, id);
+        return;
     }
 
-    return ret;
-}
+    flock(fd, LOCK_EX);
 
+    if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        memcmp(hdr.magic, INDEX_FILTER_MAGIC, sizeof(INDEX_FILTER_MAGIC)) == 0 &&
+        hdr.k == INDEX_FILTER_K && hdr.n_recs == (uint64_t)pos &&
+        (uint64_t)(pos + 1) * INDEX_FILTER_BPR <= hdr.n_bits) {
+        uint32_t bits[INDEX_FILTER_K];
+        int i, ok = 1;
 
-int object_user_cache_add(snac *user, const char *id, const char *cachedir)
-/* caches an object into a user cache */
-{
-    return _object_user_cache(user, id, cachedir, 0);
-}
+        _index_filter_bits(key, hdr.n_bits, bits);
 
+        /* set the bits first, then mark the record as covered */
+        for (i = 0; ok && i < INDEX_FILTER_K; i++) {
+            off_t off = sizeof(hdr) + bits[i] / 8;
+            unsigned char c = 0;
 
-int object_user_cache_del(snac *user, const char *id, const char *cachedir)
-/* deletes an object from a user cache */
-{
-    return _object_user_cache(user, id, cachedir, 1);
-}
+            ok = pread(fd, &c, 1, off) == 1;
 
+            if (ok) {
+                c |= 1 << (bits[i] % 8);
+                ok = pwrite(fd, &c, 1, off) == 1;
+            }
+        }
 
-int object_user_cache_in(snac *user, const char *id, const char *cachedir)
-/* checks if an object is stored in a cache */
-{
-    xs *cfn = object_user_cache_fn(user, id, cachedir);
-    return !!(mtime(cfn) != 0.0);
-}
+        if (ok) {
+            hdr.n_recs++;
+            ok = pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr);
+        }
 
+        if (!ok) {
+            /* a filter missing a record would give false negatives:
+               drop it (while still locked), it will be rebuilt */
+            srv_log(xs_fmt("index filter: cannot update %s (errno: %d)", ffn, errno));
+            unlink(ffn);
+        }
 
-int object_user_cache_in_by_md5(snac *user, const char *md5, const char *cachedir)
-/* checks if an object is stored in a cache */
-{
-    xs *cfn = object_user_cache_fn_by_md5(user, md5, cachedir);
-    return !!(mtime(cfn) != 0.0);
+        close(fd);
+    }
+    else {
+        /* out of sync or full */
+        close(fd);
+        _index_filter_build(fn);
+    }
 }
 
 
-xs_list *object_user_cache_list(snac *user, const char *cachedir, int max, int inv)
-/* returns the objects in a cache as a list */
+static int _index_filter_check(const char *fn, const char *md5)
+/* checks an md5 against the filter of an index: returns 0 if it's
+   surely not there, 1 if it may be, or -1 if there is no usable filter */
 {
-    xs *idx = xs_fmt("%s/%s.idx", user->basedir, cachedir);
-    return inv ? index_list_desc(idx, 0, max) : index_list(idx, max);
-}
+    char key[INDEX_REC_SIZE];
+    struct stat st;
+    t_filter_hdr hdr;
+    int ret = -1;
+    int fd;
 
+    if (stat(fn, &st) == -1 || st.st_size < INDEX_HDR_SIZE + INDEX_FILTER_MIN * INDEX_REC_SIZE)
+        return -1;
 
-/** specialized functions **/
+    if (strlen(md5) != MD5_HEX_SIZE - 1 || _xs_hex_dec(key, md5, MD5_HEX_SIZE - 1) == NULL)
+        return -1;
 
-/** followers **/
+    xs *ffn = _index_filter_fn(fn);
 
-int follower_add(snac *snac, const char *actor)
-/* adds a follower */
-{
-    int ret = object_user_cache_add(snac, actor, "followers");
+    if ((fd = open(ffn, O_RDONLY)) == -1)
+        return -1;
 
-    snac_debug(snac, 2, xs_fmt("follower_add %s", actor));
+    if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        memcmp(hdr.magic, INDEX_FILTER_MAGIC, sizeof(INDEX_FILTER_MAGIC)) == 0 &&
+        hdr.k == INDEX_FILTER_K &&
+        hdr.n_recs == (uint64_t)(st.st_size - INDEX_HDR_SIZE) / INDEX_REC_SIZE) {
+        uint32_t bits[INDEX_FILTER_K];
+        int i;
 
-    return ret == -1 ? HTTP_STATUS_INTERNAL_SERVER_ERROR : HTTP_STATUS_OK;
-}
+        _index_filter_bits(key, hdr.n_bits, bits);
 
+        for (ret = 1, i = 0; ret && i < INDEX_FILTER_K; i++) {
+            unsigned char c = 0;
 
-int follower_del(snac *snac, const char *actor)
-/* deletes a follower */
-{
-    int ret = object_user_cache_del(snac, actor, "followers");
+            if (pread(fd, &c, 1, sizeof(hdr) + bits[i] / 8) != 1)
+                ret = -1;
+            else
+            if (!(c & (1 << (bits[i] % 8))))
+                ret = 0;
+        }
+    }
 
-    snac_debug(snac, 2, xs_fmt("follower_del %s", actor));
+    close(fd);
 
-    return ret == -1 ? HTTP_STATUS_NOT_FOUND : HTTP_STATUS_OK;
+    return ret;
 }
 
 
-int follower_check(snac *snac, const char *actor)
-/* checks if someone is a follower */
+int index_unlink(const char *fn)
+/* deletes an index file and its filter */
 {
-    return object_user_cache_in(snac, actor, "followers");
+    xs *ffn = _index_filter_fn(fn);
+
+    unlink(ffn);
+
+    return unlink(fn);
 }
 
 
-xs_list *follower_list(snac *snac)
-/* returns the list of followers */
+int index_add_md5(const char *fn, const char *md5)
+/* adds an md5 to an index */
 {
-    xs *list       = object_user_cache_list(snac, "followers", XS_ALL, 0);
-    xs_list *fwers = xs_list_new();
-    char *p;
-    const char *v;
+    int status = HTTP_STATUS_CREATED;
+    char rec[INDEX_REC_SIZE];
+    FILE *f;
 
-    /* resolve the list of md5 to be a list of actors */
-    p = list;
-    while (xs_list_iter(&p, &v)) {
-        xs *a_obj = NULL;
+    /* never create an index nor write a garbage record */
+    if (!is_md5_hex(md5) || _xs_hex_dec(rec, md5, MD5_HEX_SIZE - 1) == NULL) {
+        srv_log(xs_fmt("index_add_md5: bad md5 %s %s", fn, md5));
+        return HTTP_STATUS_BAD_REQUEST;
+    }
 
-        if (valid_status(object_get_by_md5(v, &a_obj))) {
-            const char *actor = xs_dict_get(a_obj, "id");
+    pthread_mutex_lock(&data_mutex);
 
-            if (!xs_is_null(actor)) {
-                /* check if the actor is still cached */
-                xs *fn = xs_fmt("%s/followers/%s.json", snac->basedir, v);
+    if ((f = fopen(fn, "a+")) != NULL) {
+        char hdr[INDEX_HDR_SIZE];
+        int binary;
 
-                if (mtime(fn) > 0.0)
-                    fwers = xs_list_append(fwers, actor);
-            }
-        }
-    }
+        flock(fileno(f), LOCK_EX);
 
-    return fwers;
-}
+        /* ensure the position is at the end after getting the lock */
+        fseek(f, 0, SEEK_END);
 
+        if (ftell(f) == 0) {
+            /* new index: always binary */
+            index_header(hdr);
+            fwrite(hdr, sizeof(hdr), 1, f);
+            binary = 1;
+        }
+        else {
+            /* existing index: keep its format */
+            rewind(f);
+            binary = fread(hdr, sizeof(hdr), 1, f) &&
+                memcmp(hdr, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0;
+            fseek(f, 0, SEEK_END);
+        }
 
-/** pending followers **/
+        if (binary) {
+            struct stat st;
+            long pos = (ftell(f) - INDEX_HDR_SIZE) / INDEX_REC_SIZE;
 
-int pending_add(snac *user, const char *actor, const xs_dict *msg)
-/* stores the follow message for later confirmation */
-{
-    xs *dir = xs_fmt("%s/pending", user->basedir);
-    xs *md5 = xs_md5_hex(actor, strlen(actor));
-    xs *fn  = xs_fmt("%s/%s.json", dir, md5);
-    FILE *f;
+            fwrite(rec, sizeof(rec), 1, f);
 
-    mkdirx(dir);
+            if (fstat(fileno(f), &st) != -1)
+                _pos_map_append(fn, st.st_ino, pos, rec);
 
-    if ((f = fopen(fn, "w")) == NULL)
-        return -1;
+            fclose(f);
 
-    xs_json_dump(msg, 4, f);
-    fclose(f);
+            /* not under the index lock, as it may need to read it */
+            _index_filter_add(fn, rec, pos);
+        }
+        else {
+            fprintf(f, "%s\n", md5);
+            fclose(f);
+        }
+    }
+    else
+        status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
 
-    return 0;
+    pthread_mutex_unlock(&data_mutex);
+
+    return status;
 }
 
 
-int pending_check(snac *user, const char *actor)
-/* checks if there is a pending follow confirmation for the actor */
+int index_add(const char *fn, const char *id)
+/* adds an id to an index */
 {
-    xs *md5 = xs_md5_hex(actor, strlen(actor));
-    xs *fn = xs_fmt("%s/pending/%s.json", user->basedir, md5);
-
-    return mtime(fn) != 0;
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return index_add_md5(fn, md5);
 }
 
 
-xs_dict *pending_get(snac *user, const char *actor)
-/* returns the pending follow confirmation for the actor */
+int index_del_md5(const char *fn, const char *md5)
+/* deletes an md5 from an index */
 {
-    xs *md5 = xs_md5_hex(actor, strlen(actor));
-    xs *fn = xs_fmt("%s/pending/%s.json", user->basedir, md5);
-    xs_dict *msg = NULL;
-    FILE *f;
+    int status = HTTP_STATUS_NOT_FOUND;
+    t_index idx;
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        msg = xs_json_load(f);
-        fclose(f);
+    pthread_mutex_lock(&data_mutex);
+
+    if (index_open(&idx, fn)) {
+        long n = _index_find(&idx, md5);
+
+        if (n >= 0) {
+            int fd;
+
+            /* found! overwrite it with garbage in place
+               and an eventual call to index_gc() will clean it
+               [yes: this breaks index_len()] */
+            if ((fd = open(fn, O_WRONLY)) != -1) {
+                off_t off = idx.hdr_size + n * idx.rec_size;
+                int ok;
+
+                if (idx.binary)
+                    ok = pwrite(fd, index_deleted_rec, INDEX_REC_SIZE, off) == INDEX_REC_SIZE;
+                else
+                    ok = pwrite(fd, "-", 1, off) == 1;
+
+                if (ok)
+                    status = HTTP_STATUS_OK;
+                else {
+                    srv_log(xs_fmt("index_del_md5: cannot write %s (errno: %d)", fn, errno));
+                    status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+                }
+
+                close(fd);
+            }
+            else
+                status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+        }
+
+        index_close(&idx);
     }
+    else
+        status = HTTP_STATUS_GONE;
 
-    return msg;
+    pthread_mutex_unlock(&data_mutex);
+
+    return status;
 }
 
 
-void pending_del(snac *user, const char *actor)
-/* deletes a pending follow confirmation for the actor */
+int index_del(const char *fn, const char *id)
+/* deletes an id from an index */
 {
-    xs *md5 = xs_md5_hex(actor, strlen(actor));
-    xs *fn = xs_fmt("%s/pending/%s.json", user->basedir, md5);
-
-    unlink(fn);
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return index_del_md5(fn, md5);
 }
 
 
-xs_list *pending_list(snac *user)
-/* returns a list of pending follow confirmations */
+int index_gc(const char *fn)
+/* garbage-collects an index, deleting objects that are not here */
 {
-    xs *spec = xs_fmt("%s/pending/""*.json", user->basedir);
-    xs *l = xs_glob(spec, 0, 0);
-    xs_list *r = xs_list_new();
-    const char *v;
+    t_index idx;
+    FILE *o;
+    int gc = -1;
 
-    xs_list_foreach(l, v) {
-        FILE *f;
-        xs *msg = NULL;
+    pthread_mutex_lock(&data_mutex);
 
-        if ((f = fopen(v, "r")) == NULL)
-            continue;
+    if (index_open(&idx, fn)) {
+        xs *nfn = xs_fmt("%s.new", fn);
 
-        msg = xs_json_load(f);
-        fclose(f);
+        if ((o = fopen(nfn, "w")) != NULL) {
+            char md5[MD5_HEX_SIZE];
+            long n;
 
-        if (msg == NULL)
-            continue;
+            gc = 0;
 
-        const char *actor = xs_dict_get(msg, "actor");
+            /* keep the format of the original */
+            if (idx.binary) {
+                char hdr[INDEX_HDR_SIZE];
 
-        if (xs_type(actor) == XSTYPE_STRING)
-            r = xs_list_append(r, actor);
-    }
+                index_header(hdr);
+                fwrite(hdr, sizeof(hdr), 1, o);
+            }
 
-    return r;
-}
+            for (n = 0; n < idx.n_recs; n++) {
+                if (_index_rec(&idx, n, md5) && object_here_by_md5(md5)) {
+                    if (idx.binary)
+                        fwrite(_index_rec_ptr(&idx, n), INDEX_REC_SIZE, 1, o);
+                    else
+                        fprintf(o, "%s\n", md5);
+                }
+                else
+                    gc++;
+            }
 
+            fclose(o);
 
-/** timeline **/
+            xs *ofn = xs_fmt("%s.bak", fn);
 
-double timeline_mtime(snac *snac)
-{
-    xs *fn = xs_fmt("%s/private.idx", snac->basedir);
-    return mtime(fn);
-}
+            unlink(ofn);
+            link(fn, ofn);
+            rename(nfn, fn);
 
+            _pos_map_forget(fn);
+            _index_filter_build(fn);
+        }
 
-int timeline_touch(snac *snac)
-/* changes the date of the timeline index */
-{
-    xs *fn = xs_fmt("%s/private.idx", snac->basedir);
-    return utimes(fn, NULL);
+        index_close(&idx);
+    }
+
+    pthread_mutex_unlock(&data_mutex);
+
+    return gc;
 }
 
 
-xs_str *timeline_fn_by_md5(snac *snac, const char *md5)
-/* get the filename of an entry by md5 from any timeline */
+int index_in_md5(const char *fn, const char *md5)
+/* checks if the md5 is already in the index */
 {
-    xs_str *fn = NULL;
+    t_index idx;
+    int ret = 0;
+    int flt = _index_filter_check(fn, md5);
 
-    if (is_md5_hex(md5)) {
-        fn = xs_fmt("%s/private/%s.json", snac->basedir, md5);
+    if (flt == 0) {
+        if (p_state != NULL)
+            __atomic_fetch_add(&p_state->idx_filter_skip, 1, __ATOMIC_RELAXED);
 
-        if (mtime(fn) == 0.0) {
-            fn = xs_free(fn);
-            fn = xs_fmt("%s/public/%s.json", snac->basedir, md5);
+        return 0;
+    }
 
-            if (mtime(fn) == 0.0)
-                fn = xs_free(fn);
-        }
+    if (index_open(&idx, fn)) {
+        /* big ones are looked up in their position maps */
+        if (idx.n_recs >= INDEX_FILTER_MIN)
+            ret = _index_pos(&idx, md5) != -1;
+        else
+            ret = _index_find(&idx, md5) != -1;
+
+        index_close(&idx);
     }
 
-    return fn;
+    if (flt == 1 && p_state != NULL) {
+        if (ret)
+            __atomic_fetch_add(&p_state->idx_filter_true, 1, __ATOMIC_RELAXED);
+        else
+            __atomic_fetch_add(&p_state->idx_filter_false, 1, __ATOMIC_RELAXED);
+    }
+
+    return ret;
 }
 
 
-int timeline_here(snac *snac, const char *md5)
-/* checks if an object is in the user cache */
+int index_in(const char *fn, const char *id)
+/* checks if the object id is already in the index */
 {
-    xs *fn = timeline_fn_by_md5(snac, md5);
-
-    return !(fn == NULL);
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return index_in_md5(fn, md5);
 }
 
 
-int timeline_get_by_md5(snac *snac, const char *md5, xs_dict **msg)
-/* gets a message from the timeline */
+int index_first(const char *fn, char md5[MD5_HEX_SIZE])
+/* reads the first entry of an index */
 {
-    int status = HTTP_STATUS_NOT_FOUND;
-    FILE *f    = NULL;
-
-    xs *fn = timeline_fn_by_md5(snac, md5);
+    t_index idx;
+    int ret = 0;
 
-    if (fn != NULL && (f = fopen(fn, "r")) != NULL) {
-        *msg = xs_json_load(f);
-        fclose(f);
+    if (index_open(&idx, fn)) {
+        if (idx.n_recs > 0) {
+            _index_rec(&idx, 0, md5);
+            ret = 1;
+        }
 
-        if (*msg != NULL)
-            status = HTTP_STATUS_OK;
+        index_close(&idx);
     }
 
-    return status;
+    return ret;
 }
 
 
-int timeline_del(snac *snac, const char *id)
-/* deletes a message from the timeline */
+int index_len(const char *fn)
+/* returns the number of elements in an index */
 {
-    /* delete from the user's caches */
-    object_user_cache_del(snac, id, "public");
-    object_user_cache_del(snac, id, "private");
+    t_index idx;
+    int len = 0;
 
-    unpin(snac, id);
-    unbookmark(snac, id);
+    if (index_open(&idx, fn)) {
+        len = idx.n_recs;
+        index_close(&idx);
+    }
 
-    /* try to delete the object if it's not used elsewhere */
-    return object_del_if_unref(id);
+    return len;
 }
 
 
-void timeline_update_indexes(snac *snac, const char *id)
-/* updates the indexes */
+xs_list *index_list(const char *fn, int max)
+/* returns an index as a list */
 {
-    object_user_cache_add(snac, id, "private");
+    xs_list *list = xs_list_new();
+    t_index idx;
+    int n = 0;
 
-    if (xs_startswith(id, snac->actor)) {
-        xs *msg = NULL;
+    if (index_open(&idx, fn)) {
+        char md5[MD5_HEX_SIZE];
 
-        if (valid_status(object_get(id, &msg))) {
-            /* if its ours and is public, also store in public */
-            if (is_msg_public(msg)) {
-                if (object_user_cache_add(snac, id, "public") >= 0) {
-                    /* also add it to the instance public timeline */
-                    xs *ipt = xs_fmt("%s/public.idx", srv_basedir);
-                    index_add(ipt, id);
-                }
-                else
-                    srv_debug(1, xs_fmt("Not added to public instance index %s", id));
-            }
+        while (n < max && index_asc_next(&idx, md5)) {
+            list = xs_list_append(list, md5);
+            n++;
         }
+
+        index_close(&idx);
     }
+
+    return list;
 }
 
 
-int timeline_add(snac *snac, const char *id, const xs_dict *o_msg)
-/* adds a message to the timeline */
+int index_desc_next(t_index *idx, char md5[MD5_HEX_SIZE])
+/* reads the next entry of a desc index */
 {
-    int ret = object_add(id, o_msg);
-    timeline_update_indexes(snac, id);
-
-    tag_index(id, o_msg);
-
-    list_distribute(snac, NULL, o_msg);
+    while (idx->pos > 0) {
+        idx->pos--;
 
-    snac_debug(snac, 1, xs_fmt("timeline_add %s", id));
+        if (_index_rec(idx, idx->pos, md5))
+            return 1;
+    }
 
-    return ret;
+    return 0;
 }
 
 
-int timeline_admire(snac *snac, const char *id, const char *admirer, int like)
-/* updates a timeline entry with a new admiration */
+int index_desc_first(t_index *idx, char md5[MD5_HEX_SIZE], int skip)
+/* reads the first entry of a desc index */
 {
-    /* if we are admiring this, add to both timelines */
-    if (!like && strcmp(admirer, snac->actor) == 0) {
-        object_user_cache_add(snac, id, "public");
-        object_user_cache_add(snac, id, "private");
+    idx->pos = idx->n_recs - skip - 1;
+
+    if (idx->pos < 0) {
+        idx->pos = 0;
+        return 0;
     }
 
-    int ret = object_admire(id, admirer, like);
+    /* deleted? retry next */
+    if (!_index_rec(idx, idx->pos, md5))
+        return index_desc_next(idx, md5);
 
-    snac_debug(snac, 1, xs_fmt("timeline_admire (%s) %s %s",
-            like ? "Like" : "Announce", id, admirer));
+    return 1;
+}
 
-    return ret;
+
+int index_asc_first(t_index *idx, char md5[MD5_HEX_SIZE], const char *seek_md5)
+/* reads the first entry of an ascending index, starting from a given md5 */
+{
+    if (!index_seek(idx, seek_md5)) {
+        idx->pos = idx->n_recs;
+        return 0;
+    }
+
+    return index_asc_next(idx, md5);
 }
 
 
-xs_list *timeline_top_level(snac *snac, const xs_list *list)
-/* returns the top level md5 entries from this index */
+int index_asc_next(t_index *idx, char md5[MD5_HEX_SIZE])
+/* reads the next entry of an ascending index */
 {
-    xs_set seen;
-    const xs_str *v;
+    while (idx->pos + 1 < idx->n_recs) {
+        idx->pos++;
 
-    xs_set_init(&seen);
+        if (_index_rec(idx, idx->pos, md5))
+            return 1;
+    }
 
-    int c = 0;
-    while (xs_list_next(list, &v, &c)) {
-        char line[MD5_HEX_SIZE] = "";
+    return 0;
+}
 
-        strncpy(line, v, sizeof(line));
 
-        for (;;) {
-            char line2[MD5_HEX_SIZE];
+xs_list *index_list_desc(const char *fn, int skip, int show)
+/* returns an index as a list, in reverse order */
+{
+    xs_list *list = xs_list_new();
+    t_index idx;
 
-            /* if it doesn't have a parent, use this */
-            if (!object_parent(line, line2))
-                break;
+    if (index_open(&idx, fn)) {
+        char md5[MD5_HEX_SIZE];
 
-            /* well, there is a parent... but is it here? */
-            if (!timeline_here(snac, line2))
-                break;
+        if (index_desc_first(&idx, md5, skip)) {
+            int n = 1;
 
-            /* it's here! try again with its own parent */
-            strncpy(line, line2, sizeof(line));
+            do {
+                list = xs_list_append(list, md5);
+            } while (n++ < show && index_desc_next(&idx, md5));
         }
 
-        xs_set_add(&seen, line);
+        index_close(&idx);
     }
 
-    return xs_set_result(&seen);
+    return list;
 }
 
 
-xs_str *user_index_fn(snac *user, const char *idx_name)
-/* returns the filename of a user index */
-{
-    return xs_fmt("%s/%s.idx", user->basedir, idx_name);
+/** segmented object store **/
+
+/* When the "object_store" server.json setting is "segments", objects
+   and their side indexes (children, likes, announces and parent) are
+   not stored as files in object/xx/ but as records appended to the
+   segment files in object/seg/. Each process keeps a hash table from
+   (md5, kind) to the newest record, loaded from a snapshot and then
+   completed by scanning what was appended after it; the snapshot is
+   saved again each time a sizeable amount has been scanned. Superseded
+   and deleted records are reclaimed by object_store_compact(), that
+   also bumps a generation counter so other processes reload their
+   tables. Writers hold a shared lock on object/seg/lock and an
+   exclusive lock on the segment they append to; the compactor holds
+   an exclusive lock on object/seg/lock.
+   Additions to and deletions from side indexes are appended as small
+   delta records, each one pointing to the previous one, after the last
+   full record of the index; the full record is written again once the
+   deltas outnumber its md5s, or when a segment holding any of them is
+   compacted */
+
+#define STORE_SEG_MAX (64 * 1024 * 1024)  /* segment rollover size */
+#define STORE_SNAP_MIN (16 * 1024 * 1024) /* bytes scanned between snapshots */
+#define STORE_DELTA_MIN 64                /* side index deltas always allowed */
+#define STORE_REC_MAGIC "SOR1"
+#define STORE_SNAP_MAGIC "SNACSNP2"
+
+typedef struct {
+    char magic[4];              /* STORE_REC_MAGIC */
+    char kind;                  /* 'o' (object) or side index ('c', 'l', 'a', 'p') */
+    char op;                    /* 'P' (put), 'D' (delete), 'T' (touch),
+                                   'A' or 'R' (side index add or remove) */
+    char pad[2];
+    char key[INDEX_REC_SIZE];   /* raw md5 */
+    uint32_t size;              /* payload size */
+    uint32_t sum;               /* payload checksum */
+    int64_t mtime;              /* modification time */
+} t_store_rec;
+
+typedef struct {
+    char key[INDEX_REC_SIZE];   /* the md5 added or removed */
+    uint32_t seg;               /* previous delta record (0, none) */
+    uint32_t pad;
+    uint64_t off;
+} t_store_delta;
+
+typedef struct {
+    char key[INDEX_REC_SIZE];   /* raw md5 */
+    char kind;                  /* record kind (0, empty slot) */
+    char dead;                  /* deleted */
+    uint32_t seg;               /* segment number (0, no full record) */
+    uint64_t off;               /* record offset */
+    uint32_t size;              /* payload size */
+    int64_t mtime;              /* modification time */
+    uint32_t t_seg;             /* segment of the last touch record (0, none) */
+    uint32_t count;             /* side index: number of md5s */
+    uint32_t d_cnt;             /* side index: deltas after the full record */
+    uint32_t d_min;             /* side index: segment of the first delta */
+    uint32_t d_seg;             /* side index: segment of the last delta */
+    uint64_t d_off;             /* side index: offset of the last delta */
+} t_store_ent;
+
+typedef struct {
+    uint32_t num;               /* segment number */
+    int fd;                     /* file descriptor */
+    uint64_t scanned;           /* bytes applied to the table */
+    uint64_t live;              /* bytes in live records */
+    int sealed;                 /* no appends (corrupted tail) */
+} t_store_seg;
+
+static xs_str *store_dir         = NULL;
+static t_store_ent *store_ents   = NULL;
+static long store_n_slots        = 0;
+static long store_n_used         = 0;
+static t_store_seg *store_segs   = NULL;
+static int store_n_segs          = 0;
+static long store_gen            = 0;
+static time_t store_refreshed    = 0;
+static uint64_t store_snap_bytes = 0;
+
+
+int object_store_is_seg(void)
+/* returns true if objects are stored in segments */
+{
+    const char *v = xs_dict_get(srv_config, "object_store");
+    return xs_type(v) == XSTYPE_STRING && strcmp(v, "segments") == 0;
+}
+
+
+int object_store_ready(void)
+/* returns true if the objects have already been moved to the segments */
+{
+    xs *fn = xs_fmt("%s/object/seg/ready", srv_basedir);
+    return mtime(fn) > 0.0;
 }
 
 
-xs_list *timeline_simple_list(snac *user, const char *idx_name, int skip, int show, int *more)
-/* returns a timeline (with all entries) */
+static uint32_t _store_sum(const char *data, uint32_t size)
+/* FNV-1a checksum */
 {
-    xs *idx = user_index_fn(user, idx_name);
-
-    /* if a more flag is sent, request one more */
-    xs_list *lst = index_list_desc(idx, skip, show + (more != NULL ? 1 : 0));
+    uint32_t h = 2166136261u;
+    uint32_t n;
 
-    if (more != NULL) {
-        if (xs_list_len(lst) > show) {
-            *more = 1;
-            lst = xs_list_del(lst, -1);
-        }
-        else
-            *more = 0;
+    for (n = 0; n < size; n++) {
+        h ^= (unsigned char)data[n];
+        h *= 16777619u;
     }
 
-    return lst;
+    return h;
 }
 
 
-xs_list *timeline_list(snac *snac, const char *idx_name, int skip, int show, int *more)
-/* returns a timeline (only top level entries) */
+static xs_str *_store_seg_fn(uint32_t num)
 {
-    int c_max;
+    return xs_fmt("%s/%08x.seg", store_dir, num);
+}
 
-    /* maximum number of items in the timeline */
-    c_max = xs_number_get(xs_dict_get(srv_config, "max_timeline_entries"));
 
-    /* never more timeline entries than the configured maximum */
-    if (show > c_max)
-        show = c_max;
+static t_store_ent *_store_slot(t_store_ent *ents, long n_slots, const char *key, char kind)
+/* returns the slot for a key (either holding it or empty) */
+{
+    uint64_t h;
 
-    xs *list = timeline_simple_list(snac, idx_name, skip, show, more);
+    memcpy(&h, key, sizeof(h));
+    h ^= (uint64_t)kind * 0x9e3779b97f4a7c15ULL;
 
-    return timeline_top_level(snac, list);
+    for (h &= n_slots - 1;; h = (h + 1) & (n_slots - 1)) {
+        t_store_ent *e = &ents[h];
+
+        if (e->kind == 0 || (e->kind == kind && memcmp(e->key, key, INDEX_REC_SIZE) == 0))
+            return e;
+    }
 }
 
 
-void timeline_add_mark(snac *user)
-/* adds an "already seen" mark to the private timeline */
+static t_store_ent *_store_ent(const char *key, char kind, int create)
+/* finds (and optionally creates) a table entry */
 {
-    xs *fn = xs_fmt("%s/private.idx", user->basedir);
-    char last_entry[MD5_HEX_SIZE] = "";
-    FILE *f;
+    if (create && (store_n_used + 1) * 2 > store_n_slots) {
+        /* grow */
+        long n_slots = store_n_slots ? store_n_slots * 2 : 4096;
+        t_store_ent *ents = xs_realloc(NULL, n_slots * sizeof(t_store_ent));
+        long n;
 
-    /* get the last entry in the index */
-    if ((f = fopen(fn, "r")) != NULL) {
-        index_desc_first(f, last_entry, 0);
-        fclose(f);
-    }
+        memset(ents, '\0', n_slots * sizeof(t_store_ent));
 
-    /* is the last entry *not* a mark? */
-    if (strcmp(last_entry, MD5_ALREADY_SEEN_MARK) != 0) {
-        /* add it */
-        index_add_md5(fn, MD5_ALREADY_SEEN_MARK);
+        for (n = 0; n < store_n_slots; n++) {
+            if (store_ents[n].kind)
+                *_store_slot(ents, n_slots, store_ents[n].key, store_ents[n].kind) = store_ents[n];
+        }
+
+        xs_free(store_ents);
+        store_ents    = ents;
+        store_n_slots = n_slots;
+    }
+
+    if (store_n_slots == 0)
+        return NULL;
+
+    t_store_ent *e = _store_slot(store_ents, store_n_slots, key, kind);
+
+    if (e->kind == 0) {
+        if (!create)
+            return NULL;
+
+        memcpy(e->key, key, INDEX_REC_SIZE);
+        e->kind = kind;
+        e->dead = 1;
+        store_n_used++;
     }
+
+    return e;
 }
 
 
-xs_str *instance_index_fn(void)
+static t_store_seg *_store_seg(uint32_t num)
+/* returns a segment by number */
 {
-    return xs_fmt("%s/public.idx", srv_basedir);
+    int n;
+
+    for (n = 0; n < store_n_segs; n++) {
+        if (store_segs[n].num == num)
+            return &store_segs[n];
+    }
+
+    return NULL;
 }
 
 
-xs_list *timeline_instance_list(int skip, int show)
-/* returns the timeline for the full instance */
+static t_store_seg *_store_seg_open(uint32_t num, int create)
+/* opens a segment and adds it to the (ordered) list */
 {
-    xs *idx = instance_index_fn();
-    xs *lst = index_list_desc(idx, skip, show);
+    t_store_seg *s;
+    xs *fn = _store_seg_fn(num);
+    int fd, n;
 
-    /* make the list unique */
-    xs_set rep;
-    xs_set_init(&rep);
-    const char *md5;
+    if ((s = _store_seg(num)) != NULL)
+        return s;
 
-    xs_list_foreach(lst, md5)
-        xs_set_add(&rep, md5);
+    if ((fd = open(fn, O_RDWR | O_APPEND | (create ? O_CREAT : 0), 0660)) == -1)
+        return NULL;
 
-    return xs_set_result(&rep);
-}
+    store_segs = xs_realloc(store_segs, (store_n_segs + 1) * sizeof(t_store_seg));
 
+    for (n = store_n_segs; n > 0 && store_segs[n - 1].num > num; n--)
+        store_segs[n] = store_segs[n - 1];
 
-/** following **/
+    s = &store_segs[n];
+    memset(s, '\0', sizeof(*s));
+    s->num = num;
+    s->fd  = fd;
 
-/* this needs special treatment and cannot use the object db as is,
-   with a link to a cached author, because we need the Follow object
-   in case we need to unfollow (Undo + original Follow) */
+    store_n_segs++;
 
-xs_str *_following_fn(snac *snac, const char *actor)
+    return s;
+}
+
+
+static void _store_seg_close(uint32_t num)
+/* closes a segment and removes it from the list */
 {
-    xs *md5 = xs_md5_hex(actor, strlen(actor));
-    return xs_fmt("%s/following/%s.json", snac->basedir, md5);
+    int n;
+
+    for (n = 0; n < store_n_segs; n++) {
+        if (store_segs[n].num == num) {
+            close(store_segs[n].fd);
+            store_n_segs--;
+            memmove(&store_segs[n], &store_segs[n + 1], (store_n_segs - n) * sizeof(t_store_seg));
+            break;
+        }
+    }
 }
 
 
-int following_add(snac *snac, const char *actor, const xs_dict *msg)
-/* adds to the following list */
+static void _store_apply(const t_store_rec *r, uint32_t seg, uint64_t off)
+/* applies a record to the table */
 {
-    int ret = HTTP_STATUS_CREATED;
-    xs *fn = _following_fn(snac, actor);
-    FILE *f;
-    xs *p_object = NULL;
+    t_store_seg *s;
+    t_store_ent *e;
 
-    if (valid_status(following_get(snac, actor, &p_object))) {
-        /* object already exists; if it's of type Accept,
-           the actor is already being followed and confirmed,
-           so do nothing */
-        const char *type = xs_dict_get(p_object, "type");
+    store_snap_bytes += sizeof(t_store_rec) + r->size;
 
-        if (!xs_is_null(type) && strcmp(type, "Accept") == 0) {
-            snac_debug(snac, 1, xs_fmt("following_add actor already confirmed %s", actor));
-            return HTTP_STATUS_OK;
+    if (r->op == 'T') {
+        if ((e = _store_ent(r->key, r->kind, 0)) != NULL && !e->dead) {
+            e->mtime = r->mtime;
+            e->t_seg = seg;
         }
+
+        return;
     }
 
-    if ((f = fopen(fn, "w")) != NULL) {
-        xs_json_dump(msg, 4, f);
-        fclose(f);
+    e = _store_ent(r->key, r->kind, 1);
+
+    if (r->op == 'A' || r->op == 'R') {
+        /* side index delta (not counted as live, so the segments
+           holding them are compacted and the deltas folded) */
+        if (e->dead) {
+            /* no full record */
+            e->seg   = 0;
+            e->off   = 0;
+            e->size  = 0;
+            e->count = 0;
+            e->d_cnt = 0;
+            e->t_seg = 0;
+            e->dead  = 0;
+        }
+
+        if (e->d_cnt++ == 0)
+            e->d_min = seg;
+
+        e->d_seg = seg;
+        e->d_off = off;
+        e->mtime = r->mtime;
 
-        /* get the filename of the actor object */
-        xs *actor_fn = _object_fn(actor);
+        if (r->op == 'A')
+            e->count++;
+        else
+        if (e->count)
+            e->count--;
 
-        /* increase its reference count */
-        fn = xs_replace_i(fn, ".json", "_a.json");
-        link(actor_fn, fn);
+        return;
     }
-    else
-        ret = HTTP_STATUS_INTERNAL_SERVER_ERROR;
 
-    snac_debug(snac, 2, xs_fmt("following_add %s %s", actor, fn));
+    /* the previous record is now garbage */
+    if (!e->dead && (s = _store_seg(e->seg)) != NULL)
+        s->live -= sizeof(t_store_rec) + e->size;
 
-    return ret;
+    e->seg   = seg;
+    e->off   = off;
+    e->size  = r->size;
+    e->mtime = r->mtime;
+    e->dead  = r->op == 'D';
+    e->count = r->size / INDEX_REC_SIZE;
+    e->t_seg = 0;
+    e->d_cnt = 0;
+    e->d_min = e->d_seg = 0;
+    e->d_off = 0;
+
+    if (!e->dead && (s = _store_seg(seg)) != NULL)
+        s->live += sizeof(t_store_rec) + r->size;
 }
 
 
-int following_del(snac *snac, const char *actor)
-/* we're not following this actor any longer */
+static void _store_scan(t_store_seg *s, uint64_t upto)
+/* applies the records of a segment up to a size */
 {
-    xs *fn = _following_fn(snac, actor);
-
-    snac_debug(snac, 2, xs_fmt("following_del %s %s", actor, fn));
+    while (s->scanned < upto) {
+        t_store_rec r;
 
-    unlink(fn);
+        if (s->scanned + sizeof(r) > upto ||
+            pread(s->fd, &r, sizeof(r), s->scanned) != sizeof(r) ||
+            memcmp(r.magic, STORE_REC_MAGIC, sizeof(r.magic)) != 0 ||
+            s->scanned + sizeof(r) + r.size > upto) {
+            if (!s->sealed)
+                srv_log(xs_fmt("object store: bad record in segment %08x at %lu",
+                        s->num, (unsigned long)s->scanned));
 
-    /* also delete the reference to the author */
-    fn = xs_replace_i(fn, ".json", "_a.json");
-    unlink(fn);
+            s->sealed = 1;
+            break;
+        }
 
-    return HTTP_STATUS_OK;
+        _store_apply(&r, s->num, s->scanned);
+        s->scanned += sizeof(r) + r.size;
+    }
 }
 
 
-int following_check(snac *snac, const char *actor)
-/* checks if we are following this actor */
+static uint64_t _store_seg_size(t_store_seg *s)
+/* returns the size of a segment once no one is writing to it */
 {
-    xs *fn = _following_fn(snac, actor);
+    struct stat st;
 
-    return !!(mtime(fn) != 0.0);
+    flock(s->fd, LOCK_SH);
+    int r = fstat(s->fd, &st);
+    flock(s->fd, LOCK_UN);
+
+    return r == -1 ? 0 : (uint64_t)st.st_size;
 }
 
 
-int following_get(snac *snac, const char *actor, xs_dict **data)
-/* returns the 'Follow' object */
+static long _store_gen_read(void)
+/* returns the generation (the inode of the gen file, replaced on each compaction) */
 {
-    xs *fn = _following_fn(snac, actor);
-    FILE *f;
-    int status = HTTP_STATUS_OK;
+    xs *fn = xs_fmt("%s/gen", store_dir);
+    struct stat st;
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        *data = xs_json_load(f);
-        fclose(f);
-    }
-    else
-        status = HTTP_STATUS_NOT_FOUND;
+    return stat(fn, &st) == -1 ? 0 : (long)st.st_ino;
+}
 
-    return status;
+
+static void _store_reset(void)
+/* empties the table and closes all segments */
+{
+    while (store_n_segs)
+        _store_seg_close(store_segs[0].num);
+
+    store_ents    = xs_free(store_ents);
+    store_n_slots = 0;
+    store_n_used  = 0;
 }
 
 
-xs_list *following_list(snac *snac)
-/* returns the list of people being followed */
+static int _store_snap_load(void)
+/* loads the table snapshot */
 {
-    xs *spec = xs_fmt("%s/following/" "*.json", snac->basedir);
-    xs *glist = xs_glob(spec, 0, 0);
-    xs_list *p;
-    const xs_str *v;
-    xs_list *list = xs_list_new();
+    xs *fn = xs_fmt("%s/snapshot", store_dir);
+    char magic[8];
+    uint32_t n_segs, n;
+    uint64_t n_ents;
+    int ok = 0;
+    FILE *f;
 
-    /* iterate the list of files */
-    p = glist;
-    while (xs_list_iter(&p, &v)) {
-        FILE *f;
+    if ((f = fopen(fn, "r")) == NULL)
+        return 0;
 
-        /* load the follower data */
-        if ((f = fopen(v, "r")) != NULL) {
-            xs *o = xs_json_load(f);
-            fclose(f);
+    if (fread(magic, sizeof(magic), 1, f) && memcmp(magic, STORE_SNAP_MAGIC, sizeof(magic)) == 0 &&
+        fread(&n_segs, sizeof(n_segs), 1, f)) {
+        ok = 1;
 
-            if (o != NULL) {
-                const char *type = xs_dict_get(o, "type");
+        for (n = 0; ok && n < n_segs; n++) {
+            t_store_seg ss, *s;
 
-                if (!xs_is_null(type) && strcmp(type, "Accept") == 0) {
-                    const char *actor = xs_dict_get(o, "actor");
+            if (!fread(&ss, sizeof(ss), 1, f) || (s = _store_seg_open(ss.num, 0)) == NULL ||
+                _store_seg_size(s) < ss.scanned)
+                ok = 0;
+            else {
+                s->scanned = ss.scanned;
+                s->live    = ss.live;
+                s->sealed  = ss.sealed;
+            }
+        }
 
-                    if (!xs_is_null(actor)) {
-                        list = xs_list_append(list, actor);
+        if (ok && fread(&n_ents, sizeof(n_ents), 1, f)) {
+            long n_slots = 4096;
 
-                        /* check if there is a link to the actor object */
-                        xs *v2 = xs_replace(v, ".json", "_a.json");
+            while ((uint64_t)n_slots < n_ents * 2 + 2)
+                n_slots *= 2;
 
-                        if (mtime(v2) == 0.0) {
-                            /* no; add a link to it */
-                            xs *actor_fn = _object_fn(actor);
-                            link(actor_fn, v2);
-                        }
-                    }
+            store_ents    = xs_realloc(NULL, n_slots * sizeof(t_store_ent));
+            store_n_slots = n_slots;
+            memset(store_ents, '\0', n_slots * sizeof(t_store_ent));
+
+            while (ok && n_ents--) {
+                t_store_ent e;
+
+                if (fread(&e, sizeof(e), 1, f) && e.kind) {
+                    *_store_slot(store_ents, store_n_slots, e.key, e.kind) = e;
+                    store_n_used++;
                 }
+                else
+                    ok = 0;
             }
         }
+        else
+            ok = 0;
     }
 
-    return list;
-}
+    fclose(f);
 
+    if (!ok) {
+        srv_log(xs_fmt("object store: ignoring stale snapshot %s", fn));
+        _store_reset();
+    }
 
-xs_str *_muted_fn(snac *snac, const char *actor)
-{
-    xs *md5 = xs_md5_hex(actor, strlen(actor));
-    return xs_fmt("%s/muted/%s", snac->basedir, md5);
+    return ok;
 }
 
 
-void mute(snac *snac, const char *actor)
-/* mutes a moron */
+static void _store_snap_save(void)
+/* saves the table snapshot */
 {
-    xs *fn = _muted_fn(snac, actor);
+    xs *fn  = xs_fmt("%s/snapshot", store_dir);
+    xs *tfn = xs_fmt("%s.%d.tmp", fn, (int)getpid());
+    uint32_t n_segs = store_n_segs;
+    uint64_t n_ents = store_n_used;
+    long n;
     FILE *f;
 
-    if ((f = fopen(fn, "w")) != NULL) {
-        fprintf(f, "%s\n", actor);
-        fclose(f);
+    if ((f = fopen(tfn, "w")) == NULL)
+        return;
 
-        snac_debug(snac, 2, xs_fmt("muted %s %s", actor, fn));
+    fwrite(STORE_SNAP_MAGIC, 8, 1, f);
+    fwrite(&n_segs, sizeof(n_segs), 1, f);
+    fwrite(store_segs, sizeof(t_store_seg), n_segs, f);
+    fwrite(&n_ents, sizeof(n_ents), 1, f);
+
+    for (n = 0; n < store_n_slots; n++) {
+        if (store_ents[n].kind)
+            fwrite(&store_ents[n], sizeof(t_store_ent), 1, f);
     }
+
+    if (fclose(f) == EOF || rename(tfn, fn) == -1)
+        unlink(tfn);
+
+    store_snap_bytes = 0;
 }
 
 
-void unmute(snac *snac, const char *actor)
-/* actor is no longer a moron */
+static void _store_snap_maybe(void)
+/* saves the table snapshot if enough has been scanned since the last one */
 {
-    xs *fn = _muted_fn(snac, actor);
+    uint64_t min = (uint64_t)store_n_used * sizeof(t_store_ent);
 
-    unlink(fn);
+    if (min < STORE_SNAP_MIN)
+        min = STORE_SNAP_MIN;
 
-    snac_debug(snac, 2, xs_fmt("unmuted %s %s", actor, fn));
+    if (store_snap_bytes > min)
+        _store_snap_save();
 }
 
 
-int is_muted(snac *snac, const char *actor)
-/* check if someone is muted */
+static void _store_load(void)
+/* (re)loads the table */
 {
-    xs *fn = _muted_fn(snac, actor);
+    _store_reset();
 
-    return !!(mtime(fn) != 0.0);
-}
+    store_snap_bytes = 0;
 
+    store_gen = _store_gen_read();
 
-xs_list *muted_list(snac *user)
-/* returns the list (actor URLs) of the muted morons */
-{
-    xs_list *l = xs_list_new();
-    xs *spec = xs_fmt("%s/muted/" "*", user->basedir);
-    xs *files = xs_glob(spec, 0, 0);
-    const char *fn;
+    xs *spec = xs_fmt("%s/" "*.seg", store_dir);
+    xs *segs = xs_glob(spec, 1, 0);
+    const char *v;
 
-    xs_list_foreach(files, fn) {
-        FILE *f;
+    if (_store_snap_load() && store_n_segs) {
+        uint32_t max = store_segs[store_n_segs - 1].num;
 
-        if ((f = fopen(fn, "r")) != NULL) {
-            xs *actor = xs_strip_i(xs_readline(f));
-            fclose(f);
+        /* an older segment not in the snapshot would be scanned out of order */
+        xs_list_foreach(segs, v) {
+            uint32_t num = strtoul(v, NULL, 16);
 
-            l = xs_list_append(l, actor);
+            if (num < max && _store_seg(num) == NULL) {
+                srv_log(xs_fmt("object store: snapshot misses segment %08x", num));
+                _store_reset();
+                break;
+            }
         }
     }
 
-    return l;
-}
+    /* open all segments and scan what the snapshot does not cover */
+    xs_list_foreach(segs, v) {
+        t_store_seg *s = _store_seg_open(strtoul(v, NULL, 16), 0);
 
+        if (s != NULL)
+            _store_scan(s, _store_seg_size(s));
+    }
 
-/** bookmarking **/
+    store_refreshed = time(NULL);
 
-int is_bookmarked(snac *user, const char *id)
-/* returns true if this note is bookmarked */
-{
-    return object_user_cache_in(user, id, "bookmark");
+    _store_snap_maybe();
 }
 
 
-int bookmark(snac *user, const char *id)
-/* bookmarks a post */
+static void _store_refresh(int force)
+/* catches up with the changes made by other processes */
 {
-    if (is_bookmarked(user, id))
-        return -3;
+    int n;
 
-    return object_user_cache_add(user, id, "bookmark");
-}
+    if (!force && store_refreshed == time(NULL))
+        return;
 
+    if (_store_gen_read() != store_gen) {
+        /* compacted by someone else: start over */
+        _store_load();
+        return;
+    }
 
-int unbookmark(snac *user, const char *id)
-/* unbookmarks a post */
-{
-    return object_user_cache_del(user, id, "bookmark");
-}
+    /* only the last segment grows, until there is a newer one, so
+       nothing has changed if it's all scanned and there is no other */
+    uint32_t last = store_n_segs ? store_segs[store_n_segs - 1].num : 0;
+    xs *nfn = _store_seg_fn(last + 1);
+    struct stat st;
 
+    if ((last == 0 || (fstat(store_segs[store_n_segs - 1].fd, &st) == 0 &&
+        (uint64_t)st.st_size == store_segs[store_n_segs - 1].scanned)) && access(nfn, F_OK) == -1) {
+        store_refreshed = time(NULL);
+        return;
+    }
 
-xs_list *bookmark_list(snac *user)
-/* return the lists of bookmarked posts */
-{
-    return object_user_cache_list(user, "bookmark", XS_ALL, 1);
-}
+    for (n = 0; n < store_n_segs; n++)
+        _store_scan(&store_segs[n], _store_seg_size(&store_segs[n]));
 
+    /* new segments */
+    for (;;) {
+        t_store_seg *s = _store_seg_open(last + 1, 0);
 
-xs_str *bookmark_index_fn(snac *user)
-{
-    return object_user_cache_index_fn(user, "bookmark");
-}
+        if (s == NULL)
+            break;
 
+        _store_scan(s, _store_seg_size(s));
+        last++;
+    }
 
-/** pinning **/
+    store_refreshed = time(NULL);
 
-int is_pinned(snac *user, const char *id)
-/* returns true if this note is pinned */
-{
-    return object_user_cache_in(user, id, "pinned");
+    _store_snap_maybe();
 }
 
 
-int is_pinned_by_md5(snac *user, const char *md5)
+static int _store_init(void)
+/* initializes the store on first use (store_mutex must be locked) */
 {
-    return object_user_cache_in_by_md5(user, md5, "pinned");
+    if (store_dir == NULL) {
+        store_dir = xs_fmt("%s/object/seg", srv_basedir);
+        mkdirx(store_dir);
+
+        _store_load();
+    }
+
+    return 1;
 }
 
 
-int pin(snac *user, const char *id)
-/* pins a message */
+static int _store_lock(int op)
+/* locks the whole store (shared for writers, exclusive for compaction) */
 {
-    int ret = -2;
+    xs *fn = xs_fmt("%s/lock", store_dir);
+    int fd;
 
-    if (xs_startswith(id, user->actor)) {
-        if (is_pinned(user, id))
-            ret = -3;
-        else
-            ret = object_user_cache_add(user, id, "pinned");
-    }
+    if ((fd = open(fn, O_RDWR | O_CREAT, 0660)) != -1)
+        flock(fd, op);
 
-    return ret;
+    return fd;
 }
 
 
-int unpin(snac *user, const char *id)
-/* unpin a message */
+static t_store_seg *_store_active(uint64_t *size)
+/* returns the active segment, locked, with everything other writers
+   appended to it already applied, and its size (the store must be locked) */
 {
-    return object_user_cache_del(user, id, "pinned");
-}
+    for (;;) {
+        t_store_seg *s;
 
+        if (store_n_segs == 0) {
+            if ((s = _store_seg_open(1, 1)) == NULL)
+                return NULL;
+        }
+        else
+            s = &store_segs[store_n_segs - 1];
 
-xs_list *pinned_list(snac *user)
-/* return the lists of pinned posts */
-{
-    return object_user_cache_list(user, "pinned", XS_ALL, 1);
-}
+        flock(s->fd, LOCK_EX);
 
+        struct stat st;
+        uint32_t num = s->num;
 
-/** drafts **/
+        if (fstat(s->fd, &st) == -1) {
+            flock(s->fd, LOCK_UN);
+            return NULL;
+        }
 
-int is_draft(snac *user, const char *id)
-/* returns true if this note is a draft */
-{
-    return object_user_cache_in(user, id, "draft");
-}
+        /* catch up with other writers */
+        _store_scan(s, st.st_size);
 
+        /* was a newer segment created by someone else? */
+        xs *nfn = _store_seg_fn(num + 1);
+        int newer = access(nfn, F_OK) == 0;
 
-void draft_del(snac *user, const char *id)
-/* delete a message from the draft cache */
-{
-    object_user_cache_del(user, id, "draft");
-}
+        if (!newer && (s->sealed || st.st_size >= STORE_SEG_MAX)) {
+            /* roll over, while still holding the lock of the full one */
+            int fd = open(nfn, O_RDWR | O_CREAT, 0660);
 
+            if (fd != -1) {
+                close(fd);
+                newer = 1;
+            }
+        }
 
-void draft_add(snac *user, const char *id, const xs_dict *msg)
-/* store the message as a draft */
-{
-    /* delete from the index, in case it was already there */
-    draft_del(user, id);
+        if (newer) {
+            flock(s->fd, LOCK_UN);
 
-    /* overwrite object */
-    object_add_ow(id, msg);
+            if (_store_seg_open(num + 1, 0) == NULL)
+                return NULL;
 
-    /* [re]add to the index */
-    object_user_cache_add(user, id, "draft");
+            continue;
+        }
+
+        *size = st.st_size;
+
+        return s;
+    }
 }
 
 
-xs_list *draft_list(snac *user)
-/* return the lists of drafts */
+static int _store_put(t_store_seg *s, uint64_t at, char kind, char op, const char *key,
+                      const char *data, uint32_t size, int64_t mt)
+/* writes a record at the end (at) of the segment returned by _store_active() */
 {
-    return object_user_cache_list(user, "draft", XS_ALL, 1);
-}
+    t_store_rec r;
+    int ret = 0;
 
+    memset(&r, '\0', sizeof(r));
+    memcpy(r.magic, STORE_REC_MAGIC, sizeof(r.magic));
+    r.kind  = kind;
+    r.op    = op;
+    r.size  = size;
+    r.sum   = _store_sum(data, size);
+    r.mtime = mt ? mt : (int64_t)time(NULL);
+    memcpy(r.key, key, INDEX_REC_SIZE);
+
+    /* write header and payload at once */
+    char *buf = xs_realloc(NULL, sizeof(r) + size);
+    memcpy(buf, &r, sizeof(r));
+    memcpy(buf + sizeof(r), data, size);
+
+    if (write(s->fd, buf, sizeof(r) + size) == (ssize_t)(sizeof(r) + size)) {
+        _store_apply(&r, s->num, at);
+        s->scanned = at + sizeof(r) + size;
+        ret = 1;
+    }
+    else
+        srv_log(xs_fmt("object store: error writing segment %08x (errno: %d)", s->num, errno));
 
-/** scheduled posts **/
+    xs_free(buf);
 
-int is_scheduled(snac *user, const char *id)
-/* returns true if this note is scheduled for future sending */
-{
-    return object_user_cache_in(user, id, "sched");
+    return ret;
 }
 
 
-void schedule_del(snac *user, const char *id)
-/* deletes an scheduled post */
+static int _store_append(char kind, char op, const char *key,
+                         const char *data, uint32_t size, int64_t mt)
+/* appends a record to the active segment (the store must be locked) */
 {
-    object_user_cache_del(user, id, "sched");
+    uint64_t at;
+    t_store_seg *s = _store_active(&at);
+    int ret = 0;
+
+    if (s != NULL) {
+        ret = _store_put(s, at, kind, op, key, data, size, mt);
+        flock(s->fd, LOCK_UN);
+    }
+
+    return ret;
 }
 
 
-void schedule_add(snac *user, const char *id, const xs_dict *msg)
-/* schedules this post for later */
+static xs_val *_store_read_rec(uint32_t seg, uint64_t off, uint32_t size, t_store_rec *hdr)
+/* reads the payload of a record (and its header, if hdr is set) */
 {
-    /* delete from the index, in case it was already there */
-    schedule_del(user, id);
+    t_store_seg *s = _store_seg(seg);
+    t_store_rec *r;
+    xs_val *data = NULL;
 
-    /* overwrite object */
-    object_add_ow(id, msg);
+    if (s == NULL)
+        return NULL;
 
-    /* [re]add to the index */
-    object_user_cache_add(user, id, "sched");
-}
+    char *buf = xs_realloc(NULL, sizeof(t_store_rec) + size + 1);
 
+    if (pread(s->fd, buf, sizeof(t_store_rec) + size, off) == (ssize_t)(sizeof(t_store_rec) + size)) {
+        r = (t_store_rec *)buf;
 
-xs_list *scheduled_list(snac *user)
-/* return the list of scheduled posts */
-{
-    return object_user_cache_list(user, "sched", XS_ALL, 1);
-}
+        if (r->size == size && _store_sum(buf + sizeof(t_store_rec), size) == r->sum) {
+            data = xs_realloc(NULL, _xs_blk_size(size + 1));
+            memcpy(data, buf + sizeof(t_store_rec), size);
+            data[size] = '\0';
 
+            if (hdr != NULL)
+                *hdr = *r;
+        }
+        else
+            srv_log(xs_fmt("object store: bad checksum in segment %08x at %lu",
+                    seg, (unsigned long)off));
+    }
 
-void scheduled_process(snac *user)
-/* processes the scheduled list, sending those ready to be sent */
-{
-    xs *posts = scheduled_list(user);
-    const char *md5;
-    xs *right_now = xs_str_utctime(0, ISO_DATE_SPEC);
+    xs_free(buf);
 
-    xs_list_foreach(posts, md5) {
-        xs *msg = NULL;
+    return data;
+}
 
-        if (valid_status(object_get_by_md5(md5, &msg))) {
-            if (strcmp(xs_dict_get(msg, "published"), right_now) < 0) {
-                /* due date! */
-                const char *id = xs_dict_get(msg, "id");
 
-                timeline_add(user, id, msg);
+static xs_val *_store_read(const t_store_ent *e, int *size)
+/* reads the payload of an entry (the full content, if it's a side
+   index with deltas after its last full record) */
+{
+    xs_val *data;
+    int sz = 0;
 
-                xs *c_msg = msg_create(user, msg);
-                enqueue_message(user, c_msg);
+    if (e->seg != 0) {
+        if ((data = _store_read_rec(e->seg, e->off, e->size, NULL)) == NULL)
+            return NULL;
 
-                schedule_del(user, id);
-            }
-        }
+        sz = e->size;
     }
-}
+    else
+        data = xs_realloc(NULL, _xs_blk_size(1));
+
+    if (e->d_cnt) {
+        /* gather the deltas, from the newest to the oldest */
+        t_store_delta *ds = xs_realloc(NULL, e->d_cnt * sizeof(t_store_delta));
+        char *ops = xs_realloc(NULL, e->d_cnt);
+        uint32_t seg = e->d_seg;
+        uint64_t off = e->d_off;
+        long n;
+
+        for (n = 0; n < (long)e->d_cnt; n++) {
+            t_store_rec r;
+            xs *d = _store_read_rec(seg, off, sizeof(t_store_delta), &r);
+
+            if (d == NULL || r.kind != e->kind || (r.op != 'A' && r.op != 'R') ||
+                memcmp(r.key, e->key, INDEX_REC_SIZE) != 0) {
+                srv_log(xs_fmt("object store: broken delta chain in segment %08x at %lu",
+                        seg, (unsigned long)off));
+                data = xs_free(data);
+                break;
+            }
 
+            memcpy(&ds[n], d, sizeof(t_store_delta));
+            ops[n] = r.op;
+            seg    = ds[n].seg;
+            off    = ds[n].off;
+        }
 
-/** hiding **/
+        if (data != NULL) {
+            /* apply them, from the oldest to the newest */
+            t_pos_map m;
+            long n_recs;
 
-xs_str *_hidden_fn(snac *snac, const char *id)
-{
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    return xs_fmt("%s/hidden/%s", snac->basedir, md5);
-}
+            memset(&m, '\0', sizeof(m));
 
+            sz    -= sz % INDEX_REC_SIZE;
+            n_recs = sz / INDEX_REC_SIZE;
 
-void hide(snac *snac, const char *id)
-/* hides a message tree */
-{
-    xs *fn = _hidden_fn(snac, id);
-    FILE *f;
+            for (n = 0; n < n_recs; n++)
+                _pos_map_put(&m, data + n * INDEX_REC_SIZE, n);
 
-    if ((f = fopen(fn, "w")) != NULL) {
-        fprintf(f, "%s\n", id);
-        fclose(f);
+            for (n = e->d_cnt - 1; n >= 0; n--) {
+                t_pos_slot *ps = m.n_slots ? _pos_map_slot(m.slots, m.n_slots, ds[n].key) : NULL;
+                int here = ps != NULL && ps->pos >= 0;
 
-        snac_debug(snac, 2, xs_fmt("hidden %s %s", id, fn));
+                if (ops[n] == 'A' && !here) {
+                    data = xs_realloc(data, _xs_blk_size((n_recs + 1) * INDEX_REC_SIZE + 1));
+                    memcpy(data + n_recs * INDEX_REC_SIZE, ds[n].key, INDEX_REC_SIZE);
+                    _pos_map_put(&m, ds[n].key, n_recs++);
+                }
+                else
+                if (ops[n] == 'R' && here) {
+                    memcpy(data + ps->pos * INDEX_REC_SIZE, index_deleted_rec, INDEX_REC_SIZE);
+                    ps->pos = -2;
+                }
+            }
 
-        /* hide all the children */
-        xs *chld = object_children(id);
-        char *p;
-        const char *v;
+            /* drop the removed ones */
+            long i, o;
 
-        p = chld;
-        while (xs_list_iter(&p, &v)) {
-            xs *co = NULL;
+            for (i = o = 0; i < n_recs; i++) {
+                const char *r = data + i * INDEX_REC_SIZE;
 
-            /* resolve to get the id */
-            if (valid_status(object_get_by_md5(v, &co))) {
-                const char *id = xs_dict_get(co, "id");
-                if (id != NULL)
-                    hide(snac, id);
+                if (memcmp(r, index_deleted_rec, INDEX_REC_SIZE) != 0) {
+                    if (o != i)
+                        memcpy(data + o * INDEX_REC_SIZE, r, INDEX_REC_SIZE);
+                    o++;
+                }
             }
+
+            sz = o * INDEX_REC_SIZE;
+            data[sz] = '\0';
+
+            _pos_map_free(&m);
         }
-    }
-}
 
+        xs_free(ops);
+        xs_free(ds);
+    }
 
-int is_hidden(snac *snac, const char *id)
-/* check is id is hidden */
-{
-    xs *fn = _hidden_fn(snac, id);
+    if (data != NULL)
+        *size = sz;
 
-    return !!(mtime(fn) != 0.0);
+    return data;
 }
 
 
-int actor_add(const char *actor, const xs_dict *msg)
-/* adds an actor */
+static int _store_key(const char *md5, char key[INDEX_REC_SIZE])
+/* converts an md5 to a store key */
 {
-    return object_add_ow(actor, msg);
+    return is_md5_hex(md5) && _xs_hex_dec(key, md5, MD5_HEX_SIZE - 1) != NULL;
 }
 
 
-int actor_get(const char *actor, xs_dict **data)
-/* returns an already downloaded actor */
+static int _store_lookup(const char *md5, char kind, t_store_ent *out)
+/* finds a live record (store_mutex must be locked) */
 {
-    int status = HTTP_STATUS_OK;
-    xs_dict *d = NULL;
+    char key[INDEX_REC_SIZE];
+    t_store_ent *e;
+    int pass;
 
-    if (xs_startswith(actor, srv_baseurl)) {
-        /* it's a (possible) local user */
-        xs *l = xs_split(actor, "/");
-        const char *uid = xs_list_get(l, -1);
-        snac user;
+    if (!_store_key(md5, key))
+        return 0;
 
-        if (!xs_is_null(uid) && user_open(&user, uid)) {
-            if (data)
-                *data = msg_actor(&user);
+    for (pass = 0; pass < 2; pass++) {
+        /* on a miss, look again after catching up with other processes */
+        _store_refresh(pass);
 
-            user_free(&user);
-            return HTTP_STATUS_OK;
+        if ((e = _store_ent(key, kind, 0)) != NULL && !e->dead) {
+            *out = *e;
+            return 1;
         }
-        else
-            return HTTP_STATUS_NOT_FOUND;
     }
 
-    /* read the object */
-    if (!valid_status(status = object_get(actor, &d))) {
-        d = xs_free(d);
-        return status;
-    }
+    return 0;
+}
 
-    /* if the object is corrupted, discard it */
-    if (xs_is_null(xs_dict_get(d, "id")) || xs_is_null(xs_dict_get(d, "type"))) {
-        srv_debug(1, xs_fmt("corrupted actor object %s", actor));
-        d = xs_free(d);
-        return HTTP_STATUS_NOT_FOUND;
-    }
 
-    if (data)
-        *data = d;
-    else
-        d = xs_free(d);
+static int _store_here(const char *md5, char kind, double *mtime)
+/* checks if a record is in the store */
+{
+    t_store_ent e;
+    int ret;
 
-    xs *fn = _object_fn(actor);
-    double max_time;
+    pthread_mutex_lock(&store_mutex);
 
-    /* maximum time for the actor data to be considered stale */
-    max_time = 3600.0 * 36.0;
+    _store_init();
 
-    if (mtime(fn) + max_time < (double) time(NULL)) {
-        /* actor data exists but also stinks */
-        status = HTTP_STATUS_RESET_CONTENT; /* "110: Response Is Stale" */
-    }
+    if ((ret = _store_lookup(md5, kind, &e)) && mtime)
+        *mtime = (double)e.mtime;
 
-    return status;
+    pthread_mutex_unlock(&store_mutex);
+
+    return ret;
 }
 
 
-int actor_get_refresh(snac *user, const char *actor, xs_dict **data)
-/* gets an actor and requests a refresh if it's stale */
+static xs_val *_store_get(const char *md5, char kind, int *size)
+/* gets the payload of a record */
 {
-    int status = actor_get(actor, data);
+    t_store_ent e;
+    xs_val *data = NULL;
+    int sz = 0;
 
-    if (status == HTTP_STATUS_RESET_CONTENT && user && !xs_startswith(actor, srv_baseurl))
-        enqueue_actor_refresh(user, actor, 0);
+    pthread_mutex_lock(&store_mutex);
 
-    return status;
-}
+    _store_init();
 
+    if (_store_lookup(md5, kind, &e) && (data = _store_read(&e, &sz)) != NULL && size)
+        *size = sz;
 
-/** user limiting (announce blocks) **/
+    pthread_mutex_unlock(&store_mutex);
 
-int limited(snac *user, const char *id, int cmd)
-/* announce messages from a followed (0: check, 1: limit; 2: unlimit) */
+    return data;
+}
+
+
+static int _store_write(const char *md5, char kind, char op, const char *data, int size)
+/* writes a record */
 {
+    char key[INDEX_REC_SIZE];
     int ret = 0;
-    xs *dir = xs_fmt("%s/limited", user->basedir);
-    xs *md5 = xs_md5_hex(id, strlen(id));
-    xs *fn  = xs_fmt("%s/%s", dir, md5);
 
-    switch (cmd) {
-    case 0: /** check **/
-        ret = !!(mtime(fn) > 0.0);
-        break;
+    if (!_store_key(md5, key))
+        return 0;
 
-    case 1: /** limit **/
-        mkdirx(dir);
+    pthread_mutex_lock(&store_mutex);
 
-        if (mtime(fn) > 0.0)
-            ret = -1;
-        else {
-            FILE *f;
+    _store_init();
 
-            if ((f = fopen(fn, "w")) != NULL) {
-                fprintf(f, "%s\n", id);
-                fclose(f);
-            }
-            else
-                ret = -2;
-        }
-        break;
+    int lfd = _store_lock(LOCK_SH);
 
-    case 2: /** unlimit **/
-        if (mtime(fn) > 0.0)
-            ret = unlink(fn);
-        else
-            ret = -1;
-        break;
+    if (op == 'P')
+        ret = _store_append(kind, op, key, data, size, 0);
+    else {
+        t_store_ent e;
+
+        /* only delete or touch what's here */
+        if (_store_lookup(md5, kind, &e))
+            ret = _store_append(kind, op, key, "", 0, 0);
     }
 
+    if (lfd != -1)
+        close(lfd);
+
+    pthread_mutex_unlock(&store_mutex);
+
     return ret;
 }
 
 
-/** tag indexing **/
-
-void tag_index(const char *id, const xs_dict *obj)
-/* update the tag indexes for this object */
+static int _store_sidx_delta(t_store_seg *s, uint64_t at, const t_store_ent *e,
+                             char kind, char op, const char *key, const char *ekey)
+/* appends a side index delta record, chained to the previous one */
 {
-    const xs_list *tags = xs_dict_get(obj, "tag");
-    xs *md5_id = xs_md5_hex(id, strlen(id));
+    t_store_delta d;
 
-    if (is_msg_public(obj) && xs_type(tags) == XSTYPE_LIST && xs_list_len(tags) > 0) {
-        xs *g_tag_dir = xs_fmt("%s/tag", srv_basedir);
+    memset(&d, '\0', sizeof(d));
+    memcpy(d.key, ekey, INDEX_REC_SIZE);
 
-        mkdirx(g_tag_dir);
+    if (e != NULL && e->d_cnt) {
+        d.seg = e->d_seg;
+        d.off = e->d_off;
+    }
 
-        const xs_dict *v;
-        int ct = 0;
-        while (xs_list_next(tags, &v, &ct)) {
-            const char *type = xs_dict_get(v, "type");
-            const char *name = xs_dict_get(v, "name");
+    return _store_put(s, at, kind, op, key, (char *)&d, sizeof(d), 0);
+}
 
-            if (!xs_is_null(type) && !xs_is_null(name) && strcmp(type, "Hashtag") == 0) {
-                while (*name == '#' || *name == '@')
-                    name++;
 
-                if (*name == '\0')
-                    continue;
+static int _store_sidx(const char *md5, char kind, const char *emd5, int add)
+/* adds or deletes an md5 to a side index stored as records */
+{
+    char key[INDEX_REC_SIZE];
+    char ekey[INDEX_REC_SIZE];
+    int ret = 0;
 
-                name = xs_tolower_i((xs_str *)name);
+    if (!_store_key(md5, key) || !_store_key(emd5, ekey))
+        return 0;
 
-                xs *md5_tag   = xs_md5_hex(name, strlen(name));
-                xs *tag_dir   = xs_fmt("%s/%c%c", g_tag_dir, md5_tag[0], md5_tag[1]);
-                mkdirx(tag_dir);
+    pthread_mutex_lock(&store_mutex);
 
-                xs *g_tag_idx = xs_fmt("%s/%s.idx", tag_dir, md5_tag);
+    _store_init();
 
-                if (!index_in_md5(g_tag_idx, md5_id))
-                    index_add_md5(g_tag_idx, md5_id);
+    int lfd = _store_lock(LOCK_SH);
+    uint64_t at;
+    t_store_seg *s;
 
-                FILE *f;
-                xs *g_tag_name = xs_replace(g_tag_idx, ".idx", ".tag");
-                if ((f = fopen(g_tag_name, "w")) != NULL) {
-                    fprintf(f, "%s\n", name);
-                    fclose(f);
-                }
+    /* with the active segment locked, the entry is up to date
+       and no one else can append a delta in between */
+    if ((s = _store_active(&at)) != NULL) {
+        t_store_ent *e = _store_ent(key, kind, 0);
+        xs *data = NULL;
+        int size = 0;
 
-                srv_debug(0, xs_fmt("tagged %s #%s (#%s)", id, name, md5_tag));
+        if (e != NULL && e->dead)
+            e = NULL;
+
+        if (e != NULL && (data = _store_read(e, &size)) == NULL)
+            srv_log(xs_fmt("object store: cannot update side index %c of %s", kind, md5));
+        else {
+            long n = data ? _index_scan(data, size / INDEX_REC_SIZE, ekey) : -1;
+
+            /* write it whole again when the deltas outnumber the md5s */
+            int full = e != NULL && e->d_cnt >= STORE_DELTA_MIN && e->d_cnt >= e->count;
+
+            if (add && n == -1) {
+                if (full) {
+                    data = xs_realloc(data, size + INDEX_REC_SIZE);
+                    memcpy(data + size, ekey, INDEX_REC_SIZE);
+                    ret = _store_put(s, at, kind, 'P', key, data, size + INDEX_REC_SIZE, 0);
+                }
+                else
+                    ret = _store_sidx_delta(s, at, e, kind, 'A', key, ekey);
+            }
+            else
+            if (!add && n != -1) {
+                if (size == INDEX_REC_SIZE)
+                    ret = _store_put(s, at, kind, 'D', key, "", 0, 0);
+                else
+                if (full) {
+                    memmove(data + n * INDEX_REC_SIZE, data + (n + 1) * INDEX_REC_SIZE,
+                            size - (n + 1) * INDEX_REC_SIZE);
+                    ret = _store_put(s, at, kind, 'P', key, data, size - INDEX_REC_SIZE, 0);
+                }
+                else
+                    ret = _store_sidx_delta(s, at, e, kind, 'R', key, ekey);
             }
         }
+
+        flock(s->fd, LOCK_UN);
     }
-}
 
+    if (lfd != -1)
+        close(lfd);
 
-xs_str *tag_fn(const char *tag)
-{
-    if (*tag == '#')
-        tag++;
+    _store_snap_maybe();
 
-    xs *lw_tag = xs_tolower_i(xs_dup(tag));
-    xs *md5    = xs_md5_hex(lw_tag, strlen(lw_tag));
+    pthread_mutex_unlock(&store_mutex);
 
-    return xs_fmt("%s/tag/%c%c/%s.idx", srv_basedir, md5[0], md5[1], md5);
+    return ret;
 }
 
 
-xs_list *tag_search(const char *tag, int skip, int show)
-/* returns the list of posts tagged with tag */
+static xs_list *_store_list(char kind, double before)
+/* returns the md5s of the records of a kind older than a time */
 {
-    xs *idx = tag_fn(tag);
-
-    return index_list_desc(idx, skip, show);
-}
+    xs_list *list = xs_list_new();
+    long n;
 
+    pthread_mutex_lock(&store_mutex);
 
-/** lists **/
+    _store_init();
+    _store_refresh(1);
 
-xs_val *list_maint(snac *user, const char *list, int op)
-/* list maintenance */
-{
-    xs_val *l = NULL;
+    for (n = 0; n < store_n_slots; n++) {
+        const t_store_ent *e = &store_ents[n];
 
-    switch (op) {
-    case 0: /** list of lists **/
-        {
-            FILE *f;
-            xs *spec = xs_fmt("%s/list/" "*.id", user->basedir);
-            xs *ls   = xs_glob(spec, 0, 0);
-            int c = 0;
-            const char *v;
+        if (e->kind == kind && !e->dead && (double)e->mtime < before) {
+            char md5[MD5_HEX_SIZE];
 
-            l = xs_list_new();
+            *_xs_hex_enc(md5, e->key, INDEX_REC_SIZE) = '\0';
+            list = xs_list_append(list, md5);
+        }
+    }
 
-            while (xs_list_next(ls, &v, &c)) {
-                if ((f = fopen(v, "r")) != NULL) {
-                    xs *title = xs_readline(f);
-                    fclose(f);
+    pthread_mutex_unlock(&store_mutex);
 
-                    title = xs_strip_i(title);
+    return list;
+}
 
-                    xs *v2 = xs_replace(v, ".id", "");
-                    xs *l2 = xs_split(v2, "/");
 
-                    /* return [ list_id, list_title ] */
-                    l = xs_list_append(l, xs_list_append(xs_list_new(), xs_list_get(l2, -1), title));
-                }
-            }
-        }
+int object_store_put_raw(const char *md5, char kind, const char *data, int size, double mtime)
+/* stores a record with a given modification time (for migrations) */
+{
+    char key[INDEX_REC_SIZE];
+    int ret = 0;
 
-        break;
+    if (!_store_key(md5, key))
+        return 0;
 
-    case 1: /** create new list (list is the name) **/
-        {
-            xs *lol = list_maint(user, NULL, 0);
-            int c = 0;
-            const xs_list *v;
-            int add = 1;
+    pthread_mutex_lock(&store_mutex);
 
-            /* check if this list name already exists */
-            while (xs_list_next(lol, &v, &c)) {
-                if (strcmp(xs_list_get(v, 1), list) == 0) {
-                    add = 0;
+    _store_init();
 
-                    l = xs_dup(xs_list_get(v, 0));
+    int lfd = _store_lock(LOCK_SH);
 
-                    break;
-                }
-            }
+    ret = _store_append(kind, 'P', key, data, size, (int64_t)mtime);
 
-            if (add) {
-                FILE *f;
-                xs *dir = xs_fmt("%s/list/", user->basedir);
+    if (lfd != -1)
+        close(lfd);
 
-                l = xs_fmt("%010x", time(NULL));
+    pthread_mutex_unlock(&store_mutex);
 
-                mkdirx(dir);
+    return ret;
+}
 
-                xs *fn = xs_fmt("%s%s.id", dir, l);
 
-                if ((f = fopen(fn, "w")) != NULL) {
-                    fprintf(f, "%s\n", list);
-                    fclose(f);
-                }
-            }
-        }
+int object_store_compact(void)
+/* rewrites the segments that are mostly garbage; returns their number */
+{
+    int cnt = 0;
+    int n;
 
-        break;
+    if (!object_store_is_seg())
+        return 0;
 
-    case 2: /** delete list (list is the id) **/
-        {
-            if (xs_is_hex(list)) {
-                xs *fn = xs_fmt("%s/list/%s.id", user->basedir, list);
-                unlink(fn);
+    pthread_mutex_lock(&store_mutex);
 
-                fn = xs_replace_i(fn, ".id", ".lst");
-                unlink(fn);
+    _store_init();
 
-                fn = xs_replace_i(fn, ".lst", ".idx");
-                unlink(fn);
+    int lfd = _store_lock(LOCK_EX);
 
-                fn = xs_str_cat(fn, ".bak");
-                unlink(fn);
-            }
-        }
+    _store_refresh(1);
 
-        break;
+    if (store_n_segs) {
+        /* if the active segment is mostly garbage, roll over now
+           so that it can be compacted (there are no writers) */
+        const t_store_seg *s = &store_segs[store_n_segs - 1];
+        uint32_t num = s->num;
 
-    case 3: /** get list name **/
-        if (xs_is_hex(list)) {
-            FILE *f;
-            xs *fn = xs_fmt("%s/list/%s.id", user->basedir, list);
+        if (s->scanned > STORE_SEG_MAX / 64 && s->live * 2 < s->scanned) {
+            xs *nfn = _store_seg_fn(num + 1);
+            int fd  = open(nfn, O_RDWR | O_CREAT, 0660);
 
-            if ((f = fopen(fn, "r")) != NULL) {
-                l = xs_strip_i(xs_readline(f));
-                fclose(f);
+            if (fd != -1) {
+                close(fd);
+                _store_seg_open(num + 1, 0);
             }
         }
-
-        break;
     }
 
-    return l;
-}
-
+    /* the segments to be compacted (never the active one) */
+    uint32_t *nums = xs_realloc(NULL, (store_n_segs + 1) * sizeof(uint32_t));
+    int n_nums = 0;
 
-xs_str *list_timeline_fn(snac *user, const char *list)
-{
-    return xs_fmt("%s/list/%s.idx", user->basedir, list);
-}
+    for (n = 0; n < store_n_segs - 1; n++) {
+        const t_store_seg *s = &store_segs[n];
 
+        if (s->sealed || s->live * 2 < s->scanned)
+            nums[n_nums++] = s->num;
+    }
 
-xs_list *list_timeline(snac *user, const char *list, int skip, int show)
-/* returns the timeline of a list */
-{
-    xs_list *l = NULL;
+    for (n = 0; n < n_nums; n++) {
+        int oldest = store_n_segs && store_segs[0].num == nums[n];
+        t_store_ent *keep = NULL;
+        long n_keep = 0;
+        long i;
 
-    if (!xs_is_hex(list))
-        return NULL;
+        /* collect first, as appending changes the table */
+        for (i = 0; i < store_n_slots; i++) {
+            const t_store_ent *e = &store_ents[i];
 
-    xs *fn = list_timeline_fn(user, list);
+            if (!e->kind)
+                continue;
 
-    if (mtime(fn) > 0.0)
-        l = index_list_desc(fn, skip, show);
-    else
-        l = xs_list_new();
+            if (e->dead) {
+                /* tombstones are carried forward unless there is nothing older */
+                if (e->seg != nums[n] || oldest)
+                    continue;
+            }
+            else
+            if (e->seg != nums[n] && e->t_seg != nums[n] &&
+                !(e->d_cnt && e->d_min <= nums[n] && nums[n] <= e->d_seg))
+                continue;
 
-    return l;
-}
+            keep = xs_realloc(keep, (n_keep + 1) * sizeof(t_store_ent));
+            keep[n_keep++] = *e;
+        }
 
+        int ok = 1;
 
-xs_val *list_content(snac *user, const char *list, const char *actor_md5, int op)
-/* list content management */
-{
-    xs_val *l = NULL;
+        for (i = 0; ok && i < n_keep; i++) {
+            const t_store_ent *e = &keep[i];
 
-    if (!xs_is_hex(list))
-        return NULL;
+            if (e->dead)
+                ok = _store_append(e->kind, 'D', e->key, "", 0, e->mtime);
+            else
+            if (e->seg != nums[n] && !e->d_cnt) {
+                /* only the touch is there: keep the time */
+                ok = _store_append(e->kind, 'T', e->key, "", 0, e->mtime);
+            }
+            else {
+                /* the full record, or some of its deltas, are there:
+                   write it whole (so the deltas are folded) */
+                int size = 0;
+                xs *data = _store_read(e, &size);
 
-    if (actor_md5 != NULL && !xs_is_hex(actor_md5))
-        return NULL;
+                ok = data != NULL &&
+                    _store_append(e->kind, 'P', e->key, data, size, e->mtime);
+            }
+        }
 
-    xs *fn = xs_fmt("%s/list/%s.lst", user->basedir, list);
+        xs_free(keep);
 
-    switch (op) {
-    case 0: /** list content **/
-        l = index_list(fn, XS_ALL);
+        if (!ok) {
+            srv_log(xs_fmt("object store: cannot compact segment %08x", nums[n]));
+            break;
+        }
 
-        break;
+        xs *fn = _store_seg_fn(nums[n]);
+        unlink(fn);
+        _store_seg_close(nums[n]);
 
-    case 1: /** append actor to list **/
-        if (actor_md5 != NULL) {
-            if (!index_in_md5(fn, actor_md5))
-                index_add_md5(fn, actor_md5);
-        }
+        srv_debug(1, xs_fmt("object store: compacted segment %08x (%ld records)", nums[n], n_keep));
+        cnt++;
+    }
 
-        break;
+    xs_free(nums);
 
-    case 2: /** delete actor from list **/
-        if (actor_md5 != NULL)
-            index_del_md5(fn, actor_md5);
+    if (cnt) {
+        /* tell the other processes by replacing the gen file */
+        xs *gfn = xs_fmt("%s/gen", store_dir);
+        xs *tfn = xs_fmt("%s.tmp", gfn);
+        FILE *f;
 
-        break;
+        if ((f = fopen(tfn, "w")) != NULL) {
+            fprintf(f, "%ld\n", (long)time(NULL));
+            fclose(f);
+            rename(tfn, gfn);
+        }
 
-    default:
-        srv_log(xs_fmt("ERROR: list_content: bad op %d", op));
-        break;
+        store_gen = _store_gen_read();
     }
 
-    return l;
-}
+    _store_snap_save();
 
+    if (lfd != -1)
+        close(lfd);
 
-void list_distribute(snac *user, const char *who, const xs_dict *post)
-/* distributes the post to all appropriate lists */
-{
-    const char *id = xs_dict_get(post, "id");
+    pthread_mutex_unlock(&store_mutex);
 
-    /* if who is not set, use the attributedTo in the message */
-    if (xs_is_null(who))
-        who = get_atto(post);
+    return cnt;
+}
 
-    if (xs_type(who) == XSTYPE_STRING && xs_type(id) == XSTYPE_STRING) {
-        xs *a_md5 = xs_md5_hex(who, strlen(who));
-        xs *i_md5 = xs_md5_hex(id, strlen(id));
-        xs *spec  = xs_fmt("%s/list/" "*.lst", user->basedir);
-        xs *ls    = xs_glob(spec, 0, 0);
-        int c = 0;
+
+int data_convert(void)
+/* rewrites all stored data (objects, queue items, notifications, etc.)
+   in the configured format; returns the number of converted items */
+{
+    const char *specs[] = { "%s/object/??" "/" "*.json",
+                            "%s/queue/" "*.json",
+                            "%s/payload/" "*.json",
+                            "%s/tmp/" "*.json",
+                            "%s/user/" "*/queue/" "*.json",
+                            "%s/user/" "*/notify/" "*.json",
+                            "%s/user/" "*/following/" "*.json",
+                            "%s/user/" "*/pending/" "*.json",
+                            "%s/user/" "*/private/" "*.json",
+                            "%s/user/" "*/public/" "*.json",
+                            "%s/user/" "*/pinned/" "*.json",
+                            "%s/user/" "*/bookmark/" "*.json",
+                            "%s/user/" "*/draft/" "*.json",
+                            "%s/user/" "*/sched/" "*.json",
+                            NULL };
+    int n, cnt = 0, err = 0;
+    xs *links = xs_dict_new();
+
+    for (n = 0; specs[n]; n++) {
+        xs *spec  = xs_fmt(specs[n], srv_basedir);
+        xs *files = xs_glob(spec, 0, 0);
         const char *v;
 
-        while (xs_list_next(ls, &v, &c)) {
-            /* is the actor in this list? */
-            if (index_in_md5(v, a_md5)) {
-                /* it is; add post md5 to its timeline */
-                xs *idx = xs_replace(v, ".lst", ".idx");
-                index_add_md5(idx, i_md5);
+        xs_list_foreach(files, v) {
+            int r = _data_convert_file(v, &links);
 
-                snac_debug(user, 1, xs_fmt("listed post %s in %s", id, idx));
+            if (r == 1)
+                cnt++;
+            else
+            if (r == -1) {
+                srv_log(xs_fmt("data_convert: cannot convert %s", v));
+                err++;
             }
         }
     }
-}
-
 
-/** static data **/
+    if (object_store_is_seg() && object_store_ready()) {
+        xs *objs = _store_list('o', (double)time(NULL) + 86400);
+        const char *md5;
+        int s_cnt = 0;
 
-static int _load_raw_file(const char *fn, xs_val **data, int *size,
-                        const char *inm, xs_str **etag)
-/* loads a cached file */
-{
-    int status = HTTP_STATUS_NOT_FOUND;
+        xs_list_foreach(objs, md5) {
+            int size = 0;
+            xs *data = _store_get(md5, 'o', &size);
 
-    if (fn) {
-        double tm = mtime(fn);
+            if (data == NULL || _data_converted(data, size))
+                continue;
 
-        if (tm > 0.0) {
-            /* file exists; build the etag */
-            xs *e = xs_fmt("W/\"snac-%.0lf\"", tm);
+            xs *v = data_loads(data, size);
+            int d_size;
+            xs *d = NULL;
 
-            /* if if-none-match is set, check if it's the same */
-            if (!xs_is_null(inm) && strcmp(e, inm) == 0) {
-                /* client has the newest version */
-                status = HTTP_STATUS_NOT_MODIFIED;
-            }
+            if (v != NULL && (d = data_dumps(v, &d_size)) != NULL &&
+                object_store_put_raw(md5, 'o', d, d_size, object_mtime_by_md5(md5)))
+                s_cnt++;
             else {
-                /* newer or never downloaded; read the full file */
-                FILE *f;
+                srv_log(xs_fmt("data_convert: cannot convert object %s", md5));
+                err++;
+            }
+        }
 
-                if ((f = fopen(fn, "rb")) != NULL) {
-                    *size = XS_ALL;
-                    *data = xs_read(f, size);
-                    fclose(f);
+        /* drop the old records */
+        if (s_cnt)
+            object_store_compact();
 
-                    status = HTTP_STATUS_OK;
-                }
-            }
-
-            /* if caller wants the etag, return it */
-            if (etag != NULL)
-                *etag = xs_dup(e);
-
-            srv_debug(1, xs_fmt("_load_raw_file(): %s %d", fn, status));
-        }
+        cnt += s_cnt;
     }
 
-    return status;
+    srv_log(xs_fmt("data_convert: %d items converted to %s (%d errors)",
+        cnt, data_binary() ? "binary" : "JSON", err));
+
+    return cnt;
 }
 
 
-xs_str *_static_fn(snac *snac, const char *id)
-/* gets the filename for a static file */
+/** objects **/
+
+static xs_str *_object_fn_by_md5(const char *md5, const char *func)
 {
-    if (strchr(id, '/'))
-        return NULL;
+    xs *bfn = xs_fmt("%s/object/%c%c", srv_basedir, md5[0], md5[1]);
+    xs_str *ret;
+    int ok = 1;
+
+    /* an object deleted from an index; fail but don't bark */
+    if (md5[0] == '-')
+        ok = 0;
     else
-        return xs_fmt("%s/static/%s", snac->basedir, id);
+    if (!is_md5_hex(md5)) {
+        srv_log(xs_fmt("_object_fn_by_md5() [from %s()]: bad md5 '%s'", func, md5));
+        ok = 0;
+    }
+
+    if (ok) {
+        mkdirx(bfn);
+        ret = xs_fmt("%s/%s.json", bfn, md5);
+    }
+    else
+        ret = xs_fmt("%s/object/invalid/invalid.json", srv_basedir);
+
+    return ret;
 }
 
 
-int static_get(snac *snac, const char *id, xs_val **data, int *size,
-                const char *inm, xs_str **etag)
-/* returns static content */
+static xs_str *_object_fn(const char *id)
 {
-    xs *fn = _static_fn(snac, id);
-
-    return _load_raw_file(fn, data, size, inm, etag);
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return _object_fn_by_md5(md5, "_object_fn");
 }
 
 
-void static_put(snac *snac, const char *id, const char *data, int size)
-/* writes status content */
+static xs_str *_object_sidx_fn(const char *md5, char kind)
+/* returns the file name of an object side index */
 {
-    xs *fn = _static_fn(snac, id);
-    FILE *f;
+    xs *fn  = _object_fn_by_md5(md5, "_object_sidx_fn");
+    xs *sfx = xs_fmt("_%c.idx", kind);
 
-    if (fn && (f = fopen(fn, "wb")) != NULL) {
-        fwrite(data, size, 1, f);
-        fclose(f);
-    }
+    return xs_replace(fn, ".json", sfx);
 }
 
 
-void static_put_meta(snac *snac, const char *id, const char *str)
-/* puts metadata (i.e. a media description string) to id */
+static int _object_sidx_add(const char *md5, char kind, const char *emd5)
+/* adds an md5 to an object side index, if it's not already there */
 {
-    xs *fn = _static_fn(snac, id);
+    if (object_store_is_seg())
+        return _store_sidx(md5, kind, emd5, 1) ? HTTP_STATUS_CREATED : HTTP_STATUS_OK;
 
-    if (fn) {
-        fn = xs_str_cat(fn, ".txt");
-        FILE *f;
+    xs *fn = _object_sidx_fn(md5, kind);
 
-        if ((f = fopen(fn, "w")) != NULL) {
-            fprintf(f, "%s\n", str);
-            fclose(f);
-        }
-    }
+    if (index_in_md5(fn, emd5))
+        return HTTP_STATUS_OK;
+
+    return index_add_md5(fn, emd5);
 }
 
 
-xs_str *static_get_meta(snac *snac, const char *id)
-/* gets metadata from a media */
+static int _object_sidx_del(const char *md5, char kind, const char *emd5)
+/* deletes an md5 from an object side index */
 {
-    xs *fn    = _static_fn(snac, id);
-    xs_str *r = NULL;
+    if (object_store_is_seg())
+        return _store_sidx(md5, kind, emd5, 0) ? HTTP_STATUS_OK : HTTP_STATUS_NOT_FOUND;
 
-    if (fn) {
-        fn = xs_str_cat(fn, ".txt");
-        FILE *f;
+    xs *fn = _object_sidx_fn(md5, kind);
+    int status = index_del_md5(fn, emd5);
 
-        if ((f = fopen(fn, "r")) != NULL) {
-            r = xs_strip_i(xs_readline(f));
-            fclose(f);
-        }
-    }
-    else
-        r = xs_str_new("");
+    if (valid_status(status))
+        index_gc(fn);
 
-    return r;
+    return status;
 }
 
 
-/** history **/
-
-xs_str *_history_fn(snac *snac, const char *id)
-/* gets the filename for the history */
+static int _object_sidx_here(const char *md5, char kind)
+/* checks if an object side index exists */
 {
-    if (strchr(id, '/'))
-        return NULL;
-    else
-        return xs_fmt("%s/history/%s", snac->basedir, id);
+    if (object_store_is_seg())
+        return _store_here(md5, kind, NULL);
+
+    xs *fn = _object_sidx_fn(md5, kind);
+    return mtime(fn) > 0.0;
 }
 
 
-double history_mtime(snac *snac, const char *id)
+static xs_list *_object_sidx_list(const char *md5, char kind, int max)
+/* returns the content of an object side index */
 {
-    double t = 0.0;
-    xs *fn = _history_fn(snac, id);
+    if (object_store_is_seg()) {
+        xs_list *list = xs_list_new();
+        int size = 0;
+        xs *data = _store_get(md5, kind, &size);
+        int n;
 
-    if (fn != NULL)
-        t = mtime(fn);
+        for (n = 0; data && n < size / INDEX_REC_SIZE && n < max; n++) {
+            char emd5[MD5_HEX_SIZE];
 
-    return t;
+            *_xs_hex_enc(emd5, data + n * INDEX_REC_SIZE, INDEX_REC_SIZE) = '\0';
+            list = xs_list_append(list, emd5);
+        }
+
+        return list;
+    }
+
+    xs *fn = _object_sidx_fn(md5, kind);
+    return index_list(fn, max);
 }
 
 
-void history_add(snac *snac, const char *id, const char *content, int size,
-                    xs_str **etag)
-/* adds something to the history */
+static int _object_sidx_len(const char *md5, char kind)
+/* returns the number of elements in an object side index */
 {
-    xs *fn = _history_fn(snac, id);
-    FILE *f;
+    if (object_store_is_seg()) {
+        t_store_ent e;
+        int len = 0;
 
-    if (fn && (f = fopen(fn, "w")) != NULL) {
-        fwrite(content, size, 1, f);
-        fclose(f);
+        pthread_mutex_lock(&store_mutex);
 
-        if (etag) {
-            double tm = mtime(fn);
-            *etag = xs_fmt("W/\"snac-%.0lf\"", tm);
-        }
-    }
-}
+        _store_init();
 
+        if (_store_lookup(md5, kind, &e))
+            len = e.count;
 
-int history_get(snac *snac, const char *id, xs_str **content, int *size,
-                const char *inm, xs_str **etag)
-{
-    xs *fn = _history_fn(snac, id);
+        pthread_mutex_unlock(&store_mutex);
 
-    return _load_raw_file(fn, content, size, inm, etag);
+        return len;
+    }
+
+    xs *fn = _object_sidx_fn(md5, kind);
+    return index_len(fn);
 }
 
 
-int history_del(snac *snac, const char *id)
-{
-    xs *fn = _history_fn(snac, id);
+/* parsed object cache: objects are kept in memory, most recently used
+   first, up to the "object_cache_mb" server.json setting. Entries are
+   validated on each use against a stamp of the stored object (file
+   mtime, inode and size or, in the segmented store, the position of its
+   record), so changes made by other processes are noticed */
 
-    if (fn)
-        return unlink(fn);
-    else
-        return -1;
-}
+#define OBJ_CACHE_BUCKETS 4096
 
+typedef struct _t_obj_cent {
+    char md5[MD5_HEX_SIZE];
+    int64_t stamp[3];               /* version of the stored object */
+    xs_dict *obj;                   /* the parsed object */
+    int size;                       /* memory used */
+    struct _t_obj_cent *prev;       /* LRU (more recent) */
+    struct _t_obj_cent *next;       /* LRU (less recent) */
+    struct _t_obj_cent *hnext;      /* hash chain */
+} t_obj_cent;
 
-xs_list *history_list(snac *snac)
+static t_obj_cent *obj_cache_hash[OBJ_CACHE_BUCKETS];
+static t_obj_cent *obj_cache_head = NULL;
+static t_obj_cent *obj_cache_tail = NULL;
+static long obj_cache_bytes       = 0;
+static long obj_cache_entries     = 0;
+
+
+static int _object_stamp(const char *md5, int64_t stamp[3])
+/* gets the stamp of a stored object; returns 0 if it's not here */
 {
-    xs *spec = xs_fmt("%s/history/" "*.html", snac->basedir);
+    if (object_store_is_seg()) {
+        t_store_ent e;
+        int ret;
 
-    return xs_glob(spec, 1, 1);
-}
+        pthread_mutex_lock(&store_mutex);
 
+        _store_init();
 
-void lastlog_write(snac *snac, const char *source)
-/* writes the last time the user logged in */
-{
-    xs *fn = xs_fmt("%s/lastlog.txt", snac->basedir);
-    FILE *f;
+        if ((ret = _store_lookup(md5, 'o', &e))) {
+            stamp[0] = e.seg;
+            stamp[1] = e.off;
+            stamp[2] = e.size;
+        }
 
-    if ((f = fopen(fn, "w")) != NULL) {
-        fprintf(f, "%lf %s\n", ftime(), source);
-        fclose(f);
-    }
-}
+        pthread_mutex_unlock(&store_mutex);
 
+        return ret;
+    }
 
-/** inbox collection **/
+    xs *fn = _object_fn_by_md5(md5, "_object_stamp");
+    struct stat st;
 
-void inbox_add(const char *inbox)
-/* collects a shared inbox */
-{
-    /* don't collect ourselves */
-    if (xs_startswith(inbox, srv_baseurl))
-        return;
+    if (stat(fn, &st) == -1)
+        return 0;
 
-    xs *md5 = xs_md5_hex(inbox, strlen(inbox));
-    xs *fn  = xs_fmt("%s/inbox/%s", srv_basedir, md5);
-    FILE *f;
+    stamp[0] = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    stamp[1] = st.st_ino;
+    stamp[2] = st.st_size;
 
-    if ((f = fopen(fn, "w")) != NULL) {
-        fprintf(f, "%s\n", inbox);
-        fclose(f);
-    }
+    return 1;
 }
 
 
-void inbox_add_by_actor(const xs_dict *actor)
-/* collects an actor's shared inbox, if it has one */
+static t_obj_cent **_object_cache_slot(const char *md5)
+/* returns the hash chain pointer to an entry (obj_cache_mutex must be locked) */
 {
-    const char *v;
+    t_obj_cent **pe = &obj_cache_hash[xs_hash_func(md5, MD5_HEX_SIZE - 1) % OBJ_CACHE_BUCKETS];
 
-    if (!xs_is_null(v = xs_dict_get(actor, "endpoints")) &&
-        !xs_is_null(v = xs_dict_get(v, "sharedInbox"))) {
-        /* only collect this inbox if its instance is not blocked */
-        if (!is_instance_blocked(v))
-            inbox_add(v);
-    }
+    while (*pe && memcmp((*pe)->md5, md5, MD5_HEX_SIZE - 1) != 0)
+        pe = &(*pe)->hnext;
+
+    return pe;
 }
 
 
-xs_list *inbox_list(void)
-/* returns the collected inboxes as a list */
+static void _object_cache_unlink(t_obj_cent **pe)
+/* drops an entry (obj_cache_mutex must be locked) */
 {
-    xs_list *ibl = xs_list_new();
-    xs *spec     = xs_fmt("%s/inbox/" "*", srv_basedir);
-    xs *files    = xs_glob(spec, 0, 0);
-    const xs_val *v;
+    t_obj_cent *e = *pe;
 
-    xs_list_foreach(files, v) {
-        FILE *f;
-
-        if ((f = fopen(v, "r")) != NULL) {
-            xs *line = xs_readline(f);
+    *pe = e->hnext;
 
-            if (line && *line) {
-                line = xs_strip_i(line);
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        obj_cache_head = e->next;
 
-                if (!is_instance_blocked(line))
-                    ibl = xs_list_append(ibl, line);
-            }
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        obj_cache_tail = e->prev;
 
-            fclose(f);
-        }
-    }
+    obj_cache_bytes -= e->size;
+    obj_cache_entries--;
 
-    return ibl;
+    xs_free(e->obj);
+    xs_free(e);
 }
 
 
-/** instance-wide operations **/
-
-xs_str *_instance_block_fn(const char *instance)
+static void _object_cache_stats(int hit)
+/* updates the shared statistics (obj_cache_mutex must be locked) */
 {
-    xs *s   = xs_replace(instance, "http:/" "/", "");
-    xs *s1  = xs_replace(s, "https:/" "/", "");
-    xs *l   = xs_split(s1, "/");
-    const char *p = xs_list_get(l, 0);
-    xs *md5 = xs_md5_hex(p, strlen(p));
+    if (p_state != NULL) {
+        if (hit > 0)
+            p_state->obj_cache_hits++;
+        else
+        if (hit == 0)
+            p_state->obj_cache_misses++;
 
-    return xs_fmt("%s/block/%s", srv_basedir, md5);
+        p_state->obj_cache_entries = obj_cache_entries;
+        p_state->obj_cache_bytes   = obj_cache_bytes;
+    }
 }
 
 
-int is_instance_blocked(const char *instance)
+static xs_dict *_object_cache_get(const char *md5, const int64_t stamp[3])
+/* returns a copy of a cached object, if it's still valid */
 {
-    xs *fn = _instance_block_fn(instance);
-
-    return !!(mtime(fn) != 0.0);
-}
+    xs_dict *obj = NULL;
+    t_obj_cent **pe;
 
+    pthread_mutex_lock(&obj_cache_mutex);
 
-int instance_block(const char *instance)
-/* blocks a full instance */
-{
-    int ret;
+    if (*(pe = _object_cache_slot(md5)) != NULL) {
+        t_obj_cent *e = *pe;
 
-    /* create the subdir */
-    xs *dir = xs_fmt("%s/block/", srv_basedir);
-    mkdirx(dir);
+        if (memcmp(e->stamp, stamp, sizeof(e->stamp)) == 0) {
+            obj = xs_dup(e->obj);
 
-    if (!is_instance_blocked(instance)) {
-        xs *fn = _instance_block_fn(instance);
-        FILE *f;
+            /* move to the head */
+            if (e != obj_cache_head) {
+                e->prev->next = e->next;
 
-        if ((f = fopen(fn, "w")) != NULL) {
-            fprintf(f, "%s\n", instance);
-            fclose(f);
+                if (e->next)
+                    e->next->prev = e->prev;
+                else
+                    obj_cache_tail = e->prev;
 
-            ret = 0;
+                e->prev = NULL;
+                e->next = obj_cache_head;
+                obj_cache_head->prev = e;
+                obj_cache_head = e;
+            }
         }
         else
-            ret = -1;
+            _object_cache_unlink(pe);
     }
-    else
-        ret = -2;
 
-    return ret;
+    _object_cache_stats(obj != NULL);
+
+    pthread_mutex_unlock(&obj_cache_mutex);
+
+    return obj;
 }
 
 
-int instance_unblock(const char *instance)
-/* unblocks a full instance */
+static void _object_cache_put(const char *md5, const int64_t stamp[3], const xs_dict *obj)
+/* stores a copy of an object in the cache */
 {
-    int ret;
+    long budget = xs_number_get(xs_dict_get_def(srv_config, "object_cache_mb", "16")) * 1024 * 1024;
+    int size    = sizeof(t_obj_cent) + xs_size(obj);
+    t_obj_cent **pe;
 
-    if (is_instance_blocked(instance)) {
-        xs *fn = _instance_block_fn(instance);
-        ret = unlink(fn);
-    }
-    else
-        ret = -2;
+    /* too big to be worth it? */
+    if (size > budget / 16)
+        return;
 
-    return ret;
-}
+    pthread_mutex_lock(&obj_cache_mutex);
+
+    if (*(pe = _object_cache_slot(md5)) != NULL)
+        _object_cache_unlink(pe);
+
+    t_obj_cent *e = xs_realloc(NULL, sizeof(t_obj_cent));
+
+    memset(e, '\0', sizeof(*e));
+
+    memcpy(e->md5, md5, MD5_HEX_SIZE - 1);
+    memcpy(e->stamp, stamp, sizeof(e->stamp));
+    e->obj  = xs_dup(obj);
+    e->size = size;
+
+    e->next = obj_cache_head;
+
+    if (obj_cache_head)
+        obj_cache_head->prev = e;
+    else
+        obj_cache_tail = e;
+
+    obj_cache_head = e;
+
+    e->hnext = *pe;
+    *pe = e;
+
+    obj_cache_bytes += size;
+    obj_cache_entries++;
+
+    /* trim to budget */
+    while (obj_cache_bytes > budget && obj_cache_tail != NULL)
+        _object_cache_unlink(_object_cache_slot(obj_cache_tail->md5));
+
+    _object_cache_stats(-1);
+
+    pthread_mutex_unlock(&obj_cache_mutex);
+}
+
+
+void object_cache_del(const char *md5)
+/* invalidates a cached object */
+{
+    t_obj_cent **pe;
+
+    pthread_mutex_lock(&obj_cache_mutex);
+
+    if (*(pe = _object_cache_slot(md5)) != NULL) {
+        _object_cache_unlink(pe);
+        _object_cache_stats(-1);
+    }
+
+    pthread_mutex_unlock(&obj_cache_mutex);
+}
+
+
+int object_here_by_md5(const char *id)
+/* checks if an object is already downloaded */
+{
+    if (object_store_is_seg())
+        return _store_here(id, 'o', NULL);
+
+    xs *fn = _object_fn_by_md5(id, "object_here_by_md5");
+    return mtime(fn) > 0.0;
+}
+
+
+int object_here(const char *id)
+/* checks if an object is already downloaded */
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return object_here_by_md5(md5);
+}
+
+
+int object_get_by_md5(const char *md5, xs_dict **obj)
+/* returns a stored object, optionally of the requested type */
+{
+    int status = HTTP_STATUS_NOT_FOUND;
+    int64_t stamp[3];
+    FILE *f;
+
+    *obj = NULL;
+
+    if (!_object_stamp(md5, stamp))
+        return status;
+
+    if ((*obj = _object_cache_get(md5, stamp)) != NULL)
+        return HTTP_STATUS_OK;
+
+    if (object_store_is_seg()) {
+        int size = 0;
+        xs *data = _store_get(md5, 'o', &size);
+
+        if (data != NULL)
+            *obj = data_loads(data, size);
+    }
+    else {
+        xs *fn = _object_fn_by_md5(md5, "object_get_by_md5");
+
+        if ((f = fopen(fn, "r")) != NULL) {
+            *obj = data_load(f);
+            fclose(f);
+        }
+    }
+
+    if (*obj) {
+        _object_cache_put(md5, stamp, *obj);
+        status = HTTP_STATUS_OK;
+    }
+
+    return status;
+}
+
+
+int object_get(const char *id, xs_dict **obj)
+/* returns a stored object, optionally of the requested type */
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return object_get_by_md5(md5, obj);
+}
+
+
+int _object_add(const char *id, const xs_dict *obj, int ow)
+/* stores an object */
+{
+    int status = HTTP_STATUS_CREATED; /* Created */
+    xs *md5    = xs_md5_hex(id, strlen(id));
+    FILE *f;
+
+    if (object_here_by_md5(md5)) {
+        if (!ow) {
+            /* object already here */
+            srv_debug(1, xs_fmt("object_add object already here %s", id));
+            return HTTP_STATUS_NO_CONTENT;
+        }
+        else
+            status = HTTP_STATUS_OK;
+    }
+
+    if (object_store_is_seg()) {
+        int size = 0;
+        xs *data = data_dumps(obj, &size);
+
+        if (data == NULL || !_store_write(md5, 'o', 'P', data, size)) {
+            srv_log(xs_fmt("object_add error storing %s", id));
+            return HTTP_STATUS_INTERNAL_SERVER_ERROR;
+        }
+    }
+    else {
+        xs *fn = _object_fn_by_md5(md5, "_object_add");
+
+        if ((f = fopen(fn, "w")) == NULL) {
+            srv_log(xs_fmt("object_add error writing %s (errno: %d)", fn, errno));
+            return HTTP_STATUS_INTERNAL_SERVER_ERROR;
+        }
+
+        flock(fileno(f), LOCK_EX);
+
+        data_dump(obj, f);
+        fclose(f);
+    }
+
+    /* does this object has a parent? */
+    const char *in_reply_to = get_in_reply_to(obj);
+
+    if (!xs_is_null(in_reply_to) && *in_reply_to) {
+        xs *p_md5 = xs_md5_hex(in_reply_to, strlen(in_reply_to));
+
+        /* update the children index of the parent */
+        if (_object_sidx_add(p_md5, 'c', md5) == HTTP_STATUS_CREATED)
+            srv_debug(1, xs_fmt("object_add added child %s to %s", id, in_reply_to));
+        else
+            srv_debug(1, xs_fmt("object_add %s child already in %s", id, in_reply_to));
+
+        /* create a one-element index with the parent */
+        if (!_object_sidx_here(md5, 'p')) {
+            _object_sidx_add(md5, 'p', p_md5);
+            srv_debug(1, xs_fmt("object_add added parent %s to %s", in_reply_to, id));
+        }
+    }
+
+    object_cache_del(md5);
+
+    srv_debug(1, xs_fmt("object_add %s %s %d", id, md5, status));
+
+    return status;
+}
+
+
+int object_add(const char *id, const xs_dict *obj)
+/* stores an object */
+{
+    return _object_add(id, obj, 0);
+}
+
+
+int object_add_ow(const char *id, const xs_dict *obj)
+/* stores an object (overwriting allowed) */
+{
+    return _object_add(id, obj, 1);
+}
+
+
+int object_del_by_md5(const char *md5)
+/* deletes an object by its md5 */
+{
+    int status = HTTP_STATUS_NOT_FOUND;
+
+    object_cache_del(md5);
+
+    if (object_store_is_seg()) {
+        if (_store_write(md5, 'o', 'D', NULL, 0)) {
+            const char *kinds = "clap";
+
+            status = HTTP_STATUS_OK;
+
+            /* also delete associated indexes */
+            while (*kinds)
+                _store_write(md5, *kinds++, 'D', NULL, 0);
+        }
+
+        srv_debug(1, xs_fmt("object_del %s %d", md5, status));
+
+        return status;
+    }
+
+    xs *fn = _object_fn_by_md5(md5, "object_del_by_md5");
+
+    if (unlink(fn) != -1) {
+        status = HTTP_STATUS_OK;
+
+        /* also delete associated indexes */
+        xs *spec  = xs_dup(fn);
+        spec      = xs_replace_i(spec, ".json", "*.idx");
+        xs *files = xs_glob(spec, 0, 0);
+        char *p;
+        const char *v;
+
+        p = files;
+        while (xs_list_iter(&p, &v)) {
+            srv_debug(1, xs_fmt("object_del index %s", v));
+            index_unlink(v);
+        }
+    }
+
+    srv_debug(1, xs_fmt("object_del %s %d", fn, status));
+
+    return status;
+}
+
+
+int object_del(const char *id)
+/* deletes an object */
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return object_del_by_md5(md5);
+}
+
+
+static const char *object_user_caches[] = { "private", "public", "followers", "pinned",
+                                           "bookmark", "draft", "sched", NULL };
+
+static void _object_refs_add(t_pos_map *refs, const char *md5)
+/* adds an md5 to a set of referenced objects */
+{
+    char key[INDEX_REC_SIZE];
+
+    if (strlen(md5) == MD5_HEX_SIZE - 1 && _xs_hex_dec(key, md5, MD5_HEX_SIZE - 1) != NULL)
+        _pos_map_put(refs, key, 0);
+}
+
+
+static void _object_refs_collect(t_pos_map *refs)
+/* collects the objects referenced by all users (in the segment store,
+   as there is no hard link count to look at) */
+{
+    xs *users = user_list();
+    const char *uid;
+
+    xs_list_foreach(users, uid) {
+        int n;
+
+        for (n = 0; object_user_caches[n]; n++) {
+            xs *fn = xs_fmt("%s/user/%s/%s.idx", srv_basedir, uid, object_user_caches[n]);
+            t_index idx;
+            long r;
+
+            if (!index_open(&idx, fn))
+                continue;
+
+            for (r = 0; r < idx.n_recs; r++) {
+                const char *rec = _index_rec_ptr(&idx, r);
+
+                if (idx.binary) {
+                    if (memcmp(rec, index_deleted_rec, INDEX_REC_SIZE) != 0)
+                        _pos_map_put(refs, rec, 0);
+                }
+                else {
+                    char md5[MD5_HEX_SIZE];
+
+                    if (_index_rec(&idx, r, md5))
+                        _object_refs_add(refs, md5);
+                }
+            }
+
+            index_close(&idx);
+        }
+
+        /* the actors of the followed accounts */
+        xs *spec  = xs_fmt("%s/user/%s/following/" "*.json", srv_basedir, uid);
+        xs *files = xs_glob(spec, 1, 0);
+        const char *v;
+
+        xs_list_foreach(files, v) {
+            xs *md5 = xs_replace(v, ".json", "");
+            _object_refs_add(refs, md5);
+        }
+    }
+}
+
+
+static int _object_refs_in(const t_pos_map *refs, const char *md5)
+/* checks if an md5 is in a set of referenced objects */
+{
+    char key[INDEX_REC_SIZE];
+
+    if (refs->n_slots == 0 || strlen(md5) != MD5_HEX_SIZE - 1 ||
+        _xs_hex_dec(key, md5, MD5_HEX_SIZE - 1) == NULL)
+        return 0;
+
+    return _pos_map_slot(refs->slots, refs->n_slots, key)->pos != -1;
+}
+
+
+static int _object_referenced(const char *md5)
+/* checks if any user references an object (in the segment store,
+   as there is no hard link count to look at) */
+{
+    xs *users = user_list();
+    const char *uid;
+    int ret = 0;
+
+    xs_list_foreach(users, uid) {
+        int n;
+
+        for (n = 0; !ret && object_user_caches[n]; n++) {
+            xs *idx = xs_fmt("%s/user/%s/%s.idx", srv_basedir, uid, object_user_caches[n]);
+            ret = index_in_md5(idx, md5);
+        }
+
+        if (!ret) {
+            /* the actor of a followed account */
+            xs *fn = xs_fmt("%s/user/%s/following/%s.json", srv_basedir, uid, md5);
+            ret = mtime(fn) > 0.0;
+        }
+
+        if (ret)
+            break;
+    }
+
+    return ret;
+}
+
+
+int object_del_if_unref(const char *id)
+/* deletes an object if its n_links < 2 */
+{
+    int ret = 0;
+
+    if (object_store_is_seg()) {
+        xs *md5 = xs_md5_hex(id, strlen(id));
+
+        if (object_here_by_md5(md5) && !_object_referenced(md5))
+            ret = object_del_by_md5(md5);
+
+        return ret;
+    }
+
+    xs *fn = _object_fn(id);
+    int n_links;
+
+    if (mtime_nl(fn, &n_links) > 0.0 && n_links < 2)
+        ret = object_del(id);
+
+    return ret;
+}
+
+
+double object_ctime_by_md5(const char *md5)
+{
+    if (object_store_is_seg())
+        return object_mtime_by_md5(md5);
+
+    xs *fn = _object_fn_by_md5(md5, "object_ctime_by_md5");
+    return f_ctime(fn);
+}
+
+
+double object_ctime(const char *id)
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return object_ctime_by_md5(md5);
+}
+
+
+double object_mtime_by_md5(const char *md5)
+{
+    if (object_store_is_seg()) {
+        double mt = 0.0;
+
+        _store_here(md5, 'o', &mt);
+        return mt;
+    }
+
+    xs *fn = _object_fn_by_md5(md5, "object_mtime_by_md5");
+    return mtime(fn);
+}
+
+
+double object_mtime(const char *id)
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return object_mtime_by_md5(md5);
+}
+
+
+void object_touch(const char *id)
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+
+    if (object_store_is_seg()) {
+        _store_write(md5, 'o', 'T', NULL, 0);
+        return;
+    }
+
+    xs *fn = _object_fn_by_md5(md5, "object_touch");
+
+    if (mtime(fn))
+        utimes(fn, NULL);
+}
+
+
+int object_likes_len(const char *id)
+/* returns the number of likes (without reading the index) */
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return _object_sidx_len(md5, 'l');
+}
+
+
+int object_announces_len(const char *id)
+/* returns the number of announces (without reading the index) */
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return _object_sidx_len(md5, 'a');
+}
+
+
+xs_list *object_children(const char *id)
+/* returns the list of an object's children */
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return _object_sidx_list(md5, 'c', XS_ALL);
+}
+
+
+xs_list *object_likes(const char *id)
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return _object_sidx_list(md5, 'l', XS_ALL);
+}
+
+
+xs_list *object_announces(const char *id)
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return _object_sidx_list(md5, 'a', XS_ALL);
+}
+
+
+int object_parent(const char *md5, char parent[MD5_HEX_SIZE])
+/* returns the object parent, if any */
+{
+    xs *l = _object_sidx_list(md5, 'p', 1);
+    const char *v = xs_list_get(l, 0);
+
+    if (v == NULL)
+        return 0;
+
+    strncpy(parent, v, MD5_HEX_SIZE);
+    return 1;
+}
+
+
+int object_admire(const char *id, const char *actor, int like)
+/* actor likes or announces this object */
+{
+    int status;
+    xs *md5   = xs_md5_hex(id, strlen(id));
+    xs *a_md5 = xs_md5_hex(actor, strlen(actor));
+
+    status = _object_sidx_add(md5, like ? 'l' : 'a', a_md5);
+
+    if (status == HTTP_STATUS_CREATED) {
+        srv_debug(1, xs_fmt("object_admire (%s) %s %s", like ? "Like" : "Announce", actor, id));
+        status = HTTP_STATUS_OK;
+    }
+
+    return status;
+}
+
+
+int object_unadmire(const char *id, const char *actor, int like)
+/* actor no longer likes or announces this object */
+{
+    int status;
+    xs *md5   = xs_md5_hex(id, strlen(id));
+    xs *a_md5 = xs_md5_hex(actor, strlen(actor));
+
+    status = _object_sidx_del(md5, like ? 'l' : 'a', a_md5);
+
+    srv_debug(0,
+        xs_fmt("object_unadmire (%s) %s %s %d", like ? "Like" : "Announce", actor, id, status));
+
+    return status;
+}
+
+
+xs_str *object_user_cache_fn_by_md5(snac *user, const char *md5, const char *cachedir)
+{
+    return xs_fmt("%s/%s/%s.json", user->basedir, cachedir, md5);
+}
+
+
+xs_str *object_user_cache_fn(snac *user, const char *id, const char *cachedir)
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return object_user_cache_fn_by_md5(user, md5, cachedir);
+}
+
+
+xs_str *object_user_cache_index_fn(snac *user, const char *cachedir)
+{
+    return xs_fmt("%s/%s.idx", user->basedir, cachedir);
+}
+
+
+int _object_user_cache(snac *user, const char *id, const char *cachedir, int del)
+/* adds or deletes from a user cache */
+{
+    xs *ofn = _object_fn(id);
+    xs *cfn = object_user_cache_fn(user, id, cachedir);
+    xs *idx = object_user_cache_index_fn(user, cachedir);
+    int ret;
+
+    if (object_store_is_seg()) {
+        /* no links to the object files: the index is the cache */
+        if (del)
+            ret = valid_status(index_del(idx, id)) ? 0 : -1;
+        else
+        if (!object_here(id) || index_in(idx, id))
+            ret = -1;
+        else
+            ret = valid_status(index_add(idx, id)) ? 0 : -1;
+
+        return ret;
+    }
+
+    if (del) {
+        ret = unlink(cfn);
+        index_del(idx, id);
+    }
+    else {
+        /* create the subfolder, if it does not exist */
+        xs *dir = xs_fmt("%s/%s/", user->basedir, cachedir);
+        mkdirx(dir);
+
+        if ((ret = link(ofn, cfn)) != -1)
+            index_add(idx, id);
+    }
+
+    return ret;
+}
+
+
+int object_user_cache_add(snac *user, const char *id, const char *cachedir)
+/* caches an object into a user cache */
+{
+    return _object_user_cache(user, id, cachedir, 0);
+}
+
+
+int object_user_cache_del(snac *user, const char *id, const char *cachedir)
+/* deletes an object from a user cache */
+{
+    return _object_user_cache(user, id, cachedir, 1);
+}
+
+
+int object_user_cache_in_by_md5(snac *user, const char *md5, const char *cachedir)
+/* checks if an object is stored in a cache */
+{
+    if (object_store_is_seg()) {
+        xs *idx = object_user_cache_index_fn(user, cachedir);
+        return index_in_md5(idx, md5);
+    }
+
+    xs *cfn = object_user_cache_fn_by_md5(user, md5, cachedir);
+    return !!(mtime(cfn) != 0.0);
+}
+
+
+int object_user_cache_in(snac *user, const char *id, const char *cachedir)
+/* checks if an object is stored in a cache */
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return object_user_cache_in_by_md5(user, md5, cachedir);
+}
+
+
+xs_list *object_user_cache_list(snac *user, const char *cachedir, int max, int inv)
+/* returns the objects in a cache as a list */
+{
+    xs *idx = xs_fmt("%s/%s.idx", user->basedir, cachedir);
+    return inv ? index_list_desc(idx, 0, max) : index_list(idx, max);
+}
+
+
+/** specialized functions **/
+
+/** reverse follow index **/
+
+/* instance-wide indexes, one per remote actor or followed hashtag, with the
+   md5s of the local users that follow it or are followed by it; used to
+   know which users may be interested in what arrives to the shared inbox */
+
+xs_str *_rfollow_fn(const char *key)
+{
+    xs *md5 = xs_md5_hex(key, strlen(key));
+    return xs_fmt("%s/rfollow/%c%c/%s.idx", srv_basedir, md5[0], md5[1], md5);
+}
+
+
+void rfollow_add(snac *user, const char *key)
+/* adds a user to the index of key */
+{
+    xs *g_dir = xs_fmt("%s/rfollow", srv_basedir);
+    xs *md5   = xs_md5_hex(key, strlen(key));
+    xs *dir   = xs_fmt("%s/%c%c", g_dir, md5[0], md5[1]);
+    xs *fn    = _rfollow_fn(key);
+
+    mkdirx(g_dir);
+    mkdirx(dir);
+
+    if (!index_in_md5(fn, user->md5))
+        index_add_md5(fn, user->md5);
+}
+
+
+void rfollow_del(snac *user, const char *key)
+/* deletes a user from the index of key */
+{
+    xs *fn = _rfollow_fn(key);
+
+    index_del_md5(fn, user->md5);
+}
+
+
+static void _rfollow_update(snac *user, const char *actor)
+/* updates the index of an actor after a follow relationship changed */
+{
+    if (following_check(user, actor) || follower_check(user, actor))
+        rfollow_add(user, actor);
+    else
+        rfollow_del(user, actor);
+}
+
+
+xs_list *rfollow_list(const char *key)
+/* returns the uids of the local users in the index of key */
+{
+    xs *fn   = _rfollow_fn(key);
+    xs *md5s = index_list(fn, XS_ALL);
+    xs_list *list = xs_list_new();
+    const char *md5;
+
+    xs_list_foreach(md5s, md5) {
+        xs *uid = _user_map_get(1, md5);
+
+        if (uid != NULL)
+            list = xs_list_append(list, uid);
+    }
+
+    return list;
+}
+
+
+/** followers **/
+
+int follower_add(snac *snac, const char *actor)
+/* adds a follower */
+{
+    int ret = object_user_cache_add(snac, actor, "followers");
+
+    _rfollow_update(snac, actor);
+
+    snac_debug(snac, 2, xs_fmt("follower_add %s", actor));
+
+    return ret == -1 ? HTTP_STATUS_INTERNAL_SERVER_ERROR : HTTP_STATUS_OK;
+}
+
+
+int follower_del(snac *snac, const char *actor)
+/* deletes a follower */
+{
+    int ret = object_user_cache_del(snac, actor, "followers");
+
+    _rfollow_update(snac, actor);
+
+    snac_debug(snac, 2, xs_fmt("follower_del %s", actor));
+
+    return ret == -1 ? HTTP_STATUS_NOT_FOUND : HTTP_STATUS_OK;
+}
+
+
+int follower_check(snac *snac, const char *actor)
+/* checks if someone is a follower */
+{
+    return object_user_cache_in(snac, actor, "followers");
+}
+
+
+xs_list *follower_list(snac *snac)
+/* returns the list of followers */
+{
+    xs *list       = object_user_cache_list(snac, "followers", XS_ALL, 0);
+    xs_list *fwers = xs_list_new();
+    char *p;
+    const char *v;
+
+    /* resolve the list of md5 to be a list of actors */
+    p = list;
+    while (xs_list_iter(&p, &v)) {
+        xs *a_obj = NULL;
+
+        if (valid_status(object_get_by_md5(v, &a_obj))) {
+            const char *actor = xs_dict_get(a_obj, "id");
+
+            if (!xs_is_null(actor)) {
+                /* check if the actor is still cached */
+                if (object_user_cache_in_by_md5(snac, v, "followers"))
+                    fwers = xs_list_append(fwers, actor);
+            }
+        }
+    }
+
+    return fwers;
+}
+
+
+/** pending followers **/
+
+int pending_add(snac *user, const char *actor, const xs_dict *msg)
+/* stores the follow message for later confirmation */
+{
+    xs *dir = xs_fmt("%s/pending", user->basedir);
+    xs *md5 = xs_md5_hex(actor, strlen(actor));
+    xs *fn  = xs_fmt("%s/%s.json", dir, md5);
+    FILE *f;
+
+    mkdirx(dir);
+
+    if ((f = fopen(fn, "w")) == NULL)
+        return -1;
+
+    data_dump(msg, f);
+    fclose(f);
+
+    return 0;
+}
+
+
+int pending_check(snac *user, const char *actor)
+/* checks if there is a pending follow confirmation for the actor */
+{
+    xs *md5 = xs_md5_hex(actor, strlen(actor));
+    xs *fn = xs_fmt("%s/pending/%s.json", user->basedir, md5);
+
+    return mtime(fn) != 0;
+}
+
+
+xs_dict *pending_get(snac *user, const char *actor)
+/* returns the pending follow confirmation for the actor */
+{
+    xs *md5 = xs_md5_hex(actor, strlen(actor));
+    xs *fn = xs_fmt("%s/pending/%s.json", user->basedir, md5);
+    xs_dict *msg = NULL;
+    FILE *f;
+
+    if ((f = fopen(fn, "r")) != NULL) {
+        msg = data_load(f);
+        fclose(f);
+    }
+
+    return msg;
+}
+
+
+void pending_del(snac *user, const char *actor)
+/* deletes a pending follow confirmation for the actor */
+{
+    xs *md5 = xs_md5_hex(actor, strlen(actor));
+    xs *fn = xs_fmt("%s/pending/%s.json", user->basedir, md5);
+
+    unlink(fn);
+}
+
+
+xs_list *pending_list(snac *user)
+/* returns a list of pending follow confirmations */
+{
+    xs *spec = xs_fmt("%s/pending/""*.json", user->basedir);
+    xs *l = xs_glob(spec, 0, 0);
+    xs_list *r = xs_list_new();
+    const char *v;
+
+    xs_list_foreach(l, v) {
+        FILE *f;
+        xs *msg = NULL;
+
+        if ((f = fopen(v, "r")) == NULL)
+            continue;
+
+        msg = data_load(f);
+        fclose(f);
+
+        if (msg == NULL)
+            continue;
+
+        const char *actor = xs_dict_get(msg, "actor");
+
+        if (xs_type(actor) == XSTYPE_STRING)
+            r = xs_list_append(r, actor);
+    }
+
+    return r;
+}
+
+
+/** timeline **/
+
+double timeline_mtime(snac *snac)
+{
+    xs *fn = xs_fmt("%s/private.idx", snac->basedir);
+    return mtime(fn);
+}
+
+
+int timeline_touch(snac *snac)
+/* changes the date of the timeline index */
+{
+    xs *fn = xs_fmt("%s/private.idx", snac->basedir);
+    return utimes(fn, NULL);
+}
+
+
+xs_str *timeline_fn_by_md5(snac *snac, const char *md5)
+/* get the filename of an entry by md5 from any timeline */
+{
+    xs_str *fn = NULL;
+
+    if (is_md5_hex(md5)) {
+        fn = xs_fmt("%s/private/%s.json", snac->basedir, md5);
+
+        if (mtime(fn) == 0.0) {
+            fn = xs_free(fn);
+            fn = xs_fmt("%s/public/%s.json", snac->basedir, md5);
+
+            if (mtime(fn) == 0.0)
+                fn = xs_free(fn);
+        }
+    }
+
+    return fn;
+}
+
+
+int timeline_here(snac *snac, const char *md5)
+/* checks if an object is in the user cache */
+{
+    if (object_store_is_seg())
+        return object_user_cache_in_by_md5(snac, md5, "private") ||
+               object_user_cache_in_by_md5(snac, md5, "public");
+
+    xs *fn = timeline_fn_by_md5(snac, md5);
+
+    return !(fn == NULL);
+}
+
+
+int timeline_get_by_md5(snac *snac, const char *md5, xs_dict **msg)
+/* gets a message from the timeline */
+{
+    int status = HTTP_STATUS_NOT_FOUND;
+    FILE *f    = NULL;
+
+    if (!timeline_here(snac, md5))
+        return status;
+
+    /* the user caches are links to the objects, so use the object cache */
+    if (valid_status(status = object_get_by_md5(md5, msg)) || object_store_is_seg())
+        return status;
+
+    xs *fn = timeline_fn_by_md5(snac, md5);
+
+    if (fn != NULL && (f = fopen(fn, "r")) != NULL) {
+        *msg = data_load(f);
+        fclose(f);
+
+        if (*msg != NULL)
+            status = HTTP_STATUS_OK;
+    }
+
+    return status;
+}
+
+
+int timeline_del(snac *snac, const char *id)
+/* deletes a message from the timeline */
+{
+    /* delete from the user's caches */
+    object_user_cache_del(snac, id, "public");
+    object_user_cache_del(snac, id, "private");
+
+    unpin(snac, id);
+    unbookmark(snac, id);
+
+    /* try to delete the object if it's not used elsewhere */
+    return object_del_if_unref(id);
+}
+
+
+void timeline_update_indexes(snac *snac, const char *id)
+/* updates the indexes */
+{
+    object_user_cache_add(snac, id, "private");
+
+    if (xs_startswith(id, snac->actor)) {
+        xs *msg = NULL;
+
+        if (valid_status(object_get(id, &msg))) {
+            /* if its ours and is public, also store in public */
+            if (is_msg_public(msg)) {
+                if (object_user_cache_add(snac, id, "public") >= 0) {
+                    /* also add it to the instance public timeline */
+                    xs *ipt = xs_fmt("%s/public.idx", srv_basedir);
+                    index_add(ipt, id);
+                }
+                else
+                    srv_debug(1, xs_fmt("Not added to public instance index %s", id));
+            }
+        }
+    }
+}
+
+
+int timeline_add(snac *snac, const char *id, const xs_dict *o_msg)
+/* adds a message to the timeline */
+{
+    int ret = object_add(id, o_msg);
+    timeline_update_indexes(snac, id);
+
+    tag_index(id, o_msg);
+
+    list_distribute(snac, NULL, o_msg);
+
+    snac_debug(snac, 1, xs_fmt("timeline_add %s", id));
+
+    return ret;
+}
+
+
+int timeline_admire(snac *snac, const char *id, const char *admirer, int like)
+/* updates a timeline entry with a new admiration */
+{
+    /* if we are admiring this, add to both timelines */
+    if (!like && strcmp(admirer, snac->actor) == 0) {
+        object_user_cache_add(snac, id, "public");
+        object_user_cache_add(snac, id, "private");
+    }
+
+    int ret = object_admire(id, admirer, like);
+
+    snac_debug(snac, 1, xs_fmt("timeline_admire (%s) %s %s",
+            like ? "Like" : "Announce", id, admirer));
+
+    return ret;
+}
+
+
+xs_list *timeline_top_level(snac *snac, const xs_list *list)
+/* returns the top level md5 entries from this index */
+{
+    xs_set seen;
+    const xs_str *v;
+
+    xs_set_init(&seen);
+
+    int c = 0;
+    while (xs_list_next(list, &v, &c)) {
+        char line[MD5_HEX_SIZE] = "";
+
+        strncpy(line, v, sizeof(line));
+
+        for (;;) {
+            char line2[MD5_HEX_SIZE];
+
+            /* if it doesn't have a parent, use this */
+            if (!object_parent(line, line2))
+                break;
+
+            /* well, there is a parent... but is it here? */
+            if (!timeline_here(snac, line2))
+                break;
+
+            /* it's here! try again with its own parent */
+            strncpy(line, line2, sizeof(line));
+        }
+
+        xs_set_add(&seen, line);
+    }
+
+    return xs_set_result(&seen);
+}
+
+
+xs_str *user_index_fn(snac *user, const char *idx_name)
+/* returns the filename of a user index */
+{
+    return xs_fmt("%s/%s.idx", user->basedir, idx_name);
+}
+
+
+xs_list *timeline_simple_list(snac *user, const char *idx_name, int skip, int show, int *more)
+/* returns a timeline (with all entries) */
+{
+    xs *idx = user_index_fn(user, idx_name);
+
+    /* if a more flag is sent, request one more */
+    xs_list *lst = index_list_desc(idx, skip, show + (more != NULL ? 1 : 0));
+
+    if (more != NULL) {
+        if (xs_list_len(lst) > show) {
+            *more = 1;
+            lst = xs_list_del(lst, -1);
+        }
+        else
+            *more = 0;
+    }
+
+    return lst;
+}
+
+
+xs_list *timeline_list(snac *snac, const char *idx_name, int skip, int show, int *more)
+/* returns a timeline (only top level entries) */
+{
+    int c_max;
+
+    /* maximum number of items in the timeline */
+    c_max = xs_number_get(xs_dict_get(srv_config, "max_timeline_entries"));
+
+    /* never more timeline entries than the configured maximum */
+    if (show > c_max)
+        show = c_max;
+
+    xs *list = timeline_simple_list(snac, idx_name, skip, show, more);
+
+    return timeline_top_level(snac, list);
+}
+
+
+void timeline_add_mark(snac *user)
+/* adds an "already seen" mark to the private timeline */
+{
+    xs *fn = xs_fmt("%s/private.idx", user->basedir);
+    char last_entry[MD5_HEX_SIZE] = "";
+    t_index idx;
+
+    /* get the last entry in the index */
+    if (index_open(&idx, fn)) {
+        index_desc_first(&idx, last_entry, 0);
+        index_close(&idx);
+    }
+
+    /* is the last entry *not* a mark? */
+    if (strcmp(last_entry, MD5_ALREADY_SEEN_MARK) != 0) {
+        /* add it */
+        index_add_md5(fn, MD5_ALREADY_SEEN_MARK);
+    }
+}
+
+
+xs_str *instance_index_fn(void)
+{
+    return xs_fmt("%s/public.idx", srv_basedir);
+}
+
+
+xs_list *timeline_instance_list(int skip, int show)
+/* returns the timeline for the full instance */
+{
+    xs *idx = instance_index_fn();
+    xs *lst = index_list_desc(idx, skip, show);
+
+    /* make the list unique */
+    xs_set rep;
+    xs_set_init(&rep);
+    const char *md5;
+
+    xs_list_foreach(lst, md5)
+        xs_set_add(&rep, md5);
+
+    return xs_set_result(&rep);
+}
+
+
+/** following **/
+
+/* this needs special treatment and cannot use the object db as is,
+   with a link to a cached author, because we need the Follow object
+   in case we need to unfollow (Undo + original Follow) */
+
+xs_str *_following_fn(snac *snac, const char *actor)
+{
+    xs *md5 = xs_md5_hex(actor, strlen(actor));
+    return xs_fmt("%s/following/%s.json", snac->basedir, md5);
+}
+
+
+int following_add(snac *snac, const char *actor, const xs_dict *msg)
+/* adds to the following list */
+{
+    int ret = HTTP_STATUS_CREATED;
+    xs *fn = _following_fn(snac, actor);
+    FILE *f;
+    xs *p_object = NULL;
+
+    if (valid_status(following_get(snac, actor, &p_object))) {
+        /* object already exists; if it's of type Accept,
+           the actor is already being followed and confirmed,
+           so do nothing */
+        const char *type = xs_dict_get(p_object, "type");
+
+        if (!xs_is_null(type) && strcmp(type, "Accept") == 0) {
+            snac_debug(snac, 1, xs_fmt("following_add actor already confirmed %s", actor));
+            return HTTP_STATUS_OK;
+        }
+    }
+
+    if ((f = fopen(fn, "w")) != NULL) {
+        data_dump(msg, f);
+        fclose(f);
+
+        if (!object_store_is_seg()) {
+            /* get the filename of the actor object */
+            xs *actor_fn = _object_fn(actor);
+
+            /* increase its reference count */
+            fn = xs_replace_i(fn, ".json", "_a.json");
+            link(actor_fn, fn);
+        }
+
+        _rfollow_update(snac, actor);
+    }
+    else
+        ret = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+
+    snac_debug(snac, 2, xs_fmt("following_add %s %s", actor, fn));
+
+    return ret;
+}
+
+
+int following_del(snac *snac, const char *actor)
+/* we're not following this actor any longer */
+{
+    xs *fn = _following_fn(snac, actor);
+
+    snac_debug(snac, 2, xs_fmt("following_del %s %s", actor, fn));
+
+    unlink(fn);
+
+    /* also delete the reference to the author */
+    fn = xs_replace_i(fn, ".json", "_a.json");
+    unlink(fn);
+
+    _rfollow_update(snac, actor);
+
+    return HTTP_STATUS_OK;
+}
+
+
+int following_check(snac *snac, const char *actor)
+/* checks if we are following this actor */
+{
+    xs *fn = _following_fn(snac, actor);
+
+    return !!(mtime(fn) != 0.0);
+}
+
+
+int following_get(snac *snac, const char *actor, xs_dict **data)
+/* returns the 'Follow' object */
+{
+    xs *fn = _following_fn(snac, actor);
+    FILE *f;
+    int status = HTTP_STATUS_OK;
+
+    if ((f = fopen(fn, "r")) != NULL) {
+        *data = data_load(f);
+        fclose(f);
+    }
+    else
+        status = HTTP_STATUS_NOT_FOUND;
+
+    return status;
+}
+
+
+xs_list *following_list(snac *snac)
+/* returns the list of people being followed */
+{
+    xs *spec = xs_fmt("%s/following/" "*.json", snac->basedir);
+    xs *glist = xs_glob(spec, 0, 0);
+    xs_list *p;
+    const xs_str *v;
+    xs_list *list = xs_list_new();
+
+    /* iterate the list of files */
+    p = glist;
+    while (xs_list_iter(&p, &v)) {
+        FILE *f;
+
+        /* load the follower data */
+        if ((f = fopen(v, "r")) != NULL) {
+            xs *o = data_load(f);
+            fclose(f);
+
+            if (o != NULL) {
+                const char *type = xs_dict_get(o, "type");
+
+                if (!xs_is_null(type) && strcmp(type, "Accept") == 0) {
+                    const char *actor = xs_dict_get(o, "actor");
+
+                    if (!xs_is_null(actor)) {
+                        list = xs_list_append(list, actor);
+
+                        /* check if there is a link to the actor object */
+                        xs *v2 = xs_replace(v, ".json", "_a.json");
+
+                        if (!object_store_is_seg() && mtime(v2) == 0.0) {
+                            /* no; add a link to it */
+                            xs *actor_fn = _object_fn(actor);
+                            link(actor_fn, v2);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return list;
+}
+
+
+
+xs_str *_muted_fn(snac *snac, const char *actor)
+{
+    xs *md5 = xs_md5_hex(actor, strlen(actor));
+    return xs_fmt("%s/muted/%s", snac->basedir, md5);
+}
+
+
+void mute(snac *snac, const char *actor)
+/* mutes a moron */
+{
+    xs *fn = _muted_fn(snac, actor);
+    FILE *f;
+
+    if ((f = fopen(fn, "w")) != NULL) {
+        fprintf(f, "%s\n", actor);
+        fclose(f);
+
+        snac_debug(snac, 2, xs_fmt("muted %s %s", actor, fn));
+    }
+}
+
+
+void unmute(snac *snac, const char *actor)
+/* actor is no longer a moron */
+{
+    xs *fn = _muted_fn(snac, actor);
+
+    unlink(fn);
+
+    snac_debug(snac, 2, xs_fmt("unmuted %s %s", actor, fn));
+}
+
+
+int is_muted(snac *snac, const char *actor)
+/* check if someone is muted */
+{
+    xs *fn = _muted_fn(snac, actor);
+
+    return !!(mtime(fn) != 0.0);
+}
+
+
+xs_list *muted_list(snac *user)
+/* returns the list (actor URLs) of the muted morons */
+{
+    xs_list *l = xs_list_new();
+    xs *spec = xs_fmt("%s/muted/" "*", user->basedir);
+    xs *files = xs_glob(spec, 0, 0);
+    const char *fn;
+
+    xs_list_foreach(files, fn) {
+        FILE *f;
+
+        if ((f = fopen(fn, "r")) != NULL) {
+            xs *actor = xs_strip_i(xs_readline(f));
+            fclose(f);
+
+            l = xs_list_append(l, actor);
+        }
+    }
+
+    return l;
+}
+
+
+/** bookmarking **/
+
+int is_bookmarked(snac *user, const char *id)
+/* returns true if this note is bookmarked */
+{
+    return object_user_cache_in(user, id, "bookmark");
+}
+
+
+int bookmark(snac *user, const char *id)
+/* bookmarks a post */
+{
+    if (is_bookmarked(user, id))
+        return -3;
+
+    return object_user_cache_add(user, id, "bookmark");
+}
+
+
+int unbookmark(snac *user, const char *id)
+/* unbookmarks a post */
+{
+    return object_user_cache_del(user, id, "bookmark");
+}
+
+
+xs_list *bookmark_list(snac *user)
+/* return the lists of bookmarked posts */
+{
+    return object_user_cache_list(user, "bookmark", XS_ALL, 1);
+}
+
+
+xs_str *bookmark_index_fn(snac *user)
+{
+    return object_user_cache_index_fn(user, "bookmark");
+}
+
+
+/** pinning **/
+
+int is_pinned(snac *user, const char *id)
+/* returns true if this note is pinned */
+{
+    return object_user_cache_in(user, id, "pinned");
+}
+
+
+int is_pinned_by_md5(snac *user, const char *md5)
+{
+    return object_user_cache_in_by_md5(user, md5, "pinned");
+}
+
+
+int pin(snac *user, const char *id)
+/* pins a message */
+{
+    int ret = -2;
+
+    if (xs_startswith(id, user->actor)) {
+        if (is_pinned(user, id))
+            ret = -3;
+        else
+            ret = object_user_cache_add(user, id, "pinned");
+    }
+
+    return ret;
+}
+
+
+int unpin(snac *user, const char *id)
+/* unpin a message */
+{
+    return object_user_cache_del(user, id, "pinned");
+}
+
+
+xs_list *pinned_list(snac *user)
+/* return the lists of pinned posts */
+{
+    return object_user_cache_list(user, "pinned", XS_ALL, 1);
+}
+
+
+/** drafts **/
+
+int is_draft(snac *user, const char *id)
+/* returns true if this note is a draft */
+{
+    return object_user_cache_in(user, id, "draft");
+}
+
+
+void draft_del(snac *user, const char *id)
+/* delete a message from the draft cache */
+{
+    object_user_cache_del(user, id, "draft");
+}
+
+
+void draft_add(snac *user, const char *id, const xs_dict *msg)
+/* store the message as a draft */
+{
+    /* delete from the index, in case it was already there */
+    draft_del(user, id);
+
+    /* overwrite object */
+    object_add_ow(id, msg);
+
+    /* [re]add to the index */
+    object_user_cache_add(user, id, "draft");
+}
+
+
+xs_list *draft_list(snac *user)
+/* return the lists of drafts */
+{
+    return object_user_cache_list(user, "draft", XS_ALL, 1);
+}
+
+
+/** scheduled posts **/
+
+int is_scheduled(snac *user, const char *id)
+/* returns true if this note is scheduled for future sending */
+{
+    return object_user_cache_in(user, id, "sched");
+}
+
+
+static void _scheduled_at(snac *user, const xs_dict *msg)
+/* tells the queue scheduler when a scheduled post is due */
+{
+    const char *published = xs_dict_get(msg, "published");
+
+    if (xs_is_string(published)) {
+        xs *idx = object_user_cache_index_fn(user, "sched");
+
+        /* one second later, as it must be strictly in the past */
+        queue_sched_at(idx, xs_parse_iso_date(published, 0) + 1);
+    }
+}
+
+
+void schedule_del(snac *user, const char *id)
+/* deletes an scheduled post */
+{
+    object_user_cache_del(user, id, "sched");
+}
+
+
+void schedule_add(snac *user, const char *id, const xs_dict *msg)
+/* schedules this post for later */
+{
+    /* delete from the index, in case it was already there */
+    schedule_del(user, id);
+
+    /* overwrite object */
+    object_add_ow(id, msg);
+
+    /* [re]add to the index */
+    object_user_cache_add(user, id, "sched");
+
+    _scheduled_at(user, msg);
+}
+
+
+xs_list *scheduled_list(snac *user)
+/* return the list of scheduled posts */
+{
+    return object_user_cache_list(user, "sched", XS_ALL, 1);
+}
+
+
+void scheduled_process(snac *user)
+/* processes the scheduled list, sending those ready to be sent */
+{
+    xs *posts = scheduled_list(user);
+    const char *md5;
+    xs *right_now = xs_str_utctime(0, ISO_DATE_SPEC);
+    xs *next = NULL;
+
+    xs_list_foreach(posts, md5) {
+        xs *msg = NULL;
+
+        if (valid_status(object_get_by_md5(md5, &msg))) {
+            if (strcmp(xs_dict_get(msg, "published"), right_now) < 0) {
+                /* due date! */
+                const char *id = xs_dict_get(msg, "id");
+
+                timeline_add(user, id, msg);
+
+                xs *c_msg = msg_create(user, msg);
+                enqueue_message(user, c_msg);
+
+                schedule_del(user, id);
+            }
+            else
+            if (next == NULL || strcmp(xs_dict_get(msg, "published"),
+                                       xs_dict_get(next, "published")) < 0) {
+                xs_free(next);
+                next = xs_dup(msg);
+            }
+        }
+    }
+
+    /* wake up again when the next one is due */
+    if (next != NULL)
+        _scheduled_at(user, next);
+}
+
+
+/** hiding **/
+
+xs_str *_hidden_fn(snac *snac, const char *id)
+{
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    return xs_fmt("%s/hidden/%s", snac->basedir, md5);
+}
+
+
+void hide(snac *snac, const char *id)
+/* hides a message tree */
+{
+    xs *fn = _hidden_fn(snac, id);
+    FILE *f;
+
+    if ((f = fopen(fn, "w")) != NULL) {
+        fprintf(f, "%s\n", id);
+        fclose(f);
+
+        snac_debug(snac, 2, xs_fmt("hidden %s %s", id, fn));
+
+        /* hide all the children */
+        xs *chld = object_children(id);
+        char *p;
+        const char *v;
+
+        p = chld;
+        while (xs_list_iter(&p, &v)) {
+            xs *co = NULL;
+
+            /* resolve to get the id */
+            if (valid_status(object_get_by_md5(v, &co))) {
+                const char *id = xs_dict_get(co, "id");
+                if (id != NULL)
+                    hide(snac, id);
+            }
+        }
+    }
+}
+
+
+int is_hidden(snac *snac, const char *id)
+/* check is id is hidden */
+{
+    xs *fn = _hidden_fn(snac, id);
+
+    return !!(mtime(fn) != 0.0);
+}
+
+
+int actor_add(const char *actor, const xs_dict *msg)
+/* adds an actor */
+{
+    /* its public key may have changed */
+    key_cache_del(actor);
+
+    return object_add_ow(actor, msg);
+}
+
+
+int actor_get(const char *actor, xs_dict **data)
+/* returns an already downloaded actor */
+{
+    int status = HTTP_STATUS_OK;
+    xs_dict *d = NULL;
+
+    if (xs_startswith(actor, srv_baseurl)) {
+        /* it's a (possible) local user */
+        xs *l = xs_split(actor, "/");
+        const char *uid = xs_list_get(l, -1);
+        snac user;
+
+        if (!xs_is_null(uid) && user_open(&user, uid)) {
+            if (data)
+                *data = msg_actor(&user);
+
+            user_free(&user);
+            return HTTP_STATUS_OK;
+        }
+        else
+            return HTTP_STATUS_NOT_FOUND;
+    }
+
+    /* read the object */
+    if (!valid_status(status = object_get(actor, &d))) {
+        d = xs_free(d);
+        return status;
+    }
+
+    /* if the object is corrupted, discard it */
+    if (xs_is_null(xs_dict_get(d, "id")) || xs_is_null(xs_dict_get(d, "type"))) {
+        srv_debug(1, xs_fmt("corrupted actor object %s", actor));
+        d = xs_free(d);
+        return HTTP_STATUS_NOT_FOUND;
+    }
+
+    if (data)
+        *data = d;
+    else
+        d = xs_free(d);
+
+    double max_time;
+
+    /* maximum time for the actor data to be considered stale */
+    max_time = 3600.0 * 36.0;
+
+    if (object_mtime(actor) + max_time < (double) time(NULL)) {
+        /* actor data exists but also stinks */
+        status = HTTP_STATUS_RESET_CONTENT; /* "110: Response Is Stale" */
+    }
+
+    return status;
+}
+
+
+int actor_get_refresh(snac *user, const char *actor, xs_dict **data)
+/* gets an actor and requests a refresh if it's stale */
+{
+    int status = actor_get(actor, data);
+
+    if (status == HTTP_STATUS_RESET_CONTENT && user && !xs_startswith(actor, srv_baseurl))
+        enqueue_actor_refresh(user, actor, 0);
+
+    return status;
+}
+
+
+/** user limiting (announce blocks) **/
+
+int limited(snac *user, const char *id, int cmd)
+/* announce messages from a followed (0: check, 1: limit; 2: unlimit) */
+{
+    int ret = 0;
+    xs *dir = xs_fmt("%s/limited", user->basedir);
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    xs *fn  = xs_fmt("%s/%s", dir, md5);
+
+    switch (cmd) {
+    case 0: /** check **/
+        ret = !!(mtime(fn) > 0.0);
+        break;
+
+    case 1: /** limit **/
+        mkdirx(dir);
+
+        if (mtime(fn) > 0.0)
+            ret = -1;
+        else {
+            FILE *f;
+
+            if ((f = fopen(fn, "w")) != NULL) {
+                fprintf(f, "%s\n", id);
+                fclose(f);
+            }
+            else
+                ret = -2;
+        }
+        break;
+
+    case 2: /** unlimit **/
+        if (mtime(fn) > 0.0)
+            ret = unlink(fn);
+        else
+            ret = -1;
+        break;
+    }
+
+    return ret;
+}
+
+
+/** tag indexing **/
+
+void tag_index(const char *id, const xs_dict *obj)
+/* update the tag indexes for this object */
+{
+    const xs_list *tags = xs_dict_get(obj, "tag");
+    xs *md5_id = xs_md5_hex(id, strlen(id));
+
+    if (is_msg_public(obj) && xs_type(tags) == XSTYPE_LIST && xs_list_len(tags) > 0) {
+        xs *g_tag_dir = xs_fmt("%s/tag", srv_basedir);
+
+        mkdirx(g_tag_dir);
+
+        const xs_dict *v;
+        int ct = 0;
+        while (xs_list_next(tags, &v, &ct)) {
+            const char *type = xs_dict_get(v, "type");
+            const char *name = xs_dict_get(v, "name");
+
+            if (!xs_is_null(type) && !xs_is_null(name) && strcmp(type, "Hashtag") == 0) {
+                while (*name == '#' || *name == '@')
+                    name++;
+
+                if (*name == '\0')
+                    continue;
+
+                name = xs_tolower_i((xs_str *)name);
+
+                xs *md5_tag   = xs_md5_hex(name, strlen(name));
+                xs *tag_dir   = xs_fmt("%s/%c%c", g_tag_dir, md5_tag[0], md5_tag[1]);
+                mkdirx(tag_dir);
+
+                xs *g_tag_idx = xs_fmt("%s/%s.idx", tag_dir, md5_tag);
+
+                if (!index_in_md5(g_tag_idx, md5_id))
+                    index_add_md5(g_tag_idx, md5_id);
+
+                FILE *f;
+                xs *g_tag_name = xs_replace(g_tag_idx, ".idx", ".tag");
+                if ((f = fopen(g_tag_name, "w")) != NULL) {
+                    fprintf(f, "%s\n", name);
+                    fclose(f);
+                }
+
+                srv_debug(0, xs_fmt("tagged %s #%s (#%s)", id, name, md5_tag));
+            }
+        }
+    }
+}
+
+
+xs_str *tag_fn(const char *tag)
+{
+    if (*tag == '#')
+        tag++;
+
+    xs *lw_tag = xs_tolower_i(xs_dup(tag));
+    xs *md5    = xs_md5_hex(lw_tag, strlen(lw_tag));
+
+    return xs_fmt("%s/tag/%c%c/%s.idx", srv_basedir, md5[0], md5[1], md5);
+}
+
+
+xs_list *tag_search(const char *tag, int skip, int show)
+/* returns the list of posts tagged with tag */
+{
+    xs *idx = tag_fn(tag);
+
+    return index_list_desc(idx, skip, show);
+}
+
+
+/** lists **/
+
+xs_val *list_maint(snac *user, const char *list, int op)
+/* list maintenance */
+{
+    xs_val *l = NULL;
+
+    switch (op) {
+    case 0: /** list of lists **/
+        {
+            FILE *f;
+            xs *spec = xs_fmt("%s/list/" "*.id", user->basedir);
+            xs *ls   = xs_glob(spec, 0, 0);
+            int c = 0;
+            const char *v;
+
+            l = xs_list_new();
+
+            while (xs_list_next(ls, &v, &c)) {
+                if ((f = fopen(v, "r")) != NULL) {
+                    xs *title = xs_readline(f);
+                    fclose(f);
+
+                    title = xs_strip_i(title);
+
+                    xs *v2 = xs_replace(v, ".id", "");
+                    xs *l2 = xs_split(v2, "/");
+
+                    /* return [ list_id, list_title ] */
+                    l = xs_list_append(l, xs_list_append(xs_list_new(), xs_list_get(l2, -1), title));
+                }
+            }
+        }
+
+        break;
+
+    case 1: /** create new list (list is the name) **/
+        {
+            xs *lol = list_maint(user, NULL, 0);
+            int c = 0;
+            const xs_list *v;
+            int add = 1;
+
+            /* check if this list name already exists */
+            while (xs_list_next(lol, &v, &c)) {
+                if (strcmp(xs_list_get(v, 1), list) == 0) {
+                    add = 0;
+
+                    l = xs_dup(xs_list_get(v, 0));
+
+                    break;
+                }
+            }
+
+            if (add) {
+                FILE *f;
+                xs *dir = xs_fmt("%s/list/", user->basedir);
+
+                l = xs_fmt("%010x", time(NULL));
+
+                mkdirx(dir);
+
+                xs *fn = xs_fmt("%s%s.id", dir, l);
+
+                if ((f = fopen(fn, "w")) != NULL) {
+                    fprintf(f, "%s\n", list);
+                    fclose(f);
+                }
+            }
+        }
+
+        break;
+
+    case 2: /** delete list (list is the id) **/
+        {
+            if (xs_is_hex(list)) {
+                xs *fn = xs_fmt("%s/list/%s.id", user->basedir, list);
+                unlink(fn);
+
+                fn = xs_replace_i(fn, ".id", ".lst");
+                index_unlink(fn);
+
+                fn = xs_replace_i(fn, ".lst", ".idx");
+                index_unlink(fn);
+
+                fn = xs_str_cat(fn, ".bak");
+                unlink(fn);
+            }
+        }
+
+        break;
+
+    case 3: /** get list name **/
+        if (xs_is_hex(list)) {
+            FILE *f;
+            xs *fn = xs_fmt("%s/list/%s.id", user->basedir, list);
+
+            if ((f = fopen(fn, "r")) != NULL) {
+                l = xs_strip_i(xs_readline(f));
+                fclose(f);
+            }
+        }
+
+        break;
+    }
+
+    return l;
+}
+
+
+xs_str *list_timeline_fn(snac *user, const char *list)
+{
+    return xs_fmt("%s/list/%s.idx", user->basedir, list);
+}
+
+
+xs_list *list_timeline(snac *user, const char *list, int skip, int show)
+/* returns the timeline of a list */
+{
+    xs_list *l = NULL;
+
+    if (!xs_is_hex(list))
+        return NULL;
+
+    xs *fn = list_timeline_fn(user, list);
+
+    if (mtime(fn) > 0.0)
+        l = index_list_desc(fn, skip, show);
+    else
+        l = xs_list_new();
+
+    return l;
+}
+
+
+xs_val *list_content(snac *user, const char *list, const char *actor_md5, int op)
+/* list content management */
+{
+    xs_val *l = NULL;
+
+    if (!xs_is_hex(list))
+        return NULL;
+
+    if (actor_md5 != NULL && !xs_is_hex(actor_md5))
+        return NULL;
+
+    xs *fn = xs_fmt("%s/list/%s.lst", user->basedir, list);
+
+    switch (op) {
+    case 0: /** list content **/
+        l = index_list(fn, XS_ALL);
+
+        break;
+
+    case 1: /** append actor to list **/
+        if (actor_md5 != NULL) {
+            if (!index_in_md5(fn, actor_md5))
+                index_add_md5(fn, actor_md5);
+        }
+
+        break;
+
+    case 2: /** delete actor from list **/
+        if (actor_md5 != NULL)
+            index_del_md5(fn, actor_md5);
+
+        break;
+
+    default:
+        srv_log(xs_fmt("ERROR: list_content: bad op %d", op));
+        break;
+    }
+
+    return l;
+}
+
+
+void list_distribute(snac *user, const char *who, const xs_dict *post)
+/* distributes the post to all appropriate lists */
+{
+    const char *id = xs_dict_get(post, "id");
+
+    /* if who is not set, use the attributedTo in the message */
+    if (xs_is_null(who))
+        who = get_atto(post);
+
+    if (xs_type(who) == XSTYPE_STRING && xs_type(id) == XSTYPE_STRING) {
+        xs *a_md5 = xs_md5_hex(who, strlen(who));
+        xs *i_md5 = xs_md5_hex(id, strlen(id));
+        xs *spec  = xs_fmt("%s/list/" "*.lst", user->basedir);
+        xs *ls    = xs_glob(spec, 0, 0);
+        int c = 0;
+        const char *v;
+
+        while (xs_list_next(ls, &v, &c)) {
+            /* is the actor in this list? */
+            if (index_in_md5(v, a_md5)) {
+                /* it is; add post md5 to its timeline */
+                xs *idx = xs_replace(v, ".lst", ".idx");
+                index_add_md5(idx, i_md5);
+
+                snac_debug(user, 1, xs_fmt("listed post %s in %s", id, idx));
+            }
+        }
+    }
+}
+
+
+/** static data **/
+
+static int _load_raw_file(const char *fn, xs_val **data, int *size,
+                        const char *inm, xs_str **etag)
+/* loads a cached file */
+{
+    int status = HTTP_STATUS_NOT_FOUND;
+
+    if (fn) {
+        double tm = mtime(fn);
+
+        if (tm > 0.0) {
+            /* file exists; build the etag */
+            xs *e = xs_fmt("W/\"snac-%.0lf\"", tm);
+
+            /* if if-none-match is set, check if it's the same */
+            if (!xs_is_null(inm) && strcmp(e, inm) == 0) {
+                /* client has the newest version */
+                status = HTTP_STATUS_NOT_MODIFIED;
+            }
+            else {
+                /* newer or never downloaded; read the full file */
+                FILE *f;
+
+                if ((f = fopen(fn, "rb")) != NULL) {
+                    *size = XS_ALL;
+                    *data = xs_read(f, size);
+                    fclose(f);
+
+                    status = HTTP_STATUS_OK;
+                }
+            }
+
+            /* if caller wants the etag, return it */
+            if (etag != NULL)
+                *etag = xs_dup(e);
+
+            srv_debug(1, xs_fmt("_load_raw_file(): %s %d", fn, status));
+        }
+    }
+
+    return status;
+}
+
+
+xs_str *_static_fn(snac *snac, const char *id)
+/* gets the filename for a static file */
+{
+    if (strchr(id, '/'))
+        return NULL;
+    else
+        return xs_fmt("%s/static/%s", snac->basedir, id);
+}
+
+
+int static_get(snac *snac, const char *id, xs_val **data, int *size,
+                const char *inm, xs_str **etag)
+/* returns static content */
+{
+    xs *fn = _static_fn(snac, id);
+
+    return _load_raw_file(fn, data, size, inm, etag);
+}
+
+
+void static_put(snac *snac, const char *id, const char *data, int size)
+/* writes status content */
+{
+    xs *fn = _static_fn(snac, id);
+    FILE *f;
+
+    if (fn && (f = fopen(fn, "wb")) != NULL) {
+        fwrite(data, size, 1, f);
+        fclose(f);
+    }
+}
+
+
+void static_put_meta(snac *snac, const char *id, const char *str)
+/* puts metadata (i.e. a media description string) to id */
+{
+    xs *fn = _static_fn(snac, id);
+
+    if (fn) {
+        fn = xs_str_cat(fn, ".txt");
+        FILE *f;
+
+        if ((f = fopen(fn, "w")) != NULL) {
+            fprintf(f, "%s\n", str);
+            fclose(f);
+        }
+    }
+}
+
+
+xs_str *static_get_meta(snac *snac, const char *id)
+/* gets metadata from a media */
+{
+    xs *fn    = _static_fn(snac, id);
+    xs_str *r = NULL;
+
+    if (fn) {
+        fn = xs_str_cat(fn, ".txt");
+        FILE *f;
+
+        if ((f = fopen(fn, "r")) != NULL) {
+            r = xs_strip_i(xs_readline(f));
+            fclose(f);
+        }
+    }
+    else
+        r = xs_str_new("");
+
+    return r;
+}
+
+
+/** history **/
+
+xs_str *_history_fn(snac *snac, const char *id)
+/* gets the filename for the history */
+{
+    if (strchr(id, '/'))
+        return NULL;
+    else
+        return xs_fmt("%s/history/%s", snac->basedir, id);
+}
+
+
+double history_mtime(snac *snac, const char *id)
+{
+    double t = 0.0;
+    xs *fn = _history_fn(snac, id);
+
+    if (fn != NULL)
+        t = mtime(fn);
+
+    return t;
+}
+
+
+void history_add(snac *snac, const char *id, const char *content, int size,
+                    xs_str **etag)
+/* adds something to the history */
+{
+    xs *fn = _history_fn(snac, id);
+    FILE *f;
+
+    if (fn && (f = fopen(fn, "w")) != NULL) {
+        fwrite(content, size, 1, f);
+        fclose(f);
+
+        if (etag) {
+            double tm = mtime(fn);
+            *etag = xs_fmt("W/\"snac-%.0lf\"", tm);
+        }
+    }
+}
+
+
+int history_get(snac *snac, const char *id, xs_str **content, int *size,
+                const char *inm, xs_str **etag)
+{
+    xs *fn = _history_fn(snac, id);
+
+    return _load_raw_file(fn, content, size, inm, etag);
+}
+
+
+int history_del(snac *snac, const char *id)
+{
+    xs *fn = _history_fn(snac, id);
+
+    if (fn)
+        return unlink(fn);
+    else
+        return -1;
+}
+
+
+xs_list *history_list(snac *snac)
+{
+    xs *spec = xs_fmt("%s/history/" "*.html", snac->basedir);
+
+    return xs_glob(spec, 1, 1);
+}
+
+
+void lastlog_write(snac *snac, const char *source)
+/* writes the last time the user logged in */
+{
+    xs *fn = xs_fmt("%s/lastlog.txt", snac->basedir);
+    FILE *f;
+
+    if ((f = fopen(fn, "w")) != NULL) {
+        fprintf(f, "%lf %s\n", ftime(), source);
+        fclose(f);
+    }
+}
+
+
+/** inbox collection **/
+
+void inbox_add(const char *inbox)
+/* collects a shared inbox */
+{
+    /* don't collect ourselves */
+    if (xs_startswith(inbox, srv_baseurl))
+        return;
+
+    xs *md5 = xs_md5_hex(inbox, strlen(inbox));
+    xs *fn  = xs_fmt("%s/inbox/%s", srv_basedir, md5);
+    FILE *f;
+
+    if ((f = fopen(fn, "w")) != NULL) {
+        fprintf(f, "%s\n", inbox);
+        fclose(f);
+    }
+}
+
+
+void inbox_add_by_actor(const xs_dict *actor)
+/* collects an actor's shared inbox, if it has one */
+{
+    const char *v;
+
+    if (!xs_is_null(v = xs_dict_get(actor, "endpoints")) &&
+        !xs_is_null(v = xs_dict_get(v, "sharedInbox"))) {
+        /* only collect this inbox if its instance is not blocked */
+        if (!is_instance_blocked(v))
+            inbox_add(v);
+    }
+}
+
+
+xs_list *inbox_list(void)
+/* returns the collected inboxes as a list */
+{
+    xs_list *ibl = xs_list_new();
+    xs *spec     = xs_fmt("%s/inbox/" "*", srv_basedir);
+    xs *files    = xs_glob(spec, 0, 0);
+    const xs_val *v;
+
+    xs_list_foreach(files, v) {
+        FILE *f;
+
+        if ((f = fopen(v, "r")) != NULL) {
+            xs *line = xs_readline(f);
+
+            if (line && *line) {
+                line = xs_strip_i(line);
+
+                if (!is_instance_blocked(line))
+                    ibl = xs_list_append(ibl, line);
+            }
+
+            fclose(f);
+        }
+    }
+
+    return ibl;
+}
+
+
+/** instance-wide operations **/
+
+xs_str *_instance_block_fn(const char *instance)
+{
+    xs *s   = xs_replace(instance, "http:/" "/", "");
+    xs *s1  = xs_replace(s, "https:/" "/", "");
+    xs *l   = xs_split(s1, "/");
+    const char *p = xs_list_get(l, 0);
+    xs *md5 = xs_md5_hex(p, strlen(p));
+
+    return xs_fmt("%s/block/%s", srv_basedir, md5);
+}
+
+
+int is_instance_blocked(const char *instance)
+{
+    xs *fn = _instance_block_fn(instance);
+
+    return !!(mtime(fn) != 0.0);
+}
+
+
+int instance_block(const char *instance)
+/* blocks a full instance */
+{
+    int ret;
+
+    /* create the subdir */
+    xs *dir = xs_fmt("%s/block/", srv_basedir);
+    mkdirx(dir);
+
+    if (!is_instance_blocked(instance)) {
+        xs *fn = _instance_block_fn(instance);
+        FILE *f;
+
+        if ((f = fopen(fn, "w")) != NULL) {
+            fprintf(f, "%s\n", instance);
+            fclose(f);
+
+            ret = 0;
+        }
+        else
+            ret = -1;
+    }
+    else
+        ret = -2;
+
+    return ret;
+}
+
+
+int instance_unblock(const char *instance)
+/* unblocks a full instance */
+{
+    int ret;
+
+    if (is_instance_blocked(instance)) {
+        xs *fn = _instance_block_fn(instance);
+        ret = unlink(fn);
+    }
+    else
+        ret = -2;
+
+    return ret;
+}
 
 
 /** operations by content **/
 
-int content_match(const char *file, const xs_dict *msg)
-/* checks if a message's content matches any of the regexes in file */
-/* file format: one regex per line */
+int content_match(const char *file, const xs_dict *msg)
+/* checks if a message's content matches any of the regexes in file */
+/* file format: one regex per line */
+{
+    xs *fn = xs_fmt("%s/%s", srv_basedir, file);
+    FILE *f;
+    int r = 0;
+    const char *v = xs_dict_get(msg, "content");
+
+    if (xs_type(v) == XSTYPE_STRING && *v) {
+        if ((f = fopen(fn, "r")) != NULL) {
+            srv_debug(1, xs_fmt("content_match: loading regexes from %s", fn));
+
+            /* massage content (strip HTML tags, etc.) */
+            xs *c = xs_regex_replace(v, "<[^>]+>", " ");
+            c = xs_regex_replace_i(c, " {2,}", " ");
+            c = xs_tolower_i(c);
+
+            while (!r && !feof(f)) {
+                xs *rx = xs_strip_i(xs_readline(f));
+
+                if (*rx && xs_regex_match(c, rx)) {
+                    srv_debug(1, xs_fmt("content_match: match for '%s'", rx));
+                    r = 1;
+                }
+            }
+
+            fclose(f);
+        }
+    }
+
+    return r;
+}
+
+
+xs_list *content_search(snac *user, const char *regex,
+                int priv, int skip, int show, int max_secs, int *timeout)
+/* returns a list of posts which content matches the regex */
+{
+    if (regex == NULL || *regex == '\0')
+        return xs_list_new();
+
+    xs *i_regex = xs_utf8_to_lower(regex);
+
+    xs_set seen;
+
+    xs_set_init(&seen);
+
+    if (max_secs == 0)
+        max_secs = 3;
+
+    time_t t = time(NULL) + max_secs;
+    *timeout = 0;
+
+    /* iterate all timelines simultaneously */
+    xs_list *tls[3] = {0};
+    const char *md5s[3] = {0};
+    int c[3] = {0};
+
+    tls[0] = timeline_simple_list(user, "public", 0, XS_ALL, NULL);   /* public */
+    tls[1] = timeline_instance_list(0, XS_ALL); /* instance */
+    tls[2] = priv ? timeline_simple_list(user, "private", 0, XS_ALL, NULL) : xs_list_new(); /* private or none */
+
+    /* first positioning */
+    for (int n = 0; n < 3; n++)
+        xs_list_next(tls[n], &md5s[n], &c[n]);
+
+    show += skip;
+
+    while (show > 0) {
+        /* timeout? */
+        if (time(NULL) > t) {
+            *timeout = 1;
+            break;
+        }
+
+        /* find the newest post */
+        int newest = -1;
+        double mtime = 0.0;
+
+        for (int n = 0; n < 3; n++) {
+            if (md5s[n] != NULL) {
+                double mt;
+
+                while ((mt = object_mtime_by_md5(md5s[n])) == 0 && md5s[n] != NULL) {
+                    /* object is not here: move to the next one */
+                    if (!xs_list_next(tls[n], &md5s[n], &c[n]))
+                        md5s[n] = NULL;
+                }
+
+                if (mt > mtime) {
+                    newest = n;
+                    mtime = mt;
+                }
+            }
+        }
+
+        if (newest == -1)
+            break;
+
+        const char *md5 = md5s[newest];
+
+        /* advance the chosen timeline */
+        if (!xs_list_next(tls[newest], &md5s[newest], &c[newest]))
+            md5s[newest] = NULL;
+
+        xs *post = NULL;
+
+        if (!valid_status(object_get_by_md5(md5, &post)))
+            continue;
+
+        if (!xs_match(xs_dict_get_def(post, "type", "-"), POSTLIKE_OBJECT_TYPE))
+            continue;
+
+        const char *id = xs_dict_get(post, "id");
+
+        if (id == NULL || is_hidden(user, id))
+            continue;
+
+        /* recalculate the md5 id to be sure it's not repeated
+           (it may have been searched by the "url" field instead of "id") */
+        xs *new_md5 = xs_md5_hex(id, strlen(id));
+        md5 = new_md5;
+
+        /* test for the post URL */
+        if (strcmp(id, regex) == 0) {
+            if (xs_set_add(&seen, md5) == 1)
+                show--;
+
+            continue;
+        }
+
+        /* test for the alternate post id */
+        const char *url = xs_dict_get(post, "url");
+        if (xs_type(url) == XSTYPE_STRING && strcmp(url, regex) == 0) {
+            if (xs_set_add(&seen, md5) == 1)
+                show--;
+
+            continue;
+        }
+
+        xs *c = xs_str_new(NULL);
+        const char *content = xs_dict_get(post, "content");
+        const char *name    = xs_dict_get(post, "name");
+
+        if (!xs_is_null(content))
+            c = xs_str_cat(c, content);
+        if (!xs_is_null(name))
+            c = xs_str_cat(c, " ", name);
+
+        /* add alt-texts from attachments */
+        const xs_list *atts = xs_dict_get(post, "attachment");
+        int tc = 0;
+        const xs_dict *att;
+
+        while (xs_list_next(atts, &att, &tc)) {
+            const char *name = xs_dict_get(att, "name");
+
+            if (name != NULL)
+                c = xs_str_cat(c, " ", name);
+        }
+
+        /* strip HTML */
+        c = xs_regex_replace_i(c, "<[^>]+>", " ");
+        c = xs_regex_replace_i(c, " {2,}", " ");
+
+        /* convert to lowercase */
+        xs *lc = xs_utf8_to_lower(c);
+
+        /* apply regex */
+        if (xs_regex_match(lc, i_regex)) {
+            if (xs_set_add(&seen, md5) == 1)
+            show--;
+        }
+    }
+
+    xs_list *r = xs_set_result(&seen);
+
+    if (skip) {
+        /* BAD */
+        while (skip--) {
+            r = xs_list_del(r, 0);
+        }
+    }
+
+    xs_free(tls[0]);
+    xs_free(tls[1]);
+    xs_free(tls[2]);
+
+    return r;
+}
+
+
+/** notifications **/
+
+xs_str *notify_check_time(snac *snac, int reset)
+/* gets or resets the latest notification check time */
 {
-    xs *fn = xs_fmt("%s/%s", srv_basedir, file);
+    xs_str *t = NULL;
+    xs *fn    = xs_fmt("%s/notifydate.txt", snac->basedir);
     FILE *f;
-    int r = 0;
-    const char *v = xs_dict_get(msg, "content");
 
-    if (xs_type(v) == XSTYPE_STRING && *v) {
+    if (reset) {
+        if ((f = fopen(fn, "w")) != NULL) {
+            t = tid(0);
+            fprintf(f, "%s\n", t);
+            fclose(f);
+        }
+    }
+    else {
         if ((f = fopen(fn, "r")) != NULL) {
-            srv_debug(1, xs_fmt("content_match: loading regexes from %s", fn));
+            t = xs_readline(f);
+            fclose(f);
+        }
+        else
+            /* never set before */
+            t = xs_fmt("%16.6f", 0.0);
+    }
+
+    return t;
+}
+
+xs_dict *markers_get(snac *snac, const xs_list *markers)
+{
+    xs *data = NULL;
+    xs_dict *returns = xs_dict_new();
+    xs *fn = xs_fmt("%s/markers.json", snac->basedir);
+    const xs_str *v = NULL;
+    FILE *f;
+
+    if ((f = fopen(fn, "r")) != NULL) {
+        data = xs_json_load(f);
+        fclose(f);
+    }
+
+    if (xs_is_null(data))
+        data = xs_dict_new();
+
+    xs_list_foreach(markers, v) {
+        const xs_dict *mark = xs_dict_get(data, v);
+        if (!xs_is_null(mark)) {
+            returns = xs_dict_append(returns, v, mark);
+        }
+    }
+    return returns;
+}
+
+xs_dict *markers_set(snac *snac, const char *home_marker, const char *notify_marker)
+/* gets or sets notification marker */
+{
+    xs *data = NULL;
+    xs_dict *written = xs_dict_new();
+    xs *fn = xs_fmt("%s/markers.json", snac->basedir);
+    FILE *f;
+
+    if ((f = fopen(fn, "r")) != NULL) {
+        data = xs_json_load(f);
+        fclose(f);
+    }
+
+    if (xs_is_null(data))
+        data = xs_dict_new();
+
+    if (!xs_is_null(home_marker)) {
+        xs *home = xs_dict_new();
+        xs *s_tid = tid(0);
+        home = xs_dict_append(home, "last_read_id", home_marker);
+        home = xs_dict_append(home, "version", xs_stock(0));
+        home = xs_dict_append(home, "updated_at", s_tid);
+        data = xs_dict_set(data, "home", home);
+        written = xs_dict_append(written, "home", home);
+    }
+
+    if (!xs_is_null(notify_marker)) {
+        xs *notify = xs_dict_new();
+        xs *s_tid = tid(0);
+        notify = xs_dict_append(notify, "last_read_id", notify_marker);
+        notify = xs_dict_append(notify, "version", xs_stock(0));
+        notify = xs_dict_append(notify, "updated_at", s_tid);
+        data = xs_dict_set(data, "notifications", notify);
+        written = xs_dict_append(written, "notifications", notify);
+    }
+
+    if ((f = fopen(fn, "w")) != NULL) {
+        xs_json_dump(data, data_json_indent(), f);
+        fclose(f);
+    }
+
+    return written;
+}
+
+void notify_add(snac *snac, const char *type, const char *utype,
+                const char *actor, const char *objid, const xs_dict *msg)
+/* adds a new notification */
+{
+    xs *ntid = tid(0);
+    xs *fn   = xs_fmt("%s/notify/", snac->basedir);
+    xs *date = xs_str_utctime(0, ISO_DATE_SPEC);
+    FILE *f;
+
+    /* create the directory */
+    mkdirx(fn);
+    fn = xs_str_cat(fn, ntid);
+    fn = xs_str_cat(fn, ".json");
+
+    xs *noti = xs_dict_new();
+
+    noti = xs_dict_append(noti, "id",    ntid);
+    noti = xs_dict_append(noti, "type",  type);
+    noti = xs_dict_append(noti, "utype", utype);
+    noti = xs_dict_append(noti, "actor", actor);
+    noti = xs_dict_append(noti, "date",  date);
+    noti = xs_dict_append(noti, "msg",   msg);
+
+    if (!xs_is_null(objid))
+        noti = xs_dict_append(noti, "objid", objid);
+
+    if ((f = fopen(fn, "w")) != NULL) {
+        data_dump(noti, f);
+        fclose(f);
+    }
+
+    /* add it to the index if it already exists */
+    xs *idx = xs_fmt("%s/notify.idx", snac->basedir);
+
+    if (mtime(idx) != 0.0) {
+        pthread_mutex_lock(&data_mutex);
+
+        if ((f = fopen(idx, "a")) != NULL) {
+            fprintf(f, "%-32s\n", ntid);
+            fclose(f);
+        }
+
+        pthread_mutex_unlock(&data_mutex);
+    }
+}
+
+
+xs_dict *notify_get(snac *snac, const char *id)
+/* gets a notification */
+{
+    /* base file */
+    xs *fn = xs_fmt("%s/notify/%s", snac->basedir, id);
+
+    /* strip spaces and add extension */
+    fn = xs_strip_i(fn);
+    fn = xs_str_cat(fn, ".json");
+
+    FILE *f;
+    xs_dict *out = NULL;
+
+    if ((f = fopen(fn, "r")) != NULL) {
+        out = data_load(f);
+        fclose(f);
+    }
+
+    return out;
+}
+
+
+xs_list *notify_list(snac *snac, int skip, int show)
+/* returns a list of notification ids */
+{
+    xs *idx = xs_fmt("%s/notify.idx", snac->basedir);
+
+    if (mtime(idx) == 0.0) {
+        /* create the index from scratch */
+        FILE *f;
 
-            /* massage content (strip HTML tags, etc.) */
-            xs *c = xs_regex_replace(v, "<[^>]+>", " ");
-            c = xs_regex_replace_i(c, " {2,}", " ");
-            c = xs_tolower_i(c);
+        pthread_mutex_lock(&data_mutex);
 
-            while (!r && !feof(f)) {
-                xs *rx = xs_strip_i(xs_readline(f));
+        if ((f = fopen(idx, "w")) != NULL) {
+            xs *spec = xs_fmt("%s/notify/" "*.json", snac->basedir);
+            xs *lst  = xs_glob(spec, 1, 0);
+            xs_list *p = lst;
+            const char *v;
 
-                if (*rx && xs_regex_match(c, rx)) {
-                    srv_debug(1, xs_fmt("content_match: match for '%s'", rx));
-                    r = 1;
+            while (xs_list_iter(&p, &v)) {
+                char *p = strrchr(v, '.');
+                if (p) {
+                    *p = '\0';
+                    fprintf(f, "%-32s\n", v);
                 }
             }
 
             fclose(f);
         }
+
+        pthread_mutex_unlock(&data_mutex);
     }
 
-    return r;
+    return index_list_desc(idx, skip, show);
 }
 
 
-xs_list *content_search(snac *user, const char *regex,
-                int priv, int skip, int show, int max_secs, int *timeout)
-/* returns a list of posts which content matches the regex */
+int notify_new_num(snac *snac)
+/* counts the number of new notifications */
 {
-    if (regex == NULL || *regex == '\0')
-        return xs_list_new();
+    xs *t = notify_check_time(snac, 0);
+    xs *lst = notify_list(snac, 0, XS_ALL);
+    int cnt = 0;
 
-    xs *i_regex = xs_utf8_to_lower(regex);
+    xs_list *p = lst;
+    const xs_str *v;
 
-    xs_set seen;
+    while (xs_list_iter(&p, &v)) {
+        xs *id = xs_strip_i(xs_dup(v));
 
-    xs_set_init(&seen);
+        /* old? count no more */
+        if (strcmp(id, t) < 0)
+            break;
 
-    if (max_secs == 0)
-        max_secs = 3;
+        cnt++;
+    }
 
-    time_t t = time(NULL) + max_secs;
-    *timeout = 0;
+    return cnt;
+}
 
-    /* iterate all timelines simultaneously */
-    xs_list *tls[3] = {0};
-    const char *md5s[3] = {0};
-    int c[3] = {0};
 
-    tls[0] = timeline_simple_list(user, "public", 0, XS_ALL, NULL);   /* public */
-    tls[1] = timeline_instance_list(0, XS_ALL); /* instance */
-    tls[2] = priv ? timeline_simple_list(user, "private", 0, XS_ALL, NULL) : xs_list_new(); /* private or none */
+void notify_clear(snac *snac)
+/* clears all notifications */
+{
+    xs *spec   = xs_fmt("%s/notify/" "*", snac->basedir);
+    xs *lst    = xs_glob(spec, 0, 0);
+    xs_list *p = lst;
+    const xs_str *v;
 
-    /* first positioning */
-    for (int n = 0; n < 3; n++)
-        xs_list_next(tls[n], &md5s[n], &c[n]);
+    while (xs_list_iter(&p, &v))
+        unlink(v);
 
-    show += skip;
+    xs *idx = xs_fmt("%s/notify.idx", snac->basedir);
 
-    while (show > 0) {
-        /* timeout? */
-        if (time(NULL) > t) {
-            *timeout = 1;
-            break;
-        }
+    if (mtime(idx) != 0.0) {
+        /* unlink instead of truncating, as readers may have it mapped;
+           notify_list() will create it again */
+        pthread_mutex_lock(&data_mutex);
+        unlink(idx);
+        pthread_mutex_unlock(&data_mutex);
+    }
+}
 
-        /* find the newest post */
-        int newest = -1;
-        double mtime = 0.0;
 
-        for (int n = 0; n < 3; n++) {
-            if (md5s[n] != NULL) {
-                xs *fn = _object_fn_by_md5(md5s[n], "content_search");
-                double mt;
+/** the queue scheduler **/
 
-                while ((mt = mtime(fn)) == 0 && md5s[n] != NULL) {
-                    /* object is not here: move to the next one */
-                    if (xs_list_next(tls[n], &md5s[n], &c[n])) {
-                        xs_free(fn);
-                        fn = _object_fn_by_md5(md5s[n], "content_search_2");
-                    }
-                    else
-                        md5s[n] = NULL;
-                }
+/* the files of all queues (the global one and the users') are kept in a
+   min-heap ordered by retry time, so that the background thread knows
+   when the next one is due without listing the queue directories. Where
+   inotify is available, the queue directories are watched, so files
+   written by any process (like the command-line tools) are added as soon
+   as they appear, and each directory is listed only once; elsewhere, they
+   are only picked up when the directories are rescanned from time to time
+   (fully, as a fallback, each time their mtime changes). The users'
+   scheduled posts also have an entry (their sched.idx file) due when the
+   next one is */
 
-                if (mt > mtime) {
-                    newest = n;
-                    mtime = mt;
-                }
-            }
-        }
+typedef struct {
+    time_t due;         /* retry time, taken from the file name */
+    xs_str *fn;         /* queue file */
+} t_qsched_ent;
 
-        if (newest == -1)
+static t_qsched_ent *qsched = NULL;
+static int qsched_n         = 0;
+static int qsched_size      = 0;
+static xs_dict *qsched_dirs = NULL;     /* queue directory -> mtime at last scan */
+static xs_dict *qsched_at   = NULL;     /* non-queue entries -> due time */
+
+#ifdef USE_INOTIFY
+static int qsched_ino       = -1;       /* inotify descriptor */
+static xs_dict *qsched_wds  = NULL;     /* watch descriptor -> queue directory */
+static xs_dict *qsched_wdir = NULL;     /* queue directory -> watch descriptor */
+#endif
+
+
+static void _qsched_sift_down(int i)
+/* moves down a heap entry to its place */
+{
+    t_qsched_ent e = qsched[i];
+
+    for (;;) {
+        int c = 2 * i + 1;
+
+        if (c >= qsched_n)
             break;
 
-        const char *md5 = md5s[newest];
+        if (c + 1 < qsched_n && qsched[c + 1].due < qsched[c].due)
+            c++;
 
-        /* advance the chosen timeline */
-        if (!xs_list_next(tls[newest], &md5s[newest], &c[newest]))
-            md5s[newest] = NULL;
+        if (e.due <= qsched[c].due)
+            break;
 
-        xs *post = NULL;
+        qsched[i] = qsched[c];
+        i = c;
+    }
 
-        if (!valid_status(object_get_by_md5(md5, &post)))
-            continue;
+    qsched[i] = e;
+}
 
-        if (!xs_match(xs_dict_get_def(post, "type", "-"), POSTLIKE_OBJECT_TYPE))
-            continue;
 
-        const char *id = xs_dict_get(post, "id");
+static void _qsched_push_at(const char *fn, time_t due)
+/* adds an entry to the heap */
+{
+    int i;
 
-        if (id == NULL || is_hidden(user, id))
-            continue;
+    if (qsched_n == qsched_size) {
+        qsched_size = qsched_size ? qsched_size * 2 : 64;
+        qsched = xs_realloc(qsched, qsched_size * sizeof(t_qsched_ent));
+    }
 
-        /* recalculate the md5 id to be sure it's not repeated
-           (it may have been searched by the "url" field instead of "id") */
-        xs *new_md5 = xs_md5_hex(id, strlen(id));
-        md5 = new_md5;
+    /* move up */
+    for (i = qsched_n++; i > 0; i = (i - 1) / 2) {
+        int p = (i - 1) / 2;
 
-        /* test for the post URL */
-        if (strcmp(id, regex) == 0) {
-            if (xs_set_add(&seen, md5) == 1)
-                show--;
+        if (qsched[p].due <= due)
+            break;
 
-            continue;
-        }
+        qsched[i] = qsched[p];
+    }
 
-        /* test for the alternate post id */
-        const char *url = xs_dict_get(post, "url");
-        if (xs_type(url) == XSTYPE_STRING && strcmp(url, regex) == 0) {
-            if (xs_set_add(&seen, md5) == 1)
-                show--;
+    qsched[i].due = due;
+    qsched[i].fn  = xs_str_new(fn);
+}
 
-            continue;
-        }
 
-        xs *c = xs_str_new(NULL);
-        const char *content = xs_dict_get(post, "content");
-        const char *name    = xs_dict_get(post, "name");
+static void _qsched_push(const char *fn)
+/* adds a queue file to the heap */
+{
+    const char *bn = strrchr(fn, '/');
 
-        if (!xs_is_null(content))
-            c = xs_str_cat(c, content);
-        if (!xs_is_null(name))
-            c = xs_str_cat(c, " ", name);
+    _qsched_push_at(fn, atol(bn ? bn + 1 : fn));
+}
 
-        /* add alt-texts from attachments */
-        const xs_list *atts = xs_dict_get(post, "attachment");
-        int tc = 0;
-        const xs_dict *att;
 
-        while (xs_list_next(atts, &att, &tc)) {
-            const char *name = xs_dict_get(att, "name");
+#ifdef USE_INOTIFY
 
-            if (name != NULL)
-                c = xs_str_cat(c, " ", name);
-        }
+static void _qsched_watch(const char *dir)
+/* starts watching a queue directory (qsched_mutex must be locked) */
+{
+    int wd;
 
-        /* strip HTML */
-        c = xs_regex_replace_i(c, "<[^>]+>", " ");
-        c = xs_regex_replace_i(c, " {2,}", " ");
+    if (qsched_ino == -1 && (qsched_ino = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+        srv_log(xs_fmt("queue scheduler: cannot use inotify (%s)", strerror(errno)));
+        return;
+    }
 
-        /* convert to lowercase */
-        xs *lc = xs_utf8_to_lower(c);
+    if (xs_dict_get(qsched_wdir, dir) != NULL)
+        return;
 
-        /* apply regex */
-        if (xs_regex_match(lc, i_regex)) {
-            if (xs_set_add(&seen, md5) == 1)
-            show--;
-        }
+    /* queue files appear complete: they are written to a temporary name
+       and then renamed, or hard-linked (the shared inbox fan-out) */
+    if ((wd = inotify_add_watch(qsched_ino, dir, IN_MOVED_TO | IN_CREATE)) != -1) {
+        xs *s_wd = xs_fmt("%d", wd);
+
+        qsched_wds  = xs_dict_set(qsched_wds, s_wd, dir);
+        qsched_wdir = xs_dict_set(qsched_wdir, dir, s_wd);
     }
+}
 
-    xs_list *r = xs_set_result(&seen);
+#endif /* USE_INOTIFY */
 
-    if (skip) {
-        /* BAD */
-        while (skip--) {
-            r = xs_list_del(r, 0);
-        }
+
+static void _qsched_scan(const char *dir)
+/* (re)loads the files of a queue directory into the heap
+   (for unwatched directories, the first time or after lost events) */
+{
+    xs *prefix = xs_fmt("%s/", dir);
+    xs *spec   = xs_fmt("%s/" "*.json", dir);
+    xs *fns    = xs_glob(spec, 0, 0);
+    const char *v;
+    int n, m;
+
+    /* drop the entries from this directory */
+    for (n = m = 0; n < qsched_n; n++) {
+        if (xs_startswith(qsched[n].fn, prefix))
+            xs_free(qsched[n].fn);
+        else
+            qsched[m++] = qsched[n];
     }
 
-    xs_free(tls[0]);
-    xs_free(tls[1]);
-    xs_free(tls[2]);
+    qsched_n = m;
 
-    return r;
-}
+    for (n = qsched_n / 2 - 1; n >= 0; n--)
+        _qsched_sift_down(n);
 
+    xs_list_foreach(fns, v)
+        _qsched_push(v);
+}
 
-/** notifications **/
 
-xs_str *notify_check_time(snac *snac, int reset)
-/* gets or resets the latest notification check time */
+void queue_sched_rescan(void)
+/* loads the queue files of all changed queue directories */
 {
-    xs_str *t = NULL;
-    xs *fn    = xs_fmt("%s/notifydate.txt", snac->basedir);
-    FILE *f;
+    xs *users = user_list();
+    xs *g_dir = xs_fmt("%s/queue", srv_basedir);
+    xs *dirs  = xs_list_append(xs_list_new(), g_dir);
+    const char *v;
 
-    if (reset) {
-        if ((f = fopen(fn, "w")) != NULL) {
-            t = tid(0);
-            fprintf(f, "%s\n", t);
-            fclose(f);
-        }
+    xs_list_foreach(users, v) {
+        xs *d = xs_fmt("%s/user/%s/queue", srv_basedir, v);
+        dirs = xs_list_append(dirs, d);
     }
-    else {
-        if ((f = fopen(fn, "r")) != NULL) {
-            t = xs_readline(f);
-            fclose(f);
+
+    pthread_mutex_lock(&qsched_mutex);
+
+    if (qsched_dirs == NULL) {
+        qsched_dirs = xs_dict_new();
+        qsched_at   = xs_dict_new();
+
+#ifdef USE_INOTIFY
+        qsched_wds  = xs_dict_new();
+        qsched_wdir = xs_dict_new();
+#endif
+    }
+
+    xs_list_foreach(dirs, v) {
+        struct stat st;
+
+        if (stat(v, &st) == -1)
+            continue;
+
+#ifdef USE_INOTIFY
+        /* before the scan, so that nothing is missed in between */
+        _qsched_watch(v);
+#endif
+
+        xs *stamp = xs_fmt("%ld.%09ld", (long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+        const char *o_stamp = xs_dict_get(qsched_dirs, v);
+
+#ifdef USE_INOTIFY
+        /* already loaded and watched: the watcher adds the new files */
+        if (xs_is_string(o_stamp) && xs_dict_get(qsched_wdir, v) != NULL)
+            continue;
+#endif
+
+        if (!xs_is_string(o_stamp) || strcmp(o_stamp, stamp) != 0) {
+            _qsched_scan(v);
+            qsched_dirs = xs_dict_set(qsched_dirs, v, stamp);
         }
-        else
-            /* never set before */
-            t = xs_fmt("%16.6f", 0.0);
     }
 
-    return t;
+    pthread_mutex_unlock(&qsched_mutex);
 }
 
-xs_dict *markers_get(snac *snac, const xs_list *markers)
+
+void queue_sched_add(const char *fn)
+/* tells the scheduler about a new queue file */
 {
-    xs *data = NULL;
-    xs_dict *returns = xs_dict_new();
-    xs *fn = xs_fmt("%s/markers.json", snac->basedir);
-    const xs_str *v = NULL;
-    FILE *f;
+    int first = 0;
+
+    pthread_mutex_lock(&qsched_mutex);
+
+    /* only if the scheduler is running in this process */
+    if (qsched_dirs != NULL) {
+#ifdef USE_INOTIFY
+        /* if the directory is watched, the watcher will add it */
+        xs *dir = xs_dup(fn);
+        char *p = strrchr(dir, '/');
+
+        if (p != NULL)
+            *p = '\0';
+
+        if (xs_dict_get(qsched_wdir, dir) == NULL)
+#endif
+        {
+            _qsched_push(fn);
+            first = strcmp(qsched[0].fn, fn) == 0;
+        }
+    }
+
+    pthread_mutex_unlock(&qsched_mutex);
+
+    /* it's the next one to be processed? the background thread may be
+       sleeping for longer than that */
+    if (first)
+        background_wake();
+}
+
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        data = xs_json_load(f);
-        fclose(f);
-    }
+void queue_sched_at(const char *fn, time_t due)
+/* tells the scheduler that there is something to be done on fn at due time */
+{
+    int first = 0;
 
-    if (xs_is_null(data))
-        data = xs_dict_new();
+    pthread_mutex_lock(&qsched_mutex);
 
-    xs_list_foreach(markers, v) {
-        const xs_dict *mark = xs_dict_get(data, v);
-        if (!xs_is_null(mark)) {
-            returns = xs_dict_append(returns, v, mark);
+    if (qsched_dirs != NULL) {
+        const char *o_due = xs_dict_get(qsched_at, fn);
+
+        /* already there for that time or earlier? */
+        if (!xs_is_string(o_due) || atol(o_due) > due) {
+            xs *s_due = xs_fmt("%ld", (long)due);
+            qsched_at = xs_dict_set(qsched_at, fn, s_due);
+
+            _qsched_push_at(fn, due);
+            first = strcmp(qsched[0].fn, fn) == 0;
         }
     }
-    return returns;
+
+    pthread_mutex_unlock(&qsched_mutex);
+
+    if (first)
+        background_wake();
 }
 
-xs_dict *markers_set(snac *snac, const char *home_marker, const char *notify_marker)
-/* gets or sets notification marker */
+
+int queue_sched_watch(int msecs)
+/* waits up to msecs for queue files written by anyone and adds them to
+   the heap; returns the number of them, or -1 if it cannot be done */
 {
-    xs *data = NULL;
-    xs_dict *written = xs_dict_new();
-    xs *fn = xs_fmt("%s/markers.json", snac->basedir);
-    FILE *f;
+#ifdef USE_INOTIFY
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { .fd = -1, .events = POLLIN };
+    int cnt = 0, first = 0, overflow = 0;
+    ssize_t r;
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        data = xs_json_load(f);
-        fclose(f);
+    pthread_mutex_lock(&qsched_mutex);
+    pfd.fd = qsched_ino;
+    pthread_mutex_unlock(&qsched_mutex);
+
+    if (pfd.fd == -1) {
+        /* not watching (yet) */
+        poll(NULL, 0, msecs);
+        return 0;
     }
 
-    if (xs_is_null(data))
-        data = xs_dict_new();
+    if (poll(&pfd, 1, msecs) <= 0)
+        return 0;
 
-    if (!xs_is_null(home_marker)) {
-        xs *home = xs_dict_new();
-        xs *s_tid = tid(0);
-        home = xs_dict_append(home, "last_read_id", home_marker);
-        home = xs_dict_append(home, "version", xs_stock(0));
-        home = xs_dict_append(home, "updated_at", s_tid);
-        data = xs_dict_set(data, "home", home);
-        written = xs_dict_append(written, "home", home);
+    pthread_mutex_lock(&qsched_mutex);
+
+    while ((r = read(pfd.fd, buf, sizeof(buf))) > 0) {
+        const struct inotify_event *ev;
+        const char *p;
+
+        for (p = buf; p < buf + r; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+
+            xs *s_wd = xs_fmt("%d", ev->wd);
+            const char *dir = xs_dict_get(qsched_wds, s_wd);
+
+            if (ev->mask & IN_Q_OVERFLOW)
+                overflow = 1;
+            else
+            if (ev->mask & IN_IGNORED) {
+                /* the directory is gone (e.g. a deleted user) */
+                if (xs_is_string(dir)) {
+                    qsched_wdir = xs_dict_del(qsched_wdir, dir);
+                    qsched_wds  = xs_dict_del(qsched_wds, s_wd);
+                }
+            }
+            else
+            if (ev->len && xs_is_string(dir) && xs_endswith(ev->name, ".json")) {
+                xs *fn = xs_fmt("%s/%s", dir, ev->name);
+
+                _qsched_push(fn);
+
+                if (strcmp(qsched[0].fn, fn) == 0)
+                    first = 1;
+
+                cnt++;
+            }
+        }
     }
 
-    if (!xs_is_null(notify_marker)) {
-        xs *notify = xs_dict_new();
-        xs *s_tid = tid(0);
-        notify = xs_dict_append(notify, "last_read_id", notify_marker);
-        notify = xs_dict_append(notify, "version", xs_stock(0));
-        notify = xs_dict_append(notify, "updated_at", s_tid);
-        data = xs_dict_set(data, "notifications", notify);
-        written = xs_dict_append(written, "notifications", notify);
+    if (overflow) {
+        /* events were lost: force a full rescan */
+        qsched_dirs = xs_free(qsched_dirs);
+        qsched_dirs = xs_dict_new();
     }
 
-    if ((f = fopen(fn, "w")) != NULL) {
-        xs_json_dump(data, 4, f);
-        fclose(f);
+    pthread_mutex_unlock(&qsched_mutex);
+
+    if (overflow) {
+        srv_log(xs_fmt("queue scheduler: inotify queue overflow, rescanning"));
+        queue_sched_rescan();
     }
 
-    return written;
+    if (first || overflow)
+        background_wake();
+
+    return cnt;
+#else
+    (void)msecs;
+    return -1;
+#endif
 }
 
-void notify_add(snac *snac, const char *type, const char *utype,
-                const char *actor, const char *objid, const xs_dict *msg)
-/* adds a new notification */
+
+xs_list *queue_sched_due(time_t *next)
+/* returns the queue files that are due, and the time of the next one (or 0) */
 {
-    xs *ntid = tid(0);
-    xs *fn   = xs_fmt("%s/notify/", snac->basedir);
-    xs *date = xs_str_utctime(0, ISO_DATE_SPEC);
-    FILE *f;
+    xs_list *list = xs_list_new();
+    time_t t = time(NULL);
 
-    /* create the directory */
-    mkdirx(fn);
-    fn = xs_str_cat(fn, ntid);
-    fn = xs_str_cat(fn, ".json");
+    pthread_mutex_lock(&qsched_mutex);
 
-    xs *noti = xs_dict_new();
+    while (qsched_n > 0 && qsched[0].due <= t) {
+        xs *fn = qsched[0].fn;
+        const char *o_due = xs_dict_get(qsched_at, fn);
 
-    noti = xs_dict_append(noti, "id",    ntid);
-    noti = xs_dict_append(noti, "type",  type);
-    noti = xs_dict_append(noti, "utype", utype);
-    noti = xs_dict_append(noti, "actor", actor);
-    noti = xs_dict_append(noti, "date",  date);
-    noti = xs_dict_append(noti, "msg",   msg);
+        if (xs_is_string(o_due) && atol(o_due) == qsched[0].due)
+            qsched_at = xs_dict_del(qsched_at, fn);
 
-    if (!xs_is_null(objid))
-        noti = xs_dict_append(noti, "objid", objid);
+        qsched[0] = qsched[--qsched_n];
 
-    if ((f = fopen(fn, "w")) != NULL) {
-        xs_json_dump(noti, 4, f);
-        fclose(f);
-    }
+        if (qsched_n > 0)
+            _qsched_sift_down(0);
 
-    /* add it to the index if it already exists */
-    xs *idx = xs_fmt("%s/notify.idx", snac->basedir);
+        list = xs_list_append(list, fn);
+    }
 
-    if (mtime(idx) != 0.0) {
-        pthread_mutex_lock(&data_mutex);
+    *next = qsched_n > 0 ? qsched[0].due : 0;
 
-        if ((f = fopen(idx, "a")) != NULL) {
-            fprintf(f, "%-32s\n", ntid);
-            fclose(f);
-        }
+    pthread_mutex_unlock(&qsched_mutex);
 
-        pthread_mutex_unlock(&data_mutex);
-    }
+    return list;
 }
 
 
-xs_dict *notify_get(snac *snac, const char *id)
-/* gets a notification */
-{
-    /* base file */
-    xs *fn = xs_fmt("%s/notify/%s", snac->basedir, id);
+/** delivery payloads **/
 
-    /* strip spaces and add extension */
-    fn = xs_strip_i(fn);
-    fn = xs_str_cat(fn, ".json");
+/* a message sent to many inboxes is serialized and digested only once
+   and stored in payload/; the output queue items of each inbox only have
+   a reference to it. The most recent ones are also kept in memory */
 
-    FILE *f;
-    xs_dict *out = NULL;
+#define PAYLOAD_CACHE_SIZE 8
 
-    if ((f = fopen(fn, "r")) != NULL) {
-        out = xs_json_load(f);
-        fclose(f);
-    }
+static struct {
+    xs_str *pid;
+    xs_dict *pl;
+} payload_cache[PAYLOAD_CACHE_SIZE];
+static int payload_cache_next = 0;
 
-    return out;
+
+static xs_str *_payload_fn(const char *pid)
+{
+    return xs_fmt("%s/payload/%s.json", srv_basedir, pid);
 }
 
 
-xs_list *notify_list(snac *snac, int skip, int show)
-/* returns a list of notification ids */
+static void _payload_cache_put(const char *pid, const xs_dict *pl)
+/* stores a payload in the memory cache (payload_mutex must be locked) */
 {
-    xs *idx = xs_fmt("%s/notify.idx", snac->basedir);
+    int n = payload_cache_next;
 
-    if (mtime(idx) == 0.0) {
-        /* create the index from scratch */
-        FILE *f;
+    xs_free(payload_cache[n].pid);
+    xs_free(payload_cache[n].pl);
 
-        pthread_mutex_lock(&data_mutex);
+    payload_cache[n].pid = xs_dup(pid);
+    payload_cache[n].pl  = xs_dup(pl);
 
-        if ((f = fopen(idx, "w")) != NULL) {
-            xs *spec = xs_fmt("%s/notify/" "*.json", snac->basedir);
-            xs *lst  = xs_glob(spec, 1, 0);
-            xs_list *p = lst;
-            const char *v;
+    payload_cache_next = (n + 1) % PAYLOAD_CACHE_SIZE;
+}
 
-            while (xs_list_iter(&p, &v)) {
-                char *p = strrchr(v, '.');
-                if (p) {
-                    *p = '\0';
-                    fprintf(f, "%-32s\n", v);
-                }
-            }
 
+xs_str *payload_put(const xs_dict *msg)
+/* stores a message to be delivered and returns its payload id */
+{
+    xs *body   = xs_json_dumps(msg, 4);
+    xs *s64    = xs_sha256_base64(body, strlen(body));
+    xs *digest = xs_fmt("SHA-256=%s", s64);
+    xs_str *pid = xs_md5_hex(body, strlen(body));
+    xs *fn     = _payload_fn(pid);
+    xs *pl     = xs_dict_new();
+
+    pl = xs_dict_append(pl, "body",   body);
+    pl = xs_dict_append(pl, "digest", digest);
+
+    pthread_mutex_lock(&payload_mutex);
+
+    if (mtime(fn) == 0.0) {
+        xs *tfn = xs_fmt("%s.tmp", fn);
+        FILE *f;
+
+        if ((f = fopen(tfn, "w")) != NULL) {
+            data_dump(pl, f);
             fclose(f);
+            rename(tfn, fn);
         }
-
-        pthread_mutex_unlock(&data_mutex);
     }
+    else
+        utimes(fn, NULL);
 
-    return index_list_desc(idx, skip, show);
+    _payload_cache_put(pid, pl);
+
+    pthread_mutex_unlock(&payload_mutex);
+
+    return pid;
 }
 
 
-int notify_new_num(snac *snac)
-/* counts the number of new notifications */
+xs_dict *payload_get(const char *pid)
+/* gets a stored payload (a dict with the body and its digest) */
 {
-    xs *t = notify_check_time(snac, 0);
-    xs *lst = notify_list(snac, 0, XS_ALL);
-    int cnt = 0;
-
-    xs_list *p = lst;
-    const xs_str *v;
+    xs_dict *pl = NULL;
+    int n;
 
-    while (xs_list_iter(&p, &v)) {
-        xs *id = xs_strip_i(xs_dup(v));
+    pthread_mutex_lock(&payload_mutex);
 
-        /* old? count no more */
-        if (strcmp(id, t) < 0)
+    for (n = 0; n < PAYLOAD_CACHE_SIZE; n++) {
+        if (payload_cache[n].pid && strcmp(payload_cache[n].pid, pid) == 0) {
+            pl = xs_dup(payload_cache[n].pl);
             break;
+        }
+    }
 
-        cnt++;
+    if (pl == NULL) {
+        xs *fn = _payload_fn(pid);
+        FILE *f;
+
+        if ((f = fopen(fn, "r")) != NULL) {
+            pl = data_load(f);
+            fclose(f);
+
+            if (pl != NULL)
+                _payload_cache_put(pid, pl);
+        }
     }
 
-    return cnt;
+    pthread_mutex_unlock(&payload_mutex);
+
+    return pl;
 }
 
 
-void notify_clear(snac *snac)
-/* clears all notifications */
+int output_body(const xs_dict *q_item, xs_str **body, xs_str **digest)
+/* gets the serialized body of an output queue item and its digest
+   (NULL if it must be calculated); returns 0 if it's not available */
 {
-    xs *spec   = xs_fmt("%s/notify/" "*", snac->basedir);
-    xs *lst    = xs_glob(spec, 0, 0);
-    xs_list *p = lst;
-    const xs_str *v;
+    const char *pid    = xs_dict_get(q_item, "payload");
+    const xs_dict *msg = xs_dict_get(q_item, "message");
 
-    while (xs_list_iter(&p, &v))
-        unlink(v);
+    if (xs_is_string(pid)) {
+        xs *pl = payload_get(pid);
 
-    xs *idx = xs_fmt("%s/notify.idx", snac->basedir);
+        if (pl == NULL)
+            return 0;
 
-    if (mtime(idx) != 0.0) {
-        pthread_mutex_lock(&data_mutex);
-        truncate(idx, 0);
-        pthread_mutex_unlock(&data_mutex);
+        *body   = xs_dup(xs_dict_get(pl, "body"));
+        *digest = xs_dup(xs_dict_get(pl, "digest"));
+    }
+    else
+    if (xs_is_dict(msg)) {
+        *body   = xs_json_dumps(msg, 4);
+        *digest = NULL;
     }
+    else
+        return 0;
+
+    return 1;
 }
 
 
@@ -3231,10 +6862,12 @@ static xs_dict *_enqueue_put(const char *fn, xs_dict *msg)
     FILE *f;
 
     if ((f = fopen(tfn, "w")) != NULL) {
-        xs_json_dump(msg, 4, f);
+        data_dump(msg, f);
         fclose(f);
 
         rename(tfn, fn);
+
+        queue_sched_add(fn);
     }
 
     return msg;
@@ -3292,7 +6925,8 @@ void enqueue_shared_input(const xs_dict *msg, const xs_dict *req, int retries)
 void enqueue_output_raw(const char *keyid, const char *seckey,
                         const xs_dict *msg, const xs_str *inbox,
                         int retries, int p_status)
-/* enqueues an output message to an inbox */
+/* enqueues an output message to an inbox (signed with the key of keyid,
+   or with seckey, if the user will not be there to sign it) */
 {
     xs *qmsg   = _new_qmsg("output", msg, retries);
     const char *ntid = xs_dict_get(qmsg, "ntid");
@@ -3303,18 +6937,59 @@ void enqueue_output_raw(const char *keyid, const char *seckey,
 
     qmsg = xs_dict_append(qmsg, "inbox",  inbox);
     qmsg = xs_dict_append(qmsg, "keyid",  keyid);
-    qmsg = xs_dict_append(qmsg, "seckey", seckey);
+
+    if (seckey != NULL)
+        qmsg = xs_dict_append(qmsg, "seckey", seckey);
 
     /* if it's to be sent right now, bypass the disk queue and post the job */
-    if (retries == 0 && p_state != NULL)
-        job_post(qmsg, 0);
-    else {
+    if (retries != 0 || p_state == NULL || !job_post(qmsg)) {
         qmsg = _enqueue_put(fn, qmsg);
         srv_debug(1, xs_fmt("enqueue_output %s %s %d", inbox, fn, retries));
     }
 }
 
 
+void enqueue_output_payload(const char *keyid, const char *pid,
+                            const xs_str *inbox, int retries, int p_status)
+/* enqueues a stored payload to an inbox (signed with the key of keyid) */
+{
+    int qrt  = xs_number_get(xs_dict_get(srv_config, "queue_retry_minutes"));
+    xs *ntid = tid(retries * 60 * qrt);
+    xs *fn   = xs_fmt("%s/queue/%s.json", srv_basedir, ntid);
+    xs *rn   = xs_number_new(retries);
+    xs *ns   = xs_number_new(p_status);
+
+    /* like enqueue_output_raw(), but without the message */
+    xs *qmsg = xs_dict_new();
+
+    qmsg = xs_dict_append(qmsg, "type",     "output");
+    qmsg = xs_dict_append(qmsg, "payload",  pid);
+    qmsg = xs_dict_append(qmsg, "retries",  rn);
+    qmsg = xs_dict_append(qmsg, "ntid",     ntid);
+    qmsg = xs_dict_append(qmsg, "p_status", ns);
+    qmsg = xs_dict_append(qmsg, "inbox",    inbox);
+    qmsg = xs_dict_append(qmsg, "keyid",    keyid);
+
+    if (retries != 0 || p_state == NULL || !job_post(qmsg)) {
+        qmsg = _enqueue_put(fn, qmsg);
+        srv_debug(1, xs_fmt("enqueue_output_payload %s %s %d", inbox, fn, retries));
+    }
+}
+
+
+void enqueue_delayed(const xs_dict *q_item, int secs)
+/* puts a global queue item back into the disk queue, to be processed in secs */
+{
+    xs *ntid = tid(secs);
+    xs *fn   = xs_fmt("%s/queue/%s.json", srv_basedir, ntid);
+    xs *qmsg = xs_dict_set(xs_dup(q_item), "ntid", ntid);
+
+    qmsg = _enqueue_put(fn, qmsg);
+
+    srv_debug(2, xs_fmt("enqueue_delayed %s %d", fn, secs));
+}
+
+
 void enqueue_output(snac *snac, const xs_dict *msg,
                     const xs_str *inbox, int retries, int p_status)
 /* enqueues an output message to an inbox */
@@ -3324,9 +6999,7 @@ void enqueue_output(snac *snac, const xs_dict *msg,
         return;
     }
 
-    const char *seckey = xs_dict_get(snac->key, "secret");
-
-    enqueue_output_raw(snac->actor, seckey, msg, inbox, retries, p_status);
+    enqueue_output_raw(snac->actor, NULL, msg, inbox, retries, p_status);
 }
 
 
@@ -3550,7 +7223,7 @@ xs_dict *queue_get(const char *fn)
     xs_dict *obj = NULL;
 
     if ((f = fopen(fn, "r")) != NULL) {
-        obj = xs_json_load(f);
+        obj = data_load(f);
         fclose(f);
     }
 
@@ -3617,6 +7290,28 @@ static void _purge_user_subdir(snac *snac, const char *subdir, int days)
 }
 
 
+static void _purge_user_cache(snac *snac, const char *cachedir, int days)
+/* purges all entries in a user cache index older than days
+   (the segmented object store equivalent of _purge_user_subdir()) */
+{
+    int cnt = 0;
+
+    if (days) {
+        time_t mt = time(NULL) - days * 24 * 3600;
+        xs *idx   = object_user_cache_index_fn(snac, cachedir);
+        xs *list  = index_list(idx, XS_ALL);
+        const char *v;
+
+        xs_list_foreach(list, v) {
+            if (object_mtime_by_md5(v) < mt && valid_status(index_del_md5(idx, v)))
+                cnt++;
+        }
+
+        srv_debug(1, xs_fmt("purge: %s %d", idx, cnt));
+    }
+}
+
+
 void purge_server(void)
 /* purge global server data */
 {
@@ -3629,6 +7324,41 @@ void purge_server(void)
 
     time_t mt = time(NULL) - 7 * 24 * 3600;
 
+    if (object_store_is_seg()) {
+        /* old and not referenced by any user? */
+        xs *objs = _store_list('o', mt);
+        const char *kinds = "clap";
+        t_pos_map refs = {0};
+
+        /* collected once, after the candidates, for the whole run */
+        _object_refs_collect(&refs);
+
+        xs_list_foreach(objs, v) {
+            if (!_object_refs_in(&refs, v)) {
+                object_del_by_md5(v);
+                cnt++;
+            }
+        }
+
+        _pos_map_free(&refs);
+
+        /* stray side indexes */
+        while (*kinds) {
+            xs *sidxs = _store_list(*kinds, mt);
+
+            xs_list_foreach(sidxs, v) {
+                if (!object_here_by_md5(v)) {
+                    _store_write(v, *kinds, 'D', NULL, 0);
+                    icnt++;
+                }
+            }
+
+            kinds++;
+        }
+
+        object_store_compact();
+    }
+
     p = dirs;
     while (xs_list_iter(&p, &v)) {
         xs_list *p2;
@@ -3673,7 +7403,7 @@ void purge_server(void)
 
                         if (mtime(o) == 0.0) {
                             /* delete */
-                            unlink(v2);
+                            index_unlink(v2);
                             srv_debug(1, xs_fmt("purged %s", v2));
                             icnt++;
                         }
@@ -3697,6 +7427,15 @@ void purge_server(void)
     xs *ib_dir = xs_fmt("%s/inbox", srv_basedir);
     _purge_dir(ib_dir, 7);
 
+    /* purge delivery payloads, once no queue item can be still using them */
+    {
+        int qrt = xs_number_get(xs_dict_get(srv_config, "queue_retry_minutes"));
+        int qrm = xs_number_get(xs_dict_get(srv_config, "queue_retry_max"));
+        xs *pl_dir = xs_fmt("%s/payload", srv_basedir);
+
+        _purge_dir(pl_dir, qrt * qrm * (qrm + 1) / 2 / 1440 + 2);
+    }
+
     /* purge the instance timeline */
     xs *itl_fn = xs_fmt("%s/public.idx", srv_basedir);
     int itl_gc = index_gc(itl_fn);
@@ -3722,7 +7461,7 @@ void purge_server(void)
             if (index_len(v2) == 0) {
                 /* there are no longer any entry with this tag;
                    purge it completely */
-                unlink(v2);
+                index_unlink(v2);
                 xs *dottag = xs_replace(v2, ".idx", ".tag");
                 unlink(dottag);
             }
@@ -3758,9 +7497,15 @@ void purge_user(snac *snac)
     }
 
     _purge_user_subdir(snac, "hidden",  priv_days);
-    _purge_user_subdir(snac, "private", priv_days);
 
-    _purge_user_subdir(snac, "public",  pub_days);
+    if (object_store_is_seg()) {
+        _purge_user_cache(snac, "private", priv_days);
+        _purge_user_cache(snac, "public",  pub_days);
+    }
+    else {
+        _purge_user_subdir(snac, "private", priv_days);
+        _purge_user_subdir(snac, "public",  pub_days);
+    }
 
     const char *idxs[] = { "followers.idx", "private.idx", "public.idx",
                            "pinned.idx", "bookmark.idx", "draft.idx", "sched.idx", NULL };
@@ -3541,15 +3541,13 @@ void set_user_lang(snac *user)
 }
 
 
-int html_get_handler(const xs_dict *req, const char *q_path,
+int html_get_handler(const xs_dict *req, const char *q_path, snac *user,
                      char **body, int *b_size, char **ctype,
                      xs_str **etag, xs_str **last_modified)
+/* serves the web pages of the user (or the bridges, if there is no user) */
 {
     const char *accept = xs_dict_get(req, "accept");
     int status = HTTP_STATUS_NOT_FOUND;
-    const snac *user = NULL;
-    snac snac;
-    xs *uid = NULL;
     const char *p_path;
     int cache = 1;
     int save = 1;
@@ -3598,24 +3596,16 @@ int html_get_handler(const xs_dict *req, const char *q_path,
             return HTTP_STATUS_NOT_FOUND;
     }
 
-    uid = xs_dup(v);
+    if (user == NULL)
+        return HTTP_STATUS_NOT_FOUND;
 
     /* rss extension? */
-    if (xs_endswith(uid, ".rss")) {
-        uid = xs_crop_i(uid, 0, -4);
+    if (xs_endswith(v, ".rss"))
         p_path = ".rss";
-    }
     else
         p_path = xs_list_get(l, 2);
 
-    if (!uid || !user_open(&snac, uid)) {
-        /* invalid user */
-        srv_debug(1, xs_fmt("html_get_handler bad user %s", uid));
-        return HTTP_STATUS_NOT_FOUND;
-    }
-
-    user = &snac; /* for L() */
-    set_user_lang(&snac);
+    set_user_lang(user);
 
     if (xs_is_true(xs_dict_get(srv_config, "proxy_media")))
         proxy = 1;
@@ -3642,12 +3632,12 @@ int html_get_handler(const xs_dict *req, const char *q_path,
         show = atoi(v), cache = 0, save = 0;
     if ((v = xs_dict_get(q_vars, "da")) != NULL) {
         /* user dismissed an announcement */
-        if (login(&snac, req)) {
+        if (login(user, req)) {
             double ts = atof(v);
             xs *timestamp = xs_number_new(ts);
             srv_log(xs_fmt("user dismissed announcements until %d", ts));
-            snac.config = xs_dict_set(snac.config, "last_announcement", timestamp);
-            user_persist(&snac, 0);
+            user->config = xs_dict_set(user->config, "last_announcement", timestamp);
+            user_persist(user, 0);
         }
     }
 
@@ -3663,17 +3653,17 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     if (p_path == NULL) { /** public timeline **/
         xs *h = xs_str_localtime(0, "%Y-%m.html");
 
-        if (xs_type(xs_dict_get(snac.config, "private")) == XSTYPE_TRUE) {
+        if (xs_type(xs_dict_get(user->config, "private")) == XSTYPE_TRUE) {
             /** empty public timeline for private users **/
-            *body = html_timeline(&snac, NULL, 1, 0, 0, 0, NULL, "", 1, error);
+            *body = html_timeline(user, NULL, 1, 0, 0, 0, NULL, "", 1, error);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
         }
         else
-        if (cache && history_mtime(&snac, h) > timeline_mtime(&snac)) {
-            snac_debug(&snac, 1, xs_fmt("serving cached local timeline"));
+        if (cache && history_mtime(user, h) > timeline_mtime(user)) {
+            snac_debug(user, 1, xs_fmt("serving cached local timeline"));
 
-            status = history_get(&snac, h, body, b_size,
+            status = history_get(user, h, body, b_size,
                         xs_dict_get(req, "if-none-match"), etag);
         }
         else {
@@ -3681,26 +3671,26 @@ int html_get_handler(const xs_dict *req, const char *q_path,
             int more = 0;
 
             if (xs_is_true(xs_dict_get(srv_config, "strict_public_timelines")))
-                list = timeline_simple_list(&snac, "public", skip, show, &more);
+                list = timeline_simple_list(user, "public", skip, show, &more);
             else 
-                list = timeline_list(&snac, "public", skip, show, &more);
+                list = timeline_list(user, "public", skip, show, &more);
 
-            xs *pins = pinned_list(&snac);
+            xs *pins = pinned_list(user);
             pins = xs_list_cat(pins, list);
 
-            *body = html_timeline(&snac, pins, 1, skip, show, more, NULL, "", 1, error);
+            *body = html_timeline(user, pins, 1, skip, show, more, NULL, "", 1, error);
 
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
 
             if (save)
-                history_add(&snac, h, *body, *b_size, etag);
+                history_add(user, h, *body, *b_size, etag);
         }
     }
     else
     if (strcmp(p_path, "admin") == 0) { /** private timeline **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
@@ -3721,15 +3711,15 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                     xs *object = NULL;
                     int status;
 
-                    status = activitypub_request(&snac, q, &object);
-                    snac_debug(&snac, 1, xs_fmt("Request searched URL %s %d", q, status));
+                    status = activitypub_request(user, q, &object);
+                    snac_debug(user, 1, xs_fmt("Request searched URL %s %d", q, status));
 
                     if (valid_status(status)) {
                         /* got it; also request the actor */
                         const char *attr_to = get_atto(object);
 
                         if (!xs_is_null(attr_to)) {
-                            status = actor_request(&snac, attr_to, &actor_obj);
+                            status = actor_request(user, attr_to, &actor_obj);
 
                             if (valid_status(status)) {
                                 /* reset the query string to be the real id */
@@ -3739,8 +3729,8 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                                 /* add the post to the timeline */
                                 xs *md5 = xs_md5_hex(q, strlen(q));
 
-                                if (!timeline_here(&snac, md5))
-                                    timeline_add(&snac, q, object);
+                                if (!timeline_here(user, md5))
+                                    timeline_add(user, q, object);
                             }
                         }
                     }
@@ -3760,7 +3750,7 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                     if (valid_status(webfinger_request(q, &actor, &acct))) {
                         xs *actor_obj = NULL;
 
-                        if (valid_status(actor_request(&snac, actor, &actor_obj))) {
+                        if (valid_status(actor_request(user, actor, &actor_obj))) {
                             actor_add(actor, actor_obj);
 
                             /* create a people list with only one element */
@@ -3768,7 +3758,7 @@ int html_get_handler(const xs_dict *req, const char *q_path,
 
                             xs *title = xs_fmt(L("Search results for account %s"), q);
 
-                            page = html_people_list(&snac, l, title, "wf", NULL);
+                            page = html_people_list(user, l, title, "wf", NULL);
                         }
                     }
 
@@ -3782,8 +3772,8 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                     }
 
                     xs_html *html = xs_html_tag("html",
-                        html_user_head(&snac, NULL, NULL),
-                        xs_html_add(html_user_body(&snac, 0),
+                        html_user_head(user, NULL, NULL),
+                        xs_html_add(html_user_body(user, 0),
                         page,
                         html_footer(user)));
 
@@ -3806,7 +3796,7 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                     xs *title = xs_fmt(xs_list_len(tl) ?
                         L("Search results for tag %s") : L("Nothing found for tag %s"), q);
 
-                    *body = html_timeline(&snac, tl, 0, skip, show, more, title, page, 0, error);
+                    *body = html_timeline(user, tl, 0, skip, show, more, title, page, 0, error);
                     *b_size = strlen(*body);
                     status  = HTTP_STATUS_OK;
                 }
@@ -3814,7 +3804,7 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                     /** search by content **/
                     int to = 0;
                     int msecs = atoi(xs_dict_get_def(q_vars, "msecs", "0"));
-                    xs *tl = content_search(&snac, q, 1, skip, show, msecs, &to);
+                    xs *tl = content_search(user, q, 1, skip, show, msecs, &to);
                     xs *title = NULL;
                     xs *page = xs_fmt("/admin?q=%s&msecs=%d", q, msecs + 10);
                     int tl_len = xs_list_len(tl);
@@ -3830,7 +3820,7 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                     else
                         title = xs_fmt(L("Nothing found for '%s'"), q);
 
-                    *body   = html_timeline(&snac, tl, 0, skip, tl_len, to || tl_len == show,
+                    *body   = html_timeline(user, tl, 0, skip, tl_len, to || tl_len == show,
                                             title, page, 0, error);
                     *b_size = strlen(*body);
                     status  = HTTP_STATUS_OK;
@@ -3838,54 +3828,54 @@ int html_get_handler(const xs_dict *req, const char *q_path,
             }
             else {
                 /** the private timeline **/
-                double t = history_mtime(&snac, "timeline.html_");
+                double t = history_mtime(user, "timeline.html_");
 
                 /* if enabled by admin, return a cached page if its timestamp is:
                    a) newer than the timeline timestamp
                    b) newer than the start time of the server
                 */
-                if (cache && t > timeline_mtime(&snac) && t > p_state->srv_start_time) {
-                    snac_debug(&snac, 1, xs_fmt("serving cached timeline"));
+                if (cache && t > timeline_mtime(user) && t > p_state->srv_start_time) {
+                    snac_debug(user, 1, xs_fmt("serving cached timeline"));
 
-                    status = history_get(&snac, "timeline.html_", body, b_size,
+                    status = history_get(user, "timeline.html_", body, b_size,
                                 xs_dict_get(req, "if-none-match"), etag);
                 }
                 else {
                     int more = 0;
 
-                    snac_debug(&snac, 1, xs_fmt("building timeline"));
+                    snac_debug(user, 1, xs_fmt("building timeline"));
 
-                    xs *list = timeline_list(&snac, "private", skip, show, &more);
+                    xs *list = timeline_list(user, "private", skip, show, &more);
 
-                    *body = html_timeline(&snac, list, 0, skip, show,
+                    *body = html_timeline(user, list, 0, skip, show,
                             more, NULL, "/admin", 1, error);
 
                     *b_size = strlen(*body);
                     status  = HTTP_STATUS_OK;
 
                     if (save)
-                        history_add(&snac, "timeline.html_", *body, *b_size, etag);
+                        history_add(user, "timeline.html_", *body, *b_size, etag);
 
-                    timeline_add_mark(&snac);
+                    timeline_add_mark(user);
                 }
             }
         }
     }
     else
     if (xs_startswith(p_path, "admin/p/")) { /** unique post by md5 **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
             xs *l = xs_split(p_path, "/");
             const char *md5 = xs_list_get(l, -1);
 
-            if (md5 && *md5 && timeline_here(&snac, md5)) {
+            if (md5 && *md5 && timeline_here(user, md5)) {
                 xs *list0 = xs_list_append(xs_list_new(), md5);
-                xs *list  = timeline_top_level(&snac, list0);
+                xs *list  = timeline_top_level(user, list0);
 
-                *body   = html_timeline(&snac, list, 0, 0, 0, 0, NULL, "/admin", 1, error);
+                *body   = html_timeline(user, list, 0, 0, 0, 0, NULL, "/admin", 1, error);
                 *b_size = strlen(*body);
                 status  = HTTP_STATUS_OK;
             }
@@ -3893,39 +3883,39 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     }
     else
     if (strcmp(p_path, "people") == 0) { /** the list of people **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
-            *body   = html_people(&snac);
+            *body   = html_people(user);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
         }
     }
     else
     if (strcmp(p_path, "notifications") == 0) { /** the list of notifications **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
-            *body   = html_notifications(&snac, skip, show);
+            *body   = html_notifications(user, skip, show);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
         }
     }
     else
     if (strcmp(p_path, "instance") == 0) { /** instance timeline **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
             xs *list = timeline_instance_list(skip, show);
             xs *next = timeline_instance_list(skip + show, 1);
 
-            *body = html_timeline(&snac, list, 0, skip, show,
+            *body = html_timeline(user, list, 0, skip, show,
                 xs_list_len(next), L("Showing instance timeline"), "/instance", 0, error);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
@@ -3933,14 +3923,14 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     }
     else
     if (strcmp(p_path, "pinned") == 0) { /** list of pinned posts **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
-            xs *list = pinned_list(&snac);
+            xs *list = pinned_list(user);
 
-            *body = html_timeline(&snac, list, 0, skip, show,
+            *body = html_timeline(user, list, 0, skip, show,
                 0, L("Pinned posts"), "", 0, error);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
@@ -3948,14 +3938,14 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     }
     else
     if (strcmp(p_path, "bookmarks") == 0) { /** list of bookmarked posts **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
-            xs *list = bookmark_list(&snac);
+            xs *list = bookmark_list(user);
 
-            *body = html_timeline(&snac, list, 0, skip, show,
+            *body = html_timeline(user, list, 0, skip, show,
                 0, L("Bookmarked posts"), "", 0, error);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
@@ -3963,14 +3953,14 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     }
     else
     if (strcmp(p_path, "drafts") == 0) { /** list of drafts **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
-            xs *list = draft_list(&snac);
+            xs *list = draft_list(user);
 
-            *body = html_timeline(&snac, list, 0, skip, show,
+            *body = html_timeline(user, list, 0, skip, show,
                 0, L("Post drafts"), "", 0, error);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
@@ -3978,14 +3968,14 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     }
     else
     if (strcmp(p_path, "sched") == 0) { /** list of scheduled posts **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
-            xs *list = scheduled_list(&snac);
+            xs *list = scheduled_list(user);
 
-            *body = html_timeline(&snac, list, 0, skip, show,
+            *body = html_timeline(user, list, 0, skip, show,
                 0, L("Scheduled posts"), "", 0, error);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
@@ -3993,25 +3983,25 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     }
     else
     if (xs_startswith(p_path, "list/")) { /** list timelines **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
             xs *l = xs_split(p_path, "/");
             const char *lid = xs_list_get(l, -1);
 
-            xs *list = list_timeline(&snac, lid, skip, show);
-            xs *next = list_timeline(&snac, lid, skip + show, 1);
+            xs *list = list_timeline(user, lid, skip, show);
+            xs *next = list_timeline(user, lid, skip + show, 1);
 
             if (list != NULL) {
-                xs *ttl = timeline_top_level(&snac, list);
+                xs *ttl = timeline_top_level(user, list);
 
                 xs *base = xs_fmt("/list/%s", lid);
-                xs *name = list_maint(&snac, lid, 3);
+                xs *name = list_maint(user, lid, 3);
                 xs *title = xs_fmt(L("Showing timeline for list '%s'"), name);
 
-                *body = html_timeline(&snac, ttl, 0, skip, show,
+                *body = html_timeline(user, ttl, 0, skip, show,
                     xs_list_len(next), title, base, 1, error);
                 *b_size = strlen(*body);
                 status  = HTTP_STATUS_OK;
@@ -4020,10 +4010,10 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     }
     else
     if (xs_startswith(p_path, "p/")) { /** a timeline with just one entry **/
-        if (xs_type(xs_dict_get(snac.config, "private")) == XSTYPE_TRUE)
+        if (xs_type(xs_dict_get(user->config, "private")) == XSTYPE_TRUE)
             return HTTP_STATUS_FORBIDDEN;
 
-        xs *id  = xs_fmt("%s/%s", snac.actor, p_path);
+        xs *id  = xs_fmt("%s/%s", user->actor, p_path);
         xs *msg = NULL;
 
         if (valid_status(object_get(id, &msg))) {
@@ -4032,7 +4022,7 @@ int html_get_handler(const xs_dict *req, const char *q_path,
 
             list = xs_list_append(list, md5);
 
-            *body   = html_timeline(&snac, list, 1, 0, 0, 0, NULL, "", 1, error);
+            *body   = html_timeline(user, list, 1, 0, 0, 0, NULL, "", 1, error);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_OK;
         }
@@ -4044,7 +4034,7 @@ int html_get_handler(const xs_dict *req, const char *q_path,
         int sz;
 
         if (id && *id) {
-            status = static_get(&snac, id, body, &sz,
+            status = static_get(user, id, body, &sz,
                         xs_dict_get(req, "if-none-match"), etag);
 
             if (valid_status(status)) {
@@ -4055,7 +4045,7 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     }
     else
     if (xs_startswith(p_path, "h/")) { /** an entry from the history **/
-        if (xs_type(xs_dict_get(snac.config, "private")) == XSTYPE_TRUE)
+        if (xs_type(xs_dict_get(user->config, "private")) == XSTYPE_TRUE)
             return HTTP_STATUS_FORBIDDEN;
 
         if (xs_type(xs_dict_get(srv_config, "disable_history")) == XSTYPE_TRUE)
@@ -4071,32 +4061,32 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                 status = HTTP_STATUS_NOT_FOUND;
             }
             else
-                status = history_get(&snac, id, body, b_size,
+                status = history_get(user, id, body, b_size,
                             xs_dict_get(req, "if-none-match"), etag);
         }
     }
     else
     if (strcmp(p_path, ".rss") == 0) { /** public timeline in RSS format **/
-        if (xs_type(xs_dict_get(snac.config, "private")) == XSTYPE_TRUE)
+        if (xs_type(xs_dict_get(user->config, "private")) == XSTYPE_TRUE)
             return HTTP_STATUS_FORBIDDEN;
 
         int cnt = xs_number_get(xs_dict_get_def(srv_config, "max_public_entries", "20"));
 
-        xs *elems = timeline_simple_list(&snac, "public", 0, cnt, NULL);
-        xs *bio   = xs_dup(xs_dict_get(snac.config, "bio"));
+        xs *elems = timeline_simple_list(user, "public", 0, cnt, NULL);
+        xs *bio   = xs_dup(xs_dict_get(user->config, "bio"));
 
         xs *rss_title = xs_fmt("%s (@%s@%s)",
-            xs_dict_get(snac.config, "name"),
-            snac.uid,
+            xs_dict_get(user->config, "name"),
+            user->uid,
             xs_dict_get(srv_config, "host"));
-        xs *rss_link = xs_fmt("%s.rss", snac.actor);
+        xs *rss_link = xs_fmt("%s.rss", user->actor);
 
-        *body   = timeline_to_rss(&snac, elems, rss_title, rss_link, bio);
+        *body   = timeline_to_rss(user, elems, rss_title, rss_link, bio);
         *b_size = strlen(*body);
         *ctype  = "application/rss+xml; charset=utf-8";
         status  = HTTP_STATUS_OK;
 
-        snac_debug(&snac, 1, xs_fmt("serving RSS"));
+        snac_debug(user, 1, xs_fmt("serving RSS"));
     }
     else
     if (proxy && (xs_startswith(p_path, "x/") || xs_startswith(p_path, "y/"))) { /** remote media by proxy **/
@@ -4104,16 +4094,16 @@ int html_get_handler(const xs_dict *req, const char *q_path,
 
         if (xs_startswith(p_path, "x/")) {
             /* proxy usage authorized by http basic auth */
-            if (login(&snac, req))
+            if (login(user, req))
                 proxy_prefix = xs_str_new("x/");
             else {
-                *body  = xs_dup(uid);
+                *body  = xs_dup(user->uid);
                 status = HTTP_STATUS_UNAUTHORIZED;
             }
         }
         else {
             /* proxy usage authorized by proxy_token */
-            xs *tks = xs_fmt("%s:%s", srv_proxy_token_seed, snac.actor);
+            xs *tks = xs_fmt("%s:%s", srv_proxy_token_seed, user->actor);
             xs *tk = xs_md5_hex(tks, strlen(tks));
             xs *p = xs_fmt("y/%s/", tk);
 
@@ -4161,37 +4151,37 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                 }
             }
 
-            snac_debug(&snac, 1, xs_fmt("Proxy for %s %d", url, status));
+            snac_debug(user, 1, xs_fmt("Proxy for %s %d", url, status));
         }
     }
     else
     if (strcmp(p_path, "share") == 0) { /** direct post **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
             const char *b64 = xs_dict_get(q_vars, "content");
             int sz;
             xs *content = xs_base64_dec(b64, &sz);
-            xs *msg = msg_note(&snac, content, NULL, NULL, NULL, 0, NULL, NULL);
-            xs *c_msg = msg_create(&snac, msg);
+            xs *msg = msg_note(user, content, NULL, NULL, NULL, 0, NULL, NULL);
+            xs *c_msg = msg_create(user, msg);
 
-            timeline_add(&snac, xs_dict_get(msg, "id"), msg);
+            timeline_add(user, xs_dict_get(msg, "id"), msg);
 
-            enqueue_message(&snac, c_msg);
+            enqueue_message(user, c_msg);
 
-            snac_debug(&snac, 1, xs_fmt("web action 'share' received"));
+            snac_debug(user, 1, xs_fmt("web action 'share' received"));
 
-            *body   = xs_fmt("%s/admin", snac.actor);
+            *body   = xs_fmt("%s/admin", user->actor);
             *b_size = strlen(*body);
             status  = HTTP_STATUS_SEE_OTHER;
         }
     }
     else
     if (strcmp(p_path, "authorize_interaction") == 0) { /** follow, like or boost from Mastodon **/
-        if (!login(&snac, req)) {
-            *body  = xs_dup(uid);
+        if (!login(user, req)) {
+            *body  = xs_dup(user->uid);
             status = HTTP_STATUS_UNAUTHORIZED;
         }
         else {
@@ -4202,14 +4192,14 @@ int html_get_handler(const xs_dict *req, const char *q_path,
 
             if (xs_is_string(id) && xs_is_string(action)) {
                 if (strcmp(action, "Follow") == 0) {
-                    xs *msg = msg_follow(&snac, id);
+                    xs *msg = msg_follow(user, id);
 
                     if (msg != NULL) {
                         const char *actor = xs_dict_get(msg, "object");
 
-                        following_add(&snac, actor, msg);
+                        following_add(user, actor, msg);
 
-                        enqueue_output_by_actor(&snac, msg, actor, 0);
+                        enqueue_output_by_actor(user, msg, actor, 0);
 
                         status = HTTP_STATUS_SEE_OTHER;
                     }
@@ -4217,11 +4207,11 @@ int html_get_handler(const xs_dict *req, const char *q_path,
                 else
                 if (xs_match(action, "Like|Boost|Announce")) {
                     /* bring the post */
-                    xs *msg = msg_admiration(&snac, id, *action == 'L' ? "Like" : "Announce");
+                    xs *msg = msg_admiration(user, id, *action == 'L' ? "Like" : "Announce");
 
                     if (msg != NULL) {
-                        enqueue_message(&snac, msg);
-                        timeline_admire(&snac, xs_dict_get(msg, "object"), snac.actor, *action == 'L' ? 1 : 0);
+                        enqueue_message(user, msg);
+                        timeline_admire(user, xs_dict_get(msg, "object"), user->actor, *action == 'L' ? 1 : 0);
 
                         status = HTTP_STATUS_SEE_OTHER;
                     }
@@ -4229,7 +4219,7 @@ int html_get_handler(const xs_dict *req, const char *q_path,
             }
 
             if (status == HTTP_STATUS_SEE_OTHER) {
-                *body   = xs_fmt("%s/admin", snac.actor);
+                *body   = xs_fmt("%s/admin", user->actor);
                 *b_size = strlen(*body);
             }
         }
@@ -4237,8 +4227,6 @@ int html_get_handler(const xs_dict *req, const char *q_path,
     else
         status = HTTP_STATUS_NOT_FOUND;
 
-    user_free(&snac);
-
     if (valid_status(status) && *ctype == NULL) {
         *ctype = "text/html; charset=utf-8";
     }
@@ -4247,45 +4235,34 @@ int html_get_handler(const xs_dict *req, const char *q_path,
 }
 
 
-int html_post_handler(const xs_dict *req, const char *q_path,
+int html_post_handler(const xs_dict *req, const char *q_path, snac *user,
                       char *payload, int p_size,
                       char **body, int *b_size, char **ctype)
+/* processes the forms posted from the web pages of the user */
 {
     (void)p_size;
     (void)ctype;
 
     int status = 0;
-    const snac *user = NULL;
-    snac snac;
-    const char *uid;
     const char *p_path;
     const xs_dict *p_vars;
 
     xs *l = xs_split_n(q_path, "/", 2);
 
-    uid = xs_list_get(l, 1);
-    if (!uid || !user_open(&snac, uid)) {
-        /* invalid user */
-        srv_debug(1, xs_fmt("html_post_handler bad user %s", uid));
-        return HTTP_STATUS_NOT_FOUND;
-    }
-
     p_path = xs_list_get(l, 2);
 
     /* all posts must be authenticated */
-    if (!login(&snac, req)) {
-        user_free(&snac);
-        *body  = xs_dup(uid);
+    if (!login(user, req)) {
+        *body  = xs_dup(user->uid);
         return HTTP_STATUS_UNAUTHORIZED;
     }
 
-    user = &snac; /* for L() */
-    set_user_lang(&snac);
+    set_user_lang(user);
 
     p_vars = xs_dict_get(req, "p_vars");
 
     if (p_path && strcmp(p_path, "admin/note") == 0) { /** **/
-        snac_debug(&snac, 1, xs_fmt("web action '%s' received", p_path));
+        snac_debug(user, 1, xs_fmt("web action '%s' received", p_path));
 
         /* post note */
         const char *content      = xs_dict_get(p_vars, "content");
@@ -4331,12 +4308,12 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                     const char *ext = strrchr(fn, '.');
                     xs *hash  = xs_md5_hex(rnd, strlen(rnd));
                     xs *id    = xs_fmt("post-%s%s", hash, ext ? ext : "");
-                    xs *url   = xs_fmt("%s/s/%s", snac.actor, id);
+                    xs *url   = xs_fmt("%s/s/%s", user->actor, id);
                     int fo    = xs_number_get(xs_list_get(attach_file, 1));
                     int fs    = xs_number_get(xs_list_get(attach_file, 2));
 
                     /* store */
-                    static_put(&snac, id, payload + fo, fs);
+                    static_put(user, id, payload + fo, fs);
 
                     xs *l = xs_list_new();
 
@@ -4373,13 +4350,13 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                 if (!xs_is_null(p_multiple) && strcmp(p_multiple, "on") == 0)
                     multiple = 1;
 
-                msg = msg_question(&snac, content_2, attach_list,
+                msg = msg_question(user, content_2, attach_list,
                                    poll_opts, multiple, end_secs);
 
-                enqueue_close_question(&snac, xs_dict_get(msg, "id"), end_secs);
+                enqueue_close_question(user, xs_dict_get(msg, "id"), end_secs);
             }
             else
-                msg = msg_note(&snac, content_2, to, in_reply_to, attach_list, priv, NULL, NULL);
+                msg = msg_note(user, content_2, to, in_reply_to, attach_list, priv, NULL, NULL);
 
             if (sensitive != NULL) {
                 msg = xs_dict_set(msg, "sensitive", xs_stock(XSTYPE_TRUE));
@@ -4393,15 +4370,15 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                 time_t t = xs_parse_iso_date(post_pubdate, 0);
 
                 if (t != 0) {
-                    t -= xs_tz_offset(snac.tz);
+                    t -= xs_tz_offset(user->tz);
 
                     xs *iso_date = xs_str_iso_date(t);
                     msg = xs_dict_set(msg, "published", iso_date);
 
-                    snac_debug(&snac, 1, xs_fmt("Published date: [%s]", iso_date));
+                    snac_debug(user, 1, xs_fmt("Published date: [%s]", iso_date));
                 }
                 else
-                    snac_log(&snac, xs_fmt("Invalid post date: [%s]", post_pubdate));
+                    snac_log(user, xs_fmt("Invalid post date: [%s]", post_pubdate));
             }
 
             /* is the published date from the future? */
@@ -4416,15 +4393,15 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                 const char *id = xs_dict_get(msg, "id");
 
                 if (store_as_draft) {
-                    draft_add(&snac, id, msg);
+                    draft_add(user, id, msg);
                 }
                 else
                 if (future_post) {
-                    schedule_add(&snac, id, msg);
+                    schedule_add(user, id, msg);
                 }
                 else {
-                    c_msg = msg_create(&snac, msg);
-                    timeline_add(&snac, id, msg);
+                    c_msg = msg_create(user, msg);
+                    timeline_add(user, id, msg);
                 }
             }
             else {
@@ -4443,15 +4420,15 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                     }
 
                     if (store_as_draft) {
-                        draft_add(&snac, edit_id, msg);
+                        draft_add(user, edit_id, msg);
                     }
                     else
-                    if (is_draft(&snac, edit_id)) {
+                    if (is_draft(user, edit_id)) {
                         /* message was previously a draft; it's a create activity */
 
                         /* if the date is from the past, overwrite it with right_now */
                         if (strcmp(xs_dict_get(msg, "published"), right_now) < 0) {
-                            snac_debug(&snac, 1, xs_fmt("setting draft ancient date to %s", right_now));
+                            snac_debug(user, 1, xs_fmt("setting draft ancient date to %s", right_now));
                             msg = xs_dict_set(msg, "published", right_now);
                         }
 
@@ -4459,19 +4436,19 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                         object_add_ow(edit_id, msg);
 
                         if (future_post) {
-                            schedule_add(&snac, edit_id, msg);
+                            schedule_add(user, edit_id, msg);
                         }
                         else {
-                            c_msg = msg_create(&snac, msg);
-                            timeline_add(&snac, edit_id, msg);
+                            c_msg = msg_create(user, msg);
+                            timeline_add(user, edit_id, msg);
                         }
 
-                        draft_del(&snac, edit_id);
+                        draft_del(user, edit_id);
                     }
                     else
-                    if (is_scheduled(&snac, edit_id)) {
+                    if (is_scheduled(user, edit_id)) {
                         /* editing an scheduled post; just update it */
-                        schedule_add(&snac, edit_id, msg);
+                        schedule_add(user, edit_id, msg);
                     }
                     else {
                         /* ignore the (possibly changed) published date */
@@ -4485,17 +4462,17 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                         object_add_ow(edit_id, msg);
 
                         /* update message */
-                        c_msg = msg_update(&snac, msg);
+                        c_msg = msg_update(user, msg);
                     }
                 }
                 else
-                    snac_log(&snac, xs_fmt("cannot get object '%s' for editing", edit_id));
+                    snac_log(user, xs_fmt("cannot get object '%s' for editing", edit_id));
             }
 
             if (c_msg != NULL)
-                enqueue_message(&snac, c_msg);
+                enqueue_message(user, c_msg);
 
-            history_del(&snac, "timeline.html_");
+            history_del(user, "timeline.html_");
         }
 
         status = HTTP_STATUS_SEE_OTHER;
@@ -4511,80 +4488,80 @@ int html_post_handler(const xs_dict *req, const char *q_path,
         if (action == NULL)
             return HTTP_STATUS_NOT_FOUND;
 
-        snac_debug(&snac, 1, xs_fmt("web action '%s' received", action));
+        snac_debug(user, 1, xs_fmt("web action '%s' received", action));
 
         status = HTTP_STATUS_SEE_OTHER;
 
         if (strcmp(action, L("Like")) == 0) { /** **/
-            xs *msg = msg_admiration(&snac, id, "Like");
+            xs *msg = msg_admiration(user, id, "Like");
 
             if (msg != NULL) {
-                enqueue_message(&snac, msg);
-                timeline_admire(&snac, xs_dict_get(msg, "object"), snac.actor, 1);
+                enqueue_message(user, msg);
+                timeline_admire(user, xs_dict_get(msg, "object"), user->actor, 1);
             }
         }
         else
         if (strcmp(action, L("Boost")) == 0) { /** **/
-            xs *msg = msg_admiration(&snac, id, "Announce");
+            xs *msg = msg_admiration(user, id, "Announce");
 
             if (msg != NULL) {
-                enqueue_message(&snac, msg);
-                timeline_admire(&snac, xs_dict_get(msg, "object"), snac.actor, 0);
+                enqueue_message(user, msg);
+                timeline_admire(user, xs_dict_get(msg, "object"), user->actor, 0);
             }
         }
         else
         if (strcmp(action, L("Unlike")) == 0) { /** **/
-            xs *msg = msg_repulsion(&snac, id, "Like");
+            xs *msg = msg_repulsion(user, id, "Like");
 
             if (msg != NULL) {
-                enqueue_message(&snac, msg);
+                enqueue_message(user, msg);
             }
         }
         else
         if (strcmp(action, L("Unboost")) == 0) { /** **/
-            xs *msg = msg_repulsion(&snac, id, "Announce");
+            xs *msg = msg_repulsion(user, id, "Announce");
 
             if (msg != NULL) {
-                enqueue_message(&snac, msg);
+                enqueue_message(user, msg);
             }
         }
         else
         if (strcmp(action, L("MUTE")) == 0) { /** **/
-            mute(&snac, actor);
+            mute(user, actor);
         }
         else
         if (strcmp(action, L("Unmute")) == 0) { /** **/
-            unmute(&snac, actor);
+            unmute(user, actor);
         }
         else
         if (strcmp(action, L("Hide")) == 0) { /** **/
-            if (is_draft(&snac, id))
-                draft_del(&snac, id);
+            if (is_draft(user, id))
+                draft_del(user, id);
             else
-            if (is_scheduled(&snac, id))
-                schedule_del(&snac, id);
+            if (is_scheduled(user, id))
+                schedule_del(user, id);
             else
-                hide(&snac, id);
+                hide(user, id);
         }
         else
         if (strcmp(action, L("Limit")) == 0) { /** **/
-            limit(&snac, actor);
+            limit(user, actor);
         }
         else
         if (strcmp(action, L("Unlimit")) == 0) { /** **/
-            unlimit(&snac, actor);
+            unlimit(user, actor);
         }
         else
         if (strcmp(action, L("Follow")) == 0) { /** **/
-            xs *msg = msg_follow(&snac, actor);
+            xs *msg = msg_follow(user, actor);
 
             if (msg != NULL) {
                 /* reload the actor from the message, in may be different */
                 actor = xs_dict_get(msg, "object");
 
-                following_add(&snac, actor, msg);
+                following_add(user, actor, msg);
 
-                enqueue_output_by_actor(&snac, msg, actor, 0);
+                enqueue_output_by_actor(user, msg, actor, 0);
             }
         }
         else
@@ -4592,29 +4569,29 @@ int html_post_handler(const xs_dict *req, const char *q_path,
             /* get the following object */
             xs *object = NULL;
 
-            if (valid_status(following_get(&snac, actor, &object))) {
-                xs *msg = msg_undo(&snac, xs_dict_get(object, "object"));
+            if (valid_status(following_get(user, actor, &object))) {
+                xs *msg = msg_undo(user, xs_dict_get(object, "object"));
 
-                following_del(&snac, actor);
+                following_del(user, actor);
 
-                enqueue_output_by_actor(&snac, msg, actor, 0);
+                enqueue_output_by_actor(user, msg, actor, 0);
 
-                snac_log(&snac, xs_fmt("unfollowed actor %s", actor));
+                snac_log(user, xs_fmt("unfollowed actor %s", actor));
             }
             else
-                snac_log(&snac, xs_fmt("actor is not being followed %s", actor));
+                snac_log(user, xs_fmt("actor is not being followed %s", actor));
         }
         else
         if (strcmp(action, L("Follow Group")) == 0) { /** **/
-            xs *msg = msg_follow(&snac, group);
+            xs *msg = msg_follow(user, group);
 
             if (msg != NULL) {
                 /* reload the group from the message, in may be different */
                 group = xs_dict_get(msg, "object");
 
-                following_add(&snac, group, msg);
+                following_add(user, group, msg);
 
-                enqueue_output_by_actor(&snac, msg, group, 0);
+                enqueue_output_by_actor(user, msg, group, 0);
             }
         }
         else
@@ -4622,76 +4599,76 @@ int html_post_handler(const xs_dict *req, const char *q_path,
             /* get the following object */
             xs *object = NULL;
 
-            if (valid_status(following_get(&snac, group, &object))) {
-                xs *msg = msg_undo(&snac, xs_dict_get(object, "object"));
+            if (valid_status(following_get(user, group, &object))) {
+                xs *msg = msg_undo(user, xs_dict_get(object, "object"));
 
-                following_del(&snac, group);
+                following_del(user, group);
 
-                enqueue_output_by_actor(&snac, msg, group, 0);
+                enqueue_output_by_actor(user, msg, group, 0);
 
-                snac_log(&snac, xs_fmt("unfollowed group %s", group));
+                snac_log(user, xs_fmt("unfollowed group %s", group));
             }
             else
-                snac_log(&snac, xs_fmt("actor is not being followed %s", actor));
+                snac_log(user, xs_fmt("actor is not being followed %s", actor));
         }
         else
         if (strcmp(action, L("Delete")) == 0) { /** **/
             const char *actor_form = xs_dict_get(p_vars, "actor-form");
             if (actor_form != NULL) {
                 /* delete follower */
-                if (valid_status(follower_del(&snac, actor)))
-                    snac_log(&snac, xs_fmt("deleted follower %s", actor));
+                if (valid_status(follower_del(user, actor)))
+                    snac_log(user, xs_fmt("deleted follower %s", actor));
                 else
-                    snac_log(&snac, xs_fmt("error deleting follower %s", actor));
+                    snac_log(user, xs_fmt("error deleting follower %s", actor));
             }
             else {
                 /* delete an entry */
-                if (xs_startswith(id, snac.actor) && !is_draft(&snac, id)) {
+                if (xs_startswith(id, user->actor) && !is_draft(user, id)) {
                     /* it's a post by us: generate a delete */
-                    xs *msg = msg_delete(&snac, id);
+                    xs *msg = msg_delete(user, id);
 
-                    enqueue_message(&snac, msg);
+                    enqueue_message(user, msg);
 
-                    snac_log(&snac, xs_fmt("posted tombstone for %s", id));
+                    snac_log(user, xs_fmt("posted tombstone for %s", id));
                 }
 
-                timeline_del(&snac, id);
+                timeline_del(user, id);
 
-                draft_del(&snac, id);
+                draft_del(user, id);
 
-                schedule_del(&snac, id);
+                schedule_del(user, id);
 
-                snac_log(&snac, xs_fmt("deleted entry %s", id));
+                snac_log(user, xs_fmt("deleted entry %s", id));
             }
         }
         else
         if (strcmp(action, L("Pin")) == 0) { /** **/
-            pin(&snac, id);
-            timeline_touch(&snac);
+            pin(user, id);
+            timeline_touch(user);
         }
         else
         if (strcmp(action, L("Unpin")) == 0) { /** **/
-            unpin(&snac, id);
-            timeline_touch(&snac);
+            unpin(user, id);
+            timeline_touch(user);
         }
         else
         if (strcmp(action, L("Bookmark")) == 0) { /** **/
-            bookmark(&snac, id);
-            timeline_touch(&snac);
+            bookmark(user, id);
+            timeline_touch(user);
         }
         else
         if (strcmp(action, L("Unbookmark")) == 0) { /** **/
-            unbookmark(&snac, id);
-            timeline_touch(&snac);
+            unbookmark(user, id);
+            timeline_touch(user);
         }
         else
         if (strcmp(action, L("Approve")) == 0) { /** **/
-            xs *fwreq = pending_get(&snac, actor);
+            xs *fwreq = pending_get(user, actor);
 
             if (fwreq != NULL) {
-                xs *reply = msg_accept(&snac, fwreq, actor);
+                xs *reply = msg_accept(user, fwreq, actor);
 
-                enqueue_message(&snac, reply);
+                enqueue_message(user, reply);
 
                 if (xs_is_null(xs_dict_get(fwreq, "published"))) {
                     /* add a date if it doesn't include one (Mastodon) */
@@ -4699,25 +4676,25 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                     fwreq = xs_dict_set(fwreq, "published", date);
                 }
 
-                timeline_add(&snac, xs_dict_get(fwreq, "id"), fwreq);
+                timeline_add(user, xs_dict_get(fwreq, "id"), fwreq);
 
-                follower_add(&snac, actor);
+                follower_add(user, actor);
 
-                pending_del(&snac, actor);
+                pending_del(user, actor);
 
-                snac_log(&snac, xs_fmt("new follower %s", actor));
+                snac_log(user, xs_fmt("new follower %s", actor));
             }
         }
         else
         if (strcmp(action, L("Discard")) == 0) { /** **/
-            pending_del(&snac, actor);
+            pending_del(user, actor);
         }
         else
             status = HTTP_STATUS_NOT_FOUND;
 
         /* delete the cached timeline */
         if (status == HTTP_STATUS_SEE_OTHER)
-            history_del(&snac, "timeline.html_");
+            history_del(user, "timeline.html_");
     }
     else
     if (p_path && strcmp(p_path, "admin/user-setup") == 0) { /** **/
@@ -4726,69 +4703,69 @@ int html_post_handler(const xs_dict *req, const char *q_path,
         const char *p1, *p2;
 
         if ((v = xs_dict_get(p_vars, "name")) != NULL)
-            snac.config = xs_dict_set(snac.config, "name", v);
+            user->config = xs_dict_set(user->config, "name", v);
         if ((v = xs_dict_get(p_vars, "avatar")) != NULL)
-            snac.config = xs_dict_set(snac.config, "avatar", v);
+            user->config = xs_dict_set(user->config, "avatar", v);
         if ((v = xs_dict_get(p_vars, "bio")) != NULL)
-            snac.config = xs_dict_set(snac.config, "bio", v);
+            user->config = xs_dict_set(user->config, "bio", v);
         if ((v = xs_dict_get(p_vars, "cw")) != NULL &&
             strcmp(v, "on") == 0) {
-            snac.config = xs_dict_set(snac.config, "cw", "open");
+            user->config = xs_dict_set(user->config, "cw", "open");
         } else { /* if the checkbox is not set, the parameter is missing */
-            snac.config = xs_dict_set(snac.config, "cw", "");
+            user->config = xs_dict_set(user->config, "cw", "");
         }
         if ((v = xs_dict_get(p_vars, "email")) != NULL)
-            snac.config = xs_dict_set(snac.config, "email", v);
+            user->config = xs_dict_set(user->config, "email", v);
         if ((v = xs_dict_get(p_vars, "telegram_bot")) != NULL)
-            snac.config = xs_dict_set(snac.config, "telegram_bot", v);
+            user->config = xs_dict_set(user->config, "telegram_bot", v);
         if ((v = xs_dict_get(p_vars, "telegram_chat_id")) != NULL)
-            snac.config = xs_dict_set(snac.config, "telegram_chat_id", v);
+            user->config = xs_dict_set(user->config, "telegram_chat_id", v);
         if ((v = xs_dict_get(p_vars, "ntfy_server")) != NULL)
-            snac.config = xs_dict_set(snac.config, "ntfy_server", v);
+            user->config = xs_dict_set(user->config, "ntfy_server", v);
         if ((v = xs_dict_get(p_vars, "ntfy_token")) != NULL)
-            snac.config = xs_dict_set(snac.config, "ntfy_token", v);
+            user->config = xs_dict_set(user->config, "ntfy_token", v);
         if ((v = xs_dict_get(p_vars, "purge_days")) != NULL) {
             xs *days    = xs_number_new(atof(v));
-            snac.config = xs_dict_set(snac.config, "purge_days", days);
+            user->config = xs_dict_set(user->config, "purge_days", days);
         }
         if ((v = xs_dict_get(p_vars, "drop_dm_from_unknown")) != NULL && strcmp(v, "on") == 0)
-            snac.config = xs_dict_set(snac.config, "drop_dm_from_unknown", xs_stock(XSTYPE_TRUE));
+            user->config = xs_dict_set(user->config, "drop_dm_from_unknown", xs_stock(XSTYPE_TRUE));
         else
-            snac.config = xs_dict_set(snac.config, "drop_dm_from_unknown", xs_stock(XSTYPE_FALSE));
+            user->config = xs_dict_set(user->config, "drop_dm_from_unknown", xs_stock(XSTYPE_FALSE));
         if ((v = xs_dict_get(p_vars, "bot")) != NULL && strcmp(v, "on") == 0)
-            snac.config = xs_dict_set(snac.config, "bot", xs_stock(XSTYPE_TRUE));
+            user->config = xs_dict_set(user->config, "bot", xs_stock(XSTYPE_TRUE));
         else
-            snac.config = xs_dict_set(snac.config, "bot", xs_stock(XSTYPE_FALSE));
+            user->config = xs_dict_set(user->config, "bot", xs_stock(XSTYPE_FALSE));
         if ((v = xs_dict_get(p_vars, "private")) != NULL && strcmp(v, "on") == 0)
-            snac.config = xs_dict_set(snac.config, "private", xs_stock(XSTYPE_TRUE));
+            user->config = xs_dict_set(user->config, "private", xs_stock(XSTYPE_TRUE));
         else
-            snac.config = xs_dict_set(snac.config, "private", xs_stock(XSTYPE_FALSE));
+            user->config = xs_dict_set(user->config, "private", xs_stock(XSTYPE_FALSE));
         if ((v = xs_dict_get(p_vars, "auto_boost")) != NULL && strcmp(v, "on") == 0)
-            snac.config = xs_dict_set(snac.config, "auto_boost", xs_stock(XSTYPE_TRUE));
+            user->config = xs_dict_set(user->config, "auto_boost", xs_stock(XSTYPE_TRUE));
         else
-            snac.config = xs_dict_set(snac.config, "auto_boost", xs_stock(XSTYPE_FALSE));
+            user->config = xs_dict_set(user->config, "auto_boost", xs_stock(XSTYPE_FALSE));
         if ((v = xs_dict_get(p_vars, "collapse_threads")) != NULL && strcmp(v, "on") == 0)
-            snac.config = xs_dict_set(snac.config, "collapse_threads", xs_stock(XSTYPE_TRUE));
+            user->config = xs_dict_set(user->config, "collapse_threads", xs_stock(XSTYPE_TRUE));
         else
-            snac.config = xs_dict_set(snac.config, "collapse_threads", xs_stock(XSTYPE_FALSE));
+            user->config = xs_dict_set(user->config, "collapse_threads", xs_stock(XSTYPE_FALSE));
         if ((v = xs_dict_get(p_vars, "approve_followers")) != NULL && strcmp(v, "on") == 0)
-            snac.config = xs_dict_set(snac.config, "approve_followers", xs_stock(XSTYPE_TRUE));
+            user->config = xs_dict_set(user->config, "approve_followers", xs_stock(XSTYPE_TRUE));
         else
-            snac.config = xs_dict_set(snac.config, "approve_followers", xs_stock(XSTYPE_FALSE));
+            user->config = xs_dict_set(user->config, "approve_followers", xs_stock(XSTYPE_FALSE));
         if ((v = xs_dict_get(p_vars, "show_contact_metrics")) != NULL && strcmp(v, "on") == 0)
-            snac.config = xs_dict_set(snac.config, "show_contact_metrics", xs_stock(XSTYPE_TRUE));
+            user->config = xs_dict_set(user->config, "show_contact_metrics", xs_stock(XSTYPE_TRUE));
         else
-            snac.config = xs_dict_set(snac.config, "show_contact_metrics", xs_stock(XSTYPE_FALSE));
+            user->config = xs_dict_set(user->config, "show_contact_metrics", xs_stock(XSTYPE_FALSE));
         if ((v = xs_dict_get(p_vars, "web_ui_lang")) != NULL)
-            snac.config = xs_dict_set(snac.config, "lang", v);
+            user->config = xs_dict_set(user->config, "lang", v);
         if ((v = xs_dict_get(p_vars, "tz")) != NULL)
-            snac.config = xs_dict_set(snac.config, "tz", v);
+            user->config = xs_dict_set(user->config, "tz", v);
 
-        snac.config = xs_dict_set(snac.config, "latitude", xs_dict_get_def(p_vars, "latitude", ""));
-        snac.config = xs_dict_set(snac.config, "longitude", xs_dict_get_def(p_vars, "longitude", ""));
+        user->config = xs_dict_set(user->config, "latitude", xs_dict_get_def(p_vars, "latitude", ""));
+        user->config = xs_dict_set(user->config, "longitude", xs_dict_get_def(p_vars, "longitude", ""));
 
         if ((v = xs_dict_get(p_vars, "metadata")) != NULL)
-            snac.config = xs_dict_set(snac.config, "metadata", v);
+            user->config = xs_dict_set(user->config, "metadata", v);
 
         /* uploads */
         const char *uploads[] = { "avatar", "header", NULL };
@@ -4807,14 +4784,14 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                         const char *ext = strrchr(fn, '.');
                         xs *hash        = xs_md5_hex(fn, strlen(fn));
                         xs *id          = xs_fmt("%s-%s%s", uploads[n], hash, ext ? ext : "");
-                        xs *url         = xs_fmt("%s/s/%s", snac.actor, id);
+                        xs *url         = xs_fmt("%s/s/%s", user->actor, id);
                         int fo          = xs_number_get(xs_list_get(uploaded_file, 1));
                         int fs          = xs_number_get(xs_list_get(uploaded_file, 2));
 
                         /* store */
-                        static_put(&snac, id, payload + fo, fs);
+                        static_put(user, id, payload + fo, fs);
 
-                        snac.config = xs_dict_set(snac.config, uploads[n], url);
+                        user->config = xs_dict_set(user->config, uploads[n], url);
                     }
                 }
             }
@@ -4826,7 +4803,7 @@ int html_post_handler(const xs_dict *req, const char *q_path,
             const char *delete_var = xs_dict_get(p_vars, var_name);
 
             if (delete_var != NULL && strcmp(delete_var, "on") == 0) {
-                    snac.config = xs_dict_set(snac.config, uploads[n], "");
+                    user->config = xs_dict_set(user->config, uploads[n], "");
             }
         }
 
@@ -4834,18 +4811,18 @@ int html_post_handler(const xs_dict *req, const char *q_path,
         if ((p1 = xs_dict_get(p_vars, "passwd1")) != NULL &&
             (p2 = xs_dict_get(p_vars, "passwd2")) != NULL &&
             *p1 && strcmp(p1, p2) == 0) {
-            xs *pw = hash_password(snac.uid, p1, NULL);
-            snac.config = xs_dict_set(snac.config, "passwd", pw);
+            xs *pw = hash_password(user->uid, p1, NULL);
+            user->config = xs_dict_set(user->config, "passwd", pw);
         }
 
-        user_persist(&snac, 1);
+        user_persist(user, 1);
 
         status = HTTP_STATUS_SEE_OTHER;
     }
     else
     if (p_path && strcmp(p_path, "admin/clear-notifications") == 0) { /** **/
-        notify_clear(&snac);
-        timeline_touch(&snac);
+        notify_clear(user);
+        timeline_touch(user);
 
         status = HTTP_STATUS_SEE_OTHER;
     }
@@ -4870,7 +4847,7 @@ int html_post_handler(const xs_dict *req, const char *q_path,
         int c = 0;
 
         while (xs_list_next(ls, &v, &c)) {
-            xs *msg = msg_note(&snac, "", actor, irt, NULL, 1, NULL, NULL);
+            xs *msg = msg_note(user, "", actor, irt, NULL, 1, NULL, NULL);
 
             /* set the option */
             msg = xs_dict_append(msg, "name", v);
@@ -4878,11 +4855,11 @@ int html_post_handler(const xs_dict *req, const char *q_path,
             /* delete the content */
             msg = xs_dict_del(msg, "content");
 
-            xs *c_msg = msg_create(&snac, msg);
+            xs *c_msg = msg_create(user, msg);
 
-            enqueue_message(&snac, c_msg);
+            enqueue_message(user, c_msg);
 
-            timeline_add(&snac, xs_dict_get(msg, "id"), msg);
+            timeline_add(user, xs_dict_get(msg, "id"), msg);
         }
 
         if (ls != NULL) {
@@ -4899,7 +4876,7 @@ int html_post_handler(const xs_dict *req, const char *q_path,
 
                     /* request the poll when it's closed;
                        Pleroma does not send and update when the poll closes */
-                    enqueue_object_request(&snac, irt, t + 2);
+                    enqueue_object_request(user, irt, t + 2);
                 }
             }
         }
@@ -4929,8 +4906,21 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                 new_hashtags = xs_list_append(new_hashtags, s2);
             }
 
-            snac.config = xs_dict_set(snac.config, "followed_hashtags", new_hashtags);
-            user_persist(&snac, 0);
+            /* update the reverse follow index */
+            const xs_list *old_hashtags = xs_dict_get(user->config, "followed_hashtags");
+
+            if (xs_is_list(old_hashtags)) {
+                xs_list_foreach(old_hashtags, v) {
+                    if (xs_list_in(new_hashtags, v) == -1)
+                        rfollow_del(user, v);
+                }
+            }
+
+            xs_list_foreach(new_hashtags, v)
+                rfollow_add(user, v);
+
+            user->config = xs_dict_set(user->config, "followed_hashtags", new_hashtags);
+            user_persist(user, 0);
         }
 
         status = HTTP_STATUS_SEE_OTHER;
@@ -4958,8 +4948,8 @@ int html_post_handler(const xs_dict *req, const char *q_path,
                 new_hashtags = xs_list_append(new_hashtags, s2);
             }
 
-            snac.config = xs_dict_set(snac.config, "blocked_hashtags", new_hashtags);
-            user_persist(&snac, 0);
+            user->config = xs_dict_set(user->config, "blocked_hashtags", new_hashtags);
+            user_persist(user, 0);
         }
 
         status = HTTP_STATUS_SEE_OTHER;
@@ -4971,12 +4961,10 @@ int html_post_handler(const xs_dict *req, const char *q_path,
         if (xs_is_null(redir))
             redir = "top";
 
-        *body   = xs_fmt("%s/admin#%s", snac.actor, redir);
+        *body   = xs_fmt("%s/admin#%s", user->actor, redir);
         *b_size = strlen(*body);
     }
 
-    user_free(&snac);
-
     return status;
 }
 
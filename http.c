@@ -7,27 +7,172 @@
 #include "xs_curl.h"
 #include "xs_time.h"
 #include "xs_json.h"
+#include "xs_random.h"
 
 #include "snac.h"
 
-xs_dict *http_signed_request_raw(const char *keyid, const char *seckey,
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+/** signing key cache **/
+
+/* parsed private keys of the local users, keyed by keyId (the actor),
+   shared by all threads that sign outgoing requests */
+
+typedef struct {
+    xs_str *key_id;     /* keyId (the user actor) */
+    xs_str *secret;     /* PEM, to notice key changes */
+    xs_str *key_fn;     /* key file, to notice the user is gone */
+    time_t checked;     /* last time key_fn was checked */
+    void *pkey;         /* parsed key */
+} t_seckey_ent;
+
+static t_seckey_ent *seckey_cache = NULL;
+static int seckey_cache_n = 0;
+static pthread_mutex_t seckey_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static t_seckey_ent *_seckey_cache_find(const char *key_id)
+/* finds an entry (seckey_cache_mutex must be locked) */
+{
+    int n;
+
+    for (n = 0; n < seckey_cache_n; n++) {
+        if (strcmp(seckey_cache[n].key_id, key_id) == 0)
+            return &seckey_cache[n];
+    }
+
+    return NULL;
+}
+
+
+static void _seckey_cache_drop(t_seckey_ent *e)
+/* removes an entry (seckey_cache_mutex must be locked) */
+{
+    xs_free(e->key_id);
+    xs_free(e->secret);
+    xs_free(e->key_fn);
+    xs_evp_pubkey_free(e->pkey);
+
+    *e = seckey_cache[--seckey_cache_n];
+}
+
+
+void signing_key_add(const char *key_id, const char *secret)
+/* stores the parsed private key of a user (if it's new or has changed) */
+{
+    t_seckey_ent *e;
+
+    if (key_id == NULL || !xs_is_string(secret) || !xs_startswith(key_id, srv_baseurl))
+        return;
+
+    pthread_mutex_lock(&seckey_cache_mutex);
+
+    if ((e = _seckey_cache_find(key_id)) == NULL || strcmp(e->secret, secret) != 0) {
+        void *pkey = xs_evp_seckey(secret);
+
+        if (pkey != NULL) {
+            if (e == NULL) {
+                seckey_cache = xs_realloc(seckey_cache, (seckey_cache_n + 1) * sizeof(t_seckey_ent));
+                e = &seckey_cache[seckey_cache_n++];
+                e->key_id = xs_dup(key_id);
+
+                /* the keyId is the actor, that ends with the uid */
+                e->key_fn = xs_fmt("%s/user/%s/key.json", srv_basedir,
+                                    key_id + strlen(srv_baseurl) + 1);
+            }
+            else {
+                xs_free(e->secret);
+                xs_evp_pubkey_free(e->pkey);
+            }
+
+            e->secret  = xs_dup(secret);
+            e->pkey    = pkey;
+            e->checked = time(NULL);
+        }
+        else
+            srv_log(xs_fmt("signing_key_add: cannot parse the key of %s", key_id));
+    }
+
+    pthread_mutex_unlock(&seckey_cache_mutex);
+}
+
+
+void signing_key_del(const char *key_id)
+/* forgets the private key of a user (e.g. because it was deleted) */
+{
+    t_seckey_ent *e;
+
+    pthread_mutex_lock(&seckey_cache_mutex);
+
+    if ((e = _seckey_cache_find(key_id)) != NULL)
+        _seckey_cache_drop(e);
+
+    pthread_mutex_unlock(&seckey_cache_mutex);
+}
+
+
+static void *_signing_key_get(const char *key_id)
+/* returns a reference to the parsed private key of a user, or NULL */
+{
+    void *pkey = NULL;
+    time_t t   = time(NULL);
+    t_seckey_ent *e;
+    int pass;
+
+    for (pass = 0; pkey == NULL && pass < 2; pass++) {
+        if (pass == 1) {
+            /* not here: opening the user loads its key */
+            xs *md5 = xs_md5_hex(key_id, strlen(key_id));
+            snac user;
+
+            if (!user_open_by_md5(&user, md5))
+                break;
+
+            user_free(&user);
+        }
+
+        pthread_mutex_lock(&seckey_cache_mutex);
+
+        if ((e = _seckey_cache_find(key_id)) != NULL && e->checked != t) {
+            /* the user may have been deleted from another process */
+            if (mtime(e->key_fn) == 0.0) {
+                srv_debug(1, xs_fmt("signing key: %s is gone", key_id));
+                _seckey_cache_drop(e);
+                e = NULL;
+            }
+            else
+                e->checked = t;
+        }
+
+        if (e != NULL)
+            pkey = xs_evp_pubkey_ref(e->pkey);
+
+        pthread_mutex_unlock(&seckey_cache_mutex);
+    }
+
+    return pkey;
+}
+
+
+xs_dict *http_signed_headers(const char *keyid, const char *seckey,
                             const char *method, const char *url,
                             const xs_dict *headers,
-                            const char *body, int b_size,
-                            int *status, xs_str **payload, int *p_size,
-                            int timeout)
-/* does a signed HTTP request */
+                            const char *body, int b_size, const char *digest)
+/* returns the headers for a signed HTTP request
+   (with seckey, or the cached key of keyid; digest is calculated if NULL),
+   or NULL if it cannot be signed */
 {
     xs *l1 = NULL;
     xs *date = NULL;
-    xs *digest = NULL;
+    xs *c_digest = NULL;
     xs *s64 = NULL;
     xs *signature = NULL;
-    xs *hdrs = NULL;
+    xs_dict *hdrs = NULL;
     const char *host;
     const char *target;
     const char *k, *v;
-    xs_dict *response;
 
     date = xs_str_utctime(0, "%a, %d %b %Y %H:%M:%S GMT");
 
@@ -46,7 +191,7 @@ xs_dict *http_signed_request_raw(const char *keyid, const char *seckey,
         target = "";
 
     /* digest */
-    {
+    if (digest == NULL) {
         xs *s;
 
         if (body != NULL)
@@ -54,7 +199,8 @@ xs_dict *http_signed_request_raw(const char *keyid, const char *seckey,
         else
             s = xs_sha256_base64("", 0);
 
-        digest = xs_fmt("SHA-256=%s", s);
+        c_digest = xs_fmt("SHA-256=%s", s);
+        digest   = c_digest;
     }
 
     {
@@ -66,7 +212,20 @@ xs_dict *http_signed_request_raw(const char *keyid, const char *seckey,
                     strcmp(method, "POST") == 0 ? "post" : "get",
                     target, host, digest, date);
 
-        s64 = xs_evp_sign(seckey, s, strlen(s));
+        if (seckey != NULL)
+            s64 = xs_evp_sign(seckey, s, strlen(s));
+        else {
+            void *pkey = _signing_key_get(keyid);
+
+            s64 = xs_evp_sign_pkey(pkey, s, strlen(s));
+            xs_evp_pubkey_free(pkey);
+        }
+    }
+
+    if (s64 == NULL) {
+        /* deleted user or unusable key: never send it unsigned */
+        srv_log(xs_fmt("http_signed_headers: cannot sign for %s", keyid));
+        return NULL;
     }
 
     /* build now the signature header */
@@ -96,6 +255,30 @@ xs_dict *http_signed_request_raw(const char *keyid, const char *seckey,
     hdrs = xs_dict_append(hdrs, "host",         host);
     hdrs = xs_dict_append(hdrs, "user-agent",   user_agent);
 
+    return hdrs;
+}
+
+
+xs_dict *http_signed_request_raw(const char *keyid, const char *seckey,
+                            const char *method, const char *url,
+                            const xs_dict *headers,
+                            const char *body, int b_size,
+                            int *status, xs_str **payload, int *p_size,
+                            int timeout)
+/* does a signed HTTP request (with seckey, or the cached key of keyid);
+   if it cannot be signed, nothing is sent and status is 0 */
+{
+    xs *hdrs = http_signed_headers(keyid, seckey, method, url, headers, body, b_size, NULL);
+    xs_dict *response;
+
+    if (hdrs == NULL) {
+        /* cannot be signed: nothing was sent */
+        *status  = 0;
+        *payload = NULL;
+        *p_size  = 0;
+        return NULL;
+    }
+
     response = xs_http_request(method, url, hdrs,
                            body, b_size, status, payload, p_size, timeout);
 
@@ -112,16 +295,1096 @@ xs_dict *http_signed_request(snac *snac, const char *method, const char *url,
                             int timeout)
 /* does a signed HTTP request */
 {
-    const char *seckey = xs_dict_get(snac->key, "secret");
     xs_dict *response;
 
-    response = http_signed_request_raw(snac->actor, seckey, method, url,
+    response = http_signed_request_raw(snac->actor, NULL, method, url,
                 headers, body, b_size, status, payload, p_size, timeout);
 
     return response;
 }
 
 
+/** per-host health **/
+
+/* each remote host has a circuit breaker: after some consecutive failures
+   it opens and no deliveries are attempted until a jittered, exponentially
+   growing backoff time has passed; then, a single probe request is let
+   through, and its result decides if the breaker is closed (releasing the
+   parked backlog) or opened again for longer. The table is persisted to
+   host_health.json so it survives restarts; hosts with no results for
+   HOST_HEALTH_KEEP seconds (and a closed breaker) are forgotten */
+
+#define HOST_HEALTH_BUCKETS 256
+#define HOST_HEALTH_SAVE    60          /* seconds between saves */
+#define HOST_HEALTH_KEEP    (7 * 86400) /* forget hosts unseen for this long */
+
+typedef struct _t_host {
+    struct _t_host *next;
+    xs_str *host;
+    double rate;        /* success rate (moving average) */
+    double latency;     /* response time (moving average) */
+    int failures;       /* consecutive failures */
+    int level;          /* backoff level */
+    time_t until;       /* breaker open until (0: closed) */
+    time_t since;       /* start of the current failure streak */
+    time_t seen;        /* last result */
+    time_t probing;     /* a probe is in flight until this time */
+} t_host;
+
+static t_host *host_health[HOST_HEALTH_BUCKETS];
+static int host_health_loaded = 0;
+static int host_health_dirty  = 0;
+static time_t host_health_saved = 0;
+static pthread_mutex_t host_health_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static xs_str *_url_host(const char *url)
+/* returns the host of a url */
+{
+    xs *s1 = xs_replace_n(url, "http:/" "/", "", 1);
+    xs *s2 = xs_replace_n(s1, "https:/" "/", "", 1);
+    xs *l  = xs_split_n(s2, "/", 1);
+
+    return xs_dup(xs_list_get(l, 0));
+}
+
+
+static t_host *_host_find(const char *host, int create)
+/* finds (or creates) the entry for a host (host_health_mutex must be locked) */
+{
+    t_host **pe = &host_health[xs_hash_func(host, strlen(host)) % HOST_HEALTH_BUCKETS];
+    t_host *e;
+
+    for (e = *pe; e != NULL; e = e->next) {
+        if (strcmp(e->host, host) == 0)
+            return e;
+    }
+
+    if (create) {
+        e = xs_realloc(NULL, sizeof(t_host));
+        memset(e, '\0', sizeof(t_host));
+
+        e->host = xs_str_new(host);
+        e->rate = 1.0;
+        e->next = *pe;
+        *pe     = e;
+    }
+
+    return e;
+}
+
+
+static void _host_health_count(void)
+/* updates the number of open breakers in the server state */
+{
+    int n, cnt = 0;
+    t_host *e;
+
+    if (p_state == NULL)
+        return;
+
+    for (n = 0; n < HOST_HEALTH_BUCKETS; n++) {
+        for (e = host_health[n]; e != NULL; e = e->next) {
+            if (e->until)
+                cnt++;
+        }
+    }
+
+    p_state->hosts_down = cnt;
+}
+
+
+static int _host_health_stale(time_t t, time_t until, time_t seen)
+/* returns true if a host is to be forgotten */
+{
+    return until == 0 && t - seen > HOST_HEALTH_KEEP;
+}
+
+
+static void _host_health_read(void)
+/* merges the persisted table, keeping the entries with the newest
+   results (host_health_mutex must be locked) */
+{
+    xs *fn = xs_fmt("%s/host_health.json", srv_basedir);
+    time_t t = time(NULL);
+    FILE *f;
+
+    if ((f = fopen(fn, "r")) == NULL)
+        return;
+
+    xs *j = xs_readall(f);
+    fclose(f);
+
+    xs *d = xs_json_loads(j);
+
+    if (xs_type(d) != XSTYPE_DICT)
+        return;
+
+    const char *host;
+    const xs_dict *v;
+
+    xs_dict_foreach(d, host, v) {
+        time_t until = xs_number_get(xs_dict_get(v, "until"));
+        time_t seen  = xs_number_get(xs_dict_get(v, "seen"));
+        t_host *e    = _host_find(host, 0);
+
+        if (e != NULL ? e->seen >= seen : _host_health_stale(t, until, seen))
+            continue;
+
+        e = _host_find(host, 1);
+
+        e->rate     = xs_number_get(xs_dict_get(v, "rate"));
+        e->latency  = xs_number_get(xs_dict_get(v, "latency"));
+        e->failures = xs_number_get(xs_dict_get(v, "failures"));
+        e->level    = xs_number_get(xs_dict_get(v, "level"));
+        e->until    = until;
+        e->since    = xs_number_get(xs_dict_get(v, "since"));
+        e->seen     = seen;
+    }
+}
+
+
+static void _host_health_load(void)
+/* loads the persisted table (host_health_mutex must be locked) */
+{
+    host_health_loaded = 1;
+
+    _host_health_read();
+    _host_health_count();
+}
+
+
+static void _host_health_save(void)
+/* persists the table (host_health_mutex must be locked). As other
+   processes (like the command line tools) may also write it, it's
+   done under a file lock, merging their changes first, and by
+   renaming a temporary file of this process */
+{
+    time_t t = time(NULL);
+    xs *d    = xs_dict_new();
+    int n;
+    t_host *e;
+
+    xs *lfn = xs_fmt("%s/host_health.lock", srv_basedir);
+    int lfd = open(lfn, O_RDWR | O_CREAT, 0660);
+
+    if (lfd != -1)
+        flock(lfd, LOCK_EX);
+
+    _host_health_read();
+    _host_health_count();
+
+    for (n = 0; n < HOST_HEALTH_BUCKETS; n++) {
+        t_host **pe = &host_health[n];
+
+        while ((e = *pe) != NULL) {
+            if (_host_health_stale(t, e->until, e->seen) && e->probing < t) {
+                /* not seen for long: forget it */
+                *pe = e->next;
+                xs_free(e->host);
+                xs_free(e);
+                continue;
+            }
+
+            pe = &e->next;
+
+            xs *v  = xs_dict_new();
+            xs *n1 = xs_number_new(e->rate);
+            xs *n2 = xs_number_new(e->latency);
+            xs *n3 = xs_number_new(e->failures);
+            xs *n4 = xs_number_new(e->level);
+            xs *n5 = xs_number_new(e->until);
+            xs *n6 = xs_number_new(e->since);
+            xs *n7 = xs_number_new(e->seen);
+
+            v = xs_dict_append(v, "rate",     n1);
+            v = xs_dict_append(v, "latency",  n2);
+            v = xs_dict_append(v, "failures", n3);
+            v = xs_dict_append(v, "level",    n4);
+            v = xs_dict_append(v, "until",    n5);
+            v = xs_dict_append(v, "since",    n6);
+            v = xs_dict_append(v, "seen",     n7);
+
+            d = xs_dict_append(d, e->host, v);
+        }
+    }
+
+    xs *fn  = xs_fmt("%s/host_health.json", srv_basedir);
+    xs *tfn = xs_fmt("%s.%d.new", fn, (int)getpid());
+    FILE *f;
+
+    if ((f = fopen(tfn, "w")) != NULL) {
+        int ok = xs_json_dump(d, data_json_indent(), f);
+
+        if (fclose(f) == EOF || !ok || rename(tfn, fn) == -1) {
+            srv_log(xs_fmt("cannot write %s (errno: %d)", fn, errno));
+            unlink(tfn);
+        }
+    }
+
+    if (lfd != -1)
+        close(lfd);
+
+    host_health_dirty = 0;
+    host_health_saved = t;
+}
+
+
+int host_health_admit(const char *url, int timeout, int *wait)
+/* checks if a delivery to the host of url can be done now.
+   Returns HOST_SEND, HOST_PROBE (if it's the one request that tests
+   a host with an open breaker), HOST_HOLD (a probe is in flight) or
+   HOST_PARK (the breaker is open; wait is set to the seconds until the
+   next probe) */
+{
+    xs *host = _url_host(url);
+    time_t t = time(NULL);
+    int ret  = HOST_SEND;
+    t_host *e;
+
+    pthread_mutex_lock(&host_health_mutex);
+
+    if (!host_health_loaded)
+        _host_health_load();
+
+    if ((e = _host_find(host, 0)) != NULL && e->until) {
+        if (t < e->until) {
+            *wait = e->until - t;
+            ret = HOST_PARK;
+        }
+        else
+        if (t < e->probing) {
+            *wait = e->probing - t;
+            ret = HOST_HOLD;
+        }
+        else {
+            e->probing = t + timeout + 5;
+            ret = HOST_PROBE;
+        }
+    }
+
+    pthread_mutex_unlock(&host_health_mutex);
+
+    return ret;
+}
+
+
+void host_health_update(const char *url, int status, double secs)
+/* updates the health of the host of url after a delivery */
+{
+    int threshold = xs_number_get(xs_dict_get_def(srv_config, "host_breaker_failures", "5"));
+    int backoff   = xs_number_get(xs_dict_get_def(srv_config, "host_backoff_seconds", "60"));
+    int max_bo    = xs_number_get(xs_dict_get_def(srv_config, "host_backoff_max_seconds", "21600"));
+    int ok        = !(status < 0 || status >= 500 || status == HTTP_STATUS_TOO_MANY_REQUESTS);
+    xs *host      = _url_host(url);
+    time_t t      = time(NULL);
+    xs_str *msg   = NULL;
+    int changed   = 0;
+    t_host *e;
+
+    if (threshold < 1)
+        threshold = 1;
+
+    pthread_mutex_lock(&host_health_mutex);
+
+    if (!host_health_loaded)
+        _host_health_load();
+
+    e = _host_find(host, 1);
+
+    e->rate = e->rate * 0.9 + (ok ? 0.1 : 0.0);
+    e->seen = t;
+
+    if (secs > 0.0)
+        e->latency = e->latency > 0.0 ? e->latency * 0.8 + secs * 0.2 : secs;
+
+    if (ok) {
+        if (e->until) {
+            msg = xs_fmt("host %s is back after %d failures", host, e->failures);
+            changed = 1;
+        }
+
+        e->failures = 0;
+        e->level    = 0;
+        e->until    = 0;
+        e->since    = 0;
+        e->probing  = 0;
+    }
+    else {
+        e->failures++;
+
+        if (e->since == 0)
+            e->since = t;
+
+        /* open the breaker if the streak is long enough, or again
+           for longer if the probe failed; failures of requests that
+           were in flight when it was opened don't count */
+        if ((e->until == 0 && e->failures >= threshold) || (e->until && t >= e->until)) {
+            if (e->until)
+                e->level++;
+
+            long bo = (long)backoff << (e->level < 16 ? e->level : 16);
+            unsigned int r;
+
+            if (bo > max_bo)
+                bo = max_bo;
+            if (bo < 2)
+                bo = 2;
+
+            /* equal jitter: half fixed, half random */
+            xs_rnd_buf(&r, sizeof(r));
+            bo = bo / 2 + r % (bo / 2 + 1);
+
+            e->until   = t + bo;
+            e->probing = 0;
+
+            msg = xs_fmt("host %s is down (%d failures), next try in %lds", host, e->failures, bo);
+            changed = 1;
+        }
+    }
+
+    host_health_dirty = 1;
+
+    if (changed)
+        _host_health_count();
+
+    if (changed || t - host_health_saved >= HOST_HEALTH_SAVE)
+        _host_health_save();
+
+    pthread_mutex_unlock(&host_health_mutex);
+
+    if (msg != NULL)
+        srv_log(msg);
+}
+
+
+int host_health_outage(const char *url)
+/* returns the seconds the host of url has been failing */
+{
+    xs *host = _url_host(url);
+    int ret  = 0;
+    t_host *e;
+
+    pthread_mutex_lock(&host_health_mutex);
+
+    if ((e = _host_find(host, 0)) != NULL && e->since)
+        ret = time(NULL) - e->since;
+
+    pthread_mutex_unlock(&host_health_mutex);
+
+    return ret;
+}
+
+
+void host_health_flush(void)
+/* persists the table, if it has changed */
+{
+    pthread_mutex_lock(&host_health_mutex);
+
+    if (host_health_dirty)
+        _host_health_save();
+
+    pthread_mutex_unlock(&host_health_mutex);
+}
+
+
+xs_list *host_health_report(void)
+/* returns a description of the hosts that are failing */
+{
+    time_t t   = time(NULL);
+    xs_list *r = xs_list_new();
+    int n;
+    t_host *e;
+
+    pthread_mutex_lock(&host_health_mutex);
+
+    if (!host_health_loaded)
+        _host_health_load();
+
+    for (n = 0; n < HOST_HEALTH_BUCKETS; n++) {
+        for (e = host_health[n]; e != NULL; e = e->next) {
+            if (e->failures == 0)
+                continue;
+
+            xs *s = NULL;
+
+            if (e->until == 0)
+                s = xs_fmt("%s: %d failures", e->host, e->failures);
+            else
+            if (t < e->until)
+                s = xs_fmt("%s: down, %d failures, next try in %lds", e->host,
+                    e->failures, (long)(e->until - t));
+            else
+                s = xs_fmt("%s: down, %d failures, probing", e->host, e->failures);
+
+            xs *s2 = xs_fmt("%s (success rate %d%%, latency %.3fs)", s,
+                (int)(e->rate * 100.0), e->latency);
+
+            r = xs_list_append(r, s2);
+        }
+    }
+
+    pthread_mutex_unlock(&host_health_mutex);
+
+    return r;
+}
+
+
+/** outbound delivery engine **/
+
+/* output queue items are delivered by a single thread that keeps many
+   requests in flight at the same time, instead of tying up a job thread
+   each while waiting for the remote server. The number of concurrent
+   requests to the same host is limited; items that cannot be started yet
+   wait in memory in a queue per host, and the hosts that can start one
+   more are kept in a ready list, so nothing is rescanned. When too many
+   items are waiting, new ones go back to the disk queue for a little
+   while */
+
+typedef struct _t_dlv_item {
+    struct _t_dlv_item *next;
+    xs_dict *q_item;    /* the output queue item */
+    int timeout;        /* request timeout */
+} t_dlv_item;
+
+static pthread_mutex_t dlv_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void *dlv_multi    = NULL;   /* set while the engine is running */
+static t_dlv_item *dlv_in = NULL;   /* items handed to the engine */
+static t_dlv_item **dlv_in_tail = &dlv_in;
+static int dlv_queue_n    = 0;      /* items in memory not yet started */
+static int dlv_max_queue  = 0;
+
+/* the per host queues (only used by the delivery thread) */
+
+#define DLV_HOST_BUCKETS 256
+
+typedef struct _t_dlv_host {
+    struct _t_dlv_host *next;   /* hash chain */
+    struct _t_dlv_host *r_next; /* ready or held list */
+    xs_str *host;
+    int in_flight;      /* requests in flight */
+    int listed;         /* in the ready or held list */
+    int held;           /* waiting for a probe to the host to finish */
+    t_dlv_item *head;   /* items waiting to be started */
+    t_dlv_item **tail;
+    int n_wait;
+} t_dlv_host;
+
+static t_dlv_host *dlv_hosts[DLV_HOST_BUCKETS];
+static t_dlv_host *dlv_ready = NULL;
+static t_dlv_host **dlv_ready_tail = &dlv_ready;
+static t_dlv_host *dlv_held  = NULL;
+static int dlv_held_n        = 0;
+static int dlv_max_per_host  = 0;
+
+typedef struct {
+    xs_dict *q_item;    /* the output queue item */
+    t_dlv_host *h;      /* destination host */
+    xs_dict *hdrs;      /* request headers and body (for archiving) */
+    xs_str *body;
+} t_dlv;
+
+
+int delivery_add(const xs_dict *q_item, int timeout)
+/* hands an output queue item to the delivery engine;
+   returns 0 if it's not running (so the caller must send it) */
+{
+    int ret  = 0;
+    int full = 0;
+
+    pthread_mutex_lock(&dlv_mutex);
+
+    if (dlv_multi != NULL) {
+        if (dlv_queue_n >= dlv_max_queue)
+            full = 1;
+        else {
+            t_dlv_item *it = xs_realloc(NULL, sizeof(t_dlv_item));
+
+            it->next    = NULL;
+            it->q_item  = xs_dup(q_item);
+            it->timeout = timeout;
+
+            *dlv_in_tail = it;
+            dlv_in_tail  = &it->next;
+            dlv_queue_n++;
+
+            xs_http_multi_wakeup(dlv_multi);
+        }
+
+        ret = 1;
+    }
+
+    pthread_mutex_unlock(&dlv_mutex);
+
+    /* too many waiting: put it back in the disk queue */
+    if (full)
+        enqueue_delayed(q_item, 10);
+
+    return ret;
+}
+
+
+static t_dlv_item *_dlv_item_free(t_dlv_item *it)
+/* frees a waiting item, returning the next one */
+{
+    t_dlv_item *next = it->next;
+
+    xs_free(it->q_item);
+    xs_free(it);
+
+    return next;
+}
+
+
+static void _dlv_free(t_dlv *d)
+/* frees a delivery */
+{
+    xs_free(d->q_item);
+    xs_free(d->hdrs);
+    xs_free(d->body);
+    xs_free(d);
+}
+
+
+static t_dlv_host *_dlv_host(const char *host)
+/* finds (or creates) the queue of a host */
+{
+    t_dlv_host **pe = &dlv_hosts[xs_hash_func(host, strlen(host)) % DLV_HOST_BUCKETS];
+    t_dlv_host *h;
+
+    for (h = *pe; h != NULL; h = h->next) {
+        if (strcmp(h->host, host) == 0)
+            return h;
+    }
+
+    h = xs_realloc(NULL, sizeof(t_dlv_host));
+    memset(h, '\0', sizeof(t_dlv_host));
+
+    h->host = xs_str_new(host);
+    h->tail = &h->head;
+    h->next = *pe;
+    *pe     = h;
+
+    return h;
+}
+
+
+static void _dlv_host_update(t_dlv_host *h)
+/* puts a host in the ready list if it can start one more,
+   or frees it if it has nothing to do */
+{
+    if (h->listed)
+        return;
+
+    if (h->head != NULL) {
+        if (h->in_flight < dlv_max_per_host) {
+            h->r_next       = NULL;
+            *dlv_ready_tail = h;
+            dlv_ready_tail  = &h->r_next;
+            h->listed       = 1;
+        }
+    }
+    else
+    if (h->in_flight == 0) {
+        t_dlv_host **pe = &dlv_hosts[xs_hash_func(h->host, strlen(h->host)) % DLV_HOST_BUCKETS];
+
+        while (*pe != h)
+            pe = &(*pe)->next;
+
+        *pe = h->next;
+
+        xs_free(h->host);
+        xs_free(h);
+    }
+}
+
+
+static t_dlv_host *_dlv_ready_pop(void)
+/* takes the first host out of the ready list */
+{
+    t_dlv_host *h = dlv_ready;
+
+    if (h != NULL) {
+        if ((dlv_ready = h->r_next) == NULL)
+            dlv_ready_tail = &dlv_ready;
+
+        h->listed = 0;
+    }
+
+    return h;
+}
+
+
+static int _dlv_flush(void)
+/* sends all waiting items back to the disk queue; returns their number */
+{
+    int n, cnt = 0;
+    t_dlv_host *h;
+
+    dlv_ready      = NULL;
+    dlv_ready_tail = &dlv_ready;
+    dlv_held       = NULL;
+    dlv_held_n     = 0;
+
+    for (n = 0; n < DLV_HOST_BUCKETS; n++) {
+        t_dlv_host *next;
+
+        for (h = dlv_hosts[n]; h != NULL; h = next) {
+            next = h->next;
+
+            while (h->head != NULL) {
+                enqueue_delayed(h->head->q_item, 0);
+                h->head = _dlv_item_free(h->head);
+                cnt++;
+            }
+
+            h->tail   = &h->head;
+            h->n_wait = 0;
+            h->listed = 0;
+            h->held   = 0;
+
+            _dlv_host_update(h);
+        }
+    }
+
+    return cnt;
+}
+
+
+void delivery_park(const xs_dict *q_item, int wait)
+/* puts back in the disk queue an item for a host that is down,
+   to be retried when its breaker is probed again */
+{
+    const char *inbox = xs_dict_get(q_item, "inbox");
+    int qrt = xs_number_get(xs_dict_get(srv_config, "queue_retry_minutes"));
+    int qrm = xs_number_get(xs_dict_get(srv_config, "queue_retry_max"));
+    unsigned int r;
+
+    /* parked items don't use retries, so give up on them
+       when the host has been down for as long as they would have lived */
+    if (host_health_outage(inbox) > qrt * 60 * qrm * (qrm + 1) / 2) {
+        srv_log(xs_fmt("output message: giving up %s (host down)", inbox));
+        return;
+    }
+
+    /* spread the backlog a bit, so that the probe goes first */
+    xs_rnd_buf(&r, sizeof(r));
+    enqueue_delayed(q_item, wait + 1 + r % 10);
+}
+
+
+static int _dlv_start(void *multi, const t_dlv_item *it, t_dlv_host *h)
+/* starts the delivery of an output queue item; returns 1 if started,
+   0 if it cannot be started now, or -1 if it has no message or signer */
+{
+    const xs_dict *q_item = it->q_item;
+    const char *inbox  = xs_dict_get(q_item, "inbox");
+    const char *keyid  = xs_dict_get(q_item, "keyid");
+    const char *seckey = xs_dict_get(q_item, "seckey"); /* only if the user is gone */
+    xs *body   = NULL;
+    xs *digest = NULL;
+    xs *hdrs   = NULL;
+
+    if (!output_body(q_item, &body, &digest)) {
+        srv_log(xs_fmt("output message: payload not found for %s", inbox));
+        return -1;
+    }
+
+    /* the signing user is gone: drop it, retrying won't help */
+    if ((hdrs = http_signed_headers(keyid, seckey, "POST", inbox, NULL,
+                    body, strlen(body), digest)) == NULL) {
+        srv_log(xs_fmt("output message: dropped, cannot sign for %s", inbox));
+        return -1;
+    }
+
+    t_dlv *d = xs_realloc(NULL, sizeof(t_dlv));
+
+    d->q_item = xs_dup(q_item);
+    d->h      = h;
+    d->body   = xs_dup(body);
+    d->hdrs   = xs_dup(hdrs);
+
+    if (!xs_http_multi_add(multi, "POST", inbox, d->hdrs, d->body, strlen(d->body), it->timeout, d)) {
+        srv_log(xs_fmt("delivery: cannot start request to %s", inbox));
+        _dlv_free(d);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+void *delivery_thread(void *arg)
+/* the delivery engine */
+{
+    int max_in_flight = xs_number_get(xs_dict_get_def(srv_config, "delivery_max_in_flight", "256"));
+    int max_per_host  = xs_number_get(xs_dict_get_def(srv_config, "delivery_max_per_host", "4"));
+    void *multi       = xs_http_multi_new();
+    int in_flight     = 0;
+    int gone          = 0;  /* items out of memory since the last update */
+    time_t held_check = 0;
+
+    (void)arg;
+
+    if (max_in_flight < 1)
+        max_in_flight = 1;
+    if (max_per_host < 1)
+        max_per_host = 1;
+
+    dlv_max_per_host = max_per_host;
+
+    pthread_mutex_lock(&dlv_mutex);
+    dlv_multi     = multi;
+    dlv_queue_n   = 0;
+    dlv_max_queue = max_in_flight * 4;
+    pthread_mutex_unlock(&dlv_mutex);
+
+    srv_debug(1, xs_fmt("delivery engine started (%d in flight, %d per host)",
+        max_in_flight, max_per_host));
+
+    for (;;) {
+        t_dlv_item *in;
+        int stopping = 0;
+        int stop     = 0;
+
+        pthread_mutex_lock(&dlv_mutex);
+
+        /* take the new ones */
+        in          = dlv_in;
+        dlv_in      = NULL;
+        dlv_in_tail = &dlv_in;
+
+        dlv_queue_n -= gone;
+        gone = 0;
+
+        if (!p_state->srv_running) {
+            stopping = 1;
+
+            /* wait for the ones in flight */
+            if (in_flight == 0) {
+                dlv_multi = NULL;
+                stop = 1;
+            }
+        }
+
+        if (p_state != NULL) {
+            p_state->dlv_queued    = dlv_queue_n - dlv_held_n;
+            p_state->dlv_in_flight = in_flight;
+            p_state->dlv_held      = dlv_held_n;
+        }
+
+        pthread_mutex_unlock(&dlv_mutex);
+
+        /* queue the new ones by host */
+        while (in != NULL) {
+            t_dlv_item *it = in;
+
+            in       = it->next;
+            it->next = NULL;
+
+            xs *host = _url_host(xs_dict_get(it->q_item, "inbox"));
+            t_dlv_host *h = _dlv_host(host);
+
+            *h->tail = it;
+            h->tail  = &it->next;
+            h->n_wait++;
+
+            if (h->held)
+                dlv_held_n++;
+
+            _dlv_host_update(h);
+        }
+
+        /* stopping: send the waiting ones back to the disk queue */
+        if (stopping)
+            gone += _dlv_flush();
+
+        if (stop)
+            break;
+
+        /* start them, one host at a time (signing is done here, out of the lock) */
+        while (in_flight < max_in_flight) {
+            t_dlv_host *h = _dlv_ready_pop();
+
+            if (h == NULL)
+                break;
+
+            t_dlv_item *it = h->head;
+            const char *inbox = xs_dict_get(it->q_item, "inbox");
+            int wait = 0;
+            int adm  = host_health_admit(inbox, it->timeout, &wait);
+
+            if (adm == HOST_HOLD) {
+                /* a probe is in flight: the host waits for it */
+                h->held   = 1;
+                h->listed = 1;
+                h->r_next = dlv_held;
+                dlv_held  = h;
+                dlv_held_n += h->n_wait;
+
+                continue;
+            }
+
+            if ((h->head = it->next) == NULL)
+                h->tail = &h->head;
+
+            h->n_wait--;
+            gone++;
+
+            if (adm == HOST_PARK)
+                delivery_park(it->q_item, wait);
+            else {
+                int r = _dlv_start(multi, it, h);
+
+                if (r > 0) {
+                    in_flight++;
+                    h->in_flight++;
+                }
+                else
+                if (r == 0)
+                    output_result(it->q_item, HTTP_STATUS_INTERNAL_SERVER_ERROR, NULL, 0, 0.0);
+            }
+
+            _dlv_item_free(it);
+            _dlv_host_update(h);
+        }
+
+        xs_http_multi_wait(multi, 1000);
+
+        /* collect the finished ones */
+        t_dlv *d;
+        int status;
+        xs_dict *response;
+        xs_str *payload;
+        int p_size;
+        double secs;
+
+        while ((d = xs_http_multi_next(multi, &status, &response, &payload, &p_size, &secs)) != NULL) {
+            in_flight--;
+            d->h->in_flight--;
+
+            srv_archive("SEND", xs_dict_get(d->q_item, "inbox"), d->hdrs,
+                d->body, strlen(d->body), status, response, payload, p_size);
+
+            host_health_update(xs_dict_get(d->q_item, "inbox"), status, secs);
+
+            output_result(d->q_item, status, payload, p_size, secs);
+
+            _dlv_host_update(d->h);
+
+            xs_free(response);
+            xs_free(payload);
+            _dlv_free(d);
+        }
+
+        /* give the held ones another chance, as the probe may have finished */
+        if (dlv_held != NULL && time(NULL) > held_check) {
+            while (dlv_held != NULL) {
+                t_dlv_host *h = dlv_held;
+
+                dlv_held  = h->r_next;
+                h->held   = 0;
+                h->listed = 0;
+
+                _dlv_host_update(h);
+            }
+
+            dlv_held_n = 0;
+            held_check = time(NULL);
+        }
+    }
+
+    xs_http_multi_free(multi);
+    host_health_flush();
+
+    srv_debug(1, xs_fmt("delivery engine stopped"));
+
+    return NULL;
+}
+
+
+/** public key cache **/
+
+/* parsed public keys of remote actors, to avoid fetching the actor
+   and un-PEMing its key on each incoming signed message */
+
+#define KEY_CACHE_SIZE    256   /* maximum number of keys */
+#define KEY_CACHE_TTL     3600  /* seconds a key is trusted */
+#define KEY_CACHE_REFETCH 60    /* minimum seconds between forced refetches */
+
+typedef struct {
+    xs_str *key_id;     /* keyId (without fragment) */
+    void *pkey;         /* parsed key */
+    time_t loaded;      /* when it was parsed */
+    time_t refetched;   /* last refetch from the network */
+    time_t used;        /* last use */
+} t_key_ent;
+
+static t_key_ent key_cache[KEY_CACHE_SIZE];
+static pthread_mutex_t key_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static t_key_ent *_key_cache_find(const char *key_id)
+/* finds an entry (key_cache_mutex must be locked) */
+{
+    int n;
+
+    for (n = 0; n < KEY_CACHE_SIZE; n++) {
+        if (key_cache[n].key_id && strcmp(key_cache[n].key_id, key_id) == 0)
+            return &key_cache[n];
+    }
+
+    return NULL;
+}
+
+
+static void _key_cache_free(t_key_ent *e)
+/* empties an entry (key_cache_mutex must be locked) */
+{
+    e->key_id = xs_free(e->key_id);
+    xs_evp_pubkey_free(e->pkey);
+    e->pkey = NULL;
+}
+
+
+static void *_key_cache_get(const char *key_id, time_t *refetched)
+/* returns a reference to a cached key, or NULL */
+{
+    void *pkey = NULL;
+    time_t t = time(NULL);
+    t_key_ent *e;
+
+    pthread_mutex_lock(&key_cache_mutex);
+
+    *refetched = 0;
+
+    if ((e = _key_cache_find(key_id)) != NULL) {
+        *refetched = e->refetched;
+
+        if (e->loaded + KEY_CACHE_TTL < t)
+            _key_cache_free(e);
+        else {
+            e->used = t;
+            pkey = xs_evp_pubkey_ref(e->pkey);
+        }
+    }
+
+    pthread_mutex_unlock(&key_cache_mutex);
+
+    return pkey;
+}
+
+
+static void _key_cache_put(const char *key_id, void *pkey, time_t refetched)
+/* stores a reference to a key */
+{
+    time_t t = time(NULL);
+    t_key_ent *e;
+    int n;
+
+    pthread_mutex_lock(&key_cache_mutex);
+
+    if ((e = _key_cache_find(key_id)) == NULL) {
+        /* take a free entry or the least recently used one */
+        e = &key_cache[0];
+
+        for (n = 0; n < KEY_CACHE_SIZE && e->key_id; n++) {
+            if (key_cache[n].key_id == NULL || key_cache[n].used < e->used)
+                e = &key_cache[n];
+        }
+    }
+
+    if (e->key_id)
+        _key_cache_free(e);
+
+    e->key_id    = xs_dup(key_id);
+    e->pkey      = xs_evp_pubkey_ref(pkey);
+    e->loaded    = t;
+    e->used      = t;
+    e->refetched = refetched;
+
+    pthread_mutex_unlock(&key_cache_mutex);
+}
+
+
+static void _key_cache_mark(const char *key_id, time_t refetched)
+/* remembers when a key was last refetched */
+{
+    t_key_ent *e;
+
+    pthread_mutex_lock(&key_cache_mutex);
+
+    if ((e = _key_cache_find(key_id)) != NULL)
+        e->refetched = refetched;
+
+    pthread_mutex_unlock(&key_cache_mutex);
+}
+
+
+void key_cache_del(const char *key_id)
+/* forgets a key (because its actor has been updated) */
+{
+    t_key_ent *e;
+
+    pthread_mutex_lock(&key_cache_mutex);
+
+    if ((e = _key_cache_find(key_id)) != NULL)
+        _key_cache_free(e);
+
+    pthread_mutex_unlock(&key_cache_mutex);
+}
+
+
+static void *_key_get(const char *key_id, int refetch, xs_str **err)
+/* gets the public key of an actor, from the cache, the disk or the net */
+{
+    time_t refetched;
+    void *pkey = _key_cache_get(key_id, &refetched);
+    xs *actor = NULL;
+    int status;
+
+    if (refetch) {
+        xs_evp_pubkey_free(pkey);
+        pkey = NULL;
+
+        /* the key may have been rotated: get it again, but not too often */
+        if (refetched + KEY_CACHE_REFETCH > time(NULL))
+            return NULL;
+
+        refetched = time(NULL);
+        _key_cache_mark(key_id, refetched);
+
+        if (valid_status(status = activitypub_request(NULL, key_id, &actor)))
+            actor_add(key_id, actor);
+    }
+    else {
+        if (pkey != NULL)
+            return pkey;
+
+        status = actor_request(NULL, key_id, &actor);
+    }
+
+    if (!valid_status(status)) {
+        *err = xs_fmt("actor request error %s %d", key_id, status);
+        return NULL;
+    }
+
+    const xs_dict *k;
+    const char *pem;
+
+    if ((k = xs_dict_get(actor, "publicKey")) == NULL ||
+        ((pem = xs_dict_get(k, "publicKeyPem")) == NULL) ||
+        (pkey = xs_evp_pubkey(pem)) == NULL) {
+        *err = xs_fmt("cannot get pubkey from %s", key_id);
+        return NULL;
+    }
+
+    _key_cache_put(key_id, pkey, refetched);
+
+    return pkey;
+}
+
+
 int check_signature(const xs_dict *req, xs_str **err)
 /* check the signature */
 {
@@ -132,8 +1395,6 @@ int check_signature(const xs_dict *req, xs_str **err)
     xs *created = NULL;
     xs *expires = NULL;
     char *p;
-    const char *pubkey;
-    const char *k;
 
     if (xs_is_null(sig_hdr)) {
         *err = xs_fmt("missing 'signature' header");
@@ -185,20 +1446,6 @@ int check_signature(const xs_dict *req, xs_str **err)
     if ((p = strchr(keyId, '?')) != NULL)
         *p = '\0';
 
-    xs *actor = NULL;
-    int status;
-
-    if (!valid_status((status = actor_request(NULL, keyId, &actor)))) {
-        *err = xs_fmt("actor request error %s %d", keyId, status);
-        return 0;
-    }
-
-    if ((k = xs_dict_get(actor, "publicKey")) == NULL ||
-        ((pubkey = xs_dict_get(k, "publicKeyPem")) == NULL)) {
-        *err = xs_fmt("cannot get pubkey from %s", keyId);
-        return 0;
-    }
-
     /* now build the string to be signed */
     xs *sig_str = xs_str_new(NULL);
 
@@ -253,8 +1500,26 @@ int check_signature(const xs_dict *req, xs_str **err)
         }
     }
 
-    if (xs_evp_verify(pubkey, sig_str, strlen(sig_str), signature) != 1) {
-        *err = xs_fmt("RSA verify error %s", keyId);
+    void *pkey;
+    int ok = 0;
+
+    if ((pkey = _key_get(keyId, 0, err)) == NULL)
+        return 0;
+
+    if (!(ok = xs_evp_verify_pkey(pkey, sig_str, strlen(sig_str), signature) == 1)) {
+        xs_evp_pubkey_free(pkey);
+
+        /* try once more with a fresh copy of the actor */
+        if ((pkey = _key_get(keyId, 1, err)) != NULL)
+            ok = xs_evp_verify_pkey(pkey, sig_str, strlen(sig_str), signature) == 1;
+    }
+
+    xs_evp_pubkey_free(pkey);
+
+    if (!ok) {
+        if (*err == NULL)
+            *err = xs_fmt("RSA verify error %s", keyId);
+
         return 0;
     }
 
@@ -4,6 +4,7 @@
 #include "xs.h"
 #include "xs_io.h"
 #include "xs_json.h"
+#include "xs_curl.h"
 #include "xs_socket.h"
 #include "xs_unix_socket.h"
 #include "xs_httpd.h"
@@ -17,7 +18,6 @@
 
 #include <setjmp.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <fcntl.h>
 #include <stdint.h>
 
@@ -29,25 +29,57 @@
 #include <poll.h>
 #endif
 
+#if defined(__linux__) && !defined(WITHOUT_EPOLL)
+#define USE_EPOLL
+#endif
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
 /** server state **/
 srv_state *p_state = NULL;
 
 
 /** job control **/
 
-/* mutex to access the lists of jobs */
-static pthread_mutex_t job_mutex;
-
-/* semaphore to trigger job processing */
-static sem_t *job_sem;
-
-typedef struct job_fifo_item {
-    struct job_fifo_item *next;
-    xs_val *job;
-} job_fifo_item;
+/* jobs go to separate lanes (HTTP requests, input messages, output
+   deliveries and maintenance), each one with its own threads, so
+   requests are never stuck behind queue work. Each lane is a bounded
+   ring of preallocated slots that are claimed with atomic operations
+   (no locks), and idle threads sleep on a futex (or a condition variable,
+   where there is none) that is only signaled if someone is sleeping */
+
+typedef struct {
+    size_t seq;                 /* sequence number */
+    void *ptr;                  /* connection or request (HTTP lane) */
+    xs_val *job;                /* anything else */
+} job_slot;
+
+static struct {
+    job_slot *slots;
+    size_t mask;                /* number of slots - 1 */
+    char pad1[64];
+    size_t head;                /* next slot to read */
+    char pad2[64];
+    size_t tail;                /* next slot to write */
+    char pad3[64];
+    int waiters;                /* threads sleeping */
+    unsigned int event;         /* changed to wake them up */
+#ifndef __linux__
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+} job_lanes[JOB_LANES];
 
-static job_fifo_item *job_fifo_first = NULL;
-static job_fifo_item *job_fifo_last  = NULL;
+static int _job_post(void *ptr, const xs_val *job, int lane);
 
 
 /** other global data **/
@@ -371,8 +403,332 @@ int server_get_handler(xs_dict *req, const char *q_path,
 }
 
 
-void httpd_connection(FILE *f)
-/* the connection processor */
+/** request routing **/
+
+/* requests are routed by a trie of path segments built at startup;
+   each node holds, for each method and kind of content (ActivityPub
+   or anything else), the route for the path ending there and the one
+   for anything below it. A route that serves a user opens it once and
+   passes it to the handler */
+
+enum { RT_GET, RT_POST, RT_PUT, RT_PATCH, RT_DELETE, RT_METHODS };
+enum { RT_ANY, RT_AP, RT_KINDS };
+
+typedef struct {
+    xs_dict *req;
+    const char *q_path;
+    char *payload;
+    int p_size;
+    snac *user;
+    char **body;
+    int *b_size;
+    char **ctype;
+    xs_str **etag;
+    xs_str **last_modified;
+    xs_str **link;
+} t_route_args;
+
+static int rt_server_get(t_route_args *a)
+{
+    return server_get_handler(a->req, a->q_path, a->body, a->b_size, a->ctype);
+}
+
+static int rt_webfinger_get(t_route_args *a)
+{
+    return webfinger_get_handler(a->req, a->q_path, a->body, a->b_size, a->ctype);
+}
+
+static int rt_activitypub_get(t_route_args *a)
+{
+    return activitypub_get_handler(a->req, a->q_path, a->user, a->body, a->b_size, a->ctype);
+}
+
+static int rt_activitypub_post(t_route_args *a)
+{
+    return activitypub_post_handler(a->req, a->q_path, a->user,
+                a->payload, a->p_size, a->body, a->b_size, a->ctype);
+}
+
+static int rt_not_found(t_route_args *a)
+{
+    srv_debug(1, xs_fmt("httpd_route no such resource %s", a->q_path));
+    return HTTP_STATUS_NOT_FOUND;
+}
+
+static int rt_html_get(t_route_args *a)
+{
+    return html_get_handler(a->req, a->q_path, a->user, a->body, a->b_size, a->ctype,
+                a->etag, a->last_modified);
+}
+
+static int rt_html_post(t_route_args *a)
+{
+    return html_post_handler(a->req, a->q_path, a->user,
+                a->payload, a->p_size, a->body, a->b_size, a->ctype);
+}
+
+#ifndef NO_MASTODON_API
+
+static int rt_oauth_get(t_route_args *a)
+{
+    return oauth_get_handler(a->req, a->q_path, a->body, a->b_size, a->ctype);
+}
+
+static int rt_oauth_post(t_route_args *a)
+{
+    return oauth_post_handler(a->req, a->q_path,
+                a->payload, a->p_size, a->body, a->b_size, a->ctype);
+}
+
+static int rt_mastoapi_get(t_route_args *a)
+{
+    return mastoapi_get_handler(a->req, a->q_path, a->body, a->b_size, a->ctype, a->link);
+}
+
+static int rt_mastoapi_post(t_route_args *a)
+{
+    return mastoapi_post_handler(a->req, a->q_path,
+                a->payload, a->p_size, a->body, a->b_size, a->ctype);
+}
+
+static int rt_mastoapi_put(t_route_args *a)
+{
+    return mastoapi_put_handler(a->req, a->q_path,
+                a->payload, a->p_size, a->body, a->b_size, a->ctype);
+}
+
+static int rt_mastoapi_patch(t_route_args *a)
+{
+    return mastoapi_patch_handler(a->req, a->q_path,
+                a->payload, a->p_size, a->body, a->b_size, a->ctype);
+}
+
+static int rt_mastoapi_delete(t_route_args *a)
+{
+    return mastoapi_delete_handler(a->req, a->q_path,
+                a->payload, a->p_size, a->body, a->b_size, a->ctype);
+}
+
+#endif /* NO_MASTODON_API */
+
+#define RT_USER     1   /* the first segment is a user id */
+#define RT_USER_RSS 2   /* the same, maybe with a .rss extension */
+
+static const struct {
+    const char *name;
+    int method;
+    int kind;
+    const char *path;   /* segments ("*": any; a last "**": anything below) */
+    int user;
+    int (*handler)(t_route_args *);
+} routes[] = {
+    { "server",          RT_GET,    RT_ANY, "",                      0, rt_server_get },
+    { "server",          RT_GET,    RT_ANY, "susie.png",             0, rt_server_get },
+    { "server",          RT_GET,    RT_ANY, "favicon.ico",           0, rt_server_get },
+    { "server",          RT_GET,    RT_ANY, "robots.txt",            0, rt_server_get },
+    { "server",          RT_GET,    RT_ANY, "style.css",             0, rt_server_get },
+    { "server",          RT_GET,    RT_ANY, "share",                 0, rt_server_get },
+    { "server",          RT_GET,    RT_ANY, "authorize_interaction", 0, rt_server_get },
+    { "nodeinfo",        RT_GET,    RT_ANY, "nodeinfo_2_0",          0, rt_server_get },
+    { "nodeinfo",        RT_GET,    RT_ANY, ".well-known/nodeinfo",  0, rt_server_get },
+    { "host-meta",       RT_GET,    RT_ANY, ".well-known/host-meta", 0, rt_server_get },
+    { "webfinger",       RT_GET,    RT_ANY, ".well-known/webfinger", 0, rt_webfinger_get },
+#ifndef NO_MASTODON_API
+    { "oauth",           RT_GET,    RT_ANY, "oauth/**",              0, rt_oauth_get },
+    { "oauth",           RT_POST,   RT_ANY, "oauth/**",              0, rt_oauth_post },
+    { "mastoapi",        RT_GET,    RT_ANY, "api/v1/**",             0, rt_mastoapi_get },
+    { "mastoapi",        RT_GET,    RT_ANY, "api/v2/**",             0, rt_mastoapi_get },
+    { "mastoapi",        RT_POST,   RT_ANY, "api/v1/**",             0, rt_mastoapi_post },
+    { "mastoapi",        RT_POST,   RT_ANY, "api/v2/**",             0, rt_mastoapi_post },
+    { "mastoapi",        RT_PUT,    RT_ANY, "api/v1/**",             0, rt_mastoapi_put },
+    { "mastoapi",        RT_PUT,    RT_ANY, "api/v2/**",             0, rt_mastoapi_put },
+    { "mastoapi",        RT_PATCH,  RT_ANY, "api/v1/**",             0, rt_mastoapi_patch },
+    { "mastoapi",        RT_PATCH,  RT_ANY, "api/v2/**",             0, rt_mastoapi_patch },
+    { "mastoapi",        RT_DELETE, RT_ANY, "api/v1/**",             0, rt_mastoapi_delete },
+    { "mastoapi",        RT_DELETE, RT_ANY, "api/v2/**",             0, rt_mastoapi_delete },
+#endif
+    { "shared-inbox",    RT_POST,   RT_AP,  "shared-inbox",          0, rt_activitypub_post },
+    { "inbox",           RT_POST,   RT_AP,  "*/inbox",               RT_USER, rt_activitypub_post },
+    { "not-an-inbox",    RT_POST,   RT_AP,  "*/**",                  0, rt_not_found },
+    { "actor",           RT_GET,    RT_AP,  "*",                     RT_USER, rt_activitypub_get },
+    { "objects",         RT_GET,    RT_AP,  "*/**",                  RT_USER, rt_activitypub_get },
+    { "bridge",          RT_GET,    RT_ANY, "share-bridge",          0, rt_html_get },
+    { "bridge",          RT_GET,    RT_ANY, "auth-int-bridge",       0, rt_html_get },
+    { "html",            RT_GET,    RT_ANY, "*",                     RT_USER_RSS, rt_html_get },
+    { "html",            RT_GET,    RT_ANY, "*/**",                  RT_USER, rt_html_get },
+    { "html",            RT_POST,   RT_ANY, "*/**",                  RT_USER, rt_html_post },
+};
+
+#define N_ROUTES (int)(sizeof(routes) / sizeof(routes[0]))
+
+typedef struct _t_rnode {
+    struct _t_rnode *child;     /* first child */
+    struct _t_rnode *next;      /* next sibling */
+    char *seg;                  /* path segment */
+    int here[RT_METHODS][RT_KINDS];     /* route (+ 1) for this path */
+    int below[RT_METHODS][RT_KINDS];    /* route (+ 1) for anything below */
+} t_rnode;
+
+static t_rnode rt_root = {0};
+
+
+static void httpd_routes(void)
+/* builds the route trie */
+{
+    int n;
+
+    for (n = 0; n < N_ROUTES && n < MAX_ROUTES; n++) {
+        xs *l = xs_split(routes[n].path, "/");
+        t_rnode *node = &rt_root;
+        int below = 0;
+        const char *seg;
+
+        xs_list_foreach(l, seg) {
+            t_rnode *c;
+
+            if (*seg == '\0')
+                continue;
+
+            if (strcmp(seg, "**") == 0) {
+                below = 1;
+                break;
+            }
+
+            for (c = node->child; c != NULL && strcmp(c->seg, seg) != 0; c = c->next);
+
+            if (c == NULL) {
+                c = xs_realloc(NULL, sizeof(t_rnode));
+                memset(c, '\0', sizeof(*c));
+
+                c->seg  = xs_dup(seg);
+                c->next = node->child;
+                node->child = c;
+            }
+
+            node = c;
+        }
+
+        if (below)
+            node->below[routes[n].method][routes[n].kind] = n + 1;
+        else
+            node->here[routes[n].method][routes[n].kind] = n + 1;
+    }
+}
+
+
+static int _route_match(const t_rnode *node, const xs_list *segs, int i, int method, int kind)
+/* finds the route (+ 1) for the segments from i on, below the node;
+   exact segments are preferred over the '*' wildcard */
+{
+    const char *seg = xs_list_get(segs, i);
+    const t_rnode *c;
+    int r;
+
+    if (seg == NULL) {
+        r = node->here[method][kind];
+        return r ? r : node->here[method][RT_ANY];
+    }
+
+    for (c = node->child; c != NULL; c = c->next) {
+        if (strcmp(c->seg, seg) == 0 && (r = _route_match(c, segs, i + 1, method, kind)))
+            return r;
+    }
+
+    for (c = node->child; c != NULL; c = c->next) {
+        if (strcmp(c->seg, "*") == 0 && (r = _route_match(c, segs, i + 1, method, kind)))
+            return r;
+    }
+
+    r = node->below[method][kind];
+    return r ? r : node->below[method][RT_ANY];
+}
+
+
+static int httpd_route(const char *method, t_route_args *a)
+/* routes the request to its handler */
+{
+    const char *ap_types[] = { "application/activity+json", "application/ld+json", NULL };
+    const char *methods[]  = { "GET", "POST", "PUT", "PATCH", "DELETE", NULL };
+    const char *t;
+    int m, k, n, r, status;
+
+    if (strcmp(method, "HEAD") == 0)
+        method = "GET";
+
+    for (m = 0; methods[m] && strcmp(methods[m], method) != 0; m++);
+
+    if (methods[m] == NULL)
+        return 0;
+
+    /* ActivityPub is told by what is accepted (or, if sent, by what is sent) */
+    t = xs_dict_get(a->req, m == RT_GET ? "accept" : "content-type");
+    k = RT_ANY;
+
+    for (n = 0; xs_is_string(t) && ap_types[n]; n++) {
+        if (xs_str_in(t, ap_types[n]) != -1)
+            k = RT_AP;
+    }
+
+    xs *segs = xs_split(a->q_path, "/");
+
+    /* the first one is always empty */
+    r = _route_match(&rt_root, segs, 1, m, k) - 1;
+
+    /* outside the APIs, a POST with no type or no payload is
+       a bad request, whatever the path (as it always was) */
+    if (m == RT_POST && (r == -1 || (strcmp(routes[r].name, "oauth") != 0 &&
+        strcmp(routes[r].name, "mastoapi") != 0)) &&
+        (xs_dict_get(a->req, "content-type") == NULL || xs_is_null(a->payload)))
+        return rt_activitypub_post(a);
+
+    if (r == -1)
+        return 0;
+
+    if (r < MAX_ROUTES)
+        __atomic_fetch_add(&p_state->route_hits[r], 1, __ATOMIC_RELAXED);
+
+    if (routes[r].user) {
+        xs *uid = xs_dup(xs_list_get(segs, 1));
+        snac user;
+
+        if (routes[r].user == RT_USER_RSS && xs_endswith(uid, ".rss"))
+            uid = xs_crop_i(uid, 0, -4);
+
+        if (!user_open(&user, uid)) {
+            /* invalid user */
+            srv_debug(1, xs_fmt("httpd_route bad user %s", uid));
+            return HTTP_STATUS_NOT_FOUND;
+        }
+
+        a->user = &user;
+        status = routes[r].handler(a);
+        a->user = NULL;
+
+        user_free(&user);
+    }
+    else
+        status = routes[r].handler(a);
+
+    return status;
+}
+
+
+xs_str *httpd_route_desc(int n)
+/* returns the description of a route, or NULL if there is no such one */
+{
+    const char *methods[] = { "GET", "POST", "PUT", "PATCH", "DELETE" };
+
+    if (n < 0 || n >= N_ROUTES || n >= MAX_ROUTES)
+        return NULL;
+
+    return xs_fmt("%s /%s%s (%s)", methods[routes[n].method], routes[n].path,
+        routes[n].kind == RT_AP ? " [ActivityPub]" : "", routes[n].name);
+}
+
+
+static int httpd_request(FILE *f, FILE *w, int may_keep)
+/* processes a request read from f and writes the response to w;
+   returns 1 if the connection is to be kept open for more requests */
 {
     xs *req;
     const char *method;
@@ -389,22 +745,51 @@ void httpd_connection(FILE *f)
     int p_size   = 0;
     const char *p;
     int fcgi_id;
+    int fcgi_keep = 0;
+    int keep = 0;
+
+    errno = 0;
 
     if (p_state->use_fcgi)
-        req = xs_fcgi_request(f, &payload, &p_size, &fcgi_id);
+        req = xs_fcgi_request(f, &payload, &p_size, &fcgi_id, &fcgi_keep);
     else
         req = xs_httpd_request(f, &payload, &p_size);
 
     if (req == NULL) {
+        if (errno == EINVAL && !p_state->use_fcgi) {
+            /* unreliable framing: answer, but don't read anything more */
+            xs *h = xs_dict_new();
+            h = xs_dict_append(h, "connection", "close");
+
+            xs_httpd_response(w, HTTP_STATUS_BAD_REQUEST,
+                http_status_text(HTTP_STATUS_BAD_REQUEST), h, NULL, 0);
+            fflush(w);
+        }
+
         /* probably because a timeout */
-        fclose(f);
-        return;
+        return 0;
     }
 
     if (!(method = xs_dict_get(req, "method")) || !(p = xs_dict_get(req, "path"))) {
         /* missing needed headers; discard */
-        fclose(f);
-        return;
+        return 0;
+    }
+
+    if (p_state->use_fcgi) {
+        /* the web server tells if it wants the connection kept */
+        keep = may_keep && fcgi_keep;
+    }
+    else
+    if (may_keep) {
+        /* HTTP/1.1 keeps the connection unless told otherwise;
+           HTTP/1.0, only if asked to */
+        const char *proto = xs_dict_get_def(req, "proto", "");
+        const char *conn  = xs_dict_get_def(req, "connection", "");
+
+        if (strcmp(proto, "HTTP/1.1") == 0)
+            keep = strcasecmp(conn, "close") != 0;
+        else
+            keep = strcasecmp(conn, "keep-alive") == 0;
     }
 
     q_path = xs_dup(p);
@@ -417,83 +802,20 @@ void httpd_connection(FILE *f)
     if (xs_startswith(q_path, p))
         q_path = xs_crop_i(q_path, strlen(p), 0);
 
-    if (strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) {
-        /* cascade through */
-        if (status == 0)
-            status = server_get_handler(req, q_path, &body, &b_size, &ctype);
-
-        if (status == 0)
-            status = webfinger_get_handler(req, q_path, &body, &b_size, &ctype);
-
-        if (status == 0)
-            status = activitypub_get_handler(req, q_path, &body, &b_size, &ctype);
-
-#ifndef NO_MASTODON_API
-        if (status == 0)
-            status = oauth_get_handler(req, q_path, &body, &b_size, &ctype);
-
-        if (status == 0)
-            status = mastoapi_get_handler(req, q_path, &body, &b_size, &ctype, &link);
-#endif /* NO_MASTODON_API */
-
-        if (status == 0)
-            status = html_get_handler(req, q_path, &body, &b_size, &ctype, &etag, &last_modified);
-    }
-    else
-    if (strcmp(method, "POST") == 0) {
-
-#ifndef NO_MASTODON_API
-        if (status == 0)
-            status = oauth_post_handler(req, q_path,
-                        payload, p_size, &body, &b_size, &ctype);
-
-        if (status == 0)
-            status = mastoapi_post_handler(req, q_path,
-                        payload, p_size, &body, &b_size, &ctype);
-#endif
-
-        if (status == 0)
-            status = activitypub_post_handler(req, q_path,
-                        payload, p_size, &body, &b_size, &ctype);
-
-        if (status == 0)
-            status = html_post_handler(req, q_path,
-                        payload, p_size, &body, &b_size, &ctype);
-    }
-    else
-    if (strcmp(method, "PUT") == 0) {
-
-#ifndef NO_MASTODON_API
-        if (status == 0)
-            status = mastoapi_put_handler(req, q_path,
-                        payload, p_size, &body, &b_size, &ctype);
-#endif
-
-    }
-    else
-    if (strcmp(method, "PATCH") == 0) {
-
-#ifndef NO_MASTODON_API
-        if (status == 0)
-            status = mastoapi_patch_handler(req, q_path,
-                        payload, p_size, &body, &b_size, &ctype);
-#endif
-
-    }
-    else
     if (strcmp(method, "OPTIONS") == 0) {
         const char *methods = "OPTIONS, GET, HEAD, POST, PUT, DELETE";
         headers = xs_dict_append(headers, "allow", methods);
         headers = xs_dict_append(headers, "access-control-allow-methods", methods);
         status = HTTP_STATUS_OK;
     }
-    else
-    if (strcmp(method, "DELETE") == 0) {
-#ifndef NO_MASTODON_API
-        if (status == 0)
-            status = mastoapi_delete_handler(req, q_path,
-                    payload, p_size, &body, &b_size, &ctype);
-#endif
+    else {
+        t_route_args args = {
+            .req = req, .q_path = q_path, .payload = payload, .p_size = p_size,
+            .body = &body, .b_size = &b_size, .ctype = &ctype,
+            .etag = &etag, .last_modified = &last_modified, .link = &link
+        };
+
+        status = httpd_route(method, &args);
     }
 
     /* unattended? it's an error */
@@ -558,12 +880,22 @@ void httpd_connection(FILE *f)
     /* disable any form of fucking JavaScript */
     headers = xs_dict_append(headers, "Content-Security-Policy", "script-src ;");
 
+    if (!p_state->use_fcgi)
+        headers = xs_dict_append(headers, "connection", keep ? "keep-alive" : "close");
+
     if (p_state->use_fcgi)
-        xs_fcgi_response(f, status, headers, body, b_size, fcgi_id);
+        xs_fcgi_response(w, status, headers, body, b_size, fcgi_id);
     else
-        xs_httpd_response(f, status, http_status_text(status), headers, body, b_size);
+        xs_httpd_response(w, status, http_status_text(status), headers, body, b_size);
 
-    fclose(f);
+    fflush(w);
+
+    if (p_state != NULL) {
+        p_state->http_in_requests++;
+
+        if (keep)
+            p_state->http_in_kept++;
+    }
 
     srv_archive("RECV", NULL, req, payload, p_size, status, headers, body, b_size);
 
@@ -578,190 +910,1334 @@ void httpd_connection(FILE *f)
     }
 
     xs_free(body);
+
+    return keep;
 }
 
 
-void job_post(const xs_val *job, int urgent)
-/* posts a job for the threads to process it */
+void httpd_connection(FILE *f)
+/* the connection processor */
 {
-    if (job != NULL) {
-        /* lock the mutex */
-        pthread_mutex_lock(&job_mutex);
+    int max_reqs = xs_number_get(xs_dict_get_def(srv_config, "keepalive_max_requests", "100"));
+    double idle  = xs_number_get(xs_dict_get_def(srv_config, "keepalive_timeout", "5"));
+    FILE *w      = NULL;
+    int n        = 0;
+
+    if (max_reqs > 1 && idle > 0.0 &&
+        xs_type(xs_dict_get(srv_config, "disable_http_keepalive")) != XSTYPE_TRUE) {
+        /* responses are written to a stream of their own, so that
+           pipelined requests already read into f are not lost */
+        int fd = dup(fileno(f));
+
+        if (fd != -1 && (w = fdopen(fd, "w")) == NULL)
+            close(fd);
+    }
 
-        job_fifo_item *i = xs_realloc(NULL, sizeof(job_fifo_item));
-        *i = (job_fifo_item){ NULL, xs_dup(job) };
+    if (w == NULL) {
+        /* one request per connection */
+        httpd_request(f, f, 0);
+        fclose(f);
+        return;
+    }
 
-        if (job_fifo_first == NULL)
-            job_fifo_first = job_fifo_last = i;
-        else
-        if (urgent) {
-            /* prepend */
-            i->next = job_fifo_first;
-            job_fifo_first = i;
-        }
-        else {
-            /* append */
-            job_fifo_last->next = i;
-            job_fifo_last = i;
-        }
+    while (httpd_request(f, w, ++n < max_reqs && p_state->srv_running)) {
+        double left = idle;
+        int c;
+
+        /* wait for the next request in slices, to give the thread up
+           as soon as there are other connections waiting for one */
+        for (;;) {
+            double slice = p_state->lane_size[JOB_LANE_HTTP] ? 0.05 : left < 0.5 ? left : 0.5;
+
+            xs_socket_timeout(fileno(f), slice, 0.0);
 
-        p_state->job_fifo_size++;
+            errno = 0;
+
+            if ((c = fgetc(f)) != EOF || (errno != EAGAIN && errno != EWOULDBLOCK))
+                break;
+
+            if ((left -= slice) <= 0.0 || p_state->lane_size[JOB_LANE_HTTP] ||
+                !p_state->srv_running)
+                break;
 
-        if (p_state->job_fifo_size > p_state->peak_job_fifo_size)
-            p_state->peak_job_fifo_size = p_state->job_fifo_size;
+            clearerr(f);
+        }
 
-        /* unlock the mutex */
-        pthread_mutex_unlock(&job_mutex);
+        if (c == EOF)
+            break;
 
-        /* ask for someone to attend it */
-        sem_post(job_sem);
+        ungetc(c, f);
     }
+
+    fclose(w);
+    fclose(f);
 }
 
 
-void job_wait(xs_val **job)
-/* waits for an available job */
-{
-    *job = NULL;
+/* set if the event-driven front-end is in use */
+static int rx_active = 0;
 
-    if (sem_wait(job_sem) == 0) {
-        /* lock the mutex */
-        pthread_mutex_lock(&job_mutex);
+#ifdef USE_EPOLL
 
-        /* dequeue */
-        job_fifo_item *i = job_fifo_first;
+/** event-driven front-end **/
 
-        if (i != NULL) {
-            job_fifo_first = i->next;
+/* connections are accepted, read and written by the main thread using
+   epoll, without blocking; only requests that have been completely
+   received (body included) are handed to the job threads, which answer
+   them into a memory buffer. So, slow clients don't hold job threads.
+   With FastCGI, the records of each request id are gathered separately,
+   so many requests can be answered at the same time over a connection */
 
-            if (job_fifo_first == NULL)
-                job_fifo_last = NULL;
+#define RX_MAX_HEADER    65536  /* maximum size of the request headers */
+#define RX_READ_TIMEOUT  10     /* seconds without data in a partial request */
+#define RX_REQ_TIMEOUT   60     /* maximum seconds to receive a request */
+#define RX_WRITE_TIMEOUT 30     /* seconds without progress writing a response */
 
-            *job = i->job;
-            xs_free(i);
+struct _t_rx_conn;
 
-            p_state->job_fifo_size--;
-        }
+typedef struct _t_rx_job {
+    struct _t_rx_job *next;     /* in a list of jobs */
+    struct _t_rx_conn *c;       /* the connection */
+    int id;                     /* FastCGI request id */
+    char *req;                  /* the request */
+    int req_len;
+    int req_size;
+    int may_keep;               /* the connection may be kept after it */
+    int keep;                   /* the connection is kept after the response */
+    char *out;                  /* the response */
+    size_t out_len;
+} t_rx_job;
 
-        /* unlock the mutex */
-        pthread_mutex_unlock(&job_mutex);
-    }
+typedef struct _t_rx_conn {
+    int fd;
+    char *buf;                  /* received data */
+    int len;
+    int size;
+    char *out;                  /* data to be written */
+    int out_len;
+    int out_off;
+    int jobs;                   /* requests being answered */
+    int closing;                /* close when everything is answered and written */
+    t_rx_job *partial;          /* FastCGI requests being received */
+    int events;                 /* events being waited for (0: none) */
+    int n_reqs;                 /* requests served */
+    time_t start;               /* start of the current request */
+    time_t last;                /* last activity */
+} t_rx_conn;
+
+static int rx_wake_fd  = -1;    /* eventfd to wake up the loop */
+static volatile sig_atomic_t rx_stop = 0;
+static t_rx_job *rx_done = NULL;    /* answered by the job threads */
+static pthread_mutex_t rx_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* only used by the main thread */
+static int rx_epfd = -1;
+static t_rx_conn **rx_conns = NULL; /* indexed by fd */
+static int rx_conns_size = 0;
+static int rx_n_conns    = 0;
+static long rx_buffered  = 0;
+
+
+static void _rx_wake(void)
+/* wakes up the event loop */
+{
+    uint64_t one = 1;
+
+    /* EAGAIN means the counter is full, so it's awake anyway */
+    if (write(rx_wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        srv_debug(1, xs_fmt("rx: cannot write the wake up fd (errno: %d)", errno));
 }
 
 
-static void *job_thread(void *arg)
-/* job thread */
+static void _rx_job(t_rx_job *j)
+/* answers a request (called from the job threads) */
 {
-    int pid = (int)(uintptr_t)arg;
+    FILE *f = fmemopen(j->req, j->req_len, "r");
+    FILE *w = open_memstream(&j->out, &j->out_len);
 
-    srv_debug(1, xs_fmt("job thread %d started", pid));
+    j->keep = 0;
 
-    for (;;) {
-        xs *job = NULL;
+    if (f != NULL && w != NULL)
+        j->keep = httpd_request(f, w, j->may_keep);
 
-        p_state->th_state[pid] = THST_WAIT;
+    if (f != NULL)
+        fclose(f);
+    if (w != NULL)
+        fclose(w);
 
-        job_wait(&job);
+    pthread_mutex_lock(&rx_mutex);
+    j->next = rx_done;
+    rx_done = j;
+    pthread_mutex_unlock(&rx_mutex);
 
-        if (job == NULL) /* corrupted message? */
-            continue;
+    _rx_wake();
+}
 
-        if (xs_type(job) == XSTYPE_FALSE) /* special message: exit */
-            break;
-        else
-        if (xs_type(job) == XSTYPE_DATA) {
-            /* it's a socket */
-            FILE *f = NULL;
 
-            p_state->th_state[pid] = THST_IN;
+static t_rx_job *_rx_job_new(void)
+/* creates a new job */
+{
+    t_rx_job *j = xs_realloc(NULL, sizeof(t_rx_job));
 
-            xs_data_get(&f, job);
+    memset(j, '\0', sizeof(*j));
 
-            if (f != NULL)
-                httpd_connection(f);
-        }
-        else {
-            /* it's a q_item */
-            p_state->th_state[pid] = THST_QUEUE;
+    return j;
+}
 
-            process_queue_item(job);
-        }
-    }
 
-    p_state->th_state[pid] = THST_STOP;
+static void _rx_job_free(t_rx_job *j)
+/* frees a job */
+{
+    xs_free(j->req);
 
-    srv_debug(1, xs_fmt("job thread %d stopped", pid));
+    /* (allocated by open_memstream()) */
+    free(j->out);
 
-    return NULL;
+    xs_free(j);
 }
 
-/* background thread sleep control */
-static pthread_mutex_t sleep_mutex;
-static pthread_cond_t  sleep_cond;
 
-static void *background_thread(void *arg)
-/* background thread (queue management and other things) */
+static void _rx_conn_free(t_rx_conn *c)
+/* frees a connection */
 {
-    time_t purge_time;
+    xs_free(c->out);
+    xs_free(c->buf);
+    xs_free(c);
+}
 
-    (void)arg;
 
-    /* first purge time */
-    purge_time = time(NULL) + 10 * 60;
+static void _rx_events(t_rx_conn *c, int events)
+/* sets the events to wait for on a connection; with none, it's
+   removed from the set (so a hangup while a request is being
+   answered is not noticed until the response is written) */
+{
+    struct epoll_event ev = { .events = events, .data.fd = c->fd };
 
-    srv_log(xs_fmt("background thread started"));
+    if (events == c->events)
+        return;
 
-    while (p_state->srv_running) {
-        time_t t;
-        int cnt = 0;
+    if (events == 0)
+        epoll_ctl(rx_epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    else
+        epoll_ctl(rx_epfd, c->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c->fd, &ev);
 
-        p_state->th_state[0] = THST_QUEUE;
+    c->events = events;
+}
 
-        {
-            xs *list = user_list();
-            char *p;
-            const char *uid;
 
-            /* process queues for all users */
-            p = list;
-            while (xs_list_iter(&p, &uid)) {
-                snac snac;
+static void _rx_close(t_rx_conn *c)
+/* closes a connection (its jobs, if any, will find it gone) */
+{
+    _rx_events(c, 0);
+    close(c->fd);
 
-                if (user_open(&snac, uid)) {
-                    cnt += process_user_queue(&snac);
-                    user_free(&snac);
-                }
-            }
-        }
+    rx_buffered -= c->len + (c->out_len - c->out_off);
 
-        /* global queue */
-        cnt += process_queue();
+    while (c->partial != NULL) {
+        t_rx_job *j = c->partial;
 
-        /* time to purge? */
-        if ((t = time(NULL)) > purge_time) {
-            /* next purge time is tomorrow */
-            purge_time = t + 24 * 60 * 60;
+        c->partial = j->next;
+        rx_buffered -= j->req_len;
+        _rx_job_free(j);
+    }
 
-            xs *q_item = xs_dict_new();
-            q_item = xs_dict_append(q_item, "type", "purge");
-            job_post(q_item, 0);
-        }
+    rx_conns[c->fd] = NULL;
+    rx_n_conns--;
+
+    if (c->jobs) {
+        /* orphan: it will be freed when its jobs are answered */
+        c->fd = -1;
+        return;
+    }
+
+    _rx_conn_free(c);
+}
+
+
+static void _rx_output(t_rx_conn *c, const char *data, int size)
+/* adds data to be written to a connection */
+{
+    if (c->out_off == c->out_len) {
+        c->out_off = c->out_len = 0;
+    }
+
+    c->out = xs_realloc(c->out, c->out_len + size);
+    memcpy(c->out + c->out_len, data, size);
+    c->out_len += size;
+
+    rx_buffered += size;
+}
+
+
+static int _rx_dispatch(t_rx_conn *c, t_rx_job *j)
+/* hands a complete request to the job threads;
+   if there is no room for it, it's dropped and 0 returned */
+{
+    j->c = c;
+
+    if (!_job_post(j, NULL, JOB_LANE_HTTP)) {
+        srv_debug(1, xs_fmt("httpd lane full -- request dropped"));
+
+        rx_buffered -= j->req_len;
+        _rx_job_free(j);
+        return 0;
+    }
+
+    c->jobs++;
+
+    return 1;
+}
+
+
+static void _rx_consume(t_rx_conn *c, int size)
+/* drops data from the start of the received buffer */
+{
+    memmove(c->buf, c->buf + size, c->len - size + 1);
+    c->len -= size;
+    rx_buffered -= size;
+}
+
+
+static int _rx_http_len(const t_rx_conn *c, int max_req)
+/* returns the size of the first HTTP request in the buffer if it's
+   complete, 0 if it isn't yet, or -1 if it's invalid or too big */
+{
+    int n, h_len = 0;
+    long cl = -1;
+
+    /* find the end of the headers */
+    for (n = 0; n < c->len && h_len == 0; n++) {
+        if (c->buf[n] == '\n') {
+            if (n + 1 < c->len && c->buf[n + 1] == '\n')
+                h_len = n + 2;
+            else
+            if (n + 2 < c->len && c->buf[n + 1] == '\r' && c->buf[n + 2] == '\n')
+                h_len = n + 3;
+        }
+    }
+
+    if (h_len == 0)
+        return c->len > RX_MAX_HEADER ? -1 : 0;
+
+    if (h_len > RX_MAX_HEADER)
+        return -1;
+
+    /* find the content length; as the request must be delimited without
+       doubt from the next one, the same headers xs_httpd_request() refuses
+       are refused here: folded lines, whitespace before the colon,
+       transfer encodings (chunked bodies) and repeated or malformed
+       content lengths */
+    for (n = 0; n < h_len - 1; n++) {
+        const char *h = &c->buf[n + 1];
+
+        if (c->buf[n] != '\n')
+            continue;
+
+        if (*h == ' ' || *h == '\t')
+            return -1;
+
+        int nl = strcspn(h, ":\r\n");
+
+        if (h[nl] == ':' && h[strcspn(h, " \t\v\f:")] != ':')
+            return -1;
+
+        if (strncasecmp(h, "transfer-encoding:", 18) == 0)
+            return -1;
+
+        if (strncasecmp(h, "content-length:", 15) == 0) {
+            char *e;
+
+            if (cl != -1)
+                return -1;
+
+            h += 15;
+            h += strspn(h, " \t");
+
+            if (*h < '0' || *h > '9')
+                return -1;
+
+            cl = strtol(h, &e, 10);
+            e += strspn(e, " \t");
+
+            if (*e != '\r' && *e != '\n')
+                return -1;
+        }
+    }
+
+    if (cl == -1)
+        cl = 0;
+
+    if (cl > max_req - h_len)
+        return -1;
+
+    return c->len >= h_len + cl ? h_len + cl : 0;
+}
+
+
+static void _rx_write(t_rx_conn *c);
+
+static void _rx_fail(t_rx_conn *c, int status)
+/* answers with an error and closes the connection */
+{
+    if (!p_state->use_fcgi) {
+        xs *s = xs_fmt("HTTP/1.1 %d %s\r\ncontent-length: 0\r\nconnection: close\r\n\r\n",
+                        status, http_status_text(status));
+
+        _rx_output(c, s, strlen(s));
+    }
+
+    _rx_consume(c, c->len);
+
+    c->closing = 1;
+    _rx_write(c);
+}
+
+
+static int _rx_http_check(t_rx_conn *c, int max_req, int may_keep)
+/* dispatches the HTTP request in the buffer, if it's complete */
+{
+    int r;
+
+    /* one at a time, as the responses must go in order */
+    if (c->jobs || c->closing)
+        return 0;
+
+    if ((r = _rx_http_len(c, max_req)) == 0)
+        return 0;
+
+    if (r < 0) {
+        _rx_fail(c, HTTP_STATUS_BAD_REQUEST);
+        return -1;
+    }
+
+    t_rx_job *j = _rx_job_new();
+
+    j->req      = xs_realloc(NULL, r);
+    j->req_len  = r;
+    j->may_keep = may_keep;
+    memcpy(j->req, c->buf, r);
+
+    _rx_consume(c, r);
+    rx_buffered += r;
+
+    if (!_rx_dispatch(c, j)) {
+        _rx_fail(c, HTTP_STATUS_SERVICE_UNAVAILABLE);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+static int _rx_fcgi_check(t_rx_conn *c, int max_req)
+/* gathers the complete FastCGI records in the buffer by request id,
+   dispatching the requests that are complete */
+{
+    int type, id, flags, r;
+    char rec[16];
+    t_rx_job *j, **pj;
+
+    while ((r = xs_fcgi_record(c->buf, c->len, &type, &id, &flags)) > 0) {
+        /* find the request this record belongs to */
+        for (pj = &c->partial; (j = *pj) != NULL && j->id != id; pj = &j->next);
+
+        if (type == FCGI_BEGIN_REQUEST) {
+            if (j == NULL) {
+                j = _rx_job_new();
+                j->id   = id;
+                j->next = c->partial;
+                c->partial = j;
+            }
+
+            /* without FCGI_KEEP_CONN, this is the last one */
+            if (!(flags & FCGI_KEEP_CONN))
+                c->closing = 1;
+        }
+        else
+        if (id == 0 || j == NULL) {
+            /* management record, or for an unknown request */
+            if (id == 0)
+                _rx_output(c, rec, xs_fcgi_end_record(rec, type, id, 0));
+
+            _rx_consume(c, r);
+            continue;
+        }
+        else
+        if (type == FCGI_ABORT_REQUEST) {
+            /* forget it */
+            *pj = j->next;
+            rx_buffered -= j->req_len;
+            _rx_job_free(j);
+
+            _rx_output(c, rec, xs_fcgi_end_record(rec, type, id, FCGI_REQUEST_COMPLETE));
+            _rx_consume(c, r);
+            continue;
+        }
+
+        if (j->req_len + r > max_req) {
+            _rx_fail(c, 0);
+            return -1;
+        }
+
+        /* add the record to its request */
+        if (j->req_size < j->req_len + r) {
+            j->req_size = (j->req_len + r) * 2;
+            j->req = xs_realloc(j->req, j->req_size);
+        }
+
+        memcpy(j->req + j->req_len, c->buf, r);
+        j->req_len += r;
+
+        _rx_consume(c, r);
+        rx_buffered += r;
+
+        /* an empty FCGI_STDIN ends the request */
+        if (type == FCGI_STDIN && r == 8) {
+            *pj = j->next;
+
+            if (!_rx_dispatch(c, j))
+                _rx_output(c, rec, xs_fcgi_end_record(rec, FCGI_END_REQUEST, id, FCGI_OVERLOADED));
+        }
+    }
+
+    if (c->len > RX_MAX_HEADER && c->len > max_req) {
+        _rx_fail(c, 0);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void _rx_check(t_rx_conn *c)
+/* processes what has been received from a connection */
+{
+    int max_req  = xs_number_get(xs_dict_get_def(srv_config, "httpd_max_request_kb", "65536"));
+    int max_reqs = xs_number_get(xs_dict_get_def(srv_config, "keepalive_max_requests", "100"));
+    int may_keep = c->n_reqs + 1 < max_reqs && !rx_stop &&
+        xs_type(xs_dict_get(srv_config, "disable_http_keepalive")) != XSTYPE_TRUE;
+
+    if (p_state->use_fcgi) {
+        /* management records may have been answered right away */
+        if (_rx_fcgi_check(c, max_req * 1024) == 0 && c->out_off < c->out_len)
+            _rx_write(c);
+    }
+    else
+        _rx_http_check(c, max_req * 1024, may_keep);
+}
+
+
+static int _rx_read(t_rx_conn *c)
+/* reads from a connection; returns 0 if it has been closed */
+{
+    int max_buf = xs_number_get(xs_dict_get_def(srv_config, "httpd_max_buffer_kb", "262144"));
+    int chunk   = 16384;
+    ssize_t n;
+
+    if (rx_buffered + chunk > (long)max_buf * 1024) {
+        _rx_fail(c, HTTP_STATUS_SERVICE_UNAVAILABLE);
+        return 1;
+    }
+
+    if (c->size - c->len < chunk + 1) {
+        c->size = c->size * 2 > c->len + chunk + 1 ? c->size * 2 : c->len + chunk + 1;
+        c->buf  = xs_realloc(c->buf, c->size);
+    }
+
+    n = read(c->fd, c->buf + c->len, chunk);
+
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        _rx_close(c);
+        return 0;
+    }
+
+    if (n < 0)
+        return 1;
+
+    if (c->len == 0)
+        c->start = time(NULL);
+
+    c->len += n;
+    c->buf[c->len] = '\0';
+    c->last = time(NULL);
+
+    rx_buffered += n;
+
+    _rx_check(c);
+
+    return 1;
+}
+
+
+static void _rx_write(t_rx_conn *c)
+/* writes what's pending to a connection */
+{
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+
+        if (n > 0) {
+            c->out_off += n;
+            rx_buffered -= n;
+            c->last = time(NULL);
+        }
+        else
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            /* wait until it can be written again */
+            _rx_events(c, EPOLLOUT | (p_state->use_fcgi && !c->closing ? EPOLLIN : 0));
+            return;
+        }
+        else {
+            _rx_close(c);
+            return;
+        }
+    }
+
+    if (c->closing && c->jobs == 0) {
+        _rx_close(c);
+        return;
+    }
+
+    /* HTTP connections are not read while a request is being answered */
+    _rx_events(c, !p_state->use_fcgi && c->jobs ? 0 : EPOLLIN);
+}
+
+
+static void _rx_answered(void)
+/* takes the requests answered by the job threads */
+{
+    uint64_t cnt;
+    t_rx_job *j;
+
+    /* reset the eventfd (EAGAIN just means it was already read) */
+    if (read(rx_wake_fd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+        srv_debug(1, xs_fmt("rx: cannot read the wake up fd (errno: %d)", errno));
+
+    pthread_mutex_lock(&rx_mutex);
+    j = rx_done;
+    rx_done = NULL;
+    pthread_mutex_unlock(&rx_mutex);
+
+    while (j != NULL) {
+        t_rx_job *next = j->next;
+        t_rx_conn *c   = j->c;
+
+        rx_buffered -= j->req_len;
+        c->jobs--;
+
+        if (c->fd == -1) {
+            /* closed while being answered */
+            if (c->jobs == 0)
+                _rx_conn_free(c);
+        }
+        else {
+            c->n_reqs++;
+
+            if (j->out_len)
+                _rx_output(c, j->out, j->out_len);
+            else
+            if (p_state->use_fcgi) {
+                /* not answered: end it anyway, so the web server doesn't wait */
+                char rec[16];
+                _rx_output(c, rec, xs_fcgi_end_record(rec, FCGI_END_REQUEST, j->id, FCGI_REQUEST_COMPLETE));
+            }
+
+            if (!p_state->use_fcgi) {
+                if (j->out_len == 0 || !j->keep)
+                    c->closing = 1;
+                else
+                    c->start = time(NULL);
+            }
+
+            int fd = c->fd;
+
+            _rx_write(c);
+
+            /* pipelined request? */
+            if (!p_state->use_fcgi && rx_conns[fd] == c)
+                _rx_check(c);
+        }
+
+        _rx_job_free(j);
+        j = next;
+    }
+}
+
+
+static int _rx_accept(int rs, int max_conns)
+/* accepts new connections; returns -1 on errors other than having no more */
+{
+    while (rx_n_conns < max_conns) {
+        int cs = accept(rs, NULL, NULL);
+
+        if (cs == -1)
+            return errno == EAGAIN || errno == EINTR || errno == ECONNABORTED ? 0 : -1;
+
+        fcntl(cs, F_SETFL, fcntl(cs, F_GETFL) | O_NONBLOCK);
+        fcntl(cs, F_SETFD, FD_CLOEXEC);
+
+        if (cs >= rx_conns_size) {
+            int n = rx_conns_size;
+
+            rx_conns_size = cs + 256;
+            rx_conns = xs_realloc(rx_conns, rx_conns_size * sizeof(t_rx_conn *));
+
+            while (n < rx_conns_size)
+                rx_conns[n++] = NULL;
+        }
+
+        t_rx_conn *c = xs_realloc(NULL, sizeof(t_rx_conn));
+
+        memset(c, '\0', sizeof(*c));
+
+        c->fd    = cs;
+        c->start = c->last = time(NULL);
+
+        rx_conns[cs] = c;
+        rx_n_conns++;
+
+        _rx_events(c, EPOLLIN);
+    }
+
+    return 0;
+}
+
+
+static void _rx_sweep(void)
+/* closes the connections that have been waiting for too long */
+{
+    double idle = xs_number_get(xs_dict_get_def(srv_config, "keepalive_timeout", "5"));
+    time_t t = time(NULL);
+    int n;
+
+    for (n = 0; n < rx_conns_size; n++) {
+        t_rx_conn *c = rx_conns[n];
+
+        if (c == NULL || c->jobs)
+            continue;
+
+        if (c->out_off < c->out_len) {
+            if (t - c->last >= RX_WRITE_TIMEOUT)
+                _rx_close(c);
+        }
+        else
+        if (c->len == 0 && c->partial == NULL) {
+            if (t - c->last >= idle)
+                _rx_close(c);
+        }
+        else
+        if (t - c->last >= RX_READ_TIMEOUT || t - c->start >= RX_REQ_TIMEOUT)
+            _rx_close(c);
+    }
+}
+
+
+static void httpd_reactor(int rs)
+/* the event loop of the front-end */
+{
+    int max_conns = xs_number_get(xs_dict_get_def(srv_config, "httpd_max_connections", "512"));
+    struct epoll_event ev;
+    int listening = 1;
+    int acc_err   = 0;
+    time_t swept  = 0;
+
+    fcntl(rs, F_SETFL, fcntl(rs, F_GETFL) | O_NONBLOCK);
+
+    ev = (struct epoll_event){ .events = EPOLLIN, .data.fd = rs };
+    epoll_ctl(rx_epfd, EPOLL_CTL_ADD, rs, &ev);
+
+    ev = (struct epoll_event){ .events = EPOLLIN, .data.fd = rx_wake_fd };
+    epoll_ctl(rx_epfd, EPOLL_CTL_ADD, rx_wake_fd, &ev);
+
+    while (!rx_stop) {
+        struct epoll_event evs[64];
+        int n, i;
+
+        n = epoll_wait(rx_epfd, evs, 64, 1000);
+
+        if (n == -1 && errno != EINTR)
+            break;
+
+        for (i = 0; i < n; i++) {
+            int fd = evs[i].data.fd;
+
+            if (fd == rs)
+                acc_err = _rx_accept(rs, max_conns);
+            else
+            if (fd == rx_wake_fd)
+                _rx_answered();
+            else
+            if (fd < rx_conns_size && rx_conns[fd] != NULL) {
+                t_rx_conn *c = rx_conns[fd];
+
+                if ((evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !_rx_read(c))
+                    continue;
+
+                if ((evs[i].events & EPOLLOUT) && rx_conns[fd] == c)
+                    _rx_write(c);
+            }
+        }
+
+        /* stop accepting when there are too many connections
+           (or when accept() fails, to avoid spinning), and resume later */
+        if (listening && (rx_n_conns >= max_conns || acc_err)) {
+            ev = (struct epoll_event){ .events = 0, .data.fd = rs };
+            epoll_ctl(rx_epfd, EPOLL_CTL_MOD, rs, &ev);
+            listening = 0;
+        }
+
+        if (time(NULL) != swept) {
+            _rx_sweep();
+            swept = time(NULL);
+
+            if (!listening && rx_n_conns < max_conns) {
+                acc_err = 0;
+                ev = (struct epoll_event){ .events = EPOLLIN, .data.fd = rs };
+                epoll_ctl(rx_epfd, EPOLL_CTL_MOD, rs, &ev);
+                listening = 1;
+            }
+        }
+
+        p_state->rx_connections = rx_n_conns;
+        p_state->rx_buffered    = rx_buffered;
+    }
+
+    /* close the connections (the ones being answered are left as orphans) */
+    for (int n = 0; n < rx_conns_size; n++) {
+        if (rx_conns[n] != NULL)
+            _rx_close(rx_conns[n]);
+    }
+}
+
+
+#endif /* USE_EPOLL */
+
+
+const char *job_lane_name(int lane)
+/* returns the name of a lane */
+{
+    const char *names[] = { "http", "input", "output", "maintenance" };
+
+    return lane >= 0 && lane < JOB_LANES ? names[lane] : "?";
+}
+
+
+static int job_lane(const xs_val *job)
+/* returns the lane for a job */
+{
+    const char *type = xs_dict_get(job, "type");
+
+    if (xs_is_string(type)) {
+        if (strcmp(type, "input") == 0)
+            return JOB_LANE_INPUT;
+
+        if (strcmp(type, "output") == 0 || strcmp(type, "email") == 0 ||
+            strcmp(type, "telegram") == 0 || strcmp(type, "ntfy") == 0)
+            return JOB_LANE_OUTPUT;
+    }
+
+    return JOB_LANE_MAINT;
+}
+
+
+static void _job_lane_init(int lane, int size)
+/* creates the ring of a lane (its size is rounded to a power of 2) */
+{
+    size_t n = 64;
+
+    while (n < (size_t)size)
+        n *= 2;
+
+    job_lanes[lane].slots = xs_realloc(NULL, n * sizeof(job_slot));
+    job_lanes[lane].mask  = n - 1;
+
+    memset(job_lanes[lane].slots, '\0', n * sizeof(job_slot));
+
+    while (n--)
+        job_lanes[lane].slots[n].seq = n;
+
+#ifndef __linux__
+    pthread_mutex_init(&job_lanes[lane].mutex, NULL);
+    pthread_cond_init(&job_lanes[lane].cond, NULL);
+#endif
+}
+
+
+static int _job_ring_put(int lane, void *ptr, xs_val *job)
+/* stores a job in the ring of a lane; returns 0 if it's full */
+{
+    size_t pos = __atomic_load_n(&job_lanes[lane].tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        job_slot *s = &job_lanes[lane].slots[pos & job_lanes[lane].mask];
+        size_t seq  = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        long dif    = (long)(seq - pos);
+
+        if (dif == 0) {
+            /* the slot is free: try to claim it */
+            if (__atomic_compare_exchange_n(&job_lanes[lane].tail, &pos, pos + 1,
+                    1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                s->ptr = ptr;
+                s->job = job;
+                __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        }
+        else
+        if (dif < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&job_lanes[lane].tail, __ATOMIC_RELAXED);
+    }
+}
+
+
+static int _job_ring_get(int lane, void **ptr, xs_val **job)
+/* takes a job from the ring of a lane; returns 0 if it's empty */
+{
+    size_t pos = __atomic_load_n(&job_lanes[lane].head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        job_slot *s = &job_lanes[lane].slots[pos & job_lanes[lane].mask];
+        size_t seq  = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        long dif    = (long)(seq - (pos + 1));
+
+        if (dif == 0) {
+            /* the slot is used: try to claim it */
+            if (__atomic_compare_exchange_n(&job_lanes[lane].head, &pos, pos + 1,
+                    1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *ptr = s->ptr;
+                *job = s->job;
+                __atomic_store_n(&s->seq, pos + job_lanes[lane].mask + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        }
+        else
+        if (dif < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&job_lanes[lane].head, __ATOMIC_RELAXED);
+    }
+}
+
+
+static void _job_lane_wake(int lane)
+/* wakes up a thread of the lane, if any is sleeping */
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&job_lanes[lane].waiters, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    __atomic_add_fetch(&job_lanes[lane].event, 1, __ATOMIC_SEQ_CST);
+
+#ifdef __linux__
+    syscall(SYS_futex, &job_lanes[lane].event, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&job_lanes[lane].mutex);
+    pthread_cond_signal(&job_lanes[lane].cond);
+    pthread_mutex_unlock(&job_lanes[lane].mutex);
+#endif
+}
+
+
+static void _job_lane_sleep(int lane, unsigned int event, int secs)
+/* sleeps until the event of the lane is not the one given
+   (or, if secs is not 0, for that many seconds at most) */
+{
+#ifdef __linux__
+    struct timespec ts = { .tv_sec = secs, .tv_nsec = 0 };
+
+    syscall(SYS_futex, &job_lanes[lane].event, FUTEX_WAIT_PRIVATE, event,
+        secs ? &ts : NULL, NULL, 0);
+#else
+    struct timespec ts = { .tv_sec = time(NULL) + secs, .tv_nsec = 0 };
+
+    pthread_mutex_lock(&job_lanes[lane].mutex);
+
+    while (__atomic_load_n(&job_lanes[lane].event, __ATOMIC_SEQ_CST) == event) {
+        if (secs == 0)
+            pthread_cond_wait(&job_lanes[lane].cond, &job_lanes[lane].mutex);
+        else
+        if (pthread_cond_timedwait(&job_lanes[lane].cond, &job_lanes[lane].mutex, &ts) != 0)
+            break;
+    }
+
+    pthread_mutex_unlock(&job_lanes[lane].mutex);
+#endif
+}
+
+
+static void _job_count(int *cnt, int *peak, int inc)
+/* updates a job counter and its peak */
+{
+    int v = __atomic_add_fetch(cnt, inc, __ATOMIC_RELAXED);
+    int p = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+    while (v > p && !__atomic_compare_exchange_n(peak, &p, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+static int _job_post(void *ptr, const xs_val *job, int lane)
+/* posts a pointer or a copy of a job to a lane; returns 0 if it's full */
+{
+    xs_val *j;
+
+    if (job_lanes[lane].slots == NULL)
+        return 0;
+
+    j = job ? xs_dup(job) : NULL;
+
+    if (!_job_ring_put(lane, ptr, j)) {
+        xs_free(j);
+        return 0;
+    }
+
+    _job_count(&p_state->job_fifo_size, &p_state->peak_job_fifo_size, 1);
+    _job_count(&p_state->lane_size[lane], &p_state->lane_peak[lane], 1);
+
+    /* ask for someone to attend it */
+    _job_lane_wake(lane);
+
+    return 1;
+}
+
+
+int job_post(const xs_val *job)
+/* posts a job for the threads to process it; returns 0 if its lane is full */
+{
+    return job != NULL ? _job_post(NULL, job, job_lane(job)) : 1;
+}
+
+
+int job_wait(int lane, void **ptr, xs_val **job, int secs)
+/* waits for an available job in the lane (for secs seconds at most,
+   if not 0); returns 0 if none arrived in that time */
+{
+    time_t limit = secs ? time(NULL) + secs : 0;
+    int got = 0;
+
+    *ptr = NULL;
+    *job = NULL;
+
+    while (!got && !(got = _job_ring_get(lane, ptr, job))) {
+        unsigned int event = __atomic_load_n(&job_lanes[lane].event, __ATOMIC_SEQ_CST);
+        int left = limit ? (int)(limit - time(NULL)) : 0;
+
+        if (limit && left <= 0)
+            return 0;
+
+        __atomic_add_fetch(&job_lanes[lane].waiters, 1, __ATOMIC_SEQ_CST);
+
+        /* check again, as a job may have been posted
+           before the producer could see this thread waiting */
+        if (!(got = _job_ring_get(lane, ptr, job)))
+            _job_lane_sleep(lane, event, left);
+
+        __atomic_sub_fetch(&job_lanes[lane].waiters, 1, __ATOMIC_SEQ_CST);
+    }
+
+    __atomic_sub_fetch(&p_state->job_fifo_size, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&p_state->lane_size[lane], 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+
+/** elastic thread pool **/
+
+/* each lane starts with its minimum number of threads; the pool thread
+   adds more when jobs have been waiting for too long, and the threads
+   that have been idle for a while leave, down to the minimum */
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int pool_live = 0;       /* job threads alive */
+static int pool_max  = 0;       /* maximum job threads among all lanes */
+
+
+static int _pool_shrink(int lane)
+/* tells if an idle thread can leave its lane */
+{
+    int cur = __atomic_load_n(&p_state->lane_threads[lane], __ATOMIC_SEQ_CST);
+
+    while (cur > p_state->lane_min_threads[lane]) {
+        if (__atomic_compare_exchange_n(&p_state->lane_threads[lane], &cur, cur - 1,
+                0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return 1;
+    }
+
+    return 0;
+}
+
+
+static void *job_thread(void *arg)
+/* job thread */
+{
+    int pid  = (int)(uintptr_t)arg;
+    int lane = p_state->th_lane[pid];
+    int idle = xs_number_get(xs_dict_get_def(srv_config, "thread_idle_seconds", "60"));
+
+    srv_debug(1, xs_fmt("job thread %d (%s) started", pid, job_lane_name(lane)));
+
+    for (;;) {
+        void *ptr = NULL;
+        xs *job   = NULL;
+
+        p_state->th_state[pid] = THST_WAIT;
+
+        if (!job_wait(lane, &ptr, &job, idle > 0 ? idle : 0)) {
+            /* idle for a while: leave, if there are more than enough */
+            if (_pool_shrink(lane)) {
+                srv_log(xs_fmt("thread pool: %s lane shrinks to %d threads",
+                    job_lane_name(lane), p_state->lane_threads[lane]));
+                break;
+            }
+
+            continue;
+        }
+
+        if (ptr != NULL) {
+            /* it's a connection */
+            p_state->th_state[pid] = THST_IN;
+
+#ifdef USE_EPOLL
+            /* it's a request already received by the front-end */
+            if (rx_active)
+                _rx_job((t_rx_job *)ptr);
+            else
+#endif
+                httpd_connection((FILE *)ptr);
+        }
+        else
+        if (job == NULL) /* corrupted message? */
+            continue;
+        else
+        if (xs_type(job) == XSTYPE_FALSE) /* special message: exit */
+            break;
+        else {
+            /* it's a q_item */
+            p_state->th_state[pid] = THST_QUEUE;
+
+            process_queue_item(job);
+        }
+    }
+
+    srv_debug(1, xs_fmt("job thread %d (%s) stopped", pid, job_lane_name(lane)));
+
+    /* free the slot */
+    pthread_mutex_lock(&pool_mutex);
+    p_state->th_state[pid] = THST_STOP;
+    __atomic_sub_fetch(&pool_live, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool_mutex);
+
+    return NULL;
+}
+
+
+static int _pool_spawn(int lane)
+/* starts a new thread for the lane; returns 0 if it's not possible */
+{
+    pthread_attr_t attr;
+    pthread_t th;
+    int pid, ret = 0;
+
+    pthread_mutex_lock(&pool_mutex);
+
+    /* find a free slot (#0 is the background thread) */
+    for (pid = 1; pid < MAX_THREADS && p_state->th_state[pid] != THST_STOP; pid++);
+
+    if (pid < MAX_THREADS) {
+        p_state->th_lane[pid]  = lane;
+        p_state->th_state[pid] = THST_WAIT;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        if (pthread_create(&th, &attr, job_thread, (void *)(uintptr_t)pid) == 0) {
+            if (pid >= p_state->n_threads)
+                p_state->n_threads = pid + 1;
+
+            __atomic_add_fetch(&p_state->lane_threads[lane], 1, __ATOMIC_SEQ_CST);
+            __atomic_add_fetch(&pool_live, 1, __ATOMIC_SEQ_CST);
+            ret = 1;
+        }
+        else
+            p_state->th_state[pid] = THST_STOP;
+
+        pthread_attr_destroy(&attr);
+    }
+
+    pthread_mutex_unlock(&pool_mutex);
+
+    return ret;
+}
+
+
+static void *pool_thread(void *arg)
+/* grows the lanes that have had too many jobs waiting for a while */
+{
+    int depth = xs_number_get(xs_dict_get_def(srv_config, "thread_grow_depth", "1"));
+    int secs  = xs_number_get(xs_dict_get_def(srv_config, "thread_grow_seconds", "2"));
+    long waiting[JOB_LANES] = {0};
+    int ticks = 0;
+
+    (void)arg;
+
+    if (depth < 1)
+        depth = 1;
+    if (secs < 1)
+        secs = 1;
+
+    while (p_state->srv_running) {
+        int l;
+
+        /* sample the lanes 10 times a second, as they drain in bursts */
+        usleep(100000);
+
+        for (l = 0; l < JOB_LANES; l++)
+            waiting[l] += p_state->lane_size[l];
+
+        if (++ticks < secs * 10)
+            continue;
+
+        for (l = 0; l < JOB_LANES; l++) {
+            int threads = p_state->lane_threads[l];
+            long avg    = waiting[l] / ticks;
+
+            if (avg > threads * depth && threads < p_state->lane_max_threads[l] &&
+                __atomic_load_n(&pool_live, __ATOMIC_SEQ_CST) < pool_max &&
+                _pool_spawn(l)) {
+                srv_log(xs_fmt("thread pool: %s lane grows to %d threads (%ld jobs waiting)",
+                    job_lane_name(l), p_state->lane_threads[l], avg));
+            }
+
+            waiting[l] = 0;
+        }
+
+        ticks = 0;
+    }
+
+    return NULL;
+}
+
+
+/* background thread sleep control */
+static pthread_mutex_t sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sleep_cond  = PTHREAD_COND_INITIALIZER;
+static int sleep_wake = 0;
+
+void background_wake(void)
+/* wakes up the background thread, as there is something to do */
+{
+    pthread_mutex_lock(&sleep_mutex);
+    sleep_wake = 1;
+    pthread_cond_signal(&sleep_cond);
+    pthread_mutex_unlock(&sleep_mutex);
+}
+
+
+static void *queue_watch_thread(void *arg)
+/* tells the scheduler about queue files as soon as they are written */
+{
+    (void)arg;
+
+    while (p_state->srv_running) {
+        if (queue_sched_watch(1000) == -1)
+            break;
+    }
+
+    return NULL;
+}
+
+
+static void *background_thread(void *arg)
+/* background thread (queue management and other things) */
+{
+    time_t purge_time;
+    time_t rescan_time = 0;
+    int rescan_secs = xs_number_get(xs_dict_get_def(srv_config, "queue_rescan_seconds", "30"));
+    int started = 0;
+
+    (void)arg;
+
+    if (rescan_secs < 1)
+        rescan_secs = 1;
+
+    /* first purge time */
+    purge_time = time(NULL) + 10 * 60;
+
+    srv_log(xs_fmt("background thread started"));
+
+    while (p_state->srv_running) {
+        time_t t, next;
+        int cnt = 0;
+
+        p_state->th_state[0] = THST_QUEUE;
+
+        if ((t = time(NULL)) >= rescan_time) {
+            /* pick up queue files from other processes
+               (and from new users, that are not watched yet) */
+            queue_sched_rescan();
+
+            if (!started) {
+                /* process scheduled posts for all users; from now on,
+                   the scheduler knows when the next ones are due */
+                xs *list = user_list();
+                const char *uid;
+
+                xs_list_foreach(list, uid) {
+                    snac snac;
+
+                    if (user_open(&snac, uid)) {
+                        scheduled_process(&snac);
+                        user_free(&snac);
+                    }
+                }
+
+                started = 1;
+            }
+
+            rescan_time = t + rescan_secs;
+        }
+
+        /* process the queue items that are due */
+        cnt += process_queues(&next);
+
+        /* time to purge? */
+        if ((t = time(NULL)) > purge_time) {
+            xs *q_item = xs_dict_new();
+            q_item = xs_dict_append(q_item, "type", "purge");
+
+            /* next purge time is tomorrow (if there was room for it) */
+            if (job_post(q_item))
+                purge_time = t + 24 * 60 * 60;
+        }
 
         if (cnt == 0) {
-            /* sleep 3 seconds */
+            /* sleep until the next queue item is due, the next rescan,
+               or until woken up by a new queue item */
+            time_t wake_time = rescan_time;
+
+            if (next && next < wake_time)
+                wake_time = next;
+
+            if (purge_time < wake_time)
+                wake_time = purge_time;
 
             p_state->th_state[0] = THST_WAIT;
 
 #ifdef USE_POLL_FOR_SLEEP
-            poll(NULL, 0, 3 * 1000);
+            if (wake_time > t)
+                poll(NULL, 0, (wake_time - t) * 1000);
 #else
-            struct timespec ts;
-
-            clock_gettime(CLOCK_REALTIME, &ts);
-            ts.tv_sec += 3;
+            struct timespec ts = { .tv_sec = wake_time, .tv_nsec = 0 };
 
             pthread_mutex_lock(&sleep_mutex);
-            while (pthread_cond_timedwait(&sleep_cond, &sleep_mutex, &ts) == 0);
+
+            while (!sleep_wake && p_state->srv_running &&
+                pthread_cond_timedwait(&sleep_cond, &sleep_mutex, &ts) == 0);
+
+            sleep_wake = 0;
+
             pthread_mutex_unlock(&sleep_mutex);
 #endif
         }
@@ -779,6 +2255,20 @@ void term_handler(int s)
 {
     (void)s;
 
+#ifdef USE_EPOLL
+    if (rx_active) {
+        /* just tell the event loop (no logging here, as this is a
+           signal handler; it also checks rx_stop every second) */
+        uint64_t one = 1;
+        ssize_t r;
+
+        rx_stop = 1;
+        r = write(rx_wake_fd, &one, sizeof(one));
+        (void)r;
+        return;
+    }
+#endif
+
     longjmp(on_break, 1);
 }
 
@@ -881,11 +2371,9 @@ void httpd(void)
     const char *port = NULL;
     xs *full_address = NULL;
     int rs;
-    pthread_t threads[MAX_THREADS] = {0};
+    pthread_t bg_thread, dlv_thread, pool_th, qw_thread;
     int n;
-    xs *sem_name = NULL;
     xs *shm_name = NULL;
-    sem_t anon_job_sem;
     xs *pidfile = xs_fmt("%s/server.pid", srv_basedir);
     int pidfd;
 
@@ -933,8 +2421,15 @@ void httpd(void)
 
     p_state->use_fcgi = xs_type(xs_dict_get(srv_config, "fastcgi")) == XSTYPE_TRUE;
 
+    httpd_routes();
+
     p_state->srv_running = 1;
 
+    /* keep outgoing connections open for reuse */
+    xs_http_pool_init(xs_number_get(xs_dict_get_def(srv_config, "http_max_connections", "16")),
+                      xs_number_get(xs_dict_get_def(srv_config, "http_max_idle_seconds", "30")),
+                      &p_state->http_requests, &p_state->http_reused);
+
     signal(SIGPIPE, SIG_IGN);
     signal(SIGTERM, term_handler);
     signal(SIGINT,  term_handler);
@@ -949,58 +2444,104 @@ void httpd(void)
                         (int) r.rlim_cur, (int) r.rlim_max));
 
     /* initialize the job control engine */
-    pthread_mutex_init(&job_mutex, NULL);
-    sem_name = xs_fmt("/job_%d", getpid());
-    job_sem = sem_open(sem_name, O_CREAT, 0644, 0);
-
-    if (job_sem == NULL) {
-        /* error opening a named semaphore; try with an anonymous one */
-        if (sem_init(&anon_job_sem, 0, 0) != -1)
-            job_sem = &anon_job_sem;
-    }
+    n = xs_number_get(xs_dict_get_def(srv_config, "job_queue_size", "4096"));
 
-    if (job_sem == NULL) {
-        srv_log(xs_fmt("fatal error: cannot create semaphore -- cannot continue"));
-        return;
-    }
+    for (int l = 0; l < JOB_LANES; l++)
+        _job_lane_init(l, n);
 
-    /* initialize sleep control */
-    pthread_mutex_init(&sleep_mutex, NULL);
-    pthread_cond_init(&sleep_cond, NULL);
-
-    p_state->n_threads = xs_number_get(xs_dict_get(srv_config, "num_threads"));
+    n = xs_number_get(xs_dict_get(srv_config, "num_threads"));
 
 #ifdef _SC_NPROCESSORS_ONLN
-    if (p_state->n_threads == 0) {
+    if (n == 0) {
         /* get number of CPUs on the machine */
-        p_state->n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        n = sysconf(_SC_NPROCESSORS_ONLN);
     }
 #endif
 
-    if (p_state->n_threads < 4)
-        p_state->n_threads = 4;
+    if (n < 4)
+        n = 4;
+
+    {
+        /* size the lanes (HTTP gets half of the threads, unless told otherwise);
+           these are the minimums, as the lanes grow under load */
+        const char *keys[] = { "http_threads", "input_threads", "output_threads", "maintenance_threads" };
+        int defs[] = { n / 2, n / 4, n / 4, 1 };
+        int min_total = 0;
+        int l;
+
+        for (l = 0; l < JOB_LANES; l++) {
+            int t = xs_number_get(xs_dict_get_def(srv_config, keys[l], "0"));
+
+            if (t < 1)
+                t = defs[l] < 1 ? 1 : defs[l];
+
+            /* thread #0 is the background thread */
+            if (min_total + t > MAX_THREADS - 1)
+                t = MAX_THREADS - 1 - min_total;
+
+            p_state->lane_min_threads[l] = t;
+            min_total += t;
+        }
+
+        pool_max = xs_number_get(xs_dict_get_def(srv_config, "max_threads", "0"));
+
+        if (pool_max <= 0)
+            pool_max = n * 4;
 
-    if (p_state->n_threads > MAX_THREADS)
-        p_state->n_threads = MAX_THREADS;
+        if (pool_max > MAX_THREADS - 1)
+            pool_max = MAX_THREADS - 1;
 
-    srv_debug(0, xs_fmt("using %d threads", p_state->n_threads));
+        if (pool_max < min_total)
+            pool_max = min_total;
+
+        /* the spare threads are available to any lane */
+        for (l = 0; l < JOB_LANES; l++)
+            p_state->lane_max_threads[l] = p_state->lane_min_threads[l] + pool_max - min_total;
+    }
 
     /* thread #0 is the background thread */
-    pthread_create(&threads[0], NULL, background_thread, NULL);
+    p_state->n_threads = 1;
+    p_state->th_state[0] = THST_WAIT;
+    pthread_create(&bg_thread, NULL, background_thread, NULL);
+
+    /* outbound deliveries have their own thread */
+    pthread_create(&dlv_thread, NULL, delivery_thread, NULL);
+
+    /* and so has the queue directory watcher */
+    pthread_create(&qw_thread, NULL, queue_watch_thread, NULL);
 
     /* the rest of threads are for job processing */
-    char *ptr = (char *) 0x1;
-    for (n = 1; n < p_state->n_threads; n++)
-        pthread_create(&threads[n], NULL, job_thread, ptr++);
+    for (int l = 0; l < JOB_LANES; l++) {
+        for (n = 0; n < p_state->lane_min_threads[l]; n++)
+            _pool_spawn(l);
+    }
+
+    srv_debug(0, xs_fmt("using %d threads (%d http, %d input, %d output, %d maintenance), up to %d",
+                pool_live + 1, p_state->lane_threads[JOB_LANE_HTTP],
+                p_state->lane_threads[JOB_LANE_INPUT], p_state->lane_threads[JOB_LANE_OUTPUT],
+                p_state->lane_threads[JOB_LANE_MAINT], pool_max + 1));
+
+    /* the pool thread grows the lanes when needed */
+    pthread_create(&pool_th, NULL, pool_thread, NULL);
+
+#ifdef USE_EPOLL
+    if ((rx_epfd = epoll_create1(EPOLL_CLOEXEC)) != -1 &&
+        (rx_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) != -1)
+        rx_active = 1;
 
-    if (setjmp(on_break) == 0) {
+    if (rx_active)
+        httpd_reactor(rs);
+#endif
+
+    if (!rx_active && setjmp(on_break) == 0) {
         for (;;) {
             int cs = xs_socket_accept(rs);
 
             if (cs != -1) {
                 FILE *f = fdopen(cs, "r+");
-                xs *job = xs_data_new(&f, sizeof(FILE *));
-                job_post(job, 1);
+
+                if (f != NULL && !_job_post(f, NULL, JOB_LANE_HTTP))
+                    fclose(f);
             }
             else
                 break;
@@ -1009,16 +2550,29 @@ void httpd(void)
 
     p_state->srv_running = 0;
 
+    /* don't let the background thread sleep any longer */
+    background_wake();
+
+    /* stop growing */
+    pthread_join(pool_th, NULL);
+
     /* send as many exit jobs as working threads */
-    for (n = 1; n < p_state->n_threads; n++)
-        job_post(xs_stock(XSTYPE_FALSE), 0);
+    for (int l = 0; l < JOB_LANES; l++) {
+        int t = __atomic_load_n(&p_state->lane_threads[l], __ATOMIC_SEQ_CST);
+
+        for (n = 0; n < t; n++) {
+            while (!_job_post(NULL, xs_stock(XSTYPE_FALSE), l))
+                usleep(10000);
+        }
+    }
 
-    /* wait for all the threads to exit */
-    for (n = 0; n < p_state->n_threads; n++)
-        pthread_join(threads[n], NULL);
+    /* wait for all the threads to exit (job threads are detached) */
+    while (__atomic_load_n(&pool_live, __ATOMIC_SEQ_CST) > 0)
+        usleep(10000);
 
-    sem_close(job_sem);
-    sem_unlink(sem_name);
+    pthread_join(bg_thread, NULL);
+    pthread_join(dlv_thread, NULL);
+    pthread_join(qw_thread, NULL);
 
     srv_state_op(&shm_name, 2);
 
@@ -22,6 +22,7 @@ int usage(void)
     printf("\n");
     printf("init [{basedir}]                     Initializes the data storage\n");
     printf("upgrade {basedir}                    Upgrade to a new version\n");
+    printf("convert {basedir} [json|binary]      Rewrites the stored data in a format\n");
     printf("adduser {basedir} [{uid}]            Adds a new user\n");
     printf("deluser {basedir} {uid}              Deletes a user\n");
     printf("httpd {basedir}                      Starts the HTTPD daemon\n");
@@ -118,6 +119,33 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (strcmp(cmd, "convert") == 0) { /** **/
+        const char *fmt = GET_ARGV();
+
+        if (fmt != NULL) {
+            if (strcmp(fmt, "json") != 0 && strcmp(fmt, "binary") != 0)
+                return usage();
+
+            /* store it, so that it's kept from now on */
+            xs *fn = xs_fmt("%s/server.json", srv_basedir);
+            FILE *f;
+
+            srv_config = xs_dict_set(srv_config, "object_format", fmt);
+
+            if ((f = fopen(fn, "w")) == NULL) {
+                srv_log(xs_fmt("cannot write %s", fn));
+                return 1;
+            }
+
+            xs_json_dump(srv_config, 4, f);
+            fclose(f);
+        }
+
+        data_convert();
+
+        return 0;
+    }
+
     if (strcmp(cmd, "adduser") == 0) { /** **/
         user = GET_ARGV();
 
@@ -154,8 +182,63 @@ int main(int argc, char *argv[])
         printf("job fifo size (peak): %d\n", ss.peak_job_fifo_size);
         char *th_states[] = { "stopped", "waiting", "input", "output" };
 
-        for (n = 0; n < ss.n_threads; n++)
-            printf("thread #%d state: %s\n", n, th_states[ss.th_state[n]]);
+        for (n = 0; n < JOB_LANES; n++)
+            printf("%s lane: %d threads (min %d, max %d), %d jobs waiting (peak %d)\n",
+                job_lane_name(n), ss.lane_threads[n], ss.lane_min_threads[n],
+                ss.lane_max_threads[n], ss.lane_size[n], ss.lane_peak[n]);
+
+        for (n = 0; n < ss.n_threads; n++) {
+            /* free slots of the elastic pool */
+            if (n > 0 && ss.th_state[n] == THST_STOP)
+                continue;
+
+            printf("thread #%d state: %s (%s)\n", n, th_states[ss.th_state[n]],
+                n == 0 ? "background" : job_lane_name(ss.th_lane[n]));
+        }
+
+        printf("index filter skips: %ld\n", ss.idx_filter_skip);
+        printf("index filter true positives: %ld\n", ss.idx_filter_true);
+        printf("index filter false positives: %ld\n", ss.idx_filter_false);
+
+        long lookups = ss.obj_cache_hits + ss.obj_cache_misses;
+        printf("object cache hits: %ld (%ld%%)\n", ss.obj_cache_hits,
+            lookups ? ss.obj_cache_hits * 100 / lookups : 0);
+        printf("object cache misses: %ld\n", ss.obj_cache_misses);
+        printf("object cache entries: %ld\n", ss.obj_cache_entries);
+        printf("object cache memory: %ld KB\n", ss.obj_cache_bytes / 1024);
+
+        printf("resident users: %ld\n", ss.user_table_entries);
+        printf("resident users memory: %ld KB (%ld bytes per user)\n", ss.user_table_bytes / 1024,
+            ss.user_table_entries ? ss.user_table_bytes / ss.user_table_entries : 0);
+
+        printf("deliveries in flight: %d\n", ss.dlv_in_flight);
+        printf("deliveries waiting: %d\n", ss.dlv_queued);
+        printf("deliveries waiting for a host probe: %d\n", ss.dlv_held);
+        printf("hosts down: %d\n", ss.hosts_down);
+
+        xs *hosts = host_health_report();
+        const char *h;
+
+        xs_list_foreach(hosts, h)
+            printf("host %s\n", h);
+
+        printf("outgoing requests: %ld (%ld%% over reused connections)\n", ss.http_requests,
+            ss.http_requests ? ss.http_reused * 100 / ss.http_requests : 0);
+
+        printf("incoming requests: %ld (%ld%% kept the connection open)\n", ss.http_in_requests,
+            ss.http_in_requests ? ss.http_in_kept * 100 / ss.http_in_requests : 0);
+        printf("incoming connections: %d (%ld KB buffered)\n", ss.rx_connections,
+            ss.rx_buffered / 1024);
+
+        for (n = 0; n < MAX_ROUTES; n++) {
+            xs *desc = httpd_route_desc(n);
+
+            if (desc == NULL)
+                break;
+
+            if (ss.route_hits[n])
+                printf("route %s: %ld requests\n", desc, ss.route_hits[n]);
+        }
 
         return 0;
     }
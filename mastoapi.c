@@ -45,7 +45,7 @@ int app_add(const char *id, const xs_dict *app)
     fn = xs_str_cat(fn, ".json");
 
     if ((f = fopen(fn, "w")) != NULL) {
-        xs_json_dump(app, 4, f);
+        xs_json_dump(app, data_json_indent(), f);
         fclose(f);
     }
     else
@@ -108,7 +108,7 @@ int token_add(const char *id, const xs_dict *token)
     fn = xs_str_cat(fn, ".json");
 
     if ((f = fopen(fn, "w")) != NULL) {
-        xs_json_dump(token, 4, f);
+        xs_json_dump(token, data_json_indent(), f);
         fclose(f);
     }
     else
@@ -411,7 +411,7 @@ int oauth_post_handler(const xs_dict *req, const char *q_path,
                 if (!xs_is_null(scope))
                     rsp = xs_dict_append(rsp, "scope", scope);
 
-                *body  = xs_json_dumps(rsp, 4);
+                *body  = xs_json_dumps(rsp, 0);
                 *ctype = "application/json";
                 status = HTTP_STATUS_OK;
 
@@ -1315,7 +1315,7 @@ void credentials_get(char **body, char **ctype, int *status, snac snac)
         acct = xs_dict_append(acct, "following_count", ni);
     }
 
-    *body = xs_json_dumps(acct, 4);
+    *body = xs_json_dumps(acct, 0);
     *ctype = "application/json";
     *status = HTTP_STATUS_OK;
 }
@@ -1324,7 +1324,7 @@ void credentials_get(char **body, char **ctype, int *status, snac snac)
 xs_list *mastoapi_timeline(snac *user, const xs_dict *args, const char *index_fn)
 {
     xs_list *out = xs_list_new();
-    FILE *f;
+    t_index idx;
     char md5[MD5_HEX_SIZE];
 
     if (dbglevel) {
@@ -1332,14 +1332,14 @@ xs_list *mastoapi_timeline(snac *user, const xs_dict *args, const char *index_fn
         srv_debug(1, xs_fmt("mastoapi_timeline args %s", js));
     }
 
-    if ((f = fopen(index_fn, "r")) == NULL)
+    if (!index_open(&idx, index_fn))
         return out;
 
     const char *max_id   = xs_dict_get(args, "max_id");
     const char *since_id = xs_dict_get(args, "since_id");
     const char *min_id   = xs_dict_get(args, "min_id"); /* unsupported old-to-new navigation */
     const char *limit_s  = xs_dict_get(args, "limit");
-    int (*iterator)(FILE *, char *);
+    int (*iterator)(t_index *, char *);
     int initial_status = 0;
     int ascending = 0;
     int limit = 0;
@@ -1353,12 +1353,20 @@ xs_list *mastoapi_timeline(snac *user, const xs_dict *args, const char *index_fn
 
     if (min_id) {
         iterator = &index_asc_next;
-        initial_status = index_asc_first(f, md5, MID_TO_MD5(min_id));
+        initial_status = index_asc_first(&idx, md5, MID_TO_MD5(min_id));
         ascending = 1;
     }
     else {
         iterator = &index_desc_next;
-        initial_status = index_desc_first(f, md5, 0);
+
+        if (max_id) {
+            /* jump to the entry right after max_id */
+            initial_status = index_seek(&idx, MID_TO_MD5(max_id)) &&
+                             index_desc_next(&idx, md5);
+            max_id = NULL;
+        }
+        else
+            initial_status = index_desc_first(&idx, md5, 0);
     }
 
     if (initial_status) {
@@ -1460,12 +1468,12 @@ xs_list *mastoapi_timeline(snac *user, const xs_dict *args, const char *index_fn
                 cnt++;
             }
 
-        } while ((cnt < limit) && (*iterator)(f, md5));
+        } while ((cnt < limit) && (*iterator)(&idx, md5));
     }
 
-    int more = index_desc_next(f, md5);
+    int more = index_desc_next(&idx, md5);
 
-    fclose(f);
+    index_close(&idx);
 
     srv_debug(1, xs_fmt("mastoapi_timeline ret %d%s", cnt, more ? " (+)" : ""));
 
@@ -1545,7 +1553,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
                     res = xs_list_append(res, rel);
             }
 
-            *body  = xs_json_dumps(res, 4);
+            *body  = xs_json_dumps(res, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
         }
@@ -1570,7 +1578,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
                     xs *actor = msg_actor(&user);
                     xs *macct = mastoapi_account(NULL, actor);
 
-                    *body  = xs_json_dumps(macct, 4);
+                    *body  = xs_json_dumps(macct, 0);
                     *ctype = "application/json";
                     status = HTTP_STATUS_OK;
 
@@ -1748,7 +1756,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
             }
 
             if (out != NULL) {
-                *body  = xs_json_dumps(out, 4);
+                *body  = xs_json_dumps(out, 0);
                 *ctype = "application/json";
                 status = HTTP_STATUS_OK;
             }
@@ -1763,7 +1771,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
 
             *link = timeline_link_header("/api/v1/timelines/home", out);
 
-            *body  = xs_json_dumps(out, 4);
+            *body  = xs_json_dumps(out, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
 
@@ -1779,7 +1787,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
         xs *ifn = instance_index_fn();
         xs *out = mastoapi_timeline(NULL, args, ifn);
 
-        *body  = xs_json_dumps(out, 4);
+        *body  = xs_json_dumps(out, 0);
         *ctype = "application/json";
         status = HTTP_STATUS_OK;
     }
@@ -1792,7 +1800,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
         xs *ifn = tag_fn(tag);
         xs *out = mastoapi_timeline(NULL, args, ifn);
 
-        *body  = xs_json_dumps(out, 4);
+        *body  = xs_json_dumps(out, 0);
         *ctype = "application/json";
         status = HTTP_STATUS_OK;
     }
@@ -1806,7 +1814,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
             xs *ifn = list_timeline_fn(&snac1, list);
             xs *out = mastoapi_timeline(NULL, args, ifn);
 
-            *body  = xs_json_dumps(out, 4);
+            *body  = xs_json_dumps(out, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
         }
@@ -1929,7 +1937,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
 
             srv_debug(1, xs_fmt("mastoapi_notifications count %d", xs_list_len(out)));
 
-            *body  = xs_json_dumps(out, 4);
+            *body  = xs_json_dumps(out, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
         }
@@ -1965,7 +1973,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
             xs *ifn = bookmark_index_fn(&snac1);
             xs *out = mastoapi_timeline(&snac1, args, ifn);
 
-            *body  = xs_json_dumps(out, 4);
+            *body  = xs_json_dumps(out, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
         }
@@ -1991,7 +1999,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
                 l = xs_list_append(l, d);
             }
 
-            *body  = xs_json_dumps(l, 4);
+            *body  = xs_json_dumps(l, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
         }
@@ -2023,7 +2031,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
                             }
                         }
 
-                        *body  = xs_json_dumps(out, 4);
+                        *body  = xs_json_dumps(out, 0);
                         *ctype = "application/json";
                         status = HTTP_STATUS_OK;
                     }
@@ -2051,7 +2059,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
                         }
                     }
 
-                    *body  = xs_json_dumps(out, 4);
+                    *body  = xs_json_dumps(out, 0);
                     *ctype = "application/json";
                     status = HTTP_STATUS_OK;
                 }
@@ -2109,7 +2117,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
                 resp = xs_list_append(resp, an);
             }
 
-            *body  = xs_json_dumps(resp, 4);
+            *body  = xs_json_dumps(resp, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
         }
@@ -2251,7 +2259,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
             }
         }
 
-        *body  = xs_json_dumps(ins, 4);
+        *body  = xs_json_dumps(ins, 0);
         *ctype = "application/json";
         status = HTTP_STATUS_OK;
     }
@@ -2270,7 +2278,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
                 peers = xs_list_append(peers, domain);
         }
 
-        *body  = xs_json_dumps(peers, 4);
+        *body  = xs_json_dumps(peers, 0);
         *ctype = "application/json";
         status = HTTP_STATUS_OK;
     }
@@ -2383,7 +2391,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
                     srv_debug(1, xs_fmt("mastoapi status: bad id %s", id));
 
                 if (out != NULL) {
-                    *body  = xs_json_dumps(out, 4);
+                    *body  = xs_json_dumps(out, 0);
                     *ctype = "application/json";
                     status = HTTP_STATUS_OK;
                 }
@@ -2404,7 +2412,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
             const xs_list *timeline = xs_dict_get(args, "timeline[]");
             xs_str *json = NULL;
             if (!xs_is_null(timeline)) 
-                json = xs_json_dumps(markers_get(&snac1, timeline), 4);
+                json = xs_json_dumps(markers_get(&snac1, timeline), 0);
 
             if (!xs_is_null(json))
                 *body = json;
@@ -2544,7 +2552,7 @@ int mastoapi_get_handler(const xs_dict *req, const char *q_path,
             res = xs_dict_append(res, "statuses", stl);
             res = xs_dict_append(res, "hashtags", htl);
 
-            *body  = xs_json_dumps(res, 4);
+            *body  = xs_json_dumps(res, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
         }
@@ -2639,7 +2647,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
             app = xs_dict_append(app, "vapid_key",     vkey);
             app = xs_dict_append(app, "id",            id);
 
-            *body  = xs_json_dumps(app, 4);
+            *body  = xs_json_dumps(app, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
 
@@ -2748,7 +2756,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
             /* convert to a mastodon status as a response code */
             xs *st = mastoapi_status(&snac, msg);
 
-            *body  = xs_json_dumps(st, 4);
+            *body  = xs_json_dumps(st, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
         }
@@ -2857,7 +2865,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
                 }
 
                 if (out != NULL) {
-                    *body  = xs_json_dumps(out, 4);
+                    *body  = xs_json_dumps(out, 0);
                     *ctype = "application/json";
                     status = HTTP_STATUS_OK;
                 }
@@ -2900,7 +2908,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
             xs *server_key = random_str();
             wpush = xs_dict_append(wpush, "server_key", server_key);
 
-            *body  = xs_json_dumps(wpush, 4);
+            *body  = xs_json_dumps(wpush, 0);
             *ctype = "application/json";
             status = HTTP_STATUS_OK;
         }
@@ -2943,7 +2951,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
                     rsp = xs_dict_append(rsp, "remote_url",  url);
                     rsp = xs_dict_append(rsp, "description", desc);
 
-                    *body  = xs_json_dumps(rsp, 4);
+                    *body  = xs_json_dumps(rsp, 0);
                     *ctype = "application/json";
                     status = HTTP_STATUS_OK;
                 }
@@ -3028,7 +3036,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
             }
 
             if (rsp != NULL) {
-                *body  = xs_json_dumps(rsp, 4);
+                *body  = xs_json_dumps(rsp, 0);
                 *ctype = "application/json";
                 status = HTTP_STATUS_OK;
             }
@@ -3094,7 +3102,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
                 }
 
                 if (out != NULL) {
-                    *body  = xs_json_dumps(out, 4);
+                    *body  = xs_json_dumps(out, 0);
                     *ctype = "application/json";
                     status = HTTP_STATUS_OK;
                 }
@@ -3126,7 +3134,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
                     status = HTTP_STATUS_UNPROCESSABLE_CONTENT;
                 }
 
-                *body  = xs_json_dumps(out, 4);
+                *body  = xs_json_dumps(out, 0);
                 *ctype = "application/json";
             }
             else
@@ -3155,7 +3163,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
                     }
 
                     xs *out = xs_dict_new();
-                    *body   = xs_json_dumps(out, 4);
+                    *body   = xs_json_dumps(out, 0);
                     *ctype  = "application/json";
                     status  = HTTP_STATUS_OK;
                 }
@@ -3178,7 +3186,7 @@ int mastoapi_post_handler(const xs_dict *req, const char *q_path,
                 if (!xs_is_null(notify))
                     notify_marker = xs_dict_get(notify, "last_read_id");
             }
-            json = xs_json_dumps(markers_set(&snac, home_marker, notify_marker), 4);
+            json = xs_json_dumps(markers_set(&snac, home_marker, notify_marker), 0);
         }
         if (!xs_is_null(json))
             *body = json;
@@ -3341,7 +3349,7 @@ int mastoapi_put_handler(const xs_dict *req, const char *q_path,
                 rsp = xs_dict_append(rsp, "remote_url",  url);
                 rsp = xs_dict_append(rsp, "description", desc);
 
-                *body  = xs_json_dumps(rsp, 4);
+                *body  = xs_json_dumps(rsp, 0);
                 *ctype = "application/json";
                 status = HTTP_STATUS_OK;
             }
@@ -3384,7 +3392,7 @@ int mastoapi_put_handler(const xs_dict *req, const char *q_path,
                 }
 
                 if (rsp != NULL) {
-                    *body  = xs_json_dumps(rsp, 4);
+                    *body  = xs_json_dumps(rsp, 0);
                     *ctype = "application/json";
                     status = HTTP_STATUS_OK;
                 }
@@ -5,6 +5,7 @@
 
 #include "xs.h"
 #include "xs_hex.h"
+#include "xs_bin.h"
 #include "xs_io.h"
 #include "xs_unicode_tbl.h"
 #include "xs_unicode.h"
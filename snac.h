@@ -16,6 +16,10 @@
 #define MAX_THREADS 256
 #endif
 
+#ifndef MAX_ROUTES
+#define MAX_ROUTES 64
+#endif
+
 #ifndef MAX_JSON_DEPTH
 #define MAX_JSON_DEPTH 8
 #endif
@@ -28,6 +32,11 @@
 
 #define MD5_ALREADY_SEEN_MARK "00000000000000000000000000000000"
 
+#define INDEX_MAGIC "SNACIDX"   /* binary index magic (8 bytes with the null) */
+#define INDEX_VERSION 1
+#define INDEX_HDR_SIZE 16
+#define INDEX_REC_SIZE 16
+
 extern double disk_layout;
 extern xs_str *srv_basedir;
 extern xs_dict *srv_config;
@@ -64,6 +73,9 @@ typedef struct {
     const char *tz;     /* configured timezone */
 } snac;
 
+/* job lanes, each one with its own threads */
+enum { JOB_LANE_HTTP, JOB_LANE_INPUT, JOB_LANE_OUTPUT, JOB_LANE_MAINT, JOB_LANES };
+
 typedef struct {
     int s_size;             /* struct size (for double checking) */
     int srv_running;        /* server running on/off */
@@ -73,6 +85,32 @@ typedef struct {
     int peak_job_fifo_size; /* maximum job fifo size seen */
     int n_threads;          /* number of configured threads */
     enum { THST_STOP, THST_WAIT, THST_IN, THST_QUEUE } th_state[MAX_THREADS];
+    int th_lane[MAX_THREADS]; /* lane served by each thread */
+    int lane_threads[JOB_LANES]; /* threads by lane */
+    int lane_min_threads[JOB_LANES]; /* minimum threads by lane */
+    int lane_max_threads[JOB_LANES]; /* maximum threads by lane */
+    int lane_size[JOB_LANES]; /* jobs waiting by lane */
+    int lane_peak[JOB_LANES]; /* peak of jobs waiting by lane */
+    long idx_filter_skip;   /* index lookups answered by the filter */
+    long idx_filter_true;   /* filter positives found in the index */
+    long idx_filter_false;  /* filter false positives */
+    long obj_cache_hits;    /* object cache hits */
+    long obj_cache_misses;  /* object cache misses */
+    long obj_cache_entries; /* objects in the cache */
+    long obj_cache_bytes;   /* memory used by the object cache */
+    long user_table_entries; /* users in the resident table */
+    long user_table_bytes;  /* memory used by the resident user table */
+    int dlv_in_flight;      /* deliveries in progress */
+    int dlv_queued;         /* deliveries waiting to be started */
+    int dlv_held;           /* deliveries waiting for a host probe */
+    int hosts_down;         /* hosts with an open breaker */
+    long http_requests;     /* outgoing HTTP requests */
+    long http_reused;       /* outgoing HTTP requests over reused connections */
+    long http_in_requests;  /* incoming HTTP requests */
+    long http_in_kept;      /* incoming HTTP requests that kept the connection open */
+    int rx_connections;     /* connections held by the front-end */
+    long rx_buffered;       /* bytes buffered by the front-end */
+    long route_hits[MAX_ROUTES]; /* incoming requests by route */
 } srv_state;
 
 extern srv_state *p_state;
@@ -88,6 +126,8 @@ void sbox_enter(const char *basedir);
 
 int user_open(snac *snac, const char *uid);
 void user_free(snac *snac);
+void user_table_del(const char *uid);
+void user_map_reset(void);
 xs_list *user_list(void);
 int user_open_by_md5(snac *snac, const char *md5);
 int user_persist(snac *snac, int publish);
@@ -109,16 +149,43 @@ double mtime_nl(const char *fn, int *n_link);
 #define mtime(fn) mtime_nl(fn, NULL)
 double f_ctime(const char *fn);
 
+int data_binary(void);
+int data_convert(void);
+int data_json_indent(void);
+xs_val *data_loads(const char *data, int size);
+xs_val *data_load(FILE *f);
+xs_data *data_dumps(const xs_val *v, int *size);
+int data_dump(const xs_val *v, FILE *f);
+
+typedef struct {
+    const char *fn;     /* file name */
+    ino_t ino;          /* inode (to validate position maps) */
+    const char *data;   /* mapped index file */
+    size_t size;        /* size of the mapping */
+    int binary;         /* binary (1) or text (0) format */
+    size_t hdr_size;    /* header size */
+    size_t rec_size;    /* record size */
+    long n_recs;        /* number of records */
+    long pos;           /* iterator position */
+} t_index;
+
+void index_header(char hdr[INDEX_HDR_SIZE]);
+int index_open(t_index *idx, const char *fn);
+void index_close(t_index *idx);
+int index_unlink(const char *fn);
 int index_add_md5(const char *fn, const char *md5);
 int index_add(const char *fn, const char *id);
+int index_del_md5(const char *fn, const char *md5);
 int index_gc(const char *fn);
+int index_in_md5(const char *fn, const char *md5);
 int index_first(const char *fn, char md5[MD5_HEX_SIZE]);
 int index_len(const char *fn);
 xs_list *index_list(const char *fn, int max);
-int index_desc_next(FILE *f, char md5[MD5_HEX_SIZE]);
-int index_desc_first(FILE *f, char md5[MD5_HEX_SIZE], int skip);
-int index_asc_next(FILE *f, char md5[MD5_HEX_SIZE]);
-int index_asc_first(FILE *f, char md5[MD5_HEX_SIZE], const char *seek_md5);
+int index_desc_next(t_index *idx, char md5[MD5_HEX_SIZE]);
+int index_desc_first(t_index *idx, char md5[MD5_HEX_SIZE], int skip);
+int index_asc_next(t_index *idx, char md5[MD5_HEX_SIZE]);
+int index_asc_first(t_index *idx, char md5[MD5_HEX_SIZE], const char *seek_md5);
+int index_seek(t_index *idx, const char *md5);
 xs_list *index_list_desc(const char *fn, int skip, int show);
 
 int object_add(const char *id, const xs_dict *obj);
@@ -134,6 +201,12 @@ double object_ctime(const char *id);
 double object_mtime_by_md5(const char *md5);
 double object_mtime(const char *id);
 void object_touch(const char *id);
+void object_cache_del(const char *md5);
+
+int object_store_is_seg(void);
+int object_store_ready(void);
+int object_store_put_raw(const char *md5, char kind, const char *data, int size, double mtime);
+int object_store_compact(void);
 
 int object_admire(const char *id, const char *actor, int like);
 int object_unadmire(const char *id, const char *actor, int like);
@@ -184,6 +257,10 @@ int following_check(snac *snac, const char *actor);
 int following_get(snac *snac, const char *actor, xs_dict **data);
 xs_list *following_list(snac *snac);
 
+void rfollow_add(snac *user, const char *key);
+void rfollow_del(snac *user, const char *key);
+xs_list *rfollow_list(const char *key);
+
 void mute(snac *snac, const char *actor);
 void unmute(snac *snac, const char *actor);
 int is_muted(snac *snac, const char *actor);
@@ -272,13 +349,20 @@ int content_match(const char *file, const xs_dict *msg);
 xs_list *content_search(snac *user, const char *regex,
             int priv, int skip, int show, int max_secs, int *timeout);
 
+xs_str *payload_put(const xs_dict *msg);
+xs_dict *payload_get(const char *pid);
+int output_body(const xs_dict *q_item, xs_str **body, xs_str **digest);
+
 void enqueue_input(snac *snac, const xs_dict *msg, const xs_dict *req, int retries);
 void enqueue_shared_input(const xs_dict *msg, const xs_dict *req, int retries);
+void enqueue_delayed(const xs_dict *q_item, int secs);
 void enqueue_output_raw(const char *keyid, const char *seckey,
                         const xs_dict *msg, const xs_str *inbox,
                         int retries, int p_status);
 void enqueue_output(snac *snac, const xs_dict *msg,
                     const xs_str *inbox, int retries, int p_status);
+void enqueue_output_payload(const char *keyid, const char *pid,
+                            const xs_str *inbox, int retries, int p_status);
 void enqueue_output_by_actor(snac *snac, const xs_dict *msg,
                              const xs_str *actor, int retries);
 void enqueue_email(const xs_str *msg, int retries);
@@ -296,9 +380,30 @@ xs_list *queue(void);
 xs_dict *queue_get(const char *fn);
 xs_dict *dequeue(const char *fn);
 
+void queue_sched_rescan(void);
+void queue_sched_add(const char *fn);
+void queue_sched_at(const char *fn, time_t due);
+int queue_sched_watch(int msecs);
+xs_list *queue_sched_due(time_t *next);
+
 void purge(snac *snac);
 void purge_all(void);
 
+void signing_key_add(const char *key_id, const char *secret);
+void signing_key_del(const char *key_id);
+xs_dict *http_signed_headers(const char *keyid, const char *seckey,
+                            const char *method, const char *url,
+                            const xs_dict *headers,
+                            const char *body, int b_size, const char *digest);
+enum { HOST_SEND, HOST_PROBE, HOST_HOLD, HOST_PARK };
+int host_health_admit(const char *url, int timeout, int *wait);
+void host_health_update(const char *url, int status, double secs);
+int host_health_outage(const char *url);
+void host_health_flush(void);
+xs_list *host_health_report(void);
+int delivery_add(const xs_dict *q_item, int timeout);
+void delivery_park(const xs_dict *q_item, int wait);
+void *delivery_thread(void *arg);
 xs_dict *http_signed_request_raw(const char *keyid, const char *seckey,
                             const char *method, const char *url,
                             const xs_dict *headers,
@@ -311,9 +416,12 @@ xs_dict *http_signed_request(snac *snac, const char *method, const char *url,
                             int *status, xs_str **payload, int *p_size,
                             int timeout);
 int check_signature(const xs_dict *req, xs_str **err);
+void key_cache_del(const char *key_id);
 
 srv_state *srv_state_op(xs_str **fname, int op);
 void httpd(void);
+xs_str *httpd_route_desc(int n);
+void background_wake(void);
 
 int webfinger_request_signed(snac *snac, const char *qs, xs_str **actor, xs_str **user);
 int webfinger_request(const char *qs, xs_str **actor, xs_str **user);
@@ -352,7 +460,7 @@ xs_dict *msg_question(snac *user, const char *content, xs_list *attach,
 int activitypub_request(snac *snac, const char *url, xs_dict **data);
 int actor_request(snac *user, const char *actor, xs_dict **data);
 int send_to_inbox_raw(const char *keyid, const char *seckey,
-                  const xs_str *inbox, const xs_dict *msg,
+                  const xs_str *inbox, const char *body, const char *digest,
                   xs_val **payload, int *p_size, int timeout);
 int send_to_inbox(snac *snac, const xs_str *inbox, const xs_dict *msg,
                   xs_val **payload, int *p_size, int timeout);
@@ -361,15 +469,19 @@ int send_to_actor(snac *snac, const char *actor, const xs_dict *msg,
                   xs_val **payload, int *p_size, int timeout);
 int is_msg_public(const xs_dict *msg);
 int is_msg_from_private_user(const xs_dict *msg);
+xs_list *shared_inbox_users(const xs_dict *c_msg);
 int is_msg_for_me(snac *snac, const xs_dict *msg);
 
 int process_user_queue(snac *snac);
+void output_result(const xs_dict *q_item, int status,
+                   const char *payload, int p_size, double secs);
 void process_queue_item(xs_dict *q_item);
 int process_queue(void);
+int process_queues(time_t *next);
 
-int activitypub_get_handler(const xs_dict *req, const char *q_path,
+int activitypub_get_handler(const xs_dict *req, const char *q_path, snac *user,
                             char **body, int *b_size, char **ctype);
-int activitypub_post_handler(const xs_dict *req, const char *q_path,
+int activitypub_post_handler(const xs_dict *req, const char *q_path, snac *user,
                              char *payload, int p_size,
                              char **body, int *b_size, char **ctype);
 
@@ -382,11 +494,11 @@ xs_str *html_timeline(snac *user, const xs_list *list, int read_only,
                       int skip, int show, int show_more,
                       const char *title, const char *page, int utl, const char *error);
 
-int html_get_handler(const xs_dict *req, const char *q_path,
+int html_get_handler(const xs_dict *req, const char *q_path, snac *user,
                      char **body, int *b_size, char **ctype,
                      xs_str **etag, xs_str **last_modified);
 
-int html_post_handler(const xs_dict *req, const char *q_path,
+int html_post_handler(const xs_dict *req, const char *q_path, snac *user,
                       char *payload, int p_size,
                       char **body, int *b_size, char **ctype);
 xs_str *timeline_to_rss(snac *user, const xs_list *timeline,
@@ -400,8 +512,9 @@ int deluser(snac *user);
 
 extern const char *snac_blurb;
 
-void job_post(const xs_val *job, int urgent);
-void job_wait(xs_val **job);
+int job_post(const xs_val *job);
+int job_wait(int lane, void **ptr, xs_val **job, int secs);
+const char *job_lane_name(int lane);
 
 int oauth_get_handler(const xs_dict *req, const char *q_path,
                       char **body, int *b_size, char **ctype);
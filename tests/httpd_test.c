@@ -0,0 +1,288 @@
+/* copyright (c) 2022 - 2025 grunfink et al. / MIT license */
+
+/* request framing in the built-in httpd: keep-alive, pipelining and
+   the refusal of requests that can't be delimited without doubt */
+
+#include "../xs.h"
+#include "../xs_json.h"
+#include "../xs_httpd.h"
+#include "../snac.h"
+
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define _SNAC_TEST_SRV
+#include "test.h"
+
+static int port = 0;
+
+/* requests whose end can't be told without doubt; the GET after
+   them must never be answered */
+static const char *bad_framing[] = {
+    "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nContent-Type: application/activity+json\r\n"
+    "Transfer-Encoding: chunked\r\nContent-Length: 4\r\n\r\n0\r\n\r\n",
+    "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n",
+    "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nContent-Length: 2\r\nContent-Length: 40\r\n\r\n{}",
+    "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nContent-Length: 2\r\nContent-Length: 2\r\n\r\n{}",
+    "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nContent-Length: 2x\r\n\r\n{}",
+    "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nContent-Length : 2\r\n\r\n{}",
+    "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nContent-Length\t: 2\r\n\r\n{}",
+    "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nTransfer-Encoding : chunked\r\n\r\n0\r\n\r\n",
+    "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nX-Foo: bar\r\n Content-Length: 2\r\n\r\n{}",
+    NULL
+};
+
+
+static int free_port(void)
+/* gets a free TCP port */
+{
+    struct sockaddr_in a = {0};
+    socklen_t l = sizeof(a);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int p = 0;
+
+    a.sin_family      = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr *)&a, sizeof(a)) == 0 &&
+        getsockname(fd, (struct sockaddr *)&a, &l) == 0)
+        p = ntohs(a.sin_port);
+
+    close(fd);
+
+    return p;
+}
+
+
+static int conn(void)
+/* connects to the server */
+{
+    struct sockaddr_in a = {0};
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    a.sin_family      = AF_INET;
+    a.sin_port        = htons(port);
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *)&a, sizeof(a)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static xs_str *talk(const char *req, int msecs, int *closed)
+/* sends a request (or several) and collects what comes back, until
+   the connection is closed or nothing arrives for msecs */
+{
+    xs_str *out = xs_str_new(NULL);
+    int fd = conn();
+
+    *closed = 0;
+
+    if (fd == -1)
+        return out;
+
+    if (write(fd, req, strlen(req)) != (ssize_t)strlen(req)) {
+        close(fd);
+        return out;
+    }
+
+    for (;;) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        char buf[4096];
+        ssize_t n;
+
+        if (poll(&pfd, 1, msecs) <= 0)
+            break;
+
+        if ((n = read(fd, buf, sizeof(buf) - 1)) <= 0) {
+            *closed = 1;
+            break;
+        }
+
+        buf[n] = '\0';
+        out = xs_str_cat(out, buf);
+    }
+
+    close(fd);
+
+    return out;
+}
+
+
+static xs_str *statuses(const char *out)
+/* returns the status codes of the responses, space separated; each
+   response must be delimited by its content length */
+{
+    xs_str *s = xs_str_new(NULL);
+    const char *p = out;
+
+    while (strncmp(p, "HTTP/1.", 7) == 0 && strlen(p) > 12) {
+        const char *e = strstr(p, "\r\n\r\n");
+        const char *cl = strstr(p, "content-length: ");
+
+        xs *c = xs_fmt("%s%.3s", *s ? " " : "", p + 9);
+        s = xs_str_cat(s, c);
+
+        if (e == NULL || cl == NULL || cl > e)
+            break;
+
+        p = e + 4 + atoi(cl + 16);
+    }
+
+    if (*p) {
+        /* garbage after the last response */
+        s = xs_str_cat(s, " ?");
+    }
+
+    return s;
+}
+
+
+static void check(const char *req, const char *exp, const char *exp2, int exp_closed)
+/* checks the statuses of the responses and whether the connection was closed */
+{
+    int closed;
+    xs *out = talk(req, 1000, &closed);
+    xs *st  = statuses(out);
+    int ok  = (strcmp(st, exp) == 0 || (exp2 && strcmp(st, exp2) == 0)) && closed == exp_closed;
+
+    if (!ok)
+        fprintf(stderr, "got '%s'%s for:\n%s\n", st, closed ? " (closed)" : "", req);
+
+    TEST(ok);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *snac_bin = argc > 1 ? argv[1] : "./snac";
+
+    if ((port = free_port()) == 0) {
+        TEST(!"cannot get a port");
+        return test_end("httpd");
+    }
+
+    xs *cfg = xs_dict_new();
+    xs *p   = xs_number_new(port);
+    cfg = xs_dict_set(cfg, "port", p);
+
+    if (!test_srv_open(cfg)) {
+        TEST(!"cannot open the server");
+        return test_end("httpd");
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+
+        dup2(fd, 1);
+        dup2(fd, 2);
+
+        execl(snac_bin, snac_bin, "httpd", srv_basedir, NULL);
+        _exit(1);
+    }
+
+    /* wait for the server to be up */
+    int fd = -1;
+    int n;
+
+    for (n = 0; n < 100 && (fd = conn()) == -1; n++)
+        usleep(50000);
+
+    TEST(fd != -1);
+
+    if (fd != -1) {
+        close(fd);
+
+        const char *get  = "GET /.well-known/nodeinfo HTTP/1.1\r\nHost: x\r\n\r\n";
+        const char *get2 = "GET /.well-known/host-meta HTTP/1.1\r\nHost: x\r\n\r\n";
+
+        /* one request, the connection is kept */
+        check(get, "200", NULL, 0);
+
+        {
+            /* pipelined requests, answered in order */
+            xs *req = xs_fmt("%s%s%s", get, get2, get);
+            int closed;
+            xs *out = talk(req, 1000, &closed);
+            xs *st  = statuses(out);
+            const char *j = strstr(out, "application/json");
+            const char *x = strstr(out, "<XRD");
+
+            TEST(strcmp(st, "200 200 200") == 0 && !closed);
+            TEST(j != NULL && x != NULL && j < x && strstr(x, "application/json") != NULL);
+        }
+
+        /* a request with a body, followed by another */
+        check("POST /shared-inbox HTTP/1.1\r\nHost: x\r\nContent-Type: text/plain\r\n"
+              "Content-Length: 2\r\n\r\n{}"
+              "GET /.well-known/nodeinfo HTTP/1.1\r\nHost: x\r\n\r\n", "404 200", NULL, 0);
+
+        /* the client asks to close */
+        check("GET /.well-known/nodeinfo HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n"
+              "GET /.well-known/nodeinfo HTTP/1.1\r\nHost: x\r\n\r\n", "200", NULL, 1);
+
+        /* HTTP/1.0 closes by default */
+        check("GET /.well-known/nodeinfo HTTP/1.0\r\nHost: x\r\n\r\n", "200", NULL, 1);
+
+        /* requests that can't be delimited are refused, and nothing after them is read */
+        for (n = 0; bad_framing[n] != NULL; n++) {
+            xs *req = xs_fmt("%s%s", bad_framing[n], get);
+            check(req, "400", NULL, 1);
+        }
+    }
+
+    /* the parser of the threaded front end refuses the same requests */
+    for (n = 0; bad_framing[n] != NULL; n++) {
+        FILE *f = fmemopen((void *)bad_framing[n], strlen(bad_framing[n]), "r");
+        xs *payload = NULL;
+        int p_size = 0;
+
+        xs *req = xs_httpd_request(f, &payload, &p_size);
+        int ok = req == NULL && errno == EINVAL;
+
+        if (!ok)
+            fprintf(stderr, "xs_httpd_request accepted:\n%s\n", bad_framing[n]);
+
+        TEST(ok);
+        fclose(f);
+    }
+
+    {
+        /* and accepts a good one */
+        const char *good = "POST /shared-inbox HTTP/1.1\r\nHost: x\r\nContent-Length: 2\r\n\r\n{}";
+        FILE *f = fmemopen((void *)good, strlen(good), "r");
+        xs *payload = NULL;
+        int p_size = 0;
+
+        xs *req = xs_httpd_request(f, &payload, &p_size);
+
+        TEST(req != NULL && p_size == 2 && strcmp(xs_dict_get_def(req, "content-length", ""), "2") == 0);
+        fclose(f);
+    }
+
+    /* stop the server */
+    int status;
+
+    kill(pid, SIGTERM);
+
+    for (n = 0; n < 100 && waitpid(pid, &status, WNOHANG) == 0; n++)
+        usleep(50000);
+
+    if (n == 100) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+
+    return test_end("httpd");
+}
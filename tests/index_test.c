@@ -0,0 +1,209 @@
+/* copyright (c) 2022 - 2025 grunfink et al. / MIT license */
+
+/* binary and text indexes: records, membership, order and deletions */
+
+#include "../xs.h"
+#include "../xs_json.h"
+#include "../xs_openssl.h"
+#include "../snac.h"
+
+#include <sys/stat.h>
+
+#define _SNAC_TEST_SRV
+#include "test.h"
+
+#define N_RECS 300
+
+
+static xs_str *md5_n(const char *pfx, int n)
+{
+    xs *s = xs_fmt("%s%d", pfx, n);
+    return xs_md5_hex(s, strlen(s));
+}
+
+
+int main(void)
+{
+    xs *cfg = xs_dict_new();
+    int n;
+
+    if (!test_srv_open(cfg)) {
+        TEST(!"cannot open the server");
+        return test_end("index");
+    }
+
+    /* binary index, big enough to have a filter and a position map */
+    xs *fn = xs_fmt("%s/test.idx", srv_basedir);
+
+    for (n = 0; n < N_RECS; n++) {
+        xs *md5 = md5_n("in", n);
+        TEST(index_add_md5(fn, md5) == HTTP_STATUS_CREATED);
+    }
+
+    {
+        char hdr[INDEX_HDR_SIZE], f_hdr[INDEX_HDR_SIZE] = {0};
+        struct stat st;
+        FILE *f;
+
+        index_header(hdr);
+
+        if ((f = fopen(fn, "r")) != NULL) {
+            TEST(fread(f_hdr, sizeof(f_hdr), 1, f) == 1);
+            fclose(f);
+        }
+
+        TEST(memcmp(hdr, f_hdr, INDEX_HDR_SIZE) == 0);
+
+        /* version and record size are little-endian */
+        TEST(memcmp(hdr, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0);
+        TEST(memcmp(hdr + 8, "\x01\0\0\0\x10\0\0\0", 8) == 0);
+        TEST(stat(fn, &st) == 0 && st.st_size == INDEX_HDR_SIZE + N_RECS * INDEX_REC_SIZE);
+    }
+
+    TEST(index_len(fn) == N_RECS);
+
+    /* md5s that are not valid are never written */
+    TEST(index_add_md5(fn, "not an md5") == HTTP_STATUS_BAD_REQUEST);
+    TEST(index_add_md5(fn, "zz0123456789abcdef0123456789abcd") == HTTP_STATUS_BAD_REQUEST);
+    TEST(index_len(fn) == N_RECS);
+
+    /* nor create an index */
+    xs *bad_fn = xs_fmt("%s/bad.idx", srv_basedir);
+    TEST(index_add_md5(bad_fn, "zz0123456789abcdef0123456789abcd") == HTTP_STATUS_BAD_REQUEST);
+    TEST(access(bad_fn, F_OK) == -1);
+
+    for (n = 0; n < N_RECS; n++) {
+        xs *in  = md5_n("in", n);
+        xs *out = md5_n("out", n);
+
+        TEST(index_in_md5(fn, in));
+        TEST(!index_in_md5(fn, out));
+    }
+
+    {
+        char md5[MD5_HEX_SIZE];
+        xs *first = md5_n("in", 0);
+
+        TEST(index_first(fn, md5) && strcmp(md5, first) == 0);
+    }
+
+    {
+        /* newest first */
+        xs *l = index_list_desc(fn, 5, 10);
+        const char *md5;
+        int i = N_RECS - 6;
+
+        TEST(xs_list_len(l) == 10);
+
+        xs_list_foreach(l, md5) {
+            xs *exp = md5_n("in", i--);
+            TEST(strcmp(md5, exp) == 0);
+        }
+    }
+
+    {
+        /* seek by md5, as pagination cursors do */
+        t_index idx;
+        char md5[MD5_HEX_SIZE];
+        xs *seek = md5_n("in", 100);
+        xs *next = md5_n("in", 101);
+        xs *out  = md5_n("out", 100);
+
+        TEST(index_open(&idx, fn));
+        TEST(index_asc_first(&idx, md5, seek) && strcmp(md5, next) == 0);
+        TEST(!index_asc_first(&idx, md5, out));
+        index_close(&idx);
+    }
+
+    {
+        /* deleted records are skipped */
+        xs *del  = md5_n("in", 7);
+        xs *prev = md5_n("in", 6);
+        xs *next = md5_n("in", 8);
+
+        TEST(index_del_md5(fn, del) == HTTP_STATUS_OK);
+        TEST(!index_in_md5(fn, del));
+
+        xs *l = index_list(fn, 8);
+        TEST(xs_list_len(l) == 8);
+        TEST(strcmp(xs_list_get(l, 6), prev) == 0);
+        TEST(strcmp(xs_list_get(l, 7), next) == 0);
+
+        /* there are no objects, so all records go away */
+        TEST(index_gc(fn) == N_RECS);
+        TEST(index_len(fn) == 0);
+    }
+
+    {
+        /* more big indexes than used to fit in the position map cache,
+           looked up in turns, and one of them rewritten in between */
+        xs *fns = xs_list_new();
+        int m;
+
+        for (m = 0; m < 100; m++) {
+            xs *mfn = xs_fmt("%s/many%d.idx", srv_basedir, m);
+
+            for (n = 0; n < 150; n++) {
+                xs *md5 = md5_n("m", m * 1000 + n);
+                index_add_md5(mfn, md5);
+            }
+
+            fns = xs_list_append(fns, mfn);
+        }
+
+        int ok = 1;
+
+        for (n = 0; n < 2; n++) {
+            for (m = 0; m < 100; m++) {
+                const char *mfn = xs_list_get(fns, m);
+                xs *in  = md5_n("m", m * 1000 + 149);
+                xs *out = md5_n("m", (m + 1) * 1000 + 1);
+
+                ok = ok && index_in_md5(mfn, in) && !index_in_md5(mfn, out);
+            }
+
+            if (n == 0) {
+                xs *del = md5_n("m", 7 * 1000 + 149);
+                index_del_md5(xs_list_get(fns, 7), del);
+                index_gc(xs_list_get(fns, 7));
+
+                xs *md5 = md5_n("m", 7 * 1000 + 149);
+                index_add_md5(xs_list_get(fns, 7), md5);
+            }
+        }
+
+        TEST(ok);
+    }
+
+    {
+        /* old text indexes are still readable and appendable */
+        xs *tfn = xs_fmt("%s/text.idx", srv_basedir);
+        FILE *f;
+
+        if ((f = fopen(tfn, "w")) != NULL) {
+            for (n = 0; n < 3; n++) {
+                xs *md5 = md5_n("in", n);
+                fprintf(f, "%s\n", md5);
+            }
+
+            fclose(f);
+        }
+
+        xs *md5 = md5_n("in", 3);
+        TEST(index_add_md5(tfn, md5) == HTTP_STATUS_CREATED);
+        TEST(index_len(tfn) == 4);
+
+        for (n = 0; n < 4; n++) {
+            xs *in = md5_n("in", n);
+            TEST(index_in_md5(tfn, in));
+        }
+
+        xs *l = index_list_desc(tfn, 0, 10);
+        TEST(xs_list_len(l) == 4 && strcmp(xs_list_get(l, 0), md5) == 0);
+
+        struct stat st;
+        TEST(stat(tfn, &st) == 0 && st.st_size == 4 * MD5_HEX_SIZE);
+    }
+
+    return test_end("index");
+}
@@ -0,0 +1,241 @@
+/* copyright (c) 2022 - 2025 grunfink et al. / MIT license */
+
+/* segmented object store: objects and side indexes survive deletions,
+   overwrites, compaction and a reload by another process, in both
+   storage formats */
+
+#include "../xs.h"
+#include "../xs_json.h"
+#include "../xs_openssl.h"
+#include "../snac.h"
+
+#include <sys/wait.h>
+
+#define _SNAC_TEST_SRV
+#include "test.h"
+
+#define N_OBJS 200
+#define N_LIKES 300
+
+
+static xs_str *obj_id(int n)
+{
+    return xs_fmt("https:/" "/example.org/note/%d", n);
+}
+
+
+static xs_str *actor_id(int n)
+{
+    return xs_fmt("https:/" "/example.org/actor/%d", n);
+}
+
+
+static xs_dict *obj_new(int n, const char *content)
+{
+    xs *id = obj_id(n);
+    xs *num = xs_number_new(n);
+    xs *tags = xs_list_new();
+    xs_dict *obj = xs_dict_new();
+
+    tags = xs_list_append(tags, "tag", num);
+
+    obj = xs_dict_set(obj, "id",      id);
+    obj = xs_dict_set(obj, "type",    "Note");
+    obj = xs_dict_set(obj, "content", content);
+    obj = xs_dict_set(obj, "tag",     tags);
+    obj = xs_dict_set(obj, "sensitive", xs_stock(n % 2 ? XSTYPE_TRUE : XSTYPE_FALSE));
+
+    if (n > 0) {
+        /* each note replies to the first one */
+        xs *p_id = obj_id(0);
+        obj = xs_dict_set(obj, "inReplyTo", p_id);
+    }
+
+    return obj;
+}
+
+
+static int obj_is(int n, const char *content)
+/* checks that an object is stored as expected */
+{
+    xs *id  = obj_id(n);
+    xs *exp = obj_new(n, content);
+    xs *obj = NULL;
+
+    if (object_get(id, &obj) != HTTP_STATUS_OK)
+        return 0;
+
+    xs *j1 = xs_json_dumps(exp, 0);
+    xs *j2 = xs_json_dumps(obj, 0);
+
+    return strcmp(j1, j2) == 0;
+}
+
+
+static void check(void)
+/* checks the store contents after the changes made by fill() */
+{
+    xs *p_id = obj_id(0);
+    int n;
+
+    for (n = 0; n < N_OBJS; n++) {
+        xs *id = obj_id(n);
+
+        if (n % 10 == 5)
+            TEST(!object_here(id));
+        else
+        if (n % 10 == 3)
+            TEST(obj_is(n, "changed"));
+        else
+            TEST(obj_is(n, "hello"));
+    }
+
+    /* the children index keeps the deleted ones */
+    xs *c = object_children(p_id);
+    TEST(xs_list_len(c) == N_OBJS - 1);
+
+    xs *id = obj_id(1);
+    xs *md5 = xs_md5_hex(id, strlen(id));
+    xs *p_md5 = xs_md5_hex(p_id, strlen(p_id));
+    char parent[MD5_HEX_SIZE];
+
+    TEST(object_parent(md5, parent) && strcmp(parent, p_md5) == 0);
+
+    TEST(object_likes_len(p_id) == 2);
+    xs *l = object_likes(p_id);
+    TEST(xs_list_len(l) == 2);
+
+    /* a much liked one keeps the even ones, in order */
+    xs *i_id = obj_id(2);
+    xs *il = object_likes(i_id);
+    const char *v;
+    int i = 0;
+
+    TEST(object_likes_len(i_id) == N_LIKES / 2);
+    TEST(xs_list_len(il) == N_LIKES / 2);
+
+    xs_list_foreach(il, v) {
+        xs *a = actor_id(i);
+        xs *a_md5 = xs_md5_hex(a, strlen(a));
+
+        TEST(strcmp(v, a_md5) == 0);
+        i += 2;
+    }
+}
+
+
+static void fill(void)
+{
+    xs *p_id = obj_id(0);
+    int n;
+
+    for (n = 0; n < N_OBJS; n++) {
+        xs *id  = obj_id(n);
+        xs *obj = obj_new(n, "hello");
+
+        TEST(object_add(id, obj) == HTTP_STATUS_CREATED);
+        TEST(object_add(id, obj) == HTTP_STATUS_NO_CONTENT);
+    }
+
+    for (n = 0; n < N_OBJS; n++) {
+        xs *id = obj_id(n);
+
+        if (n % 10 == 5)
+            TEST(object_del(id) == HTTP_STATUS_OK);
+        else
+        if (n % 10 == 3) {
+            xs *obj = obj_new(n, "changed");
+            TEST(object_add_ow(id, obj) == HTTP_STATUS_OK);
+        }
+    }
+
+    /* the second like from bob is not added */
+    TEST(object_admire(p_id, "https:/" "/example.org/alice", 1) == HTTP_STATUS_OK);
+    TEST(object_admire(p_id, "https:/" "/example.org/bob", 1) == HTTP_STATUS_OK);
+    TEST(object_admire(p_id, "https:/" "/example.org/bob", 1) == HTTP_STATUS_OK);
+
+    /* many likes and unlikes (the index is updated by deltas,
+       and written whole from time to time) */
+    xs *i_id = obj_id(2);
+
+    for (n = 0; n < N_LIKES; n++) {
+        xs *a = actor_id(n);
+        TEST(object_admire(i_id, a, 1) == HTTP_STATUS_OK);
+    }
+
+    for (n = 1; n < N_LIKES; n += 2) {
+        xs *a = actor_id(n);
+        TEST(object_unadmire(i_id, a, 1) == HTTP_STATUS_OK);
+        TEST(object_unadmire(i_id, a, 1) == HTTP_STATUS_NOT_FOUND);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1) {
+        /* reload by another process */
+        if (!srv_open(argv[1], 0))
+            return 1;
+
+        check();
+
+        return test_fails != 0;
+    }
+
+    xs *cfg = xs_dict_new();
+    cfg = xs_dict_set(cfg, "object_store", "segments");
+    cfg = xs_dict_set(cfg, "object_cache_mb", xs_stock(0));
+
+    if (!test_srv_open(cfg)) {
+        TEST(!"cannot open the server");
+        return test_end("store");
+    }
+
+    TEST(object_store_is_seg() && object_store_ready());
+
+    const char *fmts[] = { "json", "binary", NULL };
+    int n;
+
+    for (n = 0; fmts[n]; n++) {
+        srv_config = xs_dict_set(srv_config, "object_format", fmts[n]);
+
+        fill();
+        check();
+
+        /* compaction keeps everything */
+        object_store_compact();
+        check();
+
+        /* write the format to disk, so that the other process uses it */
+        FILE *f;
+        xs *fn = xs_fmt("%s/server.json", srv_basedir);
+
+        if ((f = fopen(fn, "w")) != NULL) {
+            xs_json_dump(srv_config, 4, f);
+            fclose(f);
+        }
+
+        pid_t pid = fork();
+        int status = -1;
+
+        if (pid == 0) {
+            execl(argv[0], argv[0], srv_basedir, NULL);
+            _exit(2);
+        }
+
+        waitpid(pid, &status, 0);
+        TEST(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        /* start again with an empty store (also the side indexes) */
+        for (int i = 0; i < N_OBJS; i++) {
+            xs *id = obj_id(i);
+            object_del(id);
+            TEST(!object_here(id));
+        }
+
+        object_store_compact();
+    }
+
+    return test_end("store");
+}
@@ -0,0 +1,98 @@
+/* copyright (c) 2022 - 2025 grunfink et al. / MIT license */
+
+/* minimal helpers for the tests in this directory: each test program
+   checks conditions with TEST() and returns test_end() from main() */
+
+#include <dirent.h>
+
+static int test_fails = 0;
+
+#define TEST(cond) do { if (!(cond)) { test_fails++; \
+    fprintf(stderr, "%s:%d: FAIL: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+
+static int test_end(const char *name)
+/* prints the result; returns the exit status */
+{
+    printf("%-16s %s\n", name, test_fails ? "FAIL" : "ok");
+    return test_fails != 0;
+}
+
+
+#ifdef _SNAC_TEST_SRV
+
+static void _test_rm(const char *dir)
+/* deletes a directory tree */
+{
+    DIR *d;
+    struct dirent *e;
+
+    if ((d = opendir(dir)) != NULL) {
+        while ((e = readdir(d)) != NULL) {
+            if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+                continue;
+
+            xs *fn = xs_fmt("%s/%s", dir, e->d_name);
+
+            if (unlink(fn) == -1)
+                _test_rm(fn);
+        }
+
+        closedir(d);
+    }
+
+    rmdir(dir);
+}
+
+
+static void test_srv_close(void)
+/* deletes the temporary server */
+{
+    if (srv_basedir != NULL)
+        _test_rm(srv_basedir);
+}
+
+
+static int test_srv_open(const xs_dict *cfg)
+/* creates and opens a temporary server, with some extra settings */
+{
+    char dir[] = "/tmp/snac-test-XXXXXX";
+    const char *k;
+    const xs_val *v;
+    FILE *f;
+
+    if (mkdtemp(dir) == NULL)
+        return 0;
+
+    xs *c = xs_dict_new();
+    xs *l = xs_number_new(disk_layout);
+
+    c = xs_dict_set(c, "host",     "localhost");
+    c = xs_dict_set(c, "prefix",   "");
+    c = xs_dict_set(c, "address",  "127.0.0.1");
+    c = xs_dict_set(c, "layout",   l);
+
+    xs_dict_foreach(cfg, k, v)
+        c = xs_dict_set(c, k, v);
+
+    xs *fn = xs_fmt("%s/server.json", dir);
+
+    if ((f = fopen(fn, "w")) == NULL)
+        return 0;
+
+    xs_json_dump(c, 4, f);
+    fclose(f);
+
+    /* as created by snac init */
+    xs *udir = xs_fmt("%s/user", dir);
+    xs *odir = xs_fmt("%s/object", dir);
+    mkdirx(udir);
+    mkdirx(odir);
+
+    atexit(test_srv_close);
+
+    /* upgrading also prepares the object store */
+    return srv_open(dir, 1);
+}
+
+#endif /* _SNAC_TEST_SRV */
@@ -0,0 +1,178 @@
+/* copyright (c) 2022 - 2025 grunfink et al. / MIT license */
+
+/* binary serialization of xs values: round trips, the portable
+   encoding and damaged data */
+
+#define XS_IMPLEMENTATION
+
+#include "../xs.h"
+#include "../xs_unicode.h"
+#include "../xs_json.h"
+#include "../xs_bin.h"
+
+#include "test.h"
+
+
+static int same(const xs_val *a, const xs_val *b)
+/* compares two values by their JSON */
+{
+    xs *ja = xs_json_dumps(a, 0);
+    xs *jb = xs_json_dumps(b, 0);
+
+    return ja != NULL && jb != NULL && strcmp(ja, jb) == 0;
+}
+
+
+static void round_trip(const xs_val *v)
+{
+    int size = 0;
+    xs *d = xs_bin_dumps(v, &size);
+
+    TEST(d != NULL && xs_bin_is(d, size));
+
+    xs *r = d ? xs_bin_loads(d, size) : NULL;
+    TEST(r != NULL && same(v, r));
+
+    /* the same through a file */
+    FILE *f = tmpfile();
+    xs *fr = NULL;
+
+    if (f != NULL) {
+        TEST(xs_bin_dump(v, f));
+        rewind(f);
+        fr = xs_bin_load(f);
+        fclose(f);
+    }
+
+    TEST(fr != NULL && same(v, fr));
+}
+
+
+static uint32_t le32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | u[1] << 8 | u[2] << 16 | (uint32_t)u[3] << 24;
+}
+
+
+int main(void)
+{
+    const char *jsons[] = {
+        "{}",
+        "[]",
+        "[1,-2.5,\"\",null,true,false]",
+        "{\"a\":{\"b\":{\"c\":[{},[],{\"d\":\"e\"}]}},\"f\":\"g\"}",
+        "{\"content\":\"caf\\u00e9 \\ud83d\\ude00 <p>\\\"x\\\"</p>\",\"n\":1e3}",
+        NULL
+    };
+    int n;
+
+    for (n = 0; jsons[n]; n++) {
+        xs *v = xs_json_loads(jsons[n]);
+
+        TEST(v != NULL);
+        round_trip(v);
+    }
+
+    {
+        /* dicts with deleted and overwritten entries, and many keys */
+        xs *v = xs_dict_new();
+        xs *l = xs_list_new();
+        xs *d = xs_data_new("\0\1\2\3", 4);
+
+        for (n = 0; n < 100; n++) {
+            xs *k = xs_fmt("key%d", n);
+            xs *num = xs_number_new(n);
+            v = xs_dict_set(v, k, num);
+        }
+
+        v = xs_dict_set(v, "key5", "a longer value than a number");
+        v = xs_dict_set(v, "key6", "x");
+        v = xs_dict_del(v, "key7");
+        l = xs_list_append(l, d, v);
+        v = xs_dict_set(v, "list", l);
+
+        round_trip(v);
+
+        int size = 0;
+        xs *b = xs_bin_dumps(v, &size);
+        xs *r = b ? xs_bin_loads(b, size) : NULL;
+
+        /* loaded dicts can be searched and updated */
+        TEST(r != NULL && xs_dict_get(r, "key7") == NULL);
+        TEST(r != NULL && strcmp(xs_dict_get_def(r, "key5", ""), "a longer value than a number") == 0);
+        TEST(r != NULL && xs_number_get(xs_dict_get(r, "key99")) == 99);
+
+        if (r != NULL) {
+            r = xs_dict_set(r, "key7", "back");
+            r = xs_dict_set(r, "new", "value");
+            TEST(strcmp(xs_dict_get_def(r, "key7", ""), "back") == 0);
+            TEST(strcmp(xs_dict_get_def(r, "new", ""), "value") == 0);
+
+            const xs_val *ld = xs_list_get(xs_dict_get(r, "list"), 0);
+            char buf[4];
+
+            TEST(xs_type(ld) == XSTYPE_DATA && xs_data_size(ld) == 4);
+            xs_data_get(buf, ld);
+            TEST(memcmp(buf, "\0\1\2\3", 4) == 0);
+        }
+    }
+
+    {
+        /* the encoding is fixed: little-endian sizes everywhere */
+        xs *v = xs_json_loads("[\"abc\"]");
+        int size = 0;
+        xs *d = xs_bin_dumps(v, &size);
+        int sz = 1 + 4 + 1 + 4 + 1;
+
+        TEST(d != NULL && size == XS_BIN_HDR_SIZE + sz);
+
+        if (d != NULL) {
+            const char *p = d + XS_BIN_HDR_SIZE;
+
+            TEST(memcmp(d, "XSB2", 4) == 0);
+            TEST(le32(d + 4) == (uint32_t)sz);
+            TEST(le32(d + 12) == 0);
+            TEST(p[0] == XSTYPE_LIST && le32(p + 1) == (uint32_t)sz);
+            TEST(p[5] == XSTYPE_LITEM && strcmp(p + 6, "abc") == 0 && p[10] == '\0');
+        }
+    }
+
+    {
+        /* damaged data is never loaded */
+        xs *v = xs_json_loads("{\"a\":[1,\"x\",{\"b\":null}],\"c\":\"d\"}");
+        int size = 0;
+        xs *d = xs_bin_dumps(v, &size);
+        xs *c = xs_dup(d);
+
+        TEST(xs_bin_loads(d, size - 1) == NULL);
+        TEST(xs_bin_loads(d, XS_BIN_HDR_SIZE - 1) == NULL);
+
+        c[size - 3] ^= 0x20;
+        TEST(xs_bin_loads(c, size) == NULL);
+
+        memcpy(c, d, size);
+        c[0] = 'Y';
+        TEST(!xs_bin_is(c, size) && xs_bin_loads(c, size) == NULL);
+
+        /* a bad size inside, with a good checksum */
+        memcpy(c, d, size);
+        c[XS_BIN_HDR_SIZE + 1] += 1;
+        _xs_bin_put32(c + 8, _xs_bin_sum(c + XS_BIN_HDR_SIZE, size - XS_BIN_HDR_SIZE));
+        TEST(xs_bin_loads(c, size) == NULL);
+
+        /* a bad dict item offset, with a good checksum */
+        memcpy(c, d, size);
+        c[XS_BIN_HDR_SIZE + 1 + sizeof(dict_hdr)] += 1;
+        _xs_bin_put32(c + 8, _xs_bin_sum(c + XS_BIN_HDR_SIZE, size - XS_BIN_HDR_SIZE));
+        TEST(xs_bin_loads(c, size) == NULL);
+
+        /* only lists and dicts are stored */
+        xs *s = xs_str_new("string");
+        xs *sd = xs_bin_dumps(s, &size);
+
+        TEST(sd == NULL || xs_bin_loads(sd, size) == NULL);
+    }
+
+    return test_end("xs_bin");
+}
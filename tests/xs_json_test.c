@@ -0,0 +1,200 @@
+/* copyright (c) 2022 - 2025 grunfink et al. / MIT license */
+
+/* JSON parsing and writing: round trips between the parsers (string,
+   memory buffer and file) and the writer, and invalid documents */
+
+#define XS_IMPLEMENTATION
+
+#include "../xs.h"
+#include "../xs_unicode.h"
+#include "../xs_json.h"
+
+#include "test.h"
+
+
+static xs_val *load_file(const char *json)
+/* parses a JSON document through a file */
+{
+    FILE *f = tmpfile();
+    xs_val *v = NULL;
+
+    if (f != NULL) {
+        fputs(json, f);
+        rewind(f);
+        v = xs_json_load(f);
+        fclose(f);
+    }
+
+    return v;
+}
+
+
+int main(void)
+{
+    /* documents as written by xs_json_dumps(v, 0) */
+    const char *canon[] = {
+        "{}",
+        "[]",
+        "[1,2.5,-3,0.1,12345678901,true,false,null]",
+        "{\"a\":{\"b\":{\"c\":[{},[],{\"d\":\"e\"}]}},\"f\":\"g\"}",
+        "{\"content\":\"café 😀 \\\"q\\\" \\\\ / \\n\\t\\r\",\"n\":[\"\",\"x\"]}",
+        "{\"@context\":[\"https:/" "/www.w3.org/ns/activitystreams\",{\"sensitive\":\"as:sensitive\"}]}",
+        NULL
+    };
+    int n;
+
+    for (n = 0; canon[n]; n++) {
+        xs *v  = xs_json_loads(canon[n]);
+        xs *vm = xs_json_loadm_full(canon[n], strlen(canon[n]), MAX_JSON_DEPTH);
+        xs *vf = load_file(canon[n]);
+
+        TEST(v != NULL && vm != NULL && vf != NULL);
+
+        xs *j  = xs_json_dumps(v, 0);
+        xs *jm = xs_json_dumps(vm, 0);
+        xs *jf = xs_json_dumps(vf, 0);
+
+        TEST(j != NULL && strcmp(j, canon[n]) == 0);
+        TEST(jm != NULL && strcmp(jm, canon[n]) == 0);
+        TEST(jf != NULL && strcmp(jf, canon[n]) == 0);
+
+        /* indented output parses back to the same */
+        xs *j4 = xs_json_dumps(v, 4);
+        xs *v4 = xs_json_loads(j4);
+        xs *jj = xs_json_dumps(v4, 0);
+
+        TEST(jj != NULL && strcmp(jj, canon[n]) == 0);
+
+        /* the same through a file */
+        FILE *f = tmpfile();
+
+        if (f != NULL) {
+            TEST(xs_json_dump(v, 4, f));
+            rewind(f);
+
+            xs *fv = xs_json_load(f);
+            xs *fj = xs_json_dumps(fv, 0);
+            fclose(f);
+
+            TEST(fj != NULL && strcmp(fj, canon[n]) == 0);
+        }
+    }
+
+    {
+        /* equivalent documents */
+        const char *eq[][2] = {
+            { "  { \"a\" : [ 1 , 2 ] ,\n\t\"b\" : { } }  ", "{\"a\":[1,2],\"b\":{}}" },
+            { "[\"\\u00e9\\ud83d\\ude00\\/\"]",            "[\"é😀/\"]" },
+            { "[1e3,-0.5E1,1.5e-7]",                          "[1000,-5,0.00000015]" },
+            { "{\"a\":1,\"a\":2}",                            "{\"a\":2}" },
+            { NULL, NULL }
+        };
+
+        for (n = 0; eq[n][0]; n++) {
+            xs *v  = xs_json_loads(eq[n][0]);
+            xs *vm = xs_json_loadm_full(eq[n][0], strlen(eq[n][0]), MAX_JSON_DEPTH);
+            xs *j  = xs_json_dumps(v, 0);
+            xs *jm = xs_json_dumps(vm, 0);
+
+            TEST(j != NULL && strcmp(j, eq[n][1]) == 0);
+            TEST(jm != NULL && strcmp(jm, eq[n][1]) == 0);
+        }
+    }
+
+    {
+        /* invalid documents */
+        const char *bad[] = {
+            "", "[", "{", "[1,]", "{\"a\"}", "{\"a\":}", "{1:2}", "[\"abc",
+            "[tru]", "[nul]", "[01x]", "\"str\"", "42", "[\"\\ud83d\"x]",
+            NULL
+        };
+
+        for (n = 0; bad[n]; n++) {
+            xs *v  = xs_json_loads(bad[n]);
+            xs *vm = xs_json_loadm_full(bad[n], strlen(bad[n]), MAX_JSON_DEPTH);
+            xs *vf = load_file(bad[n]);
+
+            if (v != NULL || vm != NULL || vf != NULL)
+                fprintf(stderr, "accepted: %s\n", bad[n]);
+
+            TEST(v == NULL && vm == NULL && vf == NULL);
+        }
+
+        /* the memory parser stops at the given size */
+        const char *s = "[1,2]";
+        xs *v = xs_json_loadm_full(s, 4, MAX_JSON_DEPTH);
+        TEST(v == NULL);
+    }
+
+    {
+        /* nesting is limited (maxdepth levels below the outermost one) */
+        xs *deep = xs_str_new(NULL);
+
+        for (n = 0; n < MAX_JSON_DEPTH + 2; n++)
+            deep = xs_str_cat(deep, "[");
+        for (n = 0; n < MAX_JSON_DEPTH + 2; n++)
+            deep = xs_str_cat(deep, "]");
+
+        xs *v = xs_json_loads(deep);
+        TEST(v == NULL);
+
+        xs *v2 = xs_json_loads_full(deep, MAX_JSON_DEPTH + 1);
+        TEST(v2 != NULL);
+    }
+
+    {
+        /* appending to a string, or to nothing */
+        xs *v = xs_json_loads("{\"a\":[1]}");
+        xs *s = xs_str_new("data: ");
+
+        s = xs_json_dumps_cat(s, v, 0);
+        TEST(strcmp(s, "data: {\"a\":[1]}") == 0);
+
+        xs *s2 = xs_json_dumps_cat(NULL, v, 0);
+        TEST(s2 != NULL && strcmp(s2, "{\"a\":[1]}") == 0);
+    }
+
+    {
+        /* a stream is read up to the end of each value, without
+           waiting for its end (the writer is still open) */
+        int fds[2];
+
+        if (pipe(fds) == 0) {
+            const char *two = " {\"a\":\"}\\\"\"} [2,\"]\"]";
+            FILE *f = fdopen(fds[0], "r");
+
+            TEST(write(fds[1], two, strlen(two)) == (ssize_t)strlen(two));
+
+            xs *v1 = xs_json_load(f);
+            xs *j1 = xs_json_dumps(v1, 0);
+            TEST(j1 != NULL && strcmp(j1, "{\"a\":\"}\\\"\"}") == 0);
+
+            xs *v2 = xs_json_load(f);
+            xs *j2 = xs_json_dumps(v2, 0);
+            TEST(j2 != NULL && strcmp(j2, "[2,\"]\"]") == 0);
+
+            close(fds[1]);
+            fclose(f);
+        }
+
+        /* and a file is left just after it */
+        FILE *f = tmpfile();
+
+        if (f != NULL) {
+            fputs("[1] {\"b\":2}", f);
+            rewind(f);
+
+            xs *v1 = xs_json_load(f);
+            xs *v2 = xs_json_load(f);
+            xs *j1 = xs_json_dumps(v1, 0);
+            xs *j2 = xs_json_dumps(v2, 0);
+
+            TEST(j1 != NULL && strcmp(j1, "[1]") == 0);
+            TEST(j2 != NULL && strcmp(j2, "{\"b\":2}") == 0);
+
+            fclose(f);
+        }
+    }
+
+    return test_end("xs_json");
+}
@@ -5,12 +5,191 @@
 #include "xs_io.h"
 #include "xs_json.h"
 #include "xs_glob.h"
+#include "xs_hex.h"
 
 #include "snac.h"
 
 #include <sys/stat.h>
 
 
+static int _index_to_binary(const char *fn)
+/* converts a text index to the binary format, keeping deleted entries */
+{
+    t_index idx;
+    int ret = 0;
+
+    if (!index_open(&idx, fn))
+        return 0;
+
+    if (!idx.binary && idx.n_recs > 0) {
+        xs *nfn = xs_fmt("%s.new", fn);
+        FILE *f;
+
+        if ((f = fopen(nfn, "w")) != NULL) {
+            char hdr[INDEX_HDR_SIZE];
+            long n;
+
+            index_header(hdr);
+            fwrite(hdr, sizeof(hdr), 1, f);
+
+            for (n = 0; n < idx.n_recs; n++) {
+                const char *r = idx.data + n * idx.rec_size;
+                char rec[INDEX_REC_SIZE];
+
+                if (r[MD5_HEX_SIZE - 1] != '\n')
+                    break;
+
+                if (r[0] == '-')
+                    memset(rec, 0xff, sizeof(rec));
+                else
+                if (_xs_hex_dec(rec, r, MD5_HEX_SIZE - 1) == NULL)
+                    break;
+
+                fwrite(rec, sizeof(rec), 1, f);
+            }
+
+            fclose(f);
+
+            if (n == idx.n_recs && (size_t)idx.n_recs * idx.rec_size == idx.size) {
+                rename(nfn, fn);
+                ret = 1;
+            }
+            else {
+                /* don't lose anything: keep it as text */
+                srv_log(xs_fmt("index upgrade: unexpected content in %s, not converted", fn));
+                unlink(nfn);
+            }
+        }
+    }
+
+    index_close(&idx);
+
+    return ret;
+}
+
+
+static void _object_store_migrate(void)
+/* moves the objects and their side indexes into the segmented store */
+{
+    xs *spec = xs_fmt("%s/object/??" "/" "*", srv_basedir);
+    xs *list = xs_glob(spec, 0, 0);
+    const char *caches[] = { "private", "public", "followers", "pinned",
+                             "bookmark", "draft", "sched", NULL };
+    const char *v;
+    int o_cnt = 0, i_cnt = 0;
+
+    srv_log(xs_fmt("object store upgrade: moving objects to segments"));
+
+    xs_list_foreach(list, v) {
+        xs *l = xs_split(v, "/");
+        const char *b = xs_list_get(l, -1);
+        double mt = mtime(v);
+
+        if (xs_endswith(b, ".json") && strlen(b) == MD5_HEX_SIZE - 1 + 5) {
+            xs *md5 = xs_crop_i(xs_dup(b), 0, MD5_HEX_SIZE - 1);
+            xs *data = NULL;
+            int size = 0;
+            FILE *f;
+
+            if ((f = fopen(v, "r")) != NULL) {
+                xs *obj = data_load(f);
+                fclose(f);
+
+                if (obj != NULL)
+                    data = data_dumps(obj, &size);
+            }
+
+            if (data == NULL || !object_store_put_raw(md5, 'o', data, size, mt)) {
+                srv_log(xs_fmt("object store upgrade: cannot move %s", v));
+                continue;
+            }
+
+            o_cnt++;
+        }
+        else
+        if (xs_endswith(b, ".idx") && strlen(b) == MD5_HEX_SIZE - 1 + 6) {
+            xs *md5  = xs_crop_i(xs_dup(b), 0, MD5_HEX_SIZE - 1);
+            xs *md5s = index_list(v, XS_ALL);
+            xs *data = xs_realloc(NULL, _xs_blk_size(xs_list_len(md5s) * INDEX_REC_SIZE + 1));
+            int size = 0;
+            const char *e;
+
+            xs_list_foreach(md5s, e) {
+                if (_xs_hex_dec(data + size, e, MD5_HEX_SIZE - 1) != NULL)
+                    size += INDEX_REC_SIZE;
+            }
+
+            if (!object_store_put_raw(md5, b[MD5_HEX_SIZE], data, size, mt)) {
+                srv_log(xs_fmt("object store upgrade: cannot move %s", v));
+                continue;
+            }
+
+            i_cnt++;
+        }
+        else
+        if (!xs_endswith(b, ".bak") && !xs_endswith(b, ".bloom"))
+            continue;
+
+        index_unlink(v);
+    }
+
+    /* the user caches are now only indexes */
+    xs *users = user_list();
+
+    xs_list_foreach(users, v) {
+        snac user;
+        int n;
+
+        if (!user_open(&user, v))
+            continue;
+
+        for (n = 0; caches[n]; n++) {
+            xs *idx  = xs_fmt("%s/%s.idx", user.basedir, caches[n]);
+            xs *md5s = index_list(idx, XS_ALL);
+            const char *e;
+
+            /* entries without a link had already been purged */
+            xs_list_foreach(md5s, e) {
+                xs *cfn = xs_fmt("%s/%s/%s.json", user.basedir, caches[n], e);
+
+                if (mtime(cfn) == 0.0)
+                    index_del_md5(idx, e);
+            }
+
+            index_gc(idx);
+
+            xs *cspec = xs_fmt("%s/%s/" "*.json", user.basedir, caches[n]);
+            xs *links = xs_glob(cspec, 0, 0);
+
+            xs_list_foreach(links, e)
+                unlink(e);
+        }
+
+        /* the links to followed actors */
+        xs *fspec = xs_fmt("%s/following/" "*_a.json", user.basedir);
+        xs *flist = xs_glob(fspec, 0, 0);
+        const char *e;
+
+        xs_list_foreach(flist, e)
+            unlink(e);
+
+        user_free(&user);
+    }
+
+    object_store_compact();
+
+    xs *rfn = xs_fmt("%s/object/seg/ready", srv_basedir);
+    FILE *f;
+
+    if ((f = fopen(rfn, "w")) != NULL) {
+        fprintf(f, "%d %d\n", o_cnt, i_cnt);
+        fclose(f);
+    }
+
+    srv_log(xs_fmt("object store upgrade: %d objects and %d indexes moved", o_cnt, i_cnt));
+}
+
+
 int snac_upgrade(xs_str **error)
 {
     int ret = 1;
@@ -313,6 +492,95 @@ int snac_upgrade(xs_str **error)
 
             nf = 2.7;
         }
+        else
+        if (f < 2.8) {
+            /* convert text indexes to binary ones */
+            const char *specs[] = { "%s/public.idx",
+                                    "%s/user/" "*/" "*.idx",
+                                    "%s/user/" "*/list/" "*.idx",
+                                    "%s/user/" "*/list/" "*.lst",
+                                    "%s/tag/??" "/" "*.idx",
+                                    "%s/object/??" "/" "*.idx", NULL };
+            int n, cnt = 0;
+
+            for (n = 0; specs[n]; n++) {
+                xs *spec = xs_fmt(specs[n], srv_basedir);
+                xs *idxs = xs_glob(spec, 0, 0);
+                const char *v;
+
+                xs_list_foreach(idxs, v) {
+                    /* the notification index is not made of md5s */
+                    if (xs_endswith(v, "/notify.idx"))
+                        continue;
+
+                    cnt += _index_to_binary(v);
+                }
+            }
+
+            srv_log(xs_fmt("index upgrade: %d indexes converted", cnt));
+
+            nf = 2.8;
+        }
+        else
+        if (f < 2.9) {
+            /* build the reverse follow index */
+            xs *users = user_list();
+            const char *uid;
+            int cnt = 0;
+
+            xs_list_foreach(users, uid) {
+                snac snac;
+
+                if (user_open(&snac, uid)) {
+                    xs *spec = xs_fmt("%s/following/" "*.json", snac.basedir);
+                    xs *files = xs_glob(spec, 0, 0);
+                    xs *fwers = follower_list(&snac);
+                    const char *v;
+
+                    xs_list_foreach(files, v) {
+                        FILE *f;
+
+                        if (xs_endswith(v, "_a.json"))
+                            continue;
+
+                        if ((f = fopen(v, "r")) != NULL) {
+                            xs *o = data_load(f);
+                            fclose(f);
+
+                            /* pending Follows hold the actor as object */
+                            const char *type  = xs_dict_get(o, "type");
+                            const char *actor = xs_dict_get(o,
+                                xs_is_string(type) && strcmp(type, "Follow") == 0 ? "object" : "actor");
+
+                            if (xs_is_string(actor)) {
+                                rfollow_add(&snac, actor);
+                                cnt++;
+                            }
+                        }
+                    }
+
+                    xs_list_foreach(fwers, v) {
+                        rfollow_add(&snac, v);
+                        cnt++;
+                    }
+
+                    const xs_list *tags = xs_dict_get(snac.config, "followed_hashtags");
+
+                    if (xs_is_list(tags)) {
+                        xs_list_foreach(tags, v) {
+                            rfollow_add(&snac, v);
+                            cnt++;
+                        }
+                    }
+
+                    user_free(&snac);
+                }
+            }
+
+            srv_log(xs_fmt("reverse follow index: %d entries added", cnt));
+
+            nf = 2.9;
+        }
 
         if (f < nf) {
             f          = nf;
@@ -326,6 +594,9 @@ int snac_upgrade(xs_str **error)
             break;
     }
 
+    if (ret && object_store_is_seg() && !object_store_ready())
+        _object_store_migrate();
+
     if (f > disk_layout) {
         *error = xs_fmt("ERROR: unknown future version %lf\n", f);
         ret    = 0;
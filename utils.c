@@ -352,6 +352,8 @@ int adduser(const char *uid)
         fclose(f);
     }
 
+    user_map_reset();
+
     printf("\nUser password is %s\n", pwd);
 
     printf("\nGo to %s/%s and continue configuring your user there.\n", srv_baseurl, uid);
@@ -377,6 +379,8 @@ int resetpwd(snac *snac)
         xs_json_dump(snac->config, 4, f);
         fclose(f);
 
+        user_table_del(snac->uid);
+
         printf("New password for user %s is %s\n", snac->uid, clear_pwd);
     }
     else {
@@ -435,11 +439,15 @@ int deluser(snac *user)
         xs *object = NULL;
 
         if (valid_status(following_get(user, v, &object))) {
-            xs *msg = msg_undo(user, xs_dict_get(object, "object"));
+            xs *msg   = msg_undo(user, xs_dict_get(object, "object"));
+            xs *inbox = get_actor_inbox(v, 1);
 
             following_del(user, v);
 
-            enqueue_output_by_actor(user, msg, v, 0);
+            /* the user will be gone, so its key goes with the message */
+            if (!xs_is_null(inbox))
+                enqueue_output_raw(user->actor, xs_dict_get(user->key, "secret"),
+                    msg, inbox, 0, 0);
 
             printf("Unfollowing actor %s\n", v);
         }
@@ -447,6 +455,11 @@ int deluser(snac *user)
 
     rm_rf(user->basedir);
 
+    signing_key_del(user->actor);
+
+    user_table_del(user->uid);
+    user_map_reset();
+
     return ret;
 }
 
@@ -594,6 +607,8 @@ void verify_links(snac *user)
         }
         else
             rename(bfn, fn);
+
+        user_table_del(user->uid);
     }
 }
 
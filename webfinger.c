@@ -244,12 +244,10 @@ int webfinger_get_handler(xs_dict *req, const char *q_path,
         obj = xs_dict_append(obj, "subject", acct);
         obj = xs_dict_append(obj, "links",   links);
 
-        xs_str *j = xs_json_dumps(obj, 4);
-
         user_free(&snac);
 
         status = HTTP_STATUS_OK;
-        *body  = j;
+        *body  = xs_json_dumps(obj, 0);
         *ctype = "application/jrd+json";
     }
     else
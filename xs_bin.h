@@ -0,0 +1,338 @@
+/* copyright (c) 2022 - 2025 grunfink et al. / MIT license */
+
+#ifndef _XS_BIN_H
+
+#define _XS_BIN_H
+
+/* xs values are already flat, relocatable blobs, so they can be stored
+   almost as they are: a small header, followed by the value itself.
+   The only host dependent parts of a value are the sizes of lists,
+   dicts and data blocks and the offsets inside dicts, that are stored
+   as 32 bit little-endian numbers, as are the header fields, so the
+   files can be moved between any hosts. Values are checked for
+   structure on load. */
+
+#define XS_BIN_MAGIC "XSB2"
+#define XS_BIN_HDR_SIZE 16
+
+ int xs_bin_is(const char *data, int size);
+ xs_val *xs_bin_loads(const char *data, int size);
+ xs_val *xs_bin_load(FILE *f);
+ xs_data *xs_bin_dumps(const xs_val *v, int *size);
+ int xs_bin_dump(const xs_val *v, FILE *f);
+
+
+#ifdef XS_IMPLEMENTATION
+
+#include <stddef.h>
+
+
+static uint32_t _xs_bin_sum(const char *data, int size)
+/* FNV-1a checksum */
+{
+    uint32_t h = 2166136261u;
+    int n;
+
+    for (n = 0; n < size; n++) {
+        h ^= (unsigned char)data[n];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+
+static uint32_t _xs_bin_get32(const char *p)
+/* reads a little-endian 32 bit number */
+{
+    const unsigned char *u = (const unsigned char *)p;
+
+    return (uint32_t)u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16 | (uint32_t)u[3] << 24;
+}
+
+
+static void _xs_bin_put32(char *p, uint32_t v)
+/* writes a little-endian 32 bit number */
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+
+static int _xs_bin_int(char *q, int to_host)
+/* converts in place a 32 bit number, returning its host value */
+{
+    int i;
+
+    if (to_host) {
+        i = (int)_xs_bin_get32(q);
+        memcpy(q, &i, sizeof(i));
+    }
+    else {
+        memcpy(&i, q, sizeof(i));
+        _xs_bin_put32(q, (uint32_t)i);
+    }
+
+    return i;
+}
+
+
+static xs_val *_xs_bin_gc(const xs_val *v)
+/* returns a deep copy of v, with no deleted nor leaked dict entries */
+{
+    const xs_str *k;
+    const xs_val *e;
+    xs_val *r;
+
+    switch (xs_type(v)) {
+    case XSTYPE_LIST:
+        r = xs_list_new();
+
+        xs_list_foreach(v, e) {
+            xs *se = _xs_bin_gc(e);
+            r = xs_list_append(r, se);
+        }
+
+        break;
+
+    case XSTYPE_DICT:
+        r = xs_dict_new();
+
+        xs_dict_foreach(v, k, e) {
+            xs *se = _xs_bin_gc(e);
+            r = xs_dict_set(r, k, se);
+        }
+
+        break;
+
+    default:
+        r = xs_dup(v);
+        break;
+    }
+
+    return r;
+}
+
+
+static int _xs_bin_conv(char *p, int avail, int to_host)
+/* converts in place the sizes and offsets inside a compacted value
+   from little-endian to host order (or the other way round), checking
+   its structure on the way; returns the size of the value, or -1 if
+   it's malformed. The hash tree of dicts is not stored: it's cleared
+   on dump and rebuilt on load */
+{
+    const char *e;
+    int sz, o, n, d, last, prev;
+
+    if (avail < 1)
+        return -1;
+
+    switch (xs_type(p)) {
+    case XSTYPE_LIST:
+    case XSTYPE_DATA:
+        if (avail < 1 + _XS_TYPE_SIZE)
+            return -1;
+
+        sz = to_host ? (int)_xs_bin_get32(p + 1) : _xs_get_size(p);
+
+        if (sz < 1 + _XS_TYPE_SIZE || sz > avail)
+            return -1;
+
+        if (p[0] == XSTYPE_LIST) {
+            /* the items, up to the end mark */
+            for (o = 1 + _XS_TYPE_SIZE; o < sz - 1; o += n) {
+                if (p[o++] != XSTYPE_LITEM)
+                    return -1;
+
+                if ((n = _xs_bin_conv(p + o, sz - 1 - o, to_host)) == -1)
+                    return -1;
+            }
+
+            if (o != sz - 1 || p[o] != '\0')
+                return -1;
+        }
+
+        if (to_host)
+            _xs_put_size(p, sz);
+        else
+            _xs_bin_put32(p + 1, sz);
+
+        return sz;
+
+    case XSTYPE_DICT:
+        if (avail < 1 + (int)sizeof(dict_hdr))
+            return -1;
+
+        sz   = _xs_bin_int(p + 1 + offsetof(dict_hdr, size), to_host);
+        d    = _xs_bin_int(p + 1 + offsetof(dict_hdr, first), to_host);
+        last = _xs_bin_int(p + 1 + offsetof(dict_hdr, last), to_host);
+        memset(p + 1 + offsetof(dict_hdr, root), '\0', sizeof(int));
+
+        if (sz < 1 + (int)sizeof(dict_hdr) || sz > avail)
+            return -1;
+
+        /* the items must be sequential and contiguous */
+        o    = 1 + sizeof(dict_hdr);
+        prev = 0;
+
+        while (d) {
+            char *di = p + o;
+            int vo;
+
+            if (d != o || o + (int)sizeof(ditem_hdr) >= sz)
+                return -1;
+
+            vo = _xs_bin_int(di + offsetof(ditem_hdr, value_offset), to_host);
+            d  = _xs_bin_int(di + offsetof(ditem_hdr, next), to_host);
+            memset(di + offsetof(ditem_hdr, child), '\0', sizeof(((ditem_hdr *)0)->child));
+
+            /* the key, followed by the value */
+            if ((e = memchr(di + sizeof(ditem_hdr), '\0', sz - o - sizeof(ditem_hdr))) == NULL ||
+                vo != e - p + 1)
+                return -1;
+
+            if ((n = _xs_bin_conv(p + vo, sz - vo, to_host)) == -1)
+                return -1;
+
+            if (to_host) {
+                /* hook the item into the hash tree */
+                int *slot = _xs_dict_locate(p, di + sizeof(ditem_hdr));
+
+                if (*slot)
+                    return -1;
+
+                *slot = o;
+            }
+
+            prev = o;
+            o    = vo + n;
+        }
+
+        if (o != sz || last != prev)
+            return -1;
+
+        return sz;
+
+    case XSTYPE_NUMBER:
+        if ((e = memchr(p + 1, '\0', avail - 1)) == NULL)
+            return -1;
+
+        return e - p + 1;
+
+    case XSTYPE_NULL:
+    case XSTYPE_TRUE:
+    case XSTYPE_FALSE:
+        return 1;
+
+    case XSTYPE_STRING:
+        if ((e = memchr(p, '\0', avail)) == NULL)
+            return -1;
+
+        return e - p + 1;
+
+    default:
+        /* items out of place */
+        return -1;
+    }
+}
+
+
+int xs_bin_is(const char *data, int size)
+/* checks if data starts with a binary header */
+{
+    return size >= 4 && memcmp(data, XS_BIN_MAGIC, 4) == 0;
+}
+
+
+xs_val *xs_bin_loads(const char *data, int size)
+/* loads a value from a memory buffer */
+{
+    uint32_t sz;
+
+    if (size < XS_BIN_HDR_SIZE)
+        return NULL;
+
+    if (memcmp(data, XS_BIN_MAGIC, 4) != 0)
+        return NULL;
+
+    sz = _xs_bin_get32(data + 4);
+
+    if (sz == 0 || sz > (uint32_t)(size - XS_BIN_HDR_SIZE) ||
+        _xs_bin_sum(data + XS_BIN_HDR_SIZE, sz) != _xs_bin_get32(data + 8))
+        return NULL;
+
+    xs_val *v = xs_realloc(NULL, _xs_blk_size(sz));
+    memcpy(v, data + XS_BIN_HDR_SIZE, sz);
+
+    xstype t = xs_type(v);
+
+    if ((t != XSTYPE_DICT && t != XSTYPE_LIST) || _xs_bin_conv(v, sz, 1) != (int)sz)
+        v = xs_free(v);
+
+    return v;
+}
+
+
+xs_val *xs_bin_load(FILE *f)
+/* loads a value from a file */
+{
+    char hdr[XS_BIN_HDR_SIZE];
+    uint32_t sz;
+
+    if (fread(hdr, sizeof(hdr), 1, f) != 1 || !xs_bin_is(hdr, sizeof(hdr)))
+        return NULL;
+
+    sz = _xs_bin_get32(hdr + 4);
+
+    if (sz == 0 || sz >= 0x7fffffff - XS_BIN_HDR_SIZE)
+        return NULL;
+
+    xs *data = xs_realloc(NULL, _xs_blk_size(XS_BIN_HDR_SIZE + sz));
+    memcpy(data, hdr, sizeof(hdr));
+
+    if (fread(data + XS_BIN_HDR_SIZE, sz, 1, f) != 1)
+        return NULL;
+
+    return xs_bin_loads(data, XS_BIN_HDR_SIZE + sz);
+}
+
+
+xs_data *xs_bin_dumps(const xs_val *v, int *size)
+/* dumps a value to a memory buffer (not an xs value) */
+{
+    xs *gv = _xs_bin_gc(v);
+    int sz = xs_size(gv);
+    char *data = xs_realloc(NULL, _xs_blk_size(XS_BIN_HDR_SIZE + sz));
+    char *p = data + XS_BIN_HDR_SIZE;
+
+    memcpy(p, gv, sz);
+
+    if (_xs_bin_conv(p, sz, 0) != sz)
+        return xs_free(data);
+
+    memcpy(data, XS_BIN_MAGIC, 4);
+    _xs_bin_put32(data + 4, sz);
+    _xs_bin_put32(data + 8, _xs_bin_sum(p, sz));
+    _xs_bin_put32(data + 12, 0);
+
+    *size = XS_BIN_HDR_SIZE + sz;
+
+    return data;
+}
+
+
+int xs_bin_dump(const xs_val *v, FILE *f)
+/* dumps a value to a file */
+{
+    int size;
+    xs *data = xs_bin_dumps(v, &size);
+
+    return data != NULL && fwrite(data, size, 1, f) == 1;
+}
+
+
+#endif /* XS_IMPLEMENTATION */
+
+#endif /* _XS_BIN_H */
@@ -11,9 +11,22 @@ xs_dict *xs_http_request(const char *method, const char *url,
 
 const char *xs_curl_strerr(int errnum);
 
+void xs_http_pool_init(int max_conns, int max_idle, long *n_requests, long *n_reused);
+
+void *xs_http_multi_new(void);
+void xs_http_multi_free(void *multi);
+int xs_http_multi_add(void *multi, const char *method, const char *url,
+                        const xs_dict *headers,
+                        const xs_str *body, int b_size, int timeout, void *ctx);
+int xs_http_multi_wait(void *multi, int timeout_ms);
+void xs_http_multi_wakeup(void *multi);
+void *xs_http_multi_next(void *multi, int *status, xs_dict **response,
+                        xs_str **payload, int *p_size, double *secs);
+
 #ifdef XS_IMPLEMENTATION
 
 #include <curl/curl.h>
+#include <pthread.h>
 
 static size_t _header_callback(char *buffer, size_t size,
                                size_t nitems, xs_dict **userdata)
@@ -86,23 +99,139 @@ static int _post_callback(char *buffer, size_t size,
 }
 
 
-xs_dict *xs_http_request(const char *method, const char *url,
-                        const xs_dict *headers,
-                        const xs_str *body, int b_size, int *status,
-                        xs_str **payload, int *p_size, int timeout)
-/* does an HTTP request */
+/** connection reuse **/
+
+/* once xs_http_pool_init() is called, the DNS and TLS session caches are
+   shared by all requests, and each thread keeps its curl handle (and its
+   connection cache) from a request to the next, so requests to the same
+   host go over already open connections */
+
+static CURLSH *_xs_http_share = NULL;
+static pthread_mutex_t _xs_http_share_lock[CURL_LOCK_DATA_LAST];
+static pthread_key_t _xs_http_handle_key;
+static int _xs_http_max_conns = 0;
+static int _xs_http_max_idle  = 0;
+
+/* statistics */
+static pthread_mutex_t _xs_http_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static long *_xs_http_n_requests = NULL;
+static long *_xs_http_n_reused   = NULL;
+
+
+static void _xs_http_lock(CURL *h, curl_lock_data data, curl_lock_access access, void *u)
+{
+    (void)h;
+    (void)access;
+    (void)u;
+
+    pthread_mutex_lock(&_xs_http_share_lock[data]);
+}
+
+
+static void _xs_http_unlock(CURL *h, curl_lock_data data, void *u)
 {
-    xs_dict *response;
+    (void)h;
+    (void)u;
+
+    pthread_mutex_unlock(&_xs_http_share_lock[data]);
+}
+
+
+static void _xs_http_handle_free(void *curl)
+/* frees the curl handle of a thread on exit */
+{
+    curl_easy_cleanup(curl);
+}
+
+
+void xs_http_pool_init(int max_conns, int max_idle, long *n_requests, long *n_reused)
+/* enables connection reuse; max_conns is the number of connections kept
+   open by each thread, max_idle the seconds an idle one is kept, and
+   the counters (that may be NULL) are updated on each request */
+{
+    int n;
+
+    if (_xs_http_share != NULL)
+        return;
+
+    for (n = 0; n < CURL_LOCK_DATA_LAST; n++)
+        pthread_mutex_init(&_xs_http_share_lock[n], NULL);
+
+    _xs_http_share = curl_share_init();
+
+    curl_share_setopt(_xs_http_share, CURLSHOPT_LOCKFUNC,   _xs_http_lock);
+    curl_share_setopt(_xs_http_share, CURLSHOPT_UNLOCKFUNC, _xs_http_unlock);
+    curl_share_setopt(_xs_http_share, CURLSHOPT_SHARE,      CURL_LOCK_DATA_DNS);
+    curl_share_setopt(_xs_http_share, CURLSHOPT_SHARE,      CURL_LOCK_DATA_SSL_SESSION);
+
+    /* connections are not shared between threads (libcurl does not
+       support it), but kept in each thread's handle */
+    pthread_key_create(&_xs_http_handle_key, _xs_http_handle_free);
+
+    _xs_http_max_conns  = max_conns;
+    _xs_http_max_idle   = max_idle;
+    _xs_http_n_requests = n_requests;
+    _xs_http_n_reused   = n_reused;
+}
+
+
+typedef struct _xs_http_req {
     CURL *curl;
-    struct curl_slist *list = NULL;
+    int keep;                   /* the handle is kept for the next request */
+    struct curl_slist *list;    /* request headers */
+    xs_dict *response;          /* response headers */
+    struct _payload_data pd;    /* data to be sent */
+    struct _payload_data ipd;   /* data received */
+    void *ctx;                  /* caller data (multi requests) */
+    struct _xs_http_req *prev;  /* running list (multi requests) */
+    struct _xs_http_req *next;
+} xs_http_req;
+
+typedef struct {
+    CURLM *multi;
+    xs_http_req *running;       /* list of unfinished requests */
+} xs_http_multi;
+
+
+static void _xs_http_setup(xs_http_req *req, const char *method, const char *url,
+                           const xs_dict *headers,
+                           const xs_str *body, int b_size, int timeout, int keep)
+/* prepares an HTTP request */
+{
+    CURL *curl = NULL;
     const xs_str *k;
     const xs_val *v;
-    long lstatus = 0;
-    struct _payload_data pd;
 
-    response = xs_dict_new();
+    req->response = xs_dict_new();
+    req->list     = NULL;
+    req->pd       = (struct _payload_data){ NULL, 0, 0 };
+    req->ipd      = (struct _payload_data){ NULL, 0, 0 };
+    req->keep     = 0;
+
+    if (keep && _xs_http_share != NULL) {
+        /* reuse this thread's handle */
+        if ((curl = pthread_getspecific(_xs_http_handle_key)) != NULL)
+            curl_easy_reset(curl);
+        else
+        if ((curl = curl_easy_init()) != NULL)
+            pthread_setspecific(_xs_http_handle_key, curl);
+
+        req->keep = 1;
+    }
+    else
+        curl = curl_easy_init();
+
+    req->curl = curl;
+
+    if (_xs_http_share != NULL) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, _xs_http_share);
+
+        if (_xs_http_max_conns > 0)
+            curl_easy_setopt(curl, CURLOPT_MAXCONNECTS, (long) _xs_http_max_conns);
 
-    curl = curl_easy_init();
+        if (_xs_http_max_idle > 0)
+            curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, (long) _xs_http_max_idle);
+    }
 
     curl_easy_setopt(curl, CURLOPT_URL, url);
 
@@ -120,11 +249,10 @@ xs_dict *xs_http_request(const char *method, const char *url,
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 
     /* store response headers here */
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA,     &response);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA,     &req->response);
     curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, _header_callback);
 
-    struct _payload_data ipd = { NULL, 0, 0 };
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA,      &ipd);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA,      &req->ipd);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,  _data_callback);
 
     if (strcmp(method, "POST") == 0 || strcmp(method, "PUT") == 0) {
@@ -138,11 +266,11 @@ xs_dict *xs_http_request(const char *method, const char *url,
             /* add the content-length header */
             curl_easy_setopt(curl, curl_method == CURLOPT_POST ? CURLOPT_POSTFIELDSIZE : CURLOPT_INFILESIZE, b_size);
 
-            pd.data = (char *)body;
-            pd.size = b_size;
-            pd.offset = 0;
+            req->pd.data = (char *)body;
+            req->pd.size = b_size;
+            req->pd.offset = 0;
 
-            curl_easy_setopt(curl, CURLOPT_READDATA,     &pd);
+            curl_easy_setopt(curl, CURLOPT_READDATA,     &req->pd);
             curl_easy_setopt(curl, CURLOPT_READFUNCTION, _post_callback);
         }
     }
@@ -151,22 +279,42 @@ xs_dict *xs_http_request(const char *method, const char *url,
     xs_dict_foreach(headers, k, v) {
         xs *h = xs_fmt("%s: %s", k, v);
 
-        list = curl_slist_append(list, h);
+        req->list = curl_slist_append(req->list, h);
     }
 
     /* disable server support for 100-continue */
-    list = curl_slist_append(list, "Expect:");
+    req->list = curl_slist_append(req->list, "Expect:");
 
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, req->list);
+}
 
-    /* do it */
-    CURLcode cc = curl_easy_perform(curl);
 
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &lstatus);
+static xs_dict *_xs_http_finish(xs_http_req *req, CURLcode cc, int *status,
+                                xs_str **payload, int *p_size)
+/* collects the result of a request and cleans it up */
+{
+    long lstatus = 0;
+    long n_conns = 0;
 
-    curl_easy_cleanup(curl);
+    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &lstatus);
+    curl_easy_getinfo(req->curl, CURLINFO_NUM_CONNECTS, &n_conns);
+
+    if (_xs_http_n_requests != NULL && lstatus > 0) {
+        /* a response without new connections went over a reused one */
+        pthread_mutex_lock(&_xs_http_stats_lock);
 
-    curl_slist_free_all(list);
+        (*_xs_http_n_requests)++;
+
+        if (n_conns == 0 && _xs_http_n_reused != NULL)
+            (*_xs_http_n_reused)++;
+
+        pthread_mutex_unlock(&_xs_http_stats_lock);
+    }
+
+    if (!req->keep)
+        curl_easy_cleanup(req->curl);
+
+    curl_slist_free_all(req->list);
 
     if (status != NULL) {
         if (lstatus == 0) {
@@ -181,19 +329,198 @@ xs_dict *xs_http_request(const char *method, const char *url,
     }
 
     if (p_size != NULL)
-        *p_size = ipd.size;
+        *p_size = req->ipd.size;
 
     if (payload != NULL) {
-        *payload = ipd.data;
+        *payload = req->ipd.data;
 
         /* add an asciiz just in case (but not touching p_size) */
-        if (ipd.data != NULL)
-            ipd.data[ipd.size] = '\0';
+        if (req->ipd.data != NULL)
+            req->ipd.data[req->ipd.size] = '\0';
     }
     else
-        xs_free(ipd.data);
+        xs_free(req->ipd.data);
+
+    return req->response;
+}
+
+
+xs_dict *xs_http_request(const char *method, const char *url,
+                        const xs_dict *headers,
+                        const xs_str *body, int b_size, int *status,
+                        xs_str **payload, int *p_size, int timeout)
+/* does an HTTP request */
+{
+    xs_http_req req;
+
+    _xs_http_setup(&req, method, url, headers, body, b_size, timeout, 1);
+
+    /* do it */
+    CURLcode cc = curl_easy_perform(req.curl);
+
+    return _xs_http_finish(&req, cc, status, payload, p_size);
+}
+
+
+/** concurrent requests **/
+
+void *xs_http_multi_new(void)
+/* creates a set of concurrent HTTP requests */
+{
+    xs_http_multi *m = xs_realloc(NULL, sizeof(xs_http_multi));
+
+    m->multi   = curl_multi_init();
+    m->running = NULL;
+
+    return m;
+}
+
+
+static void *_xs_http_multi_del(xs_http_multi *m, xs_http_req *req)
+/* unlinks a finished request and frees it, returning its ctx */
+{
+    void *ctx = req->ctx;
+
+    if (req->prev)
+        req->prev->next = req->next;
+    else
+        m->running = req->next;
+
+    if (req->next)
+        req->next->prev = req->prev;
+
+    xs_free(req->pd.data);
+    xs_free(req);
+
+    return ctx;
+}
+
+
+void xs_http_multi_free(void *multi)
+/* frees a set of concurrent requests, aborting the unfinished ones
+   (their ctx is not returned, so the caller must keep track of them) */
+{
+    xs_http_multi *m = multi;
+
+    while (m->running) {
+        xs_http_req *req = m->running;
+
+        curl_multi_remove_handle(m->multi, req->curl);
+
+        xs *response = _xs_http_finish(req, CURLE_ABORTED_BY_CALLBACK, NULL, NULL, NULL);
+
+        _xs_http_multi_del(m, req);
+    }
+
+    curl_multi_cleanup(m->multi);
+    xs_free(m);
+}
+
+
+int xs_http_multi_add(void *multi, const char *method, const char *url,
+                        const xs_dict *headers,
+                        const xs_str *body, int b_size, int timeout, void *ctx)
+/* starts a new request (the body is copied) */
+{
+    xs_http_multi *m = multi;
+    xs_http_req *req = xs_realloc(NULL, sizeof(xs_http_req));
+    char *data = NULL;
+
+    if (body != NULL) {
+        if (b_size <= 0)
+            b_size = xs_size(body);
+
+        data = xs_realloc(NULL, b_size + 1);
+        memcpy(data, body, b_size);
+    }
+
+    _xs_http_setup(req, method, url, headers, data, b_size, timeout, 0);
+
+    /* the body is only used on POST and PUT */
+    if (req->pd.data != data)
+        xs_free(data);
+
+    req->ctx  = ctx;
+    req->prev = NULL;
+    req->next = m->running;
+
+    if (m->running)
+        m->running->prev = req;
+
+    m->running = req;
+
+    curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+
+    if (curl_multi_add_handle(m->multi, req->curl) != CURLM_OK) {
+        /* not started: clean it up, the caller still owns ctx */
+        xs *response = _xs_http_finish(req, CURLE_FAILED_INIT, NULL, NULL, NULL);
+
+        _xs_http_multi_del(m, req);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+
+int xs_http_multi_wait(void *multi, int timeout_ms)
+/* moves the requests forward, waiting up to timeout_ms for activity;
+   returns the number of requests still running */
+{
+    xs_http_multi *m = multi;
+    int running = 0;
+
+    curl_multi_perform(m->multi, &running);
+    curl_multi_poll(m->multi, NULL, 0, timeout_ms, NULL);
+    curl_multi_perform(m->multi, &running);
+
+    return running;
+}
+
+
+void xs_http_multi_wakeup(void *multi)
+/* interrupts an xs_http_multi_wait() from another thread */
+{
+    xs_http_multi *m = multi;
+
+    curl_multi_wakeup(m->multi);
+}
+
+
+void *xs_http_multi_next(void *multi, int *status, xs_dict **response,
+                        xs_str **payload, int *p_size, double *secs)
+/* returns the ctx of the next finished request, or NULL */
+{
+    xs_http_multi *m = multi;
+    CURLMsg *msg;
+    int left;
+
+    while ((msg = curl_multi_info_read(m->multi, &left)) != NULL) {
+        if (msg->msg == CURLMSG_DONE) {
+            xs_http_req *req = NULL;
+            CURLcode cc = msg->data.result;
+
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req);
+
+            if (secs != NULL)
+                curl_easy_getinfo(req->curl, CURLINFO_TOTAL_TIME, secs);
+
+            /* take it out of the multi handle before cleaning it up */
+            curl_multi_remove_handle(m->multi, req->curl);
+
+            xs_dict *r = _xs_http_finish(req, cc, status, payload, p_size);
+
+            if (response != NULL)
+                *response = r;
+            else
+                xs_free(r);
+
+            return _xs_http_multi_del(m, req);
+        }
+    }
 
-    return response;
+    return NULL;
 }
 
 
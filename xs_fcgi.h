@@ -2,31 +2,17 @@
 
 /*
     This is an intentionally-dead-simple FastCGI implementation;
-    only FCGI_RESPONDER type with *no* FCGI_KEEP_CON flag is supported.
-    This means only one simultaneous connection and no multiplexing.
-    It seems it's enough for nginx and OpenBSD's httpd, so here it goes.
-    Almost fully compatible with xs_httpd.h
+    only FCGI_RESPONDER type is supported. xs_fcgi_request() reads
+    one request at a time, so connections can be kept (FCGI_KEEP_CONN)
+    but not multiplexed; for that, the records of each request id must
+    be separated beforehand (see xs_fcgi_record()) and fed to it one
+    request at a time. Almost fully compatible with xs_httpd.h
 */
 
 #ifndef _XS_FCGI_H
 
 #define _XS_FCGI_H
 
- xs_dict *xs_fcgi_request(FILE *f, xs_str **payload, int *p_size, int *id);
- void xs_fcgi_response(FILE *f, int status, xs_dict *headers, xs_str *body, int b_size, int id);
-
-
-#ifdef XS_IMPLEMENTATION
-
-struct fcgi_record_header {
-    unsigned char  version;
-    unsigned char  type;
-    unsigned short id;
-    unsigned short content_len;
-    unsigned char  padding_len;
-    unsigned char  reserved;
-} __attribute__((packed));
-
 /* version */
 
 #define FCGI_VERSION_1           1
@@ -46,6 +32,35 @@ struct fcgi_record_header {
 #define FCGI_UNKNOWN_TYPE       11
 #define FCGI_MAXTYPE (FCGI_UNKNOWN_TYPE)
 
+/* flags */
+
+#define FCGI_KEEP_CONN  1
+
+/* protocol statuses */
+
+#define FCGI_REQUEST_COMPLETE 0
+#define FCGI_CANT_MPX_CONN    1
+#define FCGI_OVERLOADED       2
+#define FCGI_UNKNOWN_ROLE     3
+
+
+ xs_dict *xs_fcgi_request(FILE *f, xs_str **payload, int *p_size, int *id, int *keep_conn);
+ void xs_fcgi_response(FILE *f, int status, xs_dict *headers, xs_str *body, int b_size, int id);
+ int xs_fcgi_record(const char *buf, int size, int *type, int *id, int *flags);
+ int xs_fcgi_end_record(char *buf, int type, int id, int p_status);
+
+
+#ifdef XS_IMPLEMENTATION
+
+struct fcgi_record_header {
+    unsigned char  version;
+    unsigned char  type;
+    unsigned short id;
+    unsigned short content_len;
+    unsigned char  padding_len;
+    unsigned char  reserved;
+} __attribute__((packed));
+
 struct fcgi_begin_request {
     unsigned short role;
     unsigned char  flags;
@@ -58,25 +73,13 @@ struct fcgi_begin_request {
 #define FCGI_AUTHORIZER 2
 #define FCGI_FILTER     3
 
-/* flags */
-
-#define FCGI_KEEP_CONN  1
-
 struct fcgi_end_request {
     unsigned int app_status;
     unsigned char protocol_status;
     unsigned char reserved[3];
 } __attribute__((packed));
 
-/* protocol statuses */
-
-#define FCGI_REQUEST_COMPLETE 0
-#define FCGI_CANT_MPX_CONN    1
-#define FCGI_OVERLOADED       2
-#define FCGI_UNKNOWN_ROLE     3
-
-
-xs_dict *xs_fcgi_request(FILE *f, xs_str **payload, int *p_size, int *fcgi_id)
+xs_dict *xs_fcgi_request(FILE *f, xs_str **payload, int *p_size, int *fcgi_id, int *keep_conn)
 /* keeps receiving FCGI packets until a complete request is finished */
 {
     unsigned char p_buf[100000];
@@ -89,7 +92,8 @@ xs_dict *xs_fcgi_request(FILE *f, xs_str **payload, int *p_size, int *fcgi_id)
     xs *q_vars = NULL;
     xs *p_vars = NULL;
 
-    *fcgi_id = -1;
+    *fcgi_id   = -1;
+    *keep_conn = 0;
 
     for (;;) {
         int sz, psz;
@@ -106,7 +110,7 @@ xs_dict *xs_fcgi_request(FILE *f, xs_str **payload, int *p_size, int *fcgi_id)
 
         /* read (and drop) the padding */
         if (hdr.padding_len > 0)
-            fread(p_buf + sz, 1, hdr.padding_len, f);
+            fread(p_buf + psz, 1, hdr.padding_len, f);
 
         switch (hdr.type) {
         case FCGI_BEGIN_REQUEST:
@@ -116,11 +120,8 @@ xs_dict *xs_fcgi_request(FILE *f, xs_str **payload, int *p_size, int *fcgi_id)
                 goto end;
             }
 
-            /* fail on unsupported flags */
-            if (breq->flags & FCGI_KEEP_CONN) {
-                p_status = FCGI_CANT_MPX_CONN;
-                goto end;
-            }
+            /* the connection is not to be closed after this request */
+            *keep_conn = (breq->flags & FCGI_KEEP_CONN) != 0;
 
             /* store the id for later */
             *fcgi_id = (int) hdr.id;
@@ -272,8 +273,10 @@ end:
         ereq.protocol_status = p_status;
 
         /* reuse header */
-        hdr.type        = FCGI_ABORT_REQUEST;
+        hdr.version     = FCGI_VERSION_1;
+        hdr.type        = FCGI_END_REQUEST;
         hdr.content_len = htons(sizeof(ereq));
+        hdr.padding_len = 0;
 
         fwrite(&hdr, sizeof(hdr), 1, f);
         fwrite(&ereq, sizeof(ereq), 1, f);
@@ -368,6 +371,71 @@ void xs_fcgi_response(FILE *f, int status, xs_dict *headers, xs_str *body, int b
 }
 
 
+int xs_fcgi_record(const char *buf, int size, int *type, int *id, int *flags)
+/* checks if buf starts with a complete record; returns its size
+   (or 0 if it's not complete yet), and fills its type and id and,
+   if it's a FCGI_BEGIN_REQUEST, its flags */
+{
+    struct fcgi_record_header hdr;
+    int r_size;
+
+    if (size < (int)sizeof(hdr))
+        return 0;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    r_size = sizeof(hdr) + ntohs(hdr.content_len) + hdr.padding_len;
+
+    if (size < r_size)
+        return 0;
+
+    *type  = hdr.type;
+    *id    = ntohs(hdr.id);
+    *flags = 0;
+
+    if (hdr.type == FCGI_BEGIN_REQUEST && ntohs(hdr.content_len) >= sizeof(struct fcgi_begin_request)) {
+        const struct fcgi_begin_request *breq = (const void *)(buf + sizeof(hdr));
+        *flags = breq->flags;
+    }
+
+    return r_size;
+}
+
+
+int xs_fcgi_end_record(char *buf, int type, int id, int p_status)
+/* writes into buf (of at least 16 bytes) a FCGI_END_REQUEST record with
+   p_status or, if type is not a request type, a FCGI_UNKNOWN_TYPE record
+   or a FCGI_GET_VALUES_RESULT record with no values; returns its size */
+{
+    struct fcgi_record_header hdr = {0};
+    unsigned char body[8] = {0};
+
+    hdr.version     = FCGI_VERSION_1;
+    hdr.id          = htons(id);
+    hdr.content_len = htons(sizeof(body));
+
+    if (type == FCGI_GET_VALUES) {
+        /* we don't tell anything (the defaults are fine) */
+        hdr.type        = FCGI_GET_VALUES_RESULT;
+        hdr.content_len = 0;
+    }
+    else
+    if (type > FCGI_MAXTYPE || type == FCGI_GET_VALUES_RESULT || type == FCGI_UNKNOWN_TYPE) {
+        hdr.type = FCGI_UNKNOWN_TYPE;
+        body[0]  = type;
+    }
+    else {
+        hdr.type = FCGI_END_REQUEST;
+        body[4]  = p_status;
+    }
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), body, sizeof(body));
+
+    return sizeof(hdr) + ntohs(hdr.content_len);
+}
+
+
 #endif /* XS_IMPLEMENTATION */
 
 #endif /* XS_URL_H */
@@ -18,8 +18,15 @@ xs_dict *xs_httpd_request(FILE *f, xs_str **payload, int *p_size)
     xs *l1;
     const char *v;
     char *saveptr;
+    int bad_frame = 0;
 
-    xs_socket_timeout(fileno(f), 2.0, 0.0);
+    /* (it may also be a memory stream) */
+    int fd = fileno(f);
+
+    if (fd != -1)
+        xs_socket_timeout(fd, 2.0, 0.0);
+
+    errno = 0;
 
     /* read the first line and split it */
     l1 = xs_strip_i(xs_readline(f));
@@ -58,7 +65,13 @@ xs_dict *xs_httpd_request(FILE *f, xs_str **payload, int *p_size)
     for (;;) {
         xs *l;
 
-        l = xs_strip_i(xs_readline(f));
+        l = xs_readline(f);
+
+        /* folded lines could hide a header from a proxy in front */
+        if (*l == ' ' || *l == '\t')
+            bad_frame = 1;
+
+        l = xs_strip_i(l);
 
         /* done with the header? */
         if (strcmp(l, "") == 0)
@@ -71,15 +84,34 @@ xs_dict *xs_httpd_request(FILE *f, xs_str **payload, int *p_size)
 
         *cnt++ = '\0';
         cnt += strspn(cnt, " \r\n\t\v\f");
-        l = xs_rstrip_chars_i(l, " \r\n\t\v\f");
+
+        /* no whitespace is allowed between the name and the colon */
+        if (l[strcspn(l, " \r\n\t\v\f")] != '\0')
+            bad_frame = 1;
 
         if (!xs_is_string(cnt))
             continue;
 
-        req = xs_dict_append(req, xs_tolower_i(l), cnt);
+        l = xs_tolower_i(l);
+
+        /* the body must be delimited by a single, valid content length;
+           transfer encodings (chunked bodies) are not supported */
+        if (strcmp(l, "transfer-encoding") == 0 ||
+            (strcmp(l, "content-length") == 0 &&
+            (xs_dict_get(req, l) != NULL || *cnt == '\0' || cnt[strspn(cnt, "0123456789")] != '\0')))
+            bad_frame = 1;
+
+        req = xs_dict_append(req, l, cnt);
+    }
+
+    if (bad_frame) {
+        /* what follows can't be told apart from the next request */
+        errno = EINVAL;
+        return xs_free(req);
     }
 
-    xs_socket_timeout(fileno(f), 5.0, 0.0);
+    if (fd != -1)
+        xs_socket_timeout(fd, 5.0, 0.0);
 
     if ((v = xs_dict_get(req, "content-length")) != NULL) {
         /* if it has a payload, load it */
@@ -123,7 +155,8 @@ void xs_httpd_response(FILE *f, int status, const char *status_text, xs_dict *he
         fprintf(f, "%s: %s\r\n", k, v);
     }
 
-    if (b_size != 0)
+    /* always tell the size, as the connection may be kept open */
+    if (status >= 200 && status != 204 && status != 304)
         fprintf(f, "content-length: %d\r\n", b_size);
 
     fprintf(f, "\r\n");
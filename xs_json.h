@@ -10,74 +10,153 @@
 
 int xs_json_dump(const xs_val *data, int indent, FILE *f);
 xs_str *xs_json_dumps(const xs_val *data, int indent);
+xs_str *xs_json_dumps_cat(xs_str *str, const xs_val *data, int indent);
 
 xs_val *xs_json_load_full(FILE *f, int maxdepth);
 xs_val *xs_json_loads_full(const xs_str *json, int maxdepth);
+xs_val *xs_json_loadm_full(const char *data, int size, int maxdepth);
 #define xs_json_load(f) xs_json_load_full(f, MAX_JSON_DEPTH)
 #define xs_json_loads(s) xs_json_loads_full(s, MAX_JSON_DEPTH)
 
-xstype xs_json_load_type(FILE *f);
-int xs_json_load_array_iter(FILE *f, xs_val **value, xstype *pt, int *c);
-int xs_json_load_object_iter(FILE *f, xs_str **key, xs_val **value, xstype *pt, int *c);
-xs_list *xs_json_load_array(FILE *f, int maxdepth);
-xs_dict *xs_json_load_object(FILE *f, int maxdepth);
-
 
 #ifdef XS_IMPLEMENTATION
 
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /** IMPLEMENTATION **/
 
 /** JSON dumps **/
 
-static void _xs_json_dump_str(const char *data, FILE *f)
+/* output grows in a memory buffer; xs_json_dumps() returns it as is */
+
+typedef struct {
+    char *s;            /* buffer */
+    int len;            /* used size */
+    int size;           /* allocated size */
+} xs_json_out;
+
+
+static void _xs_json_grow(xs_json_out *o, int n)
+/* makes room for n more bytes (and an asciiz) */
+{
+    if (o->len + n + 1 > o->size) {
+        o->size = (o->len + n + 1) * 2;
+        o->s    = xs_realloc(o->s, o->size);
+    }
+}
+
+
+static void _xs_json_put(xs_json_out *o, const char *mem, int n)
+/* adds a memory block */
+{
+    _xs_json_grow(o, n);
+    memcpy(o->s + o->len, mem, n);
+    o->len += n;
+}
+
+
+static void _xs_json_putc(xs_json_out *o, char c)
+/* adds a char */
+{
+    _xs_json_grow(o, 1);
+    o->s[o->len++] = c;
+}
+
+
+static const char *_xs_json_safe(const char *p, const char *e)
+/* returns the first char from p that must be escaped (or e, if none) */
+{
+#ifdef __SSE2__
+    const __m128i q  = _mm_set1_epi8('"');
+    const __m128i b  = _mm_set1_epi8('\\');
+    const __m128i cc = _mm_set1_epi8(31);
+
+    while (e - p >= 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)p);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, q), _mm_cmpeq_epi8(c, b)),
+                    _mm_cmpeq_epi8(_mm_max_epu8(c, cc), cc));
+        int mask  = _mm_movemask_epi8(m);
+
+        if (mask)
+            return p + __builtin_ctz(mask);
+
+        p += 16;
+    }
+#endif
+
+    while (p < e && (unsigned char)*p >= 32 && *p != '"' && *p != '\\')
+        p++;
+
+    return p;
+}
+
+
+static void _xs_json_dump_str(const char *data, xs_json_out *o)
 /* dumps a string in JSON format */
 {
-    unsigned char c;
-    fputs("\"", f);
+    const char *e = data + strlen(data);
+
+    /* most strings need no escaping at all */
+    _xs_json_grow(o, e - data + 2);
+    o->s[o->len++] = '"';
+
+    while (data < e) {
+        const char *s = _xs_json_safe(data, e);
+
+        /* bulk copy up to the next char to be escaped */
+        _xs_json_put(o, data, s - data);
+        data = s;
+
+        if (data == e)
+            break;
+
+        unsigned char c = *data++;
 
-    while ((c = *data)) {
         if (c == '\n')
-            fputs("\\n", f);
+            _xs_json_put(o, "\\n", 2);
         else
         if (c == '\r')
-            fputs("\\r", f);
+            _xs_json_put(o, "\\r", 2);
         else
         if (c == '\t')
-            fputs("\\t", f);
+            _xs_json_put(o, "\\t", 2);
         else
         if (c == '\\')
-            fputs("\\\\", f);
+            _xs_json_put(o, "\\\\", 2);
         else
         if (c == '"')
-            fputs("\\\"", f);
-        else
-        if (c < 32)
-            fprintf(f, "\\u%04x", (unsigned int) c);
-        else
-            fputc(c, f);
+            _xs_json_put(o, "\\\"", 2);
+        else {
+            char tmp[8];
 
-        data++;
+            snprintf(tmp, sizeof(tmp), "\\u%04x", (unsigned int) c);
+            _xs_json_put(o, tmp, 6);
+        }
     }
 
-    fputs("\"", f);
+    _xs_json_putc(o, '"');
 }
 
 
-static void _xs_json_indent(int level, int indent, FILE *f)
+static void _xs_json_indent(int level, int indent, xs_json_out *o)
 /* adds indentation */
 {
     if (indent) {
-        int n;
-
-        fputc('\n', f);
+        int n = level * indent;
 
-        for (n = 0; n < level * indent; n++)
-            fputc(' ', f);
+        _xs_json_grow(o, n + 1);
+        o->s[o->len++] = '\n';
+        memset(o->s + o->len, ' ', n);
+        o->len += n;
     }
 }
 
 
-static void _xs_json_dump(const xs_val *data, int level, int indent, FILE *f)
+static void _xs_json_dump(const xs_val *data, int level, int indent, xs_json_out *o)
 /* dumps partial data as JSON */
 {
     int c = 0;
@@ -85,67 +164,68 @@ static void _xs_json_dump(const xs_val *data, int level, int indent, FILE *f)
 
     switch (xs_type(data)) {
     case XSTYPE_NULL:
-        fputs("null", f);
+        _xs_json_put(o, "null", 4);
         break;
 
     case XSTYPE_TRUE:
-        fputs("true", f);
+        _xs_json_put(o, "true", 4);
         break;
 
     case XSTYPE_FALSE:
-        fputs("false", f);
+        _xs_json_put(o, "false", 5);
         break;
 
     case XSTYPE_NUMBER:
-        fputs(xs_number_str(data), f);
+        v = xs_number_str(data);
+        _xs_json_put(o, v, strlen(v));
         break;
 
     case XSTYPE_LIST:
-        fputc('[', f);
+        _xs_json_putc(o, '[');
 
         xs_list_foreach(data, v) {
             if (c != 0)
-                fputc(',', f);
+                _xs_json_putc(o, ',');
 
-            _xs_json_indent(level + 1, indent, f);
-            _xs_json_dump(v, level + 1, indent, f);
+            _xs_json_indent(level + 1, indent, o);
+            _xs_json_dump(v, level + 1, indent, o);
 
             c++;
         }
 
-        _xs_json_indent(level, indent, f);
-        fputc(']', f);
+        _xs_json_indent(level, indent, o);
+        _xs_json_putc(o, ']');
 
         break;
 
     case XSTYPE_DICT:
-        fputc('{', f);
+        _xs_json_putc(o, '{');
 
         const xs_str *k;
 
         xs_dict_foreach(data, k, v) {
             if (c != 0)
-                fputc(',', f);
+                _xs_json_putc(o, ',');
 
-            _xs_json_indent(level + 1, indent, f);
+            _xs_json_indent(level + 1, indent, o);
 
-            _xs_json_dump_str(k, f);
-            fputc(':', f);
+            _xs_json_dump_str(k, o);
+            _xs_json_putc(o, ':');
 
             if (indent)
-                fputc(' ', f);
+                _xs_json_putc(o, ' ');
 
-            _xs_json_dump(v, level + 1, indent, f);
+            _xs_json_dump(v, level + 1, indent, o);
 
             c++;
         }
 
-        _xs_json_indent(level, indent, f);
-        fputc('}', f);
+        _xs_json_indent(level, indent, o);
+        _xs_json_putc(o, '}');
         break;
 
     case XSTYPE_STRING:
-        _xs_json_dump_str(data, f);
+        _xs_json_dump_str(data, o);
         break;
 
     default:
@@ -154,32 +234,50 @@ static void _xs_json_dump(const xs_val *data, int level, int indent, FILE *f)
 }
 
 
-xs_str *xs_json_dumps(const xs_val *data, int indent)
-/* dumps data as a JSON string */
+xs_str *xs_json_dumps_cat(xs_str *str, const xs_val *data, int indent)
+/* dumps data as JSON at the end of str (a new string if it's NULL) */
 {
-    xs_str *s = NULL;
-    size_t sz;
-    FILE *f;
+    xstype t = xs_type(data);
+
+    if (t == XSTYPE_LIST || t == XSTYPE_DICT) {
+        if (str == NULL)
+            str = xs_str_new(NULL);
+
+        int len = strlen(str);
+        xs_json_out o = { str, len, len + 1 };
 
-    if ((f = open_memstream(&s, &sz)) != NULL) {
-        int r = xs_json_dump(data, indent, f);
-        fclose(f);
+        /* a rough guess of the final size */
+        _xs_json_grow(&o, xs_size(data) + xs_size(data) / 4);
 
-        if (!r)
-            s = xs_free(s);
+        _xs_json_dump(data, 0, indent, &o);
+
+        o.s[o.len] = '\0';
+        str = o.s;
     }
 
-    return s;
+    return str;
+}
+
+
+xs_str *xs_json_dumps(const xs_val *data, int indent)
+/* dumps data as a JSON string */
+{
+    xstype t = xs_type(data);
+
+    if (t == XSTYPE_LIST || t == XSTYPE_DICT)
+        return xs_json_dumps_cat(NULL, data, indent);
+
+    return NULL;
 }
 
 
 int xs_json_dump(const xs_val *data, int indent, FILE *f)
 /* dumps data into a file as JSON */
 {
-    xstype t = xs_type(data);
+    xs *s = xs_json_dumps(data, indent);
 
-    if (t == XSTYPE_LIST || t == XSTYPE_DICT) {
-        _xs_json_dump(data, 0, indent, f);
+    if (s != NULL) {
+        fwrite(s, strlen(s), 1, f);
         return 1;
     }
 
@@ -208,17 +306,264 @@ typedef enum {
     JS_OBJECT
 } js_type;
 
+/* all loaders parse from memory, scanning the data in bulk
+   instead of pulling it char by char through stdio */
 
-static xs_val *_xs_json_load_lexer(FILE *f, js_type *t)
+typedef struct {
+    const char *p;      /* current position */
+    const char *e;      /* end of data */
+} xs_json_mem;
+
+
+static const char *_xs_json_mem_special(const char *p, const char *e)
+/* returns the first quote or backslash from p (or e, if none) */
+{
+#ifdef __SSE2__
+    const __m128i q = _mm_set1_epi8('"');
+    const __m128i b = _mm_set1_epi8('\\');
+
+    while (e - p >= 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)p);
+        int mask  = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(c, q), _mm_cmpeq_epi8(c, b)));
+
+        if (mask)
+            return p + __builtin_ctz(mask);
+
+        p += 16;
+    }
+#endif
+
+    while (p < e && *p != '"' && *p != '\\')
+        p++;
+
+    return p;
+}
+
+
+static int _xs_json_mem_hex(xs_json_mem *m, const char *e, unsigned int *cp)
+/* reads up to 4 hex digits (like fscanf's %04x) */
+{
+    int n;
+
+    *cp = 0;
+
+    for (n = 0; n < 4 && m->p < e; n++) {
+        int c = *m->p;
+
+        if (c >= '0' && c <= '9')
+            c -= '0';
+        else
+        if (c >= 'a' && c <= 'f')
+            c -= 'a' - 10;
+        else
+        if (c >= 'A' && c <= 'F')
+            c -= 'A' - 10;
+        else
+            break;
+
+        *cp = (*cp << 4) | c;
+        m->p++;
+    }
+
+    return n > 0;
+}
+
+
+static xs_str *_xs_json_mem_string(xs_json_mem *m)
+/* reads a string (after the initial quote) */
+{
+    const char *p = m->p;
+    xs_str *v;
+    int offset = 0;
+
+    /* find the closing quote first, to allocate the string only once:
+       no escape sequence expands, so the raw size is an upper bound */
+    for (;;) {
+        p = _xs_json_mem_special(p, m->e);
+
+        if (p == m->e)
+            return NULL;
+
+        if (*p == '"')
+            break;
+
+        /* skip the escaped char */
+        if ((p += 2) > m->e)
+            return NULL;
+    }
+
+    v = xs_realloc(NULL, _xs_blk_size(p - m->p + 1));
+
+    for (;;) {
+        const char *s = _xs_json_mem_special(m->p, p);
+
+        /* bulk copy up to the next escape */
+        memcpy(v + offset, m->p, s - m->p);
+        offset += s - m->p;
+        m->p = s;
+
+        if (m->p == p)
+            break;
+
+        /* escape sequence */
+        unsigned int cp = (unsigned char)m->p[1];
+        char tmp[4];
+
+        m->p += 2;
+
+        switch (cp) {
+        case 'n': cp = '\n'; break;
+        case 'r': cp = '\r'; break;
+        case 't': cp = '\t'; break;
+        case 'u': /* Unicode codepoint as an hex char */
+            if (!_xs_json_mem_hex(m, p, &cp))
+                return xs_free(v);
+
+            if (xs_is_surrogate(cp)) {
+                unsigned int p2;
+
+                /* \u must follow */
+                if (p - m->p < 2 || m->p[0] != '\\' || m->p[1] != 'u')
+                    return xs_free(v);
+
+                m->p += 2;
+
+                if (!_xs_json_mem_hex(m, p, &p2))
+                    return xs_free(v);
+
+                cp = xs_surrogate_dec(cp, p2);
+            }
+
+            /* replace dangerous control codes with their visual representations */
+            if (cp < ' ' && !strchr("\r\n\t", cp))
+                cp += 0x2400;
+
+            break;
+        }
+
+        int c = xs_utf8_enc(tmp, cp);
+        memcpy(v + offset, tmp, c);
+        offset += c;
+    }
+
+    v[offset] = '\0';
+
+    /* skip the closing quote */
+    m->p = p + 1;
+
+    return v;
+}
+
+
+static xs_number *_xs_json_mem_number(xs_json_mem *m)
+/* reads a number */
+{
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char *p = m->p;
+    uint64_t mant = 0;
+    int digits = 0, sig = 0, exp10 = 0, neg = 0;
+    double d;
+
+    if (p < m->e && *p == '-') {
+        neg = 1;
+        p++;
+    }
+
+    for (; p < m->e && *p >= '0' && *p <= '9'; p++, digits++) {
+        if (sig < 19) {
+            mant = mant * 10 + (*p - '0');
+            sig += mant != 0;
+        }
+        else
+            exp10++;
+    }
+
+    if (p < m->e && *p == '.') {
+        for (p++; p < m->e && *p >= '0' && *p <= '9'; p++, digits++) {
+            if (sig < 19) {
+                mant = mant * 10 + (*p - '0');
+                sig += mant != 0;
+                exp10--;
+            }
+        }
+    }
+
+    if (digits && p < m->e && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int eneg = 0, e = 0;
+
+        if (q < m->e && (*q == '-' || *q == '+'))
+            eneg = *q++ == '-';
+
+        /* like scanf(), a dangling exponent is eaten and ignored */
+        for (; q < m->e && *q >= '0' && *q <= '9'; q++) {
+            if (e < 10000)
+                e = e * 10 + (*q - '0');
+        }
+
+        exp10 += eneg ? -e : e;
+        p = q;
+    }
+
+    /* the exact case: both the mantissa and the power of 10 are exact
+       doubles, so a single operation gives the correctly rounded value;
+       anything else (or anything funny following) is left to strtod() */
+    if (digits && mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22 &&
+        (p == m->e || !(isalnum((unsigned char)*p) || *p == '.'))) {
+        d = (double)mant;
+
+        if (exp10 < 0)
+            d /= pow10[-exp10];
+        else
+            d *= pow10[exp10];
+
+        if (neg)
+            d = -d;
+
+        m->p = p;
+    }
+    else {
+        char tmp[64];
+        char *end;
+        int n;
+
+        for (p = m->p, n = 0; p < m->e && n < (int)sizeof(tmp) - 1 &&
+            (isalnum((unsigned char)*p) || strchr("+-.", *p)); p++)
+            tmp[n++] = *p;
+
+        tmp[n] = '\0';
+
+        d = strtod(tmp, &end);
+
+        if (end == tmp)
+            return NULL;
+
+        m->p += end - tmp;
+    }
+
+    return xs_number_new(d);
+}
+
+
+static xs_val *_xs_json_mem_lexer(xs_json_mem *m, js_type *t)
+/* returns the next token from memory */
 {
-    int c;
     xs_val *v = NULL;
-    int offset;
+    int c;
 
     *t = JS_ERROR;
 
     /* skip blanks */
-    while ((c = fgetc(f)) == ' ' || c == '\t' || c == '\n' || c == '\r');
+    while (m->p < m->e && (*m->p == ' ' || *m->p == '\t' || *m->p == '\n' || *m->p == '\r'))
+        m->p++;
+
+    if (m->p == m->e)
+        return NULL;
+
+    c = *m->p++;
 
     if (c == '{')
         *t = JS_OCURLY;
@@ -239,317 +584,266 @@ static xs_val *_xs_json_load_lexer(FILE *f, js_type *t)
         *t = JS_COLON;
     else
     if (c == '"') {
-        *t = JS_STRING;
-
-        v = xs_str_new(NULL);
-        offset = 0;
-
-        while ((c = fgetc(f)) != '"' && c != EOF && *t != JS_ERROR) {
-            if (c == '\\') {
-                unsigned int cp = fgetc(f);
-
-                switch (cp) {
-                case 'n': cp = '\n'; break;
-                case 'r': cp = '\r'; break;
-                case 't': cp = '\t'; break;
-                case 'u': /* Unicode codepoint as an hex char */
-                    if (fscanf(f, "%04x", &cp) != 1) {
-                        *t = JS_ERROR;
-                        break;
-                    }
-
-                    if (xs_is_surrogate(cp)) {
-                        /* \u must follow */
-                        if (fgetc(f) != '\\' || fgetc(f) != 'u') {
-                            *t = JS_ERROR;
-                            break;
-                        }
-
-                        unsigned int p2;
-                        if (fscanf(f, "%04x", &p2) != 1) {
-                            *t = JS_ERROR;
-                            break;
-                        }
-
-                        cp = xs_surrogate_dec(cp, p2);
-                    }
-
-                    /* replace dangerous control codes with their visual representations */
-                    if (cp < ' ' && !strchr("\r\n\t", cp))
-                        cp += 0x2400;
-
-                    break;
-                }
-
-                v = xs_utf8_insert(v, cp, &offset);
-            }
-            else {
-                char cc = c;
-                v = xs_insert_m(v, offset, &cc, 1);
-
-                if (!xs_is_string(v)) {
-                    *t = JS_ERROR;
-                    break;
-                }
-
-                offset++;
-            }
+        const char *s = m->p;
+
+        if ((v = _xs_json_mem_string(m)) != NULL) {
+            /* a raw first char must not be taken as a type */
+            if (*s != '\\' && !xs_is_string(v))
+                v = xs_free(v);
+            else
+                *t = JS_STRING;
         }
-
-        if (c == EOF)
-            *t = JS_ERROR;
     }
     else
     if (c == '-' || (c >= '0' && c <= '9') || c == '.') {
-        double d;
+        m->p--;
 
-        ungetc(c, f);
-        if (fscanf(f, "%lf", &d) == 1) {
+        if ((v = _xs_json_mem_number(m)) != NULL)
             *t = JS_NUMBER;
-            v = xs_number_new(d);
-        }
     }
     else
     if (c == 't') {
-        if (fgetc(f) == 'r' && fgetc(f) == 'u' && fgetc(f) == 'e') {
+        if (m->e - m->p >= 3 && memcmp(m->p, "rue", 3) == 0) {
+            m->p += 3;
             *t = JS_TRUE;
             v = xs_val_new(XSTYPE_TRUE);
         }
     }
     else
     if (c == 'f') {
-        if (fgetc(f) == 'a' && fgetc(f) == 'l' &&
-            fgetc(f) == 's' && fgetc(f) == 'e') {
+        if (m->e - m->p >= 4 && memcmp(m->p, "alse", 4) == 0) {
+            m->p += 4;
             *t = JS_FALSE;
             v = xs_val_new(XSTYPE_FALSE);
         }
     }
     else
     if (c == 'n') {
-        if (fgetc(f) == 'u' && fgetc(f) == 'l' && fgetc(f) == 'l') {
+        if (m->e - m->p >= 3 && memcmp(m->p, "ull", 3) == 0) {
+            m->p += 3;
             *t = JS_NULL;
             v = xs_val_new(XSTYPE_NULL);
         }
     }
 
-    if (*t == JS_ERROR)
-        v = xs_free(v);
-
     return v;
 }
 
 
-int xs_json_load_array_iter(FILE *f, xs_val **value, xstype *pt, int *c)
-/* loads the next scalar value from the JSON stream */
-/* if the value ahead is compound, value is NULL and pt is set */
+static xs_dict *_xs_json_mem_object(xs_json_mem *m, int maxdepth);
+
+static xs_list *_xs_json_mem_array(xs_json_mem *m, int maxdepth)
+/* loads an array (after the initial OBRACK) */
 {
+    xs_list *l = xs_list_new();
+    int c = 0;
     js_type t;
 
-    *value = _xs_json_load_lexer(f, &t);
+    for (;;) {
+        xs *v = _xs_json_mem_lexer(m, &t);
 
-    if (t == JS_ERROR)
-        return -1;
+        if (t == JS_CBRACK)
+            break;
 
-    if (t == JS_CBRACK)
-        return 0;
+        if (c > 0) {
+            if (t != JS_COMMA)
+                return xs_free(l);
 
-    if (*c > 0) {
-        if (t == JS_COMMA)
-            *value = _xs_json_load_lexer(f, &t);
-        else
-            return -1;
-    }
+            v = _xs_json_mem_lexer(m, &t);
+        }
 
-    if (*value == NULL) {
-        /* possible compound type ahead */
-        if (t == JS_OBRACK)
-            *pt = XSTYPE_LIST;
-        else
-        if (t == JS_OCURLY)
-            *pt = XSTYPE_DICT;
-        else
-            return -1;
-    }
+        /* compound value ahead? */
+        if (v == NULL && maxdepth != 0) {
+            if (t == JS_OBRACK)
+                v = _xs_json_mem_array(m, maxdepth - 1);
+            else
+            if (t == JS_OCURLY)
+                v = _xs_json_mem_object(m, maxdepth - 1);
+        }
+
+        if (v == NULL)
+            return xs_free(l);
 
-    *c = *c + 1;
+        l = xs_list_append(l, v);
+        c++;
+    }
 
-    return 1;
+    return l;
 }
 
 
-xs_list *xs_json_load_array(FILE *f, int maxdepth)
-/* loads a full JSON array (after the initial OBRACK) */
+static xs_dict *_xs_json_mem_object(xs_json_mem *m, int maxdepth)
+/* loads an object (after the initial OCURLY) */
 {
-    xstype t;
-    xs_list *l = xs_list_new();
+    xs_dict *d = xs_dict_new();
     int c = 0;
+    js_type t;
 
     for (;;) {
-        xs *v = NULL;
-        int r = xs_json_load_array_iter(f, &v, &t, &c);
-
-        if (r == -1)
-            l = xs_free(l);
-
-        if (r == 1) {
-            /* partial load? */
-            if (v == NULL && maxdepth != 0) {
-                if (t == XSTYPE_LIST)
-                    v = xs_json_load_array(f, maxdepth - 1);
-                else
-                if (t == XSTYPE_DICT)
-                    v = xs_json_load_object(f, maxdepth - 1);
-            }
+        xs *k = _xs_json_mem_lexer(m, &t);
 
-            /* still null? fail */
-            if (v == NULL) {
-                l = xs_free(l);
-                break;
-            }
+        if (t == JS_CCURLY)
+            break;
 
-            l = xs_list_append(l, v);
+        if (c > 0) {
+            if (t != JS_COMMA)
+                return xs_free(d);
+
+            k = _xs_json_mem_lexer(m, &t);
         }
-        else
-            break;
-    }
 
-    return l;
-}
+        if (t != JS_STRING)
+            return xs_free(d);
 
+        xs_free(_xs_json_mem_lexer(m, &t));
 
-int xs_json_load_object_iter(FILE *f, xs_str **key, xs_val **value, xstype *pt, int *c)
-/* loads the next key and scalar value from the JSON stream */
-/* if the value ahead is compound, value is NULL and pt is set */
-{
-    js_type t;
+        if (t != JS_COLON)
+            return xs_free(d);
 
-    *key = _xs_json_load_lexer(f, &t);
+        xs *v = _xs_json_mem_lexer(m, &t);
 
-    if (t == JS_ERROR)
-        return -1;
+        /* compound value ahead? */
+        if (v == NULL && maxdepth != 0) {
+            if (t == JS_OBRACK)
+                v = _xs_json_mem_array(m, maxdepth - 1);
+            else
+            if (t == JS_OCURLY)
+                v = _xs_json_mem_object(m, maxdepth - 1);
+        }
 
-    if (t == JS_CCURLY)
-        return 0;
+        if (v == NULL)
+            return xs_free(d);
 
-    if (*c > 0) {
-        if (t == JS_COMMA)
-            *key = _xs_json_load_lexer(f, &t);
-        else
-            return -1;
+        d = xs_dict_append(d, k, v);
+        c++;
     }
 
-    if (t != JS_STRING)
-        return -1;
+    return d;
+}
 
-    xs_free(_xs_json_load_lexer(f, &t));
 
-    if (t != JS_COLON)
-        return -1;
+static xs_val *_xs_json_mem_load(xs_json_mem *m, int maxdepth)
+/* loads a full JSON list or object from memory */
+{
+    js_type t;
 
-    *value = _xs_json_load_lexer(f, &t);
+    xs_free(_xs_json_mem_lexer(m, &t));
 
-    if (*value == NULL) {
-        /* possible complex type ahead */
-        if (t == JS_OBRACK)
-            *pt = XSTYPE_LIST;
-        else
-        if (t == JS_OCURLY)
-            *pt = XSTYPE_DICT;
-        else
-            return -1;
-    }
+    if (t == JS_OBRACK)
+        return _xs_json_mem_array(m, maxdepth);
 
-    *c = *c + 1;
+    if (t == JS_OCURLY)
+        return _xs_json_mem_object(m, maxdepth);
 
-    return 1;
+    return NULL;
 }
 
 
-xs_dict *xs_json_load_object(FILE *f, int maxdepth)
-/* loads a full JSON object (after the initial OCURLY) */
+xs_val *xs_json_loadm_full(const char *data, int size, int maxdepth)
+/* loads a memory block in JSON format */
 {
-    xstype t;
-    xs_dict *d = xs_dict_new();
-    int c = 0;
-
-    for (;;) {
-        xs *k = NULL;
-        xs *v = NULL;
-        int r = xs_json_load_object_iter(f, &k, &v, &t, &c);
-
-        if (r == -1)
-            d = xs_free(d);
-
-        if (r == 1) {
-            /* partial load? */
-            if (v == NULL && maxdepth != 0) {
-                if (t == XSTYPE_LIST)
-                    v = xs_json_load_array(f, maxdepth - 1);
-                else
-                if (t == XSTYPE_DICT)
-                    v = xs_json_load_object(f, maxdepth - 1);
-            }
+    xs_json_mem m = { data, data + size };
 
-            /* still null? fail */
-            if (v == NULL) {
-                d = xs_free(d);
-                break;
-            }
-
-            d = xs_dict_append(d, k, v);
-        }
-        else
-            break;
-    }
-
-    return d;
+    return _xs_json_mem_load(&m, maxdepth);
 }
 
 
 xs_val *xs_json_loads_full(const xs_str *json, int maxdepth)
 /* loads a string in JSON format and converts to a multiple data */
 {
-    FILE *f;
-    xs_val *v = NULL;
-
-    if ((f = fmemopen((char *)json, strlen(json), "r")) != NULL) {
-        v = xs_json_load_full(f, maxdepth);
-        fclose(f);
-    }
-
-    return v;
+    return xs_json_loadm_full(json, strlen(json), maxdepth);
 }
 
 
-xstype xs_json_load_type(FILE *f)
-/* identifies the type of a JSON stream */
+static int _xs_json_read_value(FILE *f, char **data, int *size)
+/* reads from a stream up to the end of a JSON list or object
+   (and not beyond, so that anything following it is left there) */
 {
-    xstype t = XSTYPE_NULL;
-    js_type jt;
+    int depth = 0, str = 0, esc = 0, len = 0;
+    int c;
 
-    xs_free(_xs_json_load_lexer(f, &jt));
+    while ((c = getc(f)) != EOF) {
+        if (len + 1 >= *size) {
+            *size *= 2;
+            *data = xs_realloc(*data, *size);
+        }
 
-    if (jt == JS_OBRACK)
-        t = XSTYPE_LIST;
-    else
-    if (jt == JS_OCURLY)
-        t = XSTYPE_DICT;
+        (*data)[len++] = c;
+
+        if (str) {
+            if (esc)
+                esc = 0;
+            else
+            if (c == '\\')
+                esc = 1;
+            else
+            if (c == '"')
+                str = 0;
+        }
+        else
+        if (c == '"')
+            str = 1;
+        else
+        if (c == '[' || c == '{')
+            depth++;
+        else
+        if (c == ']' || c == '}') {
+            if (--depth <= 0)
+                break;
+        }
+        else
+        if (depth == 0 && !strchr(" \t\r\n", c))
+            break;  /* not a list nor an object: the parser will fail */
+    }
 
-    return t;
+    return len;
 }
 
 
 xs_val *xs_json_load_full(FILE *f, int maxdepth)
 /* loads a JSON file */
 {
-    xs_val *v = NULL;
-    xstype t = xs_json_load_type(f);
+    struct stat st;
+    long pos = ftell(f);
+    int size = 4096;
+    int len = 0;
+    xs_val *v;
+    char *data;
 
-    if (t == XSTYPE_LIST)
-        v = xs_json_load_array(f, maxdepth);
-    else
-    if (t == XSTYPE_DICT)
-        v = xs_json_load_object(f, maxdepth);
+    if (pos != -1 && fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)) {
+        /* a regular file: read the rest at once, and then
+           leave it just after the JSON, as stream readers expect */
+        if (st.st_size > pos)
+            size = st.st_size - pos + 1;
+
+        data = xs_realloc(NULL, size);
+
+        for (;;) {
+            len += fread(data + len, 1, size - len, f);
+
+            if (len < size)
+                break;
+
+            /* it grew */
+            size *= 2;
+            data = xs_realloc(data, size);
+        }
+    }
+    else {
+        /* pipes, sockets, etc.: don't wait for the end of the stream */
+        data = xs_realloc(NULL, size);
+        len  = _xs_json_read_value(f, &data, &size);
+        pos  = -1;
+    }
+
+    xs_json_mem m = { data, data + len };
+
+    v = _xs_json_mem_load(&m, maxdepth);
+
+    if (pos != -1)
+        fseek(f, pos + (m.p - data), SEEK_SET);
+
+    xs_free(data);
 
     return v;
 }
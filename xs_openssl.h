@@ -21,7 +21,13 @@ xs_val *xs_base64_dec(const xs_str *data, int *size);
 
 xs_dict *xs_evp_genkey(int bits);
 xs_str *xs_evp_sign(const char *secret, const char *mem, int size);
+void *xs_evp_seckey(const char *secret);
+xs_str *xs_evp_sign_pkey(void *pkey, const char *mem, int size);
 int xs_evp_verify(const char *pubkey, const char *mem, int size, const char *b64sig);
+void *xs_evp_pubkey(const char *pubkey);
+void *xs_evp_pubkey_ref(void *pkey);
+void xs_evp_pubkey_free(void *pkey);
+int xs_evp_verify_pkey(void *pkey, const char *mem, int size, const char *b64sig);
 
 
 #ifdef XS_IMPLEMENTATION
@@ -153,20 +159,29 @@ end:
 }
 
 
-xs_str *xs_evp_sign(const char *secret, const char *mem, int size)
-/* signs a memory block (secret is in PEM format) */
+void *xs_evp_seckey(const char *secret)
+/* un-PEMs a private key, to be used with xs_evp_sign_pkey() */
+{
+    BIO *b = BIO_new_mem_buf(secret, strlen(secret));
+    EVP_PKEY *pkey = PEM_read_bio_PrivateKey(b, NULL, NULL, NULL);
+
+    BIO_free(b);
+
+    return pkey;
+}
+
+
+xs_str *xs_evp_sign_pkey(void *pkey, const char *mem, int size)
+/* signs a memory block with an already parsed key */
 {
     xs_str *signature = NULL;
-    BIO *b;
     unsigned char *sig;
     unsigned int sig_len;
-    EVP_PKEY *pkey;
     EVP_MD_CTX *mdctx;
     const EVP_MD *md;
 
-    /* un-PEM the key */
-    b = BIO_new_mem_buf(secret, strlen(secret));
-    pkey = PEM_read_bio_PrivateKey(b, NULL, NULL, NULL);
+    if (pkey == NULL)
+        return NULL;
 
     /* I've learnt all these magical incantations by watching
        the Python module code and the OpenSSL manual pages */
@@ -186,27 +201,58 @@ xs_str *xs_evp_sign(const char *secret, const char *mem, int size)
         signature = xs_base64_enc((char *)sig, sig_len);
 
     EVP_MD_CTX_free(mdctx);
-    EVP_PKEY_free(pkey);
-    BIO_free(b);
     xs_free(sig);
 
     return signature;
 }
 
 
-int xs_evp_verify(const char *pubkey, const char *mem, int size, const char *b64sig)
-/* verifies a base64 block, returns non-zero on ok */
+xs_str *xs_evp_sign(const char *secret, const char *mem, int size)
+/* signs a memory block (secret is in PEM format) */
+{
+    void *pkey = xs_evp_seckey(secret);
+    xs_str *signature = xs_evp_sign_pkey(pkey, mem, size);
+
+    EVP_PKEY_free(pkey);
+
+    return signature;
+}
+
+
+void *xs_evp_pubkey(const char *pubkey)
+/* un-PEMs a public key, to be used with xs_evp_verify_pkey() */
+{
+    BIO *b = BIO_new_mem_buf(pubkey, strlen(pubkey));
+    EVP_PKEY *pkey = PEM_read_bio_PUBKEY(b, NULL, NULL, NULL);
+
+    BIO_free(b);
+
+    return pkey;
+}
+
+
+void *xs_evp_pubkey_ref(void *pkey)
+/* returns a new reference to a public key */
+{
+    EVP_PKEY_up_ref(pkey);
+    return pkey;
+}
+
+
+void xs_evp_pubkey_free(void *pkey)
+/* frees a reference to a public key */
+{
+    EVP_PKEY_free(pkey);
+}
+
+
+int xs_evp_verify_pkey(void *pkey, const char *mem, int size, const char *b64sig)
+/* verifies a base64 block with an already parsed key, returns non-zero on ok */
 {
     int r = 0;
-    BIO *b;
-    EVP_PKEY *pkey;
     EVP_MD_CTX *mdctx;
     const EVP_MD *md;
 
-    /* un-PEM the key */
-    b = BIO_new_mem_buf(pubkey, strlen(pubkey));
-    pkey = PEM_read_bio_PUBKEY(b, NULL, NULL, NULL);
-
     md = EVP_get_digestbyname("sha256");
     mdctx = EVP_MD_CTX_new();
 
@@ -226,8 +272,18 @@ int xs_evp_verify(const char *pubkey, const char *mem, int size, const char *b64
     }
 
     EVP_MD_CTX_free(mdctx);
+
+    return r;
+}
+
+
+int xs_evp_verify(const char *pubkey, const char *mem, int size, const char *b64sig)
+/* verifies a base64 block, returns non-zero on ok */
+{
+    void *pkey = xs_evp_pubkey(pubkey);
+    int r = xs_evp_verify_pkey(pkey, mem, size, b64sig);
+
     EVP_PKEY_free(pkey);
-    BIO_free(b);
 
     return r;
 }